@@ -205,8 +205,10 @@ int WINAPI _tWinMain (HINSTANCE hInstance, HINSTANCE hPrevInstance, LPTSTR lpCmd
 	g_hResource = FindResource(NULL, _T("E4847ED08866458F8DD35F94B37001C0"), RT_RCDATA);
 #endif
 	g_hInstance = hInstance;
-	InitializeCriticalSection(&g_CriticalRegExCache); // v1.0.45.04: Must be done early so that it's unconditional, so that DeleteCriticalSection() in the script destructor can also be unconditional.
+	for (int i = 0; i < PCRE_CACHE_SHARD_COUNT; ++i)
+		InitializeCriticalSectionAndSpinCount(&g_CriticalRegExCache[i], 4000); // v1.0.45.04: Must be done early so that it's unconditional, so that DeleteCriticalSection() in the script destructor can also be unconditional.  The spin count avoids a kernel wait for the very short cache lookups.
 	InitializeCriticalSection(&g_CriticalAhkFunction); // used to call a function in multithreading environment.
+	init_regex_jit_stacks();
 
 	// v1.1.22+: This is done unconditionally, on startup, so that any attempts to read a drive
 	// that has no media (and possibly other errors) won't cause the system to display an error
@@ -279,6 +281,19 @@ int WINAPI _tWinMain (HINSTANCE hInstance, HINSTANCE hPrevInstance, LPTSTR lpCmd
 			if (!g_script.mIncludeLibraryFunctionsThenExit->Open(__targv[i], TextStream::WRITE | TextStream::EOL_CRLF | TextStream::BOM_UTF8, CP_UTF8)) // Can't open the temp file.
 				return CRITICAL_ERROR;
 		}
+		else if (!_tcsicmp(param, _T("/includecache"))) // Load the script and save its include cache (see IncludeCache) rather than running it.
+		{
+			++i; // Consume the next parameter too, because it's associated with this one.
+			if (i >= __argc) // Missing the expected filename parameter.
+				return CRITICAL_ERROR;
+			g_script.mIncludeCache = new IncludeCache(__targv[i]);
+		}
+		else if (!_tcsicmp(param, _T("/profile"))) // Profile the script from the start and write the results to the given file on exit.
+		{
+			++i; // Consume the next parameter too, because it's associated with this one.
+			if (i >= __argc || !g_Profiler.Start(__targv[i]))
+				return CRITICAL_ERROR;
+		}
 		else if (!_tcsicmp(param, _T("/E")) || !_tcsicmp(param, _T("/Execute")))
 		{
 			g_hResource = NULL; // Execute script from File. Override compiled, A_IsCompiled will also report 0
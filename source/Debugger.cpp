@@ -1111,6 +1111,7 @@ void Object::DebugWriteProperty(IDebugProperties *aDebugger, int aPage, int aPag
 
 	if (aDepth)
 	{
+		SortStringKeys(); // So that paging through string keys is consistent with enumeration.
 		int i = aPageSize * aPage, j = aPageSize * (aPage + 1);
 
 		if (mBase)
@@ -1138,7 +1139,7 @@ void Object::DebugWriteProperty(IDebugProperties *aDebugger, int aPage, int aPag
 			else if (i >= mKeyOffsetObject)
 				key.symbol = SYM_OBJECT, key.object = field.key.p;
 			else
-				key.symbol = SYM_INTEGER, key.value_int64 = field.key.i;
+				key.symbol = SYM_INTEGER, key.value_int64 = IntKey(i);
 			field.ToToken(value);
 
 			aDebugger->WriteProperty(key, value);
@@ -2757,6 +2758,8 @@ void DbgStack::Push(TCHAR *aDesc)
 	s.line = NULL;
 	s.desc = aDesc;
 	s.type = SE_Thread;
+	if (g_Profiler.mIsEnabled)
+		g_Profiler.EnterThread(aDesc);
 }
 	
 void DbgStack::Push(Label *aSub)
@@ -2765,6 +2768,8 @@ void DbgStack::Push(Label *aSub)
 	s.line = aSub->mJumpToLine;
 	s.sub  = aSub;
 	s.type = SE_Sub;
+	if (g_Profiler.mIsEnabled)
+		g_Profiler.EnterSub(aSub);
 }
 
 void DbgStack::Push(UDFCallInfo *aUDF)
@@ -2773,6 +2778,8 @@ void DbgStack::Push(UDFCallInfo *aUDF)
 	s.line = aUDF->func->mJumpToLine;
 	s.udf = aUDF;
 	s.type = SE_UDF;
+	if (g_Profiler.mIsEnabled)
+		g_Profiler.EnterFunc(aUDF->func);
 }
 
 
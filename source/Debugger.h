@@ -14,6 +14,8 @@ freely, without restriction.
 
 #pragma once
 
+#include "profiler.h" // Also used by Line::ExecUntil() when the debugger is disabled.
+
 #ifndef CONFIG_DEBUGGER
 
 #define DEBUGGER_STACK_PUSH(...)
@@ -163,6 +165,8 @@ struct DbgStack
 	{
 		ASSERT(mTop >= mBottom);
 		--mTop;
+		if (g_Profiler.mIsEnabled)
+			g_Profiler.Leave();
 	}
 
 	void Push(TCHAR *aDesc);
@@ -24,6 +24,24 @@ SimpleHeap *SimpleHeap::sLast = NULL;
 char *SimpleHeap::sMostRecentlyAllocated = NULL;
 UINT SimpleHeap::sBlockCount = 0;
 SimpleHeap **sBlocks;
+SimpleHeap::FreeItem *SimpleHeap::sFreeList[SIMPLEHEAP_SIZE_CLASS_COUNT] = {0};
+size_t SimpleHeap::sBytesRecyclable = 0;
+SimpleHeapUnit *SimpleHeap::sUnit = NULL;
+size_t SimpleHeapUnit::sBytesReserved = 0;
+size_t SimpleHeapUnit::sBytesReleased = 0;
+
+// The sizes which Free() can recycle.  These are the sizes Var::AssignString() uses for short strings,
+// which are the only SimpleHeap allocations routinely abandoned at runtime (when a variable outgrows them).
+static const size_t sSizeClass[SIMPLEHEAP_SIZE_CLASS_COUNT] = {_TSIZE(4), _TSIZE(8), _TSIZE(MAX_ALLOC_SIMPLE)};
+
+int SimpleHeap::SizeClass(size_t aSize)
+// Returns the index of aSize in sSizeClass, or -1 if it isn't recyclable.
+{
+	for (int i = 0; i < SIMPLEHEAP_SIZE_CLASS_COUNT; ++i)
+		if (aSize == sSizeClass[i])
+			return i;
+	return -1;
+}
 
 LPTSTR SimpleHeap::Malloc(LPTSTR aBuf, size_t aLength)
 // v1.0.44.14: Added aLength to improve performance in cases where callers already know the length.
@@ -34,8 +52,23 @@ LPTSTR SimpleHeap::Malloc(LPTSTR aBuf, size_t aLength)
 		return _T(""); // Return the constant empty string to the caller (not aBuf itself since that might be volatile).
 	if (aLength == -1) // Caller wanted us to calculate it.  Compare directly to -1 since aLength is unsigned.
 		aLength = _tcslen(aBuf);
+	return CopyString(SimpleHeap::Malloc((aLength + 1) * sizeof(TCHAR)), aBuf, aLength); // +1 for the zero terminator.
+}
+
+LPTSTR SimpleHeap::MallocLine(LPTSTR aBuf, size_t aLength)
+// Same as Malloc(aBuf, aLength) except that the memory comes from sUnit, if there is one.
+{
+	if (!aBuf || !*aBuf)
+		return _T("");
+	if (aLength == -1)
+		aLength = _tcslen(aBuf);
+	return CopyString(MallocLine((aLength + 1) * sizeof(TCHAR)), aBuf, aLength);
+}
+
+LPTSTR SimpleHeap::CopyString(void *aMem, LPTSTR aBuf, size_t aLength)
+{
 	LPTSTR new_buf;
-	if (!(new_buf = (LPTSTR)SimpleHeap::Malloc((aLength + 1) * sizeof(TCHAR)))) // +1 for the zero terminator.
+	if (!(new_buf = (LPTSTR)aMem))
 	{
 		g_script.ScriptError(ERR_OUTOFMEM, aBuf);
 		return NULL; // Callers may rely on NULL vs. "" being returned in the event of failure.
@@ -55,17 +88,38 @@ void* SimpleHeap::Malloc(size_t aSize)
 // around 80, and only rarely would exceed 1000.  Trying to find memory in old blocks
 // seems like a bad trade-off compared to the performance impact of traversing a
 // potentially large linked list or maintaining and traversing an array of
-// "under-utilized" blocks.
+// "under-utilized" blocks.  The exception is the few sizes recycled by Free(),
+// which are kept on their own lists and are therefore cheap to find.
 {
 	if (aSize < 1 || aSize > BLOCK_SIZE)
 		return NULL;
+	int size_class = SizeClass(aSize);
+	if (size_class != -1 && sFreeList[size_class])
+	{
+		FreeItem *item = sFreeList[size_class];
+		sFreeList[size_class] = item->mNext;
+		sBytesRecyclable -= aSize;
+		sMostRecentlyAllocated = NULL; // Delete() can only reclaim memory at the end of the current block.
+		return item;
+	}
 	if (!sFirst) // We need at least one block to do anything, so create it.
 		if (!(sFirst = CreateBlock()))
 			return NULL;
 	if (aSize > sLast->mSpaceAvailable)
 		if (!(sLast->mNextBlock = CreateBlock()))
 			return NULL;
-	sMostRecentlyAllocated = sLast->mFreeMarker; // THIS IS NOW THE NEWLY ALLOCATED BLOCK FOR THE CALLER, which is 32-bit aligned because the previous call to this function (i.e. the logic below) set it up that way.
+	return sMostRecentlyAllocated = (char *)sLast->Carve(aSize); // THIS IS NOW THE NEWLY ALLOCATED BLOCK FOR THE CALLER.
+}
+
+void *SimpleHeap::MallocLine(size_t aSize)
+{
+	return sUnit ? sUnit->Malloc(aSize) : Malloc(aSize);
+}
+
+void *SimpleHeap::Carve(size_t aSize)
+// Takes aSize bytes from this block, which the caller has ensured has enough space available.
+{
+	void *mem = mFreeMarker; // This is 32-bit aligned because the previous call to this function (i.e. the logic below) set it up that way.
 	// v1.0.40.04: Set up the NEXT chunk to be aligned on a 32-bit boundary (the first chunk in each block
 	// should always be aligned since the block's address came from malloc()).  On average, this change
 	// "wastes" only 1.5 bytes per chunk. In a 200 KB script of typical contents, this change requires less
@@ -78,11 +132,11 @@ void* SimpleHeap::Malloc(size_t aSize)
 	size_t remainder = aSize % sizeof(void *);
 	size_t size_consumed = remainder ? aSize + (sizeof(void *) - remainder) : aSize;
 	// v1.0.45: The following can't happen when BLOCK_SIZE is a multiple of 4, so it's commented out:
-	//if (size_consumed > sLast->mSpaceAvailable) // For maintainability, don't allow mFreeMarker to go out of bounds or
-	//	size_consumed = sLast->mSpaceAvailable; // mSpaceAvailable to go negative (which it can't due to be unsigned).
-	sLast->mFreeMarker += size_consumed;
-	sLast->mSpaceAvailable -= size_consumed;
-	return (void *)sMostRecentlyAllocated;
+	//if (size_consumed > mSpaceAvailable) // For maintainability, don't allow mFreeMarker to go out of bounds or
+	//	size_consumed = mSpaceAvailable; // mSpaceAvailable to go negative (which it can't due to be unsigned).
+	mFreeMarker += size_consumed;
+	mSpaceAvailable -= size_consumed;
+	return mem;
 }
 
 
@@ -102,6 +156,45 @@ void SimpleHeap::Delete(void *aPtr)
 
 
 
+void SimpleHeap::Free(void *aPtr, size_t aSize)
+// Makes aPtr available to future calls of Malloc() if aSize is one of the recyclable sizes; otherwise
+// the memory is simply abandoned, as it always was before.  Caller must ensure that aPtr came from
+// Malloc() (not MallocLine()) with exactly aSize bytes and that nothing refers to it anymore.
+{
+	int size_class;
+	if (!aPtr || (size_class = SizeClass(aSize)) == -1)
+		return;
+	if (aPtr == sMostRecentlyAllocated)
+		sMostRecentlyAllocated = NULL; // Don't let Delete() reclaim it a second time.
+	FreeItem *item = (FreeItem *)aPtr; // Every size class is at least sizeof(void *) after alignment by Carve().
+	item->mNext = sFreeList[size_class];
+	sFreeList[size_class] = item;
+	sBytesRecyclable += aSize;
+}
+
+
+
+size_t SimpleHeap::GetInfo(SimpleHeapInfoType aType)
+{
+	switch (aType)
+	{
+	case HEAPINFO_RESERVED: return sBlockCount * BLOCK_SIZE;
+	case HEAPINFO_USED:
+	{
+		size_t used = 0;
+		for (UINT i = 0; i < sBlockCount; ++i)
+			used += sBlocks[i]->mFreeMarker - sBlocks[i]->mBlock;
+		return used - sBytesRecyclable;
+	}
+	case HEAPINFO_RECYCLABLE: return sBytesRecyclable;
+	case HEAPINFO_UNIT_RESERVED: return SimpleHeapUnit::sBytesReserved;
+	case HEAPINFO_UNIT_RELEASED: return SimpleHeapUnit::sBytesReleased;
+	}
+	return 0;
+}
+
+
+
 // Commented out because not currently used:
 void SimpleHeap::DeleteAll()
 // See Hotkey::AllDestructAndExit for comments about why this isn't actually called.
@@ -121,6 +214,9 @@ void SimpleHeap::DeleteAll()
 		sFirst = NULL;
 		sLast = NULL;
 		sMostRecentlyAllocated = NULL;
+		for (int i = 0; i < SIMPLEHEAP_SIZE_CLASS_COUNT; ++i)
+			sFreeList[i] = NULL;
+		sBytesRecyclable = 0;
 		free(sBlocks);
 		sBlocks = NULL;
 #ifdef _USRDLL
@@ -131,55 +227,127 @@ void SimpleHeap::DeleteAll()
 
 
 
-SimpleHeap *SimpleHeap::CreateBlock()
-// Added for v1.0.40.04 to try to solve the fact that some functions such as GetRawInputDeviceList()
-// will sometimes fail if passed memory from SimpleHeap. Although this change didn't actually solve
-// the issue (it turned out to be a 32-bit alignment issue), using malloc() appears to save memory
-// (compared to using "new" on a class that contains a large buffer such as "char mBlock[BLOCK_SIZE]").
-// In a 200 KB script, it saves 8 KB of VM Size as shown by Task Manager.
+SimpleHeap *SimpleHeap::NewBlock()
+// Creates a block without making it part of the heap; see CreateBlock() and SimpleHeapUnit.
 {
-#ifdef _USRDLL
-	EnterCriticalSection(&g_CriticalHeapBlocks);
-#endif
 	SimpleHeap *block;
 	if (!(block = new SimpleHeap))
-	{
-#ifdef _USRDLL
-		LeaveCriticalSection(&g_CriticalHeapBlocks);
-#endif
 		return NULL;
-	}
 	// The new block's mFreeMarker starts off pointing to the first byte in the new block:
 	if (!(block->mBlock = block->mFreeMarker = (char *)malloc(BLOCK_SIZE)))
 	{
 		delete block;
-#ifdef _USRDLL
-		LeaveCriticalSection(&g_CriticalHeapBlocks);
-#endif
 		return NULL;
 	}
 	// Since above didn't return, block was successfully created:
 	block->mSpaceAvailable = BLOCK_SIZE;
-	sLast = block;  // Constructing a new block always results in it becoming the current block.
+	return block;
+}
+
+
+
+bool SimpleHeap::RegisterBlock(SimpleHeap *aBlock)
+// Adds aBlock to sBlocks so that it is freed by DeleteAll().
+// Caller must have entered g_CriticalHeapBlocks (if applicable).
+{
 	if (!sBlockCount || !(sBlockCount % 1024))
 	{
 		SimpleHeap **new_Blocks;
 		if (!(new_Blocks = (SimpleHeap**)realloc(sBlocks, (!sBlockCount ? 1024 : sBlockCount * 2) * sizeof(SimpleHeap*))))
+			return false;
+		sBlocks = new_Blocks;
+	}
+	sBlocks[sBlockCount] = aBlock;
+	++sBlockCount;
+	return true;
+}
+
+
+
+SimpleHeap *SimpleHeap::CreateBlock()
+// Added for v1.0.40.04 to try to solve the fact that some functions such as GetRawInputDeviceList()
+// will sometimes fail if passed memory from SimpleHeap. Although this change didn't actually solve
+// the issue (it turned out to be a 32-bit alignment issue), using malloc() appears to save memory
+// (compared to using "new" on a class that contains a large buffer such as "char mBlock[BLOCK_SIZE]").
+// In a 200 KB script, it saves 8 KB of VM Size as shown by Task Manager.
+{
+#ifdef _USRDLL
+	EnterCriticalSection(&g_CriticalHeapBlocks);
+#endif
+	SimpleHeap *block;
+	if (block = NewBlock())
+	{
+		if (RegisterBlock(block))
+			sLast = block;  // Constructing a new block always results in it becoming the current block.
+		else
 		{
 			delete block;
+			block = NULL;
+		}
+	}
 #ifdef _USRDLL
-			LeaveCriticalSection(&g_CriticalHeapBlocks);
+	LeaveCriticalSection(&g_CriticalHeapBlocks);
 #endif
+	return block;
+}
+
+
+
+void *SimpleHeapUnit::Malloc(size_t aSize)
+{
+	if (aSize < 1 || aSize > BLOCK_SIZE)
+		return NULL;
+	if (!mLast || aSize > mLast->mSpaceAvailable)
+	{
+		SimpleHeap *block;
+		if (!(block = SimpleHeap::NewBlock()))
 			return NULL;
-		}
-		sBlocks = new_Blocks;
+		if (mLast)
+			mLast->mNextBlock = block;
+		else
+			mFirst = block;
+		mLast = block;
+		mBytesReserved += BLOCK_SIZE;
+		sBytesReserved += BLOCK_SIZE;
+	}
+	return mLast->Carve(aSize);
+}
+
+
+
+void SimpleHeapUnit::Release()
+{
+	for (SimpleHeap *next; mFirst; mFirst = next)
+	{
+		next = mFirst->mNextBlock;
+		delete mFirst;
+	}
+	mLast = NULL;
+	sBytesReserved -= mBytesReserved;
+	sBytesReleased += mBytesReserved;
+	mBytesReserved = 0;
+}
+
+
+
+void SimpleHeapUnit::Keep()
+{
+#ifdef _USRDLL
+	EnterCriticalSection(&g_CriticalHeapBlocks);
+#endif
+	for (SimpleHeap *next; mFirst; mFirst = next)
+	{
+		next = mFirst->mNextBlock;
+		mFirst->mNextBlock = NULL; // It's not part of SimpleHeap's chain, only of sBlocks (which is what DeleteAll() uses).
+		if (!SimpleHeap::RegisterBlock(mFirst))
+			break; // Extremely rare: the memory is lost until the program exits, just as it would have been before.
 	}
-	sBlocks[sBlockCount] = block;
-	++sBlockCount;
 #ifdef _USRDLL
 	LeaveCriticalSection(&g_CriticalHeapBlocks);
 #endif
-	return block;
+	mFirst = mLast = NULL;
+	sBytesReserved -= mBytesReserved;
+	mBytesReserved = 0;
 }
 
 
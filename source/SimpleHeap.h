@@ -37,11 +37,27 @@ GNU General Public License for more details.
 // Unicode strings are twice as large.
 #define BLOCK_SIZE (32 * 1024 * sizeof(TCHAR)) // Relied upon by Malloc() to be a multiple of 4.
 
+#define SIMPLEHEAP_SIZE_CLASS_COUNT 3 // Number of sizes which Free() can recycle; see SimpleHeap.cpp.
+
+// Values for SimpleHeap::GetInfo() and ahkHeapInfo():
+enum SimpleHeapInfoType {HEAPINFO_RESERVED, HEAPINFO_USED, HEAPINFO_RECYCLABLE
+	, HEAPINFO_UNIT_RESERVED, HEAPINFO_UNIT_RELEASED};
+
+class SimpleHeapUnit;
 class SimpleHeap
 {
 private:
+	friend class SimpleHeapUnit;
 
 	SimpleHeap();  // Private constructor, since we want only the static methods to be able to create new objects.
+	static SimpleHeap *NewBlock();
+	static bool RegisterBlock(SimpleHeap *aBlock);
+	void *Carve(size_t aSize);
+
+	struct FreeItem { FreeItem *mNext; };
+	static FreeItem *sFreeList[SIMPLEHEAP_SIZE_CLASS_COUNT];
+	static int SizeClass(size_t aSize);
+	static LPTSTR CopyString(void *aMem, LPTSTR aBuf, size_t aLength);
 public:
 	~SimpleHeap();
 	static SimpleHeap *CreateBlock();
@@ -56,7 +72,41 @@ public:
 	static LPTSTR Malloc(LPTSTR aBuf, size_t aLength = -1); // Return a block of memory to the caller and copy aBuf into it.
 	static void* Malloc(size_t aSize); // Return a block of memory to the caller.
 	static void Delete(void *aPtr);
+	static void Free(void *aPtr, size_t aSize);
 	static void DeleteAll();
+
+	// Memory which belongs to script lines (args, derefs, postfix), as opposed to things like variables
+	// and functions which persist for the life of the script.  It comes from sUnit when one is installed.
+	static SimpleHeapUnit *sUnit;
+	static void *MallocLine(size_t aSize);
+	static LPTSTR MallocLine(LPTSTR aBuf, size_t aLength = -1);
+
+	static size_t GetInfo(SimpleHeapInfoType aType);
+};
+
+// SimpleHeapUnit: A set of blocks which can be freed all at once, for the lines of code loaded by something
+// like ahkExec() which are discarded after use.  Since SimpleHeap never frees anything, such code would
+// otherwise leak its args, derefs and postfix arrays every time.
+class SimpleHeapUnit
+{
+	SimpleHeap *mFirst, *mLast;
+	size_t mBytesReserved;
+	SimpleHeapUnit *mPrevUnit; // The unit which was installed before this one.
+public:
+	static size_t sBytesReserved, sBytesReleased;
+
+	SimpleHeapUnit() : mFirst(NULL), mLast(NULL), mBytesReserved(0), mPrevUnit(NULL) {}
+	~SimpleHeapUnit() { Release(); }
+	void Install()
+	{
+		mPrevUnit = SimpleHeap::sUnit;
+		SimpleHeap::sUnit = this;
+	}
+	void Uninstall() { SimpleHeap::sUnit = mPrevUnit; }
+	void *Malloc(size_t aSize);
+	void Release(); // Frees all of this unit's memory.
+	void Keep(); // Hands all of this unit's memory over to SimpleHeap, for when it turns out to be needed after all.
+	size_t BytesReserved() { return mBytesReserved; }
 };
 
 #endif
@@ -28,6 +28,69 @@ bool IsLeadByteACP(BYTE b)
 	return false;
 }
 
+#else
+
+// Decodes a single UTF-8 char of aSrcSize (2-4) bytes, where aSrcSize was determined from the lead byte.
+// Returns the number of UTF-16 code units written to aDst (1 or 2), or 0 if the sequence is invalid.
+// This is much faster than calling MultiByteToWideChar() for each char, and is equally strict: overlong
+// sequences, surrogates and values beyond U+10FFFF are rejected as with MB_ERR_INVALID_CHARS.
+static inline int DecodeUTF8(LPBYTE aSrc, int aSrcSize, LPWSTR aDst)
+{
+	static const UINT sMinValue[] = { 0, 0, 0x80, 0x800, 0x10000 };
+	UINT ch = aSrc[0] & (0x7F >> aSrcSize);
+	for (int i = 1; i < aSrcSize; ++i)
+	{
+		if ((aSrc[i] & 0xC0) != 0x80)
+			return 0;
+		ch = (ch << 6) | (aSrc[i] & 0x3F);
+	}
+	if (ch < sMinValue[aSrcSize] || ch > 0x10FFFF || (ch >= 0xD800 && ch <= 0xDFFF))
+		return 0;
+	if (ch < 0x10000)
+	{
+		*aDst = (WCHAR)ch;
+		return 1;
+	}
+	ch -= 0x10000;
+	aDst[0] = (WCHAR)(0xD800 + (ch >> 10));
+	aDst[1] = (WCHAR)(0xDC00 + (ch & 0x3FF));
+	return 2;
+}
+
+// Encodes a single char of aSrcSize (1 or 2) UTF-16 code units as UTF-8, returning the number of bytes
+// written to aDst.  As with WideCharToMultiByte(), an unpaired surrogate is written as U+FFFD.
+static inline int EncodeUTF8(LPCWSTR aSrc, int aSrcSize, LPBYTE aDst)
+{
+	UINT ch = *aSrc;
+	if (aSrcSize == 2)
+		ch = 0x10000 + ((ch - 0xD800) << 10) + (aSrc[1] - 0xDC00);
+	else if (ch >= 0xD800 && ch <= 0xDFFF)
+		ch = 0xFFFD;
+	if (ch < 0x80)
+	{
+		aDst[0] = (BYTE)ch;
+		return 1;
+	}
+	if (ch < 0x800)
+	{
+		aDst[0] = (BYTE)(0xC0 | (ch >> 6));
+		aDst[1] = (BYTE)(0x80 | (ch & 0x3F));
+		return 2;
+	}
+	if (ch < 0x10000)
+	{
+		aDst[0] = (BYTE)(0xE0 | (ch >> 12));
+		aDst[1] = (BYTE)(0x80 | ((ch >> 6) & 0x3F));
+		aDst[2] = (BYTE)(0x80 | (ch & 0x3F));
+		return 3;
+	}
+	aDst[0] = (BYTE)(0xF0 | (ch >> 18));
+	aDst[1] = (BYTE)(0x80 | ((ch >> 12) & 0x3F));
+	aDst[2] = (BYTE)(0x80 | ((ch >> 6) & 0x3F));
+	aDst[3] = (BYTE)(0x80 | (ch & 0x3F));
+	return 4;
+}
+
 #endif
 
 
@@ -51,7 +114,7 @@ bool TextStream::Open(LPCTSTR aFileSpec, DWORD aFlags, UINT aCodePage)
 	if (mode != TextStream::WRITE) {
 		// Detect UTF-8 and UTF-16LE BOMs
 		if (mLength < 3)
-			Read(TEXT_IO_BLOCK); // TEXT_IO_BLOCK vs 3 for consistency and average-case performance.
+			Read(); // Fill the buffer vs. reading 3 bytes for consistency and average-case performance.
 		mPos = mBuffer;
 		if (mLength >= 2) {
 			if (mBuffer[0] == 0xFF && mBuffer[1] == 0xFE) {
@@ -149,8 +212,21 @@ DWORD TextStream::Read(LPTSTR aBuf, DWORD aBufLen, int aNumLines)
 		{
 			if (codepage == CP_UTF16)
 			{
-				src_size = sizeof(WCHAR); // Set default (currently never overridden).
+				src_size = sizeof(WCHAR); // Set default.
 				LPWSTR cp = (LPWSTR)src;
+#ifdef UNICODE
+				// Copy any run of chars which don't need EOL translation or counting directly into aBuf.
+				size_t run = min((size_t)((LPWSTR)src_end - cp), (size_t)(aBufLen - target_used));
+				if (LPWSTR run_end = tmemchrany(cp, run, _T("\r\n"), aNumLines > 0 ? 2 : 1))
+					run = run_end - cp;
+				if (run)
+				{
+					tmemcpy(aBuf + target_used, cp, run);
+					target_used += (DWORD)run;
+					src_size = (int)(run * sizeof(WCHAR));
+					continue;
+				}
+#endif
 				if (*cp == '\r')
 				{
 					if (cp + 2 <= (LPWSTR)src_end)
@@ -203,6 +279,15 @@ DWORD TextStream::Read(LPTSTR aBuf, DWORD aBufLen, int aNumLines)
 				src_size = 1; // Set default.
 				if (*src < 0x80)
 				{
+					// Copy any run of ASCII chars which don't need EOL translation or counting directly into aBuf.
+					// This covers the bulk of most text files, whatever the code page.
+					if (int run = (int)CopyAsciiToTChar(aBuf + target_used, (LPCSTR)src
+						, min((DWORD)(src_end - src), aBufLen - target_used), '\r', aNumLines > 0 ? '\n' : -1))
+					{
+						target_used += run;
+						src_size = run;
+						continue;
+					}
 					if (*src == '\r')
 					{
 						if (src + 1 < src_end)
@@ -267,7 +352,10 @@ DWORD TextStream::Read(LPTSTR aBuf, DWORD aBufLen, int aNumLines)
 						break;
 					}
 #ifdef UNICODE
-					dst_size = MultiByteToWideChar(codepage, MB_ERR_INVALID_CHARS, (LPSTR)src, src_size, dst, _countof(dst));
+					if (codepage == CP_UTF8)
+						dst_size = DecodeUTF8(src, src_size, dst);
+					else
+						dst_size = MultiByteToWideChar(codepage, MB_ERR_INVALID_CHARS, (LPSTR)src, src_size, dst, _countof(dst));
 #else
 					if (codepage == g_ACP)
 					{
@@ -389,9 +477,9 @@ DWORD TextStream::Read(LPVOID aBuf, DWORD aBufLen)
 	LPBYTE target = (LPBYTE)aBuf + target_used;
 	DWORD target_remaining = aBufLen - target_used;
 
-	if (target_remaining < TEXT_IO_BLOCK)
+	if (target_remaining < mBufferSize)
 	{
-		Read(TEXT_IO_BLOCK);
+		Read();
 
 		if (mLength <= target_remaining)
 		{
@@ -455,7 +543,7 @@ DWORD TextStream::Write(LPCTSTR aBuf, DWORD aBufLen)
 	//	a 4-byte UTF-8 sequence
 	//	a UTF-16 surrogate pair
 	//	a carriage-return/newline pair
-	LPBYTE dst_end = mBuffer + TEXT_IO_BLOCK - 4;
+	LPBYTE dst_end = mBuffer + mBufferSize - 4;
 
 	for (src = aBuf, src_end = aBuf + aBufLen; ; )
 	{
@@ -468,11 +556,19 @@ DWORD TextStream::Write(LPCTSTR aBuf, DWORD aBufLen)
 		// and handle it after the loop terminates.
 		if (mCodePage != CP_UTF16)
 		{
-			for ( ; src < src_end && !(*src & ~0x7F) && dst < dst_end; ++src)
+			while (dst < dst_end)
 			{
-				if (*src == '\n' && (mFlags & EOL_CRLF) && ((src == aBuf) ? mLastWriteChar : src[-1]) != '\r')
+				// Copy any run of ASCII chars which don't need EOL translation in bulk.
+				size_t run = CopyAsciiFromTChar(dstA, src, min((size_t)(src_end - src), (size_t)(dst_end - dst))
+					, (mFlags & EOL_CRLF) ? '\n' : -1);
+				src += run;
+				dstA += run;
+				if (src == src_end || *src != '\n' || dst >= dst_end)
+					break;
+				// Since the run stopped at \n, EOL_CRLF is in effect.
+				if (((src == aBuf) ? mLastWriteChar : src[-1]) != '\r')
 					*dstA++ = '\r';
-				*dstA++ = (CHAR)*src;
+				*dstA++ = (CHAR)*src++;
 			}
 		}
 		else
@@ -531,7 +627,10 @@ DWORD TextStream::Write(LPCTSTR aBuf, DWORD aBufLen)
 
 #ifdef UNICODE
 		ASSERT(mCodePage != CP_UTF16); // An optimization above already handled UTF-16.
-		dstA += WideCharToMultiByte(mCodePage, 0, src, src_size, dstA, 4, NULL, NULL);
+		if (mCodePage == CP_UTF8)
+			dst += EncodeUTF8(src, src_size, dst);
+		else
+			dstA += WideCharToMultiByte(mCodePage, 0, src, src_size, dstA, 4, NULL, NULL);
 		src += src_size;
 #else
 		if (mCodePage == g_ACP)
@@ -569,7 +668,7 @@ DWORD TextStream::Write(LPCVOID aBuf, DWORD aBufLen)
 	if (!PrepareToWrite())
 		return 0;
 
-	if (aBufLen < TEXT_IO_BLOCK - mLength) // There would be room for at least 1 byte after appending data.
+	if (aBufLen < mBufferSize - mLength) // There would be room for at least 1 byte after appending data.
 	{
 		// Buffer the data.
 		memcpy(mBuffer + mLength, aBuf, aBufLen);
@@ -578,7 +677,7 @@ DWORD TextStream::Write(LPCVOID aBuf, DWORD aBufLen)
 	}
 	else
 	{
-		// data is bigger than the remaining space in the buffer.  If (len < TEXT_IO_BLOCK*2 - mLength), we
+		// data is bigger than the remaining space in the buffer.  If (len < mBufferSize*2 - mLength), we
 		// could copy the first part of data into the buffer, flush it, then write the remainder into the
 		// buffer to await more text to be buffered.  However, the need for a memcpy combined with the added
 		// code size and complexity mean it probably isn't worth doing.
@@ -51,7 +51,7 @@ public:
 	};
 
 	TextStream()
-		: mFlags(0), mCodePage(-1), mLength(0), mBuffer(NULL), mPos(NULL), mLastRead(0)
+		: mFlags(0), mCodePage(-1), mLength(0), mBufferSize(TEXT_IO_BLOCK), mBuffer(NULL), mPos(NULL), mLastRead(0)
 	{
 		SetCodePage(CP_ACP);
 	}
@@ -59,7 +59,7 @@ public:
 	{
 		if (mBuffer)
 		{
-			g_memset(mBuffer, 0, TEXT_IO_BLOCK);
+			g_memset(mBuffer, 0, mBufferSize);
 			free(mBuffer);
 		}
 		//if (mLocale)
@@ -129,6 +129,15 @@ public:
 	UINT GetCodePage() { return mCodePage; }
 	DWORD GetFlags() { return mFlags; }
 
+	void SetBufferSize(DWORD aSize)
+	// Sets the size of the read/write buffer, which is TEXT_IO_BLOCK by default.  A larger buffer
+	// reduces the number of calls to _Read() when reading sequentially through a large file.
+	// This has no effect once the buffer has been allocated, so should be called before Open().
+	{
+		if (!mBuffer && aSize >= TEXT_IO_BLOCK)
+			mBufferSize = aSize;
+	}
+
 protected:
 	// IO abstraction
 	virtual bool    _Open(LPCTSTR aFileSpec, DWORD &aFlags) = 0;
@@ -168,7 +177,7 @@ protected:
 	bool PrepareToWrite()
 	{
 		if (!mBuffer)
-			mBuffer = (BYTE *) malloc(TEXT_IO_BLOCK);
+			mBuffer = (BYTE *) malloc(mBufferSize);
 		else if (mPos) // Buffered reading was used.
 			RollbackFilePointer();
 		return mBuffer != NULL;
@@ -184,16 +193,16 @@ protected:
 	DWORD WriteTranslateCRLF(TCHR *aBuf, DWORD aBufLen); // Used by TextStream::Write(LPCSTR,DWORD).
 
 	// Functions for populating the read buffer.
-	DWORD Read(DWORD aReadSize = TEXT_IO_BLOCK)
+	DWORD Read(DWORD aReadSize = ~0U) // Default to filling the buffer.
 	{
 		ASSERT(aReadSize);
 		if (!mBuffer) {
-			mBuffer = (BYTE *) malloc(TEXT_IO_BLOCK);
+			mBuffer = (BYTE *) malloc(mBufferSize);
 			if (!mBuffer)
 				return 0;
 		}
-		if (mLength + aReadSize > TEXT_IO_BLOCK)
-			aReadSize = TEXT_IO_BLOCK - mLength;
+		if (aReadSize > mBufferSize - mLength)
+			aReadSize = mBufferSize - mLength;
 		DWORD dwRead = _Read(mBuffer + mLength, aReadSize);
 		if (dwRead)
 			mLength += dwRead;
@@ -202,12 +211,12 @@ protected:
 	bool ReadAtLeast(DWORD aReadSize)
 	{
 		if (!mPos)
-			Read(TEXT_IO_BLOCK);
+			Read();
 		else if (mPos > mBuffer + mLength - aReadSize) {
 			ASSERT( (DWORD)(mPos - mBuffer) <= mLength );
 			mLength -= (DWORD)(mPos - mBuffer);
 			memmove(mBuffer, mPos, mLength);
-			Read(TEXT_IO_BLOCK);
+			Read();
 		}
 		else
 			return true;
@@ -225,6 +234,7 @@ protected:
 
 	DWORD mFlags;
 	DWORD mLength;		// The length of available data in the buffer, in bytes.
+	DWORD mBufferSize;	// The size of mBuffer, in bytes.
 	DWORD mLastRead;
 	UINT  mCodePage;
 	CPINFO mCodePageInfo;
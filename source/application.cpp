@@ -1771,7 +1771,7 @@ bool CheckScriptTimers()
 // message pump, and such pending messages might be discarded or mishandled.
 // Caller should already have checked the value of g_script.mTimerEnabledCount to ensure it's
 // greater than zero, since we don't check that here (for performance).
-// This function will go through the list of timed subroutines only once and then return to its caller.
+// This function will launch each due timer at most once and then return to its caller.
 // It does it only once so that it won't keep a thread beneath it permanently suspended if the sum
 // total of all timer durations is too large to be run at their specified frequencies.
 // This function is allowed to be called recursively, which handles certain situations better:
@@ -1801,41 +1801,36 @@ bool CheckScriptTimers()
 	// v1.0.48: Since g_IdleIsPaused was removed (to simplify a lot of things), g_nPausedThreads now
 	// counts the idle thread if it's paused.  Also, to avoid array overflow, g_MaxThreadsTotal must not
 	// be exceeded except where otherwise documented.
+	// The enabled timers are kept in a heap ordered by when they are next due, so when the earliest
+	// isn't due yet (which is the usual case), this returns without looking at the others.  This is
+	// checked first so that TimerTick() is called regularly even while timers can't be launched.
+	if (g_script.mTimerHeap[0]->mTimeDue > g_script.TimerTick())
+		return false;
+
 	if (g_nPausedThreads > 0 || !g->AllowTimers || g_nThreads >= g_MaxThreadsTotal || !IsInterruptible()) // See above.
 		return false;
 
-	ScriptTimer *ptimer, *next_timer;
+	ScriptTimer *ptimer;
 	BOOL at_least_one_timer_launched;
 	DWORD tick_start;
 	TCHAR ErrorLevel_saved[ERRORLEVEL_SAVED_SIZE];
-
-	// Note: It seems inconsequential if a subroutine that the below loop executes causes a
-	// new timer to be added to the linked list while the loop is still enumerating the timers.
-
-	for (at_least_one_timer_launched = FALSE, ptimer = g_script.mFirstTimer
-		; ptimer != NULL
-		; ptimer = next_timer)
+	static UINT sCheckPass = 0;
+	UINT check_pass = ++sCheckPass; // Each timer is marked with this when launched, so that it's launched only once per call.
+
+	// Each iteration searches the heap again from the top, so it's inconsequential if a subroutine that
+	// the below loop executes causes timers to be added, deleted or rescheduled.  Timers which are due
+	// but can't be launched yet (such as a timer which is already running) are left in the heap.
+	// As of v1.0.36.03, the time since each timer's last run is calculated by subtracting two DWORDs to
+	// support intervals of 49.7 vs. 24.8 days.  If the computer was suspended/hibernated for 50+ days,
+	// the next launch of the affected timer(s) may be delayed by up to 100% of their periods.
+	// See IsInterruptible() for more discussion.
+	for (at_least_one_timer_launched = FALSE
+		; ptimer = g_script.FindDueTimer(0, g_script.TimerTick(), check_pass) // Check the time every iteration in case a previous iteration took a long time to execute.
+		; )
 	{
 		ScriptTimer &timer = *ptimer; // For performance and convenience.
-		if (!timer.mEnabled || timer.mExistingThreads > 0 || timer.mPriority < g->Priority) // thread priorities
-		{
-			next_timer = timer.mNextTimer;
-			continue;
-		}
-
-		tick_start = GetTickCount(); // Call GetTickCount() every time in case a previous iteration of the loop took a long time to execute.
-		// As of v1.0.36.03, the following subtracts two DWORDs to support intervals of 49.7 vs. 24.8 days.
-		// This should work as long as the distance between the values being compared isn't greater than
-		// 49.7 days. This is because 1 minus 2 in unsigned math yields 0xFFFFFFFF milliseconds (49.7 days).
-		// If the distance between time values is greater than 49.7 days (perhaps because the computer was
-		// suspended/hibernated for 50+ days), the next launch of the affected timer(s) will be delayed
-		// by up to 100% of their periods.  See IsInterruptible() for more discussion.
-		if (tick_start - timer.mTimeLastRun < (DWORD)timer.mPeriod) // Timer is not yet due to run.
-		{
-			next_timer = timer.mNextTimer;
-			continue;
-		}
-		// Otherwise, this timer is due to run.
+		timer.mCheckPass = check_pass;
+		tick_start = GetTickCount();
 		if (!at_least_one_timer_launched) // This will be the first timer launched here.
 		{
 			at_least_one_timer_launched = TRUE;
@@ -1877,6 +1872,8 @@ bool CheckScriptTimers()
 		timer.mTimeLastRun = tick_start;
 		if (timer.mRunOnlyOnce)
 			timer.Disable();  // This is done prior to launching the thread for reasons similar to above.
+		else
+			g_script.ScheduleTimer(&timer); // Move it down the heap to reflect the new mTimeLastRun.
 
 		// v1.0.38.04: The following line is done prior to the timer launch to reduce situations
 		// in which a timer thread is interrupted before it can execute even a single line.
@@ -1912,9 +1909,6 @@ bool CheckScriptTimers()
 		timer.mLabel->ExecuteInNewThread(_T("Timer"));
 		--timer.mExistingThreads;
 
-		// Resolve the next timer only now, in case other timers were created or deleted while
-		// this timer was executing.  Must be done before the timer is potentially deleted below.
-		next_timer = timer.mNextTimer;
 		// If this is a run-once timer for a live reference-counted object (i.e. not a Label or
 		// Func, which can never be deleted), delete the timer.  Otherwise, there's a high risk
 		// that the script will leak objects, because if the object is only referenced by the
@@ -1924,14 +1918,13 @@ bool CheckScriptTimers()
 		// but that would only work if the script releases its last reference to the object
 		// *before* the timer expires.
 		// mEnabled is checked in case the timer re-enabled itself.
-		if (timer.mRunOnlyOnce && !timer.mEnabled && timer.mLabel.IsLiveObject())
-			timer.mLabel = NULL;
 		// If the script attempted to delete this timer while it was executing, mLabel was set
 		// to NULL and it is now time to delete the timer.  mExistingThreads == 0 is implied
 		// at this point since timers are only allowed one thread.
-		if (timer.mLabel == NULL)
-			g_script.DeleteTimer(NULL);
-	} // for() each timer.
+		if (timer.mLabel == NULL
+			|| timer.mRunOnlyOnce && !timer.mEnabled && timer.mLabel.IsLiveObject())
+			g_script.DestroyTimer(&timer);
+	} // for() each due timer.
 
 	if (at_least_one_timer_launched) // Since at least one subroutine was run above, restore various values for our caller.
 	{
@@ -766,7 +766,9 @@ struct FuncAndToken {
 	ExprTokenType **param;
 	ExprTokenType params[10];
 	LPTSTR buf;
-	BYTE mParamCount;
+	int mParamCount;
+	struct AhkValue *mTypedResult; // If non-NULL, callFuncDll stores the result here instead of in result_to_return_dll.
+	bool mFailed; // Set by callFuncDll if the function couldn't be called or didn't return normally.
 };
 
 class Label;                //
@@ -970,6 +972,14 @@ inline void global_init(global_struct &g)
 
 #define ERRORLEVEL_SAVED_SIZE 128 // The size that can be remembered (saved & restored) if a thread is interrupted. Big in case user put something bigger than a number in g_ErrorLevel.
 
+// The RegEx cache is split into this many independently-locked shards (must be a power of two) so that
+// threads using different patterns rarely contend.  See get_compiled_regex().
+#define PCRE_CACHE_SHARD_BITS 3
+#define PCRE_CACHE_SHARD_COUNT (1 << PCRE_CACHE_SHARD_BITS)
+#define PCRE_CACHE_DEFAULT_SIZE 100
+
+#define LOOP_READ_BUFFER_DEFAULT_SIZE (64 * 1024) // Bytes read ahead by each file-reading loop (see #LoopReadBuffer).
+
 #ifdef UNICODE
 #define WINAPI_SUFFIX "W"
 #define PROCESS_API_SUFFIX "W" // used by Process32First and Process32Next
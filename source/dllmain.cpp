@@ -77,7 +77,9 @@ switch(fwdReason)
 		if (!IsBadReadPtr(g_hMemoryModule,1) && (((PMEMORYMODULE)lpvReserved)->modules != NULL))
 			g_hMSVCR = ((PMEMORYMODULE)lpvReserved)->modules[0];
 		*/
-		InitializeCriticalSection(&g_CriticalRegExCache); // v1.0.45.04: Must be done early so that it's unconditional, so that DeleteCriticalSection() in the script destructor can also be unconditional (deleting when never initialized can crash, at least on Win 9x).
+		for (int i = 0; i < PCRE_CACHE_SHARD_COUNT; ++i)
+			InitializeCriticalSectionAndSpinCount(&g_CriticalRegExCache[i], 4000); // v1.0.45.04: Must be done early so that it's unconditional, so that DeleteCriticalSection() in the script destructor can also be unconditional (deleting when never initialized can crash, at least on Win 9x).
+		init_regex_jit_stacks();
 		InitializeCriticalSection(&g_CriticalHeapBlocks); // used to block memory freeing in case of timeout in ahkTerminate so no corruption happens when both threads try to free Heap.
 		InitializeCriticalSection(&g_CriticalAhkFunction); // used to call a function in multithreading environment.
 #ifdef AUTODLL
@@ -122,8 +124,10 @@ switch(fwdReason)
 				free(sLib[i].path);
 		 }
 		 DeleteCriticalSection(&g_CriticalHeapBlocks); // g_CriticalHeapBlocks is used in simpleheap for thread-safety.
-		 DeleteCriticalSection(&g_CriticalRegExCache); // g_CriticalRegExCache is used elsewhere for thread-safety.
+		 for (int i = 0; i < PCRE_CACHE_SHARD_COUNT; ++i)
+			DeleteCriticalSection(&g_CriticalRegExCache[i]); // g_CriticalRegExCache is used elsewhere for thread-safety.
 		 DeleteCriticalSection(&g_CriticalAhkFunction); // used to call a function in multithreading environment.
+		 free_regex_jit_stacks();
 		 break;
 	 }
  case DLL_THREAD_DETACH:
@@ -665,6 +669,272 @@ EXPORT int ahkReady() // HotKeyIt check if dll is ready to execute
 	return g_script.mIsReadyToExecute || g_Reloading || g_Loading;
 }
 
+
+
+//
+// Script pool: runs ahkExec/addScript jobs on a set of interpreters which are started in advance and
+// reused for many jobs, so that a job doesn't have to pay for starting a script thread.  Since all of an
+// interpreter's state is global, each interpreter is a separate in-memory copy of this dll, loaded the
+// same way as by DllGetClassObject().  Each copy is driven by a dispatcher thread of its own, which takes
+// jobs from the pool's queue one at a time.  After each job the dispatcher restarts its script, so that
+// every job starts from the same state regardless of which interpreter runs it or what ran there before.
+// The restart happens before the dispatcher takes another job, so it is hidden from the host as long as
+// the pool has idle interpreters.
+//
+
+typedef UINT_PTR (*ahktextdll_type)(LPTSTR, LPTSTR, LPTSTR);
+typedef int (*ahkExec_type)(LPTSTR);
+typedef UINT_PTR (*addScript_type)(LPTSTR, int);
+typedef BOOL (*ahkTerminate_type)(int);
+
+struct ScriptPoolJob
+{
+	ScriptPoolJob *mNext;
+	HANDLE mDoneEvent;
+	UINT_PTR mResult;
+	int mAddScript; // 0 to run the code with ahkExec, otherwise to run it with addScript.
+	volatile LONG mRefCount; // 1 for the pool until the job is done, plus 1 for the host's handle.
+	TCHAR mScript[1];
+};
+
+struct ScriptPool
+{
+	LPVOID mImage; // This dll's file, read once for all instances.
+	size_t mImageSize;
+	LPTSTR mScript, mArgs;
+	CRITICAL_SECTION mLock;
+	ScriptPoolJob *mFirst, *mLast;
+	HANDLE mJobCount; // Semaphore counting queued jobs.
+	bool mStopping;
+	int mLiveCount; // Dispatchers whose interpreter hasn't failed to start.  Jobs are refused once it is 0.
+	int mThreadCount;
+	HANDLE mThread[1];
+};
+
+static void ReleasePoolJob(ScriptPoolJob *aJob)
+{
+	if (InterlockedDecrement(&aJob->mRefCount))
+		return;
+	CloseHandle(aJob->mDoneEvent);
+	free(aJob);
+}
+
+static void FailPoolJobs(ScriptPoolJob *aJob)
+// Completes each job in the list with a result of 0, without running it.
+{
+	for (ScriptPoolJob *next; aJob; aJob = next)
+	{
+		next = aJob->mNext;
+		SetEvent(aJob->mDoneEvent);
+		ReleasePoolJob(aJob);
+	}
+}
+
+static void RetirePoolDispatcher(ScriptPool &aPool)
+// Called by a dispatcher whose interpreter failed to start, just before it exits.  Queued jobs are left
+// to the other dispatchers, unless there are none left to run them.
+{
+	ScriptPoolJob *orphans = NULL;
+	EnterCriticalSection(&aPool.mLock);
+	if (!--aPool.mLiveCount)
+	{
+		orphans = aPool.mFirst;
+		aPool.mFirst = aPool.mLast = NULL;
+	}
+	LeaveCriticalSection(&aPool.mLock);
+	FailPoolJobs(orphans);
+}
+
+static unsigned __stdcall ScriptPoolDispatcher(void *aPool)
+{
+	ScriptPool &pool = *(ScriptPool *)aPool;
+	HMEMORYMODULE module = MemoryLoadLibrary(pool.mImage, pool.mImageSize);
+	ahktextdll_type instance_start = module ? (ahktextdll_type)MemoryGetProcAddress(module, "ahktextdll") : NULL;
+	ahkExec_type instance_exec = module ? (ahkExec_type)MemoryGetProcAddress(module, "ahkExec") : NULL;
+	addScript_type instance_add = module ? (addScript_type)MemoryGetProcAddress(module, "addScript") : NULL;
+	ahkTerminate_type instance_terminate = module ? (ahkTerminate_type)MemoryGetProcAddress(module, "ahkTerminate") : NULL;
+	bool ready = instance_start && instance_exec && instance_add && instance_terminate
+		&& instance_start(pool.mScript, _T(""), pool.mArgs);
+	for (;;)
+	{
+		if (!ready)
+		{
+			RetirePoolDispatcher(pool);
+			break;
+		}
+		WaitForSingleObject(pool.mJobCount, INFINITE);
+		EnterCriticalSection(&pool.mLock);
+		ScriptPoolJob *job = pool.mFirst;
+		if (job && !pool.mStopping)
+		{
+			if (  !(pool.mFirst = job->mNext)  )
+				pool.mLast = NULL;
+		}
+		else
+			job = NULL;
+		LeaveCriticalSection(&pool.mLock);
+		if (!job) // The pool is being destroyed.
+			break;
+		if (job->mAddScript)
+			job->mResult = instance_add(job->mScript, 1); // 1 = run the code before returning, since the script is restarted below.
+		else
+			job->mResult = (UINT_PTR)instance_exec(job->mScript);
+		SetEvent(job->mDoneEvent);
+		ReleasePoolJob(job);
+		// Discard whatever the job defined or changed (variables, functions, labels, hotkeys, etc.).
+		instance_terminate(0);
+		ready = instance_start(pool.mScript, _T(""), pool.mArgs) != 0;
+	}
+	if (ready)
+		instance_terminate(0);
+	if (module)
+		MemoryFreeLibrary(module);
+	return 0;
+}
+
+EXPORT UINT_PTR ahkPoolCreate(int aSize, LPTSTR aScript, LPTSTR aArgs)
+// Creates a pool of aSize interpreters, each of which runs aScript (the script's text) as its
+// auto-execute section.  The interpreters start in parallel, while this function returns immediately;
+// jobs submitted before they are ready wait in the queue.  Returns the pool, or 0 on failure.
+{
+	if (aSize < 1)
+		return 0;
+	TCHAR path[MAX_PATH];
+	FILE *fp;
+	if (!GetModuleFileName(g_hInstance, path, _countof(path)) || !(fp = _tfopen(path, _T("rb"))))
+		return 0; // This is probably an in-memory copy, which has no file to load further copies from.
+	fseek(fp, 0, SEEK_END);
+	size_t image_size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if (!aScript || !*aScript)
+		aScript = aDefaultDllScript;
+	if (!aArgs)
+		aArgs = _T("");
+	size_t script_length = _tcslen(aScript) + 1, args_length = _tcslen(aArgs) + 1;
+	ScriptPool *pool = (ScriptPool *)malloc(sizeof(ScriptPool) + (aSize - 1) * sizeof(HANDLE));
+	LPVOID image = malloc(image_size);
+	LPTSTR strings = tmalloc(script_length + args_length);
+	if (!pool || !image || !strings || fread(image, 1, image_size, fp) != image_size)
+	{
+		fclose(fp);
+		free(pool);
+		free(image);
+		free(strings);
+		return 0;
+	}
+	fclose(fp);
+	pool->mImage = image;
+	pool->mImageSize = image_size;
+	tmemcpy(pool->mScript = strings, aScript, script_length);
+	tmemcpy(pool->mArgs = strings + script_length, aArgs, args_length);
+	InitializeCriticalSection(&pool->mLock);
+	pool->mFirst = pool->mLast = NULL;
+	pool->mStopping = false;
+	pool->mLiveCount = aSize; // Dispatchers which fail to start are subtracted as they exit.
+	pool->mThreadCount = 0;
+	if (pool->mJobCount = CreateSemaphore(NULL, 0, LONG_MAX, NULL))
+		for ( ; pool->mThreadCount < aSize; ++pool->mThreadCount)
+			if (  !(pool->mThread[pool->mThreadCount] = (HANDLE)_beginthreadex(NULL, 0, &ScriptPoolDispatcher, pool, 0, NULL))  )
+				break;
+	EnterCriticalSection(&pool->mLock);
+	pool->mLiveCount -= aSize - pool->mThreadCount;
+	LeaveCriticalSection(&pool->mLock);
+	if (!pool->mThreadCount)
+	{
+		ahkPoolDestroy((UINT_PTR)pool);
+		return 0;
+	}
+	return (UINT_PTR)pool;
+}
+
+EXPORT UINT_PTR ahkPoolExec(UINT_PTR aPool, LPTSTR aScript, int aAddScript)
+// Queues aScript to be executed by the next idle interpreter in the pool: by ahkExec if aAddScript is 0,
+// otherwise by addScript, which runs the code before the job completes.  Since the interpreter is then
+// restarted, the result of addScript only indicates success.  Returns a job handle which must be freed
+// by ahkPoolFreeJob, or 0 on failure (including when none of the pool's interpreters could be started).
+{
+	if (!aPool || !aScript)
+		return 0;
+	ScriptPool &pool = *(ScriptPool *)aPool;
+	size_t script_length = _tcslen(aScript) + 1;
+	ScriptPoolJob *job = (ScriptPoolJob *)malloc(sizeof(ScriptPoolJob) + script_length * sizeof(TCHAR));
+	if (!job)
+		return 0;
+	if (  !(job->mDoneEvent = CreateEvent(NULL, TRUE, FALSE, NULL))  )
+	{
+		free(job);
+		return 0;
+	}
+	tmemcpy(job->mScript, aScript, script_length);
+	job->mNext = NULL;
+	job->mResult = 0;
+	job->mAddScript = aAddScript;
+	job->mRefCount = 2;
+	EnterCriticalSection(&pool.mLock);
+	if (!pool.mLiveCount || pool.mStopping)
+	{
+		LeaveCriticalSection(&pool.mLock);
+		CloseHandle(job->mDoneEvent);
+		free(job);
+		return 0;
+	}
+	if (pool.mLast)
+		pool.mLast->mNext = job;
+	else
+		pool.mFirst = job;
+	pool.mLast = job;
+	LeaveCriticalSection(&pool.mLock);
+	ReleaseSemaphore(pool.mJobCount, 1, NULL);
+	return (UINT_PTR)job;
+}
+
+EXPORT BOOL ahkPoolWait(UINT_PTR aJob, DWORD aTimeout, UINT_PTR *aResult)
+// Waits up to aTimeout milliseconds (0 to poll) for a job to complete.  Returns TRUE and stores the
+// result of ahkExec or addScript in *aResult (if non-NULL) if the job is done, otherwise FALSE.
+{
+	ScriptPoolJob &job = *(ScriptPoolJob *)aJob;
+	if (WaitForSingleObject(job.mDoneEvent, aTimeout) != WAIT_OBJECT_0)
+		return FALSE;
+	if (aResult)
+		*aResult = job.mResult;
+	return TRUE;
+}
+
+EXPORT void ahkPoolFreeJob(UINT_PTR aJob)
+// Frees a job handle.  If the job hasn't been executed yet, it still will be.
+{
+	if (aJob)
+		ReleasePoolJob((ScriptPoolJob *)aJob);
+}
+
+EXPORT void ahkPoolDestroy(UINT_PTR aPool)
+// Terminates each interpreter in the pool once its current job (if any) is done, and frees the pool.
+// Jobs which haven't started are completed with a result of 0.
+{
+	ScriptPool *pool = (ScriptPool *)aPool;
+	if (!pool)
+		return;
+	EnterCriticalSection(&pool->mLock);
+	pool->mStopping = true;
+	ScriptPoolJob *job = pool->mFirst;
+	pool->mFirst = pool->mLast = NULL;
+	LeaveCriticalSection(&pool->mLock);
+	FailPoolJobs(job);
+	if (pool->mThreadCount)
+		ReleaseSemaphore(pool->mJobCount, pool->mThreadCount, NULL); // Wake each dispatcher so it can exit.
+	for (int i = 0; i < pool->mThreadCount; ++i)
+	{
+		WaitForSingleObject(pool->mThread[i], INFINITE);
+		CloseHandle(pool->mThread[i]);
+	}
+	if (pool->mJobCount)
+		CloseHandle(pool->mJobCount);
+	DeleteCriticalSection(&pool->mLock);
+	free(pool->mScript); // Also frees mArgs.
+	free(pool->mImage);
+	free(pool);
+}
+
 #ifndef MINIDLL
 
 // COM Implementation //
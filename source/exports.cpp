@@ -9,6 +9,130 @@ VARIANT variant_to_return_dll;
 // ExprTokenType aResultToken_to_return ;  // for ahkPostFunction
 FuncAndToken aFuncAndTokenToReturn[10] ;    // for ahkPostFunction
 int returnCount = -1 ;
+
+// Calls posted by ahkPostFunction are queued as separately allocated records rather than being stored in
+// aFuncAndTokenToReturn, so that any number of calls can be pending without overwriting each other.
+// The queue is a lock-free singly-linked list which any host thread can push onto, and which the script
+// thread empties all at once, so a burst of posted calls is executed in a single window message.
+struct PostedFuncCall
+{
+	SLIST_ENTRY mEntry; // Must be first, for casting from PSLIST_ENTRY.
+	FuncAndToken mCall;
+	ExprTokenType *mParam[10];
+	TCHAR mBuf[MAX_NUMBER_SIZE];
+	HANDLE volatile mDoneEvent; // Created on demand by ahkWaitFunction().
+	volatile LONG mDone; // 0 while pending, 1 once the function has returned, or -1 if it failed or never ran.
+	volatile LONG mRefCount; // 1 for the queue, plus 1 if the host holds a handle.
+	TCHAR mStrings[1]; // Copies of the parameter strings, which the host might free after posting.
+};
+static SLIST_HEADER sPostedFuncs; // Static zero-initialization is equivalent to InitializeSListHead().
+static volatile LONG sPostedFuncsPending = 0; // Non-zero when a message has been posted to execute sPostedFuncs.
+// Calls taken from sPostedFuncs but not yet started, in the order they were posted.  Only used by the
+// script thread.  If a call pumps messages, a nested callPostedFuncs() appends to this and continues
+// from its head, so calls still run in the order they were posted.
+static PSLIST_ENTRY sPostedFuncsBatch = NULL, sPostedFuncsBatchLast = NULL;
+
+static void ReleasePostedFunc(PostedFuncCall *aCall)
+{
+	if (InterlockedDecrement(&aCall->mRefCount))
+		return;
+	if (aCall->mDoneEvent)
+		CloseHandle(aCall->mDoneEvent);
+	free(aCall->mCall.result_to_return_dll);
+	_aligned_free(aCall);
+}
+
+static PostedFuncCall *PostFunc(Func *aFunc, LPTSTR *aParams[], int aParamsCount, bool aWantHandle)
+// Copies the call and its parameters into a new record and queues it for execution by the script thread.
+// Returns the record, or NULL on failure.  If aWantHandle is true, the caller must eventually pass
+// the record to ReleasePostedFunc().
+{
+	int param_count = aFunc->mParamCount < aParamsCount && !aFunc->mIsVariadic ? aFunc->mParamCount : aParamsCount;
+	size_t space_needed = 0, length[10];
+	int i;
+	for (i = 0; i < param_count; ++i)
+		space_needed += (length[i] = _tcslen(*aParams[i]) + 1);
+	PostedFuncCall *call = (PostedFuncCall *)_aligned_malloc(sizeof(PostedFuncCall) + space_needed * sizeof(TCHAR), MEMORY_ALLOCATION_ALIGNMENT);
+	if (!call)
+		return NULL;
+	ZeroMemory(call, sizeof(PostedFuncCall));
+	LPTSTR cp = call->mStrings;
+	for (i = 0; i < param_count; ++i)
+	{
+		tmemcpy(cp, *aParams[i], length[i]);
+		call->mCall.params[i].SetValue(cp);
+		call->mParam[i] = &call->mCall.params[i];
+		cp += length[i];
+	}
+	call->mCall.mFunc = aFunc;
+	call->mCall.param = call->mParam;
+	call->mCall.mParamCount = param_count;
+	call->mCall.mToken.buf = call->mBuf;
+	call->mRefCount = aWantHandle ? 2 : 1;
+	InterlockedPushEntrySList(&sPostedFuncs, &call->mEntry);
+	// Post a message only if one isn't already pending.  callPostedFuncs() resets the flag before taking
+	// the list, so any call pushed after that point will either be taken or cause another message.
+	if (!InterlockedExchange(&sPostedFuncsPending, 1))
+		if (!PostMessage(g_hWnd, AHK_EXECUTE_FUNCTION_DLL, 0, 0))
+			sPostedFuncsPending = 0; // Let the next call retry.
+	return call;
+}
+
+void callPostedFuncs()
+// Called by the script thread in response to AHK_EXECUTE_FUNCTION_DLL with wParam == 0.
+{
+	InterlockedExchange(&sPostedFuncsPending, 0);
+	PSLIST_ENTRY entry = InterlockedFlushSList(&sPostedFuncs), next, first = NULL, last = entry;
+	// The list is in LIFO order, so reverse it to execute the calls in the order they were posted.
+	for ( ; entry; entry = next)
+	{
+		next = entry->Next;
+		entry->Next = first;
+		first = entry;
+	}
+	if (first)
+	{
+		if (sPostedFuncsBatchLast)
+			sPostedFuncsBatchLast->Next = first;
+		else
+			sPostedFuncsBatch = first;
+		sPostedFuncsBatchLast = last;
+	}
+	while (entry = sPostedFuncsBatch)
+	{
+		if (  !(sPostedFuncsBatch = entry->Next)  )
+			sPostedFuncsBatchLast = NULL;
+		PostedFuncCall *call = (PostedFuncCall *)entry;
+		callFuncDll(&call->mCall);
+		InterlockedExchange(&call->mDone, call->mCall.mFailed ? -1 : 1);
+		if (HANDLE done_event = call->mDoneEvent)
+			SetEvent(done_event);
+		ReleasePostedFunc(call);
+	}
+}
+
+void PostedFuncsClear()
+// Called when the script is destroyed.  Fails any calls which are still queued, since the functions
+// they refer to are about to be freed, and resets the queue for the next script in this process.
+{
+	InterlockedExchange(&sPostedFuncsPending, 0);
+	PSLIST_ENTRY entry = InterlockedFlushSList(&sPostedFuncs), next;
+	if (sPostedFuncsBatchLast) // Fail calls which a call interrupted by the exit hadn't reached yet too.
+	{
+		sPostedFuncsBatchLast->Next = entry;
+		entry = sPostedFuncsBatch;
+		sPostedFuncsBatch = sPostedFuncsBatchLast = NULL;
+	}
+	for ( ; entry; entry = next)
+	{
+		next = entry->Next;
+		PostedFuncCall *call = (PostedFuncCall *)entry;
+		InterlockedExchange(&call->mDone, -1);
+		if (HANDLE done_event = call->mDoneEvent)
+			SetEvent(done_event);
+		ReleasePostedFunc(call);
+	}
+}
 void TokenToVariant(ExprTokenType &aToken, VARIANT &aVar, BOOL aVarIsArg);
 
 // Following macros are used in addFile addScript ahkExec
@@ -77,6 +201,12 @@ int com_ahkReload(int timeout){return ahkReload(timeout);}
 #endif
 #endif
 
+EXPORT UINT_PTR ahkHeapInfo(int aType)
+// Reports SimpleHeap's memory usage to the host; see SimpleHeapInfoType for aType.
+{
+	return SimpleHeap::GetInfo((SimpleHeapInfoType)aType);
+}
+
 EXPORT int ahkIsUnicode()
 {
 #ifdef UNICODE
@@ -355,41 +485,11 @@ EXPORT int ahkPostFunction(LPTSTR func, LPTSTR param1, LPTSTR param2, LPTSTR par
 		}
 		else
 		{
-			EnterCriticalSection(&g_CriticalAhkFunction);
-			if (++returnCount > 9)
-				returnCount = 0 ;
-			FuncAndToken & aFuncAndToken = aFuncAndTokenToReturn[returnCount];
-			if (aParamsCount)
+			if (!PostFunc(aFunc, params, aParamsCount, false))
 			{
-				ExprTokenType **new_mem = (ExprTokenType**)realloc(aFuncAndToken.param,sizeof(ExprTokenType)*aParamsCount);
-				if (!new_mem)
-				{
-					g_script.ScriptError(ERR_OUTOFMEM,func);
-					LeaveCriticalSection(&g_CriticalAhkFunction);
-					return -1;
-				}
-				aFuncAndToken.param = new_mem;
-			}
-			else
-				aFuncAndToken.param = NULL;
-			aFuncAndToken.mParamCount = aFunc->mParamCount < aParamsCount && !aFunc->mIsVariadic ? aFunc->mParamCount : aParamsCount;
-			LPTSTR new_buf;
-			for (int i = 0;(aFunc->mParamCount > i || aFunc->mIsVariadic) && aParamsCount>i;i++)
-			{
-				aFuncAndToken.param[i] = &aFuncAndToken.params[i];
-				new_buf = (LPTSTR)realloc(aFuncAndToken.param[i]->marker,(_tcslen(*params[i])+1)*sizeof(TCHAR));
-				if (!new_buf)
-				{
-					g_script.ScriptError(ERR_OUTOFMEM, func);
-					LeaveCriticalSection(&g_CriticalAhkFunction);
-					return -1;
-				}
-				_tcscpy(new_buf,*params[i]); // Assign parameters
-				aFuncAndToken.param[i]->SetValue(new_buf);
+				g_script.ScriptError(ERR_OUTOFMEM, func);
+				return -1;
 			}
-			aFuncAndToken.mFunc = aFunc ;
-			PostMessage(g_hWnd, AHK_EXECUTE_FUNCTION_DLL, (WPARAM)&aFuncAndToken,NULL);
-			LeaveCriticalSection(&g_CriticalAhkFunction);
 			return 0;
 		}
 	} 
@@ -397,7 +497,364 @@ EXPORT int ahkPostFunction(LPTSTR func, LPTSTR param1, LPTSTR param2, LPTSTR par
 		return -1;
 }
 
+EXPORT UINT_PTR ahkPostFunctionEx(LPTSTR func, LPTSTR param1, LPTSTR param2, LPTSTR param3, LPTSTR param4, LPTSTR param5, LPTSTR param6, LPTSTR param7, LPTSTR param8, LPTSTR param9, LPTSTR param10)
+// Same as ahkPostFunction, but returns a handle which can be passed to ahkWaitFunction to poll or wait
+// for the call to complete and retrieve its result.  The handle must be freed with ahkFreeFunction.
+// Unlike ahkPostFunction, built-in functions are also executed by the script thread.  Returns 0 on failure.
+{
+	if (!g_script.mIsReadyToExecute)
+		return 0; // AutoHotkey needs to be running at this point //
+	Func *aFunc = g_script.FindFunc(func) ;
+	if (!aFunc)
+		return 0;
+	int aParamsCount = 0;
+	LPTSTR *params[10] = {&param1,&param2,&param3,&param4,&param5,&param6,&param7,&param8,&param9,&param10};
+	for (;aParamsCount < 10;aParamsCount++)
+		if (!*params[aParamsCount])
+			break;
+	if (aParamsCount < aFunc->mMinParams)
+	{
+		g_script.ScriptError(ERR_TOO_FEW_PARAMS, func);
+		return 0;
+	}
+	return (UINT_PTR)PostFunc(aFunc, params, aParamsCount, true);
+}
+
+EXPORT LPTSTR ahkWaitFunction(UINT_PTR aCall, DWORD aTimeout)
+// Waits up to aTimeout milliseconds (0 to poll, INFINITE to wait indefinitely) for a call posted by
+// ahkPostFunctionEx to complete.  Returns its result, or NULL if it hasn't completed yet or it failed
+// (see ahkFunctionStatus).  The result remains valid until the handle is freed.  This must not be called by the script's own thread with
+// a non-zero timeout, since that thread is the one which would complete the call.
+{
+	PostedFuncCall *call = (PostedFuncCall *)aCall;
+	if (!call->mDone && aTimeout)
+	{
+		if (!call->mDoneEvent)
+		{
+			HANDLE done_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+			if (!done_event)
+				return NULL;
+			if (InterlockedCompareExchangePointer((PVOID volatile *)&call->mDoneEvent, done_event, NULL))
+				CloseHandle(done_event); // Another thread installed one first.
+		}
+		// Since callPostedFuncs() sets mDone before checking for mDoneEvent, checking mDone again after
+		// installing the event ensures the event can't be missed.
+		if (!call->mDone)
+			WaitForSingleObject(call->mDoneEvent, aTimeout);
+	}
+	if (call->mDone != 1)
+		return NULL;
+	return call->mCall.result_to_return_dll ? call->mCall.result_to_return_dll : _T("");
+}
+
+EXPORT int ahkFunctionStatus(UINT_PTR aCall)
+// Returns 0 if a call posted by ahkPostFunctionEx is still pending, 1 if the function has returned,
+// or -1 if it couldn't be called (e.g. the script was busy or exited first) or didn't return normally.
+{
+	return ((PostedFuncCall *)aCall)->mDone;
+}
+
+EXPORT void ahkFreeFunction(UINT_PTR aCall)
+// Frees a handle returned by ahkPostFunctionEx.  The call itself is not cancelled.
+{
+	if (aCall)
+		ReleasePostedFunc((PostedFuncCall *)aCall);
+}
+
 #ifndef AUTOHOTKEYSC
+// Cache of the code loaded by ahkExec() and addScript(), keyed by the text of the script, so that a host
+// which sends the same snippets over and over only pays for loading each of them once.  An ahkExec() entry
+// owns its lines and the SimpleHeapUnit holding their args, derefs and postfix arrays.  An addScript() entry
+// merely remembers where its lines were linked into the script, since those are never deleted anyway.
+// Code which defines functions, classes, labels, hotkeys or static variables is never cached, since defining them
+// again would fail (and skipping that would change the behaviour of the script).
+#define PARSE_CACHE_BUCKETS 256 // Must be a power of two.
+#define PARSE_CACHE_DEFAULT_LIMIT (32 * 1024 * 1024)
+
+struct ParsedSnippet
+{
+	ParsedSnippet *mNextInBucket;
+	ParsedSnippet *mNewer, *mOlder; // Most-recently-used order, for eviction.
+	Line *mFirstLine, *mLastLine;
+	SimpleHeapUnit *mUnit; // NULL for addScript() entries.
+	size_t mSize; // Bytes counted against sParseCacheLimit.
+	size_t mLength;
+	volatile LONG mRefCount; // 1 while in the cache, plus 1 for each execution in progress.
+	UINT mHash;
+	bool mIsAddScript;
+	TCHAR mText[1];
+};
+static ParsedSnippet *sParseCacheBucket[PARSE_CACHE_BUCKETS];
+static int sExecSourceFileIndex = -1; // The source file shared by all cached ahkExec() lines, or -1 if none yet.
+static ParsedSnippet *sParseCacheNewest = NULL, *sParseCacheOldest = NULL;
+static size_t sParseCacheLimit = PARSE_CACHE_DEFAULT_LIMIT, sParseCacheBytes = 0, sParseCacheCount = 0;
+static size_t sParseCacheHits = 0, sParseCacheMisses = 0;
+static volatile LONG sParseCacheLock = 0; // Held only briefly, so a spin lock avoids the need to initialize anything.
+
+static inline void LockParseCache()
+{
+	while (InterlockedExchange(&sParseCacheLock, 1))
+		Sleep(0);
+}
+
+static inline void UnlockParseCache()
+{
+	InterlockedExchange(&sParseCacheLock, 0);
+}
+
+static UINT ParseCacheHash(LPCTSTR aText, size_t aLength)
+{
+	UINT hash = 2166136261U; // FNV-1a.
+	for (size_t i = 0; i < aLength; ++i)
+		hash = (hash ^ (UINT)aText[i]) * 16777619U;
+	return hash;
+}
+
+static void DeleteExecLines(Line *aFirstLine, Line *aLastLine)
+// Deletes the lines loaded by ahkExec(), which aren't linked into the script.
+{
+	g_Profiler.ForgetLines(aFirstLine, aLastLine);
+	for (Line *prevLine = aLastLine->mPrevLine; prevLine; prevLine = prevLine->mPrevLine)
+	{
+		prevLine->mNextLine->FreeDerefBufIfLarge();
+		delete prevLine->mNextLine;
+	}
+	delete aFirstLine;
+}
+
+static void ReleaseParsedSnippet(ParsedSnippet *aSnippet)
+{
+	if (InterlockedDecrement(&aSnippet->mRefCount))
+		return;
+	if (aSnippet->mUnit)
+	{
+		DeleteExecLines(aSnippet->mFirstLine, aSnippet->mLastLine);
+		delete aSnippet->mUnit;
+	}
+	free(aSnippet);
+}
+
+static void UnlinkParsedSnippet(ParsedSnippet *aSnippet)
+// Removes aSnippet from the cache.  Caller must hold the lock and release aSnippet after unlocking.
+{
+	ParsedSnippet **link = &sParseCacheBucket[aSnippet->mHash & (PARSE_CACHE_BUCKETS - 1)];
+	while (*link != aSnippet)
+		link = &(*link)->mNextInBucket;
+	*link = aSnippet->mNextInBucket;
+	if (aSnippet->mNewer)
+		aSnippet->mNewer->mOlder = aSnippet->mOlder;
+	else
+		sParseCacheNewest = aSnippet->mOlder;
+	if (aSnippet->mOlder)
+		aSnippet->mOlder->mNewer = aSnippet->mNewer;
+	else
+		sParseCacheOldest = aSnippet->mNewer;
+	sParseCacheBytes -= aSnippet->mSize;
+	--sParseCacheCount;
+}
+
+static ParsedSnippet *TrimParseCache()
+// Evicts the least recently used entries until the cache fits within its limit.  Caller must hold the
+// lock.  Returns the evicted entries linked through mNextInBucket, for the caller to release after unlocking.
+{
+	ParsedSnippet *evicted = NULL;
+	while (sParseCacheBytes > sParseCacheLimit && sParseCacheOldest)
+	{
+		ParsedSnippet *snippet = sParseCacheOldest;
+		UnlinkParsedSnippet(snippet);
+		snippet->mNextInBucket = evicted;
+		evicted = snippet;
+	}
+	return evicted;
+}
+
+static void ReleaseParsedSnippets(ParsedSnippet *aList)
+{
+	for (ParsedSnippet *next; aList; aList = next)
+	{
+		next = aList->mNextInBucket;
+		ReleaseParsedSnippet(aList);
+	}
+}
+
+static ParsedSnippet *FindParsedSnippet(LPCTSTR aText, size_t aLength, UINT aHash, bool aIsAddScript)
+// Caller must hold the lock.
+{
+	for (ParsedSnippet *snippet = sParseCacheBucket[aHash & (PARSE_CACHE_BUCKETS - 1)]; snippet; snippet = snippet->mNextInBucket)
+		if (snippet->mHash == aHash && snippet->mLength == aLength && snippet->mIsAddScript == aIsAddScript
+			&& !tmemcmp(snippet->mText, aText, aLength))
+			return snippet;
+	return NULL;
+}
+
+static ParsedSnippet *LookupParsedSnippet(LPCTSTR aText, bool aIsAddScript)
+// Returns the cached code for aText with a reference which the caller must release, or NULL if none.
+{
+	if (!sParseCacheLimit)
+		return NULL;
+	size_t length = _tcslen(aText);
+	UINT hash = ParseCacheHash(aText, length);
+	LockParseCache();
+	ParsedSnippet *snippet = FindParsedSnippet(aText, length, hash, aIsAddScript);
+	if (snippet)
+	{
+		++sParseCacheHits;
+		InterlockedIncrement(&snippet->mRefCount);
+		if (snippet->mNewer) // Move it to the front.
+		{
+			snippet->mNewer->mOlder = snippet->mOlder;
+			if (snippet->mOlder)
+				snippet->mOlder->mNewer = snippet->mNewer;
+			else
+				sParseCacheOldest = snippet->mNewer;
+			snippet->mNewer = NULL;
+			snippet->mOlder = sParseCacheNewest;
+			sParseCacheNewest->mNewer = snippet;
+			sParseCacheNewest = snippet;
+		}
+	}
+	else
+		++sParseCacheMisses;
+	UnlockParseCache();
+	return snippet;
+}
+
+static ParsedSnippet *CacheParsedSnippet(LPCTSTR aText, bool aIsAddScript, Line *aFirstLine, Line *aLastLine, SimpleHeapUnit *aUnit)
+// Adds freshly loaded code to the cache.  If successful, the cache takes ownership of the lines and aUnit
+// (if applicable) and the return value holds a reference which the caller must release.  Otherwise the
+// caller retains ownership and NULL is returned.
+{
+	size_t length = _tcslen(aText);
+	size_t size = sizeof(ParsedSnippet) + length * sizeof(TCHAR) + (aUnit ? aUnit->BytesReserved() : 0);
+	if (size > sParseCacheLimit)
+		return NULL;
+	ParsedSnippet *snippet = (ParsedSnippet *)malloc(sizeof(ParsedSnippet) + length * sizeof(TCHAR));
+	if (!snippet)
+		return NULL;
+	tmemcpy(snippet->mText, aText, length + 1);
+	snippet->mLength = length;
+	snippet->mHash = ParseCacheHash(aText, length);
+	snippet->mIsAddScript = aIsAddScript;
+	snippet->mFirstLine = aFirstLine;
+	snippet->mLastLine = aLastLine;
+	snippet->mUnit = aUnit;
+	snippet->mSize = size;
+	snippet->mRefCount = 2;
+	LockParseCache();
+	if (FindParsedSnippet(aText, length, snippet->mHash, aIsAddScript))
+	{
+		// Another thread loaded the same code in the meantime.
+		UnlockParseCache();
+		free(snippet);
+		return NULL;
+	}
+	ParsedSnippet *&bucket = sParseCacheBucket[snippet->mHash & (PARSE_CACHE_BUCKETS - 1)];
+	snippet->mNextInBucket = bucket;
+	bucket = snippet;
+	snippet->mNewer = NULL;
+	if (snippet->mOlder = sParseCacheNewest)
+		sParseCacheNewest->mNewer = snippet;
+	else
+		sParseCacheOldest = snippet;
+	sParseCacheNewest = snippet;
+	sParseCacheBytes += size;
+	++sParseCacheCount;
+	ParsedSnippet *evicted = TrimParseCache();
+	UnlockParseCache();
+	ReleaseParsedSnippets(evicted);
+	return snippet;
+}
+
+EXPORT UINT_PTR ahkParseCache(int aCommand, UINT_PTR aValue)
+// Reports on or controls the cache of code loaded by ahkExec() and addScript(); see ParseCacheCommand.
+{
+	UINT_PTR result = 0;
+	ParsedSnippet *evicted = NULL;
+	LockParseCache();
+	switch (aCommand)
+	{
+	case PARSECACHE_HITS: result = sParseCacheHits; break;
+	case PARSECACHE_MISSES: result = sParseCacheMisses; break;
+	case PARSECACHE_COUNT: result = sParseCacheCount; break;
+	case PARSECACHE_BYTES: result = sParseCacheBytes; break;
+	case PARSECACHE_LIMIT: result = sParseCacheLimit; break;
+	case PARSECACHE_SET_LIMIT: // aValue = the new limit in bytes, or 0 to disable the cache.  Returns the old limit.
+		result = sParseCacheLimit;
+		sParseCacheLimit = aValue;
+		evicted = TrimParseCache();
+		break;
+	case PARSECACHE_REMOVE: // aValue = the text of a script to invalidate.  Returns the number of entries removed.
+		if (aValue)
+		{
+			LPCTSTR text = (LPCTSTR)aValue;
+			size_t length = _tcslen(text);
+			UINT hash = ParseCacheHash(text, length);
+			for (int i = 0; i < 2; ++i)
+				if (ParsedSnippet *snippet = FindParsedSnippet(text, length, hash, i != 0))
+				{
+					UnlinkParsedSnippet(snippet);
+					snippet->mNextInBucket = evicted;
+					evicted = snippet;
+					++result;
+				}
+		}
+		break;
+	case PARSECACHE_CLEAR: // Returns the number of entries removed.
+		result = sParseCacheCount;
+		while (ParsedSnippet *snippet = sParseCacheOldest)
+		{
+			UnlinkParsedSnippet(snippet);
+			snippet->mNextInBucket = evicted;
+			evicted = snippet;
+		}
+		break;
+	case PARSECACHE_RESET_STATS:
+		sParseCacheHits = sParseCacheMisses = 0;
+		break;
+	}
+	UnlockParseCache();
+	ReleaseParsedSnippets(evicted);
+	return result;
+}
+
+void ParseCacheClear()
+// Called when the script is destroyed, since the cached lines refer to its variables, functions, etc.
+{
+	ahkParseCache(PARSECACHE_CLEAR, 0);
+	sExecSourceFileIndex = -1; // The source file names are about to be freed.
+}
+
+EXPORT int ahkProfile(int aCommand, LPTSTR aFileName)
+// Controls the line profiler; see ProfileCommand.  aFileName is where to write the results: for
+// PROFILE_START, when the script exits; for PROFILE_WRITE, immediately.  If omitted, PROFILE_WRITE
+// uses the file name given to PROFILE_START or the /profile switch.
+{
+	if (aCommand == PROFILE_IS_ENABLED)
+		return g_Profiler.mIsEnabled;
+	if (aCommand == PROFILE_WRITE) // Write() can be called from any thread.
+		return g_Profiler.Write(aFileName) == OK;
+#ifdef _WIN64
+	DWORD thisThreadID = __readgsdword(0x48); // Used to identify if code is called from different thread (AutoHotkey.dll)
+#else
+	DWORD thisThreadID = __readfsdword(0x24);
+#endif
+	if (g_MainThreadID == thisThreadID)
+		return ExecuteProfileCommand(aCommand, aFileName);
+	return (int)SendMessage(g_hWnd, AHK_PROFILE, (WPARAM)aCommand, (LPARAM)aFileName);
+}
+
+int ExecuteProfileCommand(int aCommand, LPTSTR aFileName)
+// Called on the script's thread, since the profiler's state is updated by that thread as the script runs.
+{
+	switch (aCommand)
+	{
+	case PROFILE_STOP: g_Profiler.Stop(); return 1;
+	case PROFILE_START: return g_Profiler.Start(aFileName);
+	case PROFILE_RESET: g_Profiler.Reset(); return 1;
+	}
+	return 0;
+}
+
 // Naveen: v6 addFile()
 // Todo: support for #Directives, and proper treatment of mIsReadytoExecute
 EXPORT UINT_PTR addFile(LPTSTR fileName, int waitexecute)
@@ -486,13 +943,31 @@ EXPORT UINT_PTR addScript(LPTSTR script, int waitexecute)
 	// labels, hotkeys, functions.
 	if (!g_script.mIsReadyToExecute)
 		return 0; // AutoHotkey needs to be running at this point // LOADING_FAILED cant be used due to PTR return type
+	if (ParsedSnippet *cached = LookupParsedSnippet(script, true))
+	{
+		// The same code was added before and its lines are still part of the script, so just run them again.
+		Line *aTempLine = cached->mFirstLine;
+		ReleaseParsedSnippet(cached);
+		if (waitexecute == 1)
+		{
+			g_ReturnNotExit = true;
+			SendMessage(g_hWnd, AHK_EXECUTE, (WPARAM)aTempLine, (LPARAM)NULL);
+			g_ReturnNotExit = false;
+		}
+		else if (waitexecute != 0)
+			PostMessage(g_hWnd, AHK_EXECUTE, (WPARAM)aTempLine, (LPARAM)NULL);
+		return (UINT_PTR) aTempLine;
+	}
 #ifndef MINIDLL
 	int HotkeyCount = Hotkey::sHotkeyCount;
+	HotkeyCriterion *aLastHotCriterion = g_LastHotCriterion;
 	GuiType *aGuiDefaultWindow = g->GuiDefaultWindow;
 	g->GuiDefaultWindow = NULL;
 	int a_guiCount = g_guiCount;
 	g_guiCount = 0;
 #endif
+	Label *aLastLabel = g_script.mLastLabel;
+	int aClassDefinitionCount = g_script.mClassDefinitionCount;
 
 	LPCTSTR aPathToShow = g_script.mCurrLine->mArg ? g_script.mCurrLine->mArg->text : g_script.mFileSpec;
 #ifdef _USRDLL
@@ -552,8 +1027,18 @@ EXPORT UINT_PTR addScript(LPTSTR script, int waitexecute)
 	aLastLine->mNextLine = aTempLine;
 	aTempLine->mPrevLine = aLastLine;
 	aLastLine = g_script.mLastLine;
+	// Code which defined anything besides lines can't be added again, so there's no point caching it:
+	bool cacheable = !(g_script.mFuncCount > aFuncCount || g_script.mClassDefinitionCount != aClassDefinitionCount
+		|| g_script.mLastLabel != aLastLabel || g_script.mFirstStaticLine
+#ifndef MINIDLL
+		|| Hotkey::sHotkeyCount > HotkeyCount || g_LastHotCriterion != aLastHotCriterion
+#endif
+		);
 	delete g_script.mPlaceholderLabel;
 	RESTORE_G_SCRIPT
+	if (cacheable)
+		if (ParsedSnippet *cached = CacheParsedSnippet(script, true, aTempLine, NULL, NULL))
+			ReleaseParsedSnippet(cached);
 	return (UINT_PTR) aTempLine;
 }
 #endif // AUTOHOTKEYSC
@@ -565,16 +1050,35 @@ EXPORT int ahkExec(LPTSTR script)
 	// labels, hotkeys, functions
 	if (!g_script.mIsReadyToExecute)
 		return 0; // AutoHotkey needs to be running at this point // LOADING_FAILED cant be used due to PTR return type.
+	if (ParsedSnippet *cached = LookupParsedSnippet(script, false))
+	{
+		g_ReturnNotExit = true;
+		SendMessage(g_hWnd, AHK_EXECUTE, (WPARAM)cached->mFirstLine, (LPARAM)NULL);
+		g_ReturnNotExit = false;
+		ReleaseParsedSnippet(cached);
+		return OK;
+	}
 #ifndef MINIDLL
 	int HotkeyCount = Hotkey::sHotkeyCount;
+	HotkeyCriterion *aLastHotCriterion = g_LastHotCriterion;
 #endif
+	Label *aLastLabel = g_script.mLastLabel;
+	int aClassDefinitionCount = g_script.mClassDefinitionCount;
 #ifdef _USRDLL
 	g_Loading = true;
 #endif
 	BACKUP_G_SCRIPT
 	int aSourceFileIdx = Line::sSourceFileCount;
-	if ((g_script.LoadFromText(script, _T(""), false) != OK)) // || !g_script.PreparseBlocks(oldLastLine->mNextLine))
+	// The lines loaded here are deleted after they execute, so put their args, derefs and postfix arrays
+	// into a unit of their own which can be released along with them:
+	SimpleHeapUnit *unit = new SimpleHeapUnit;
+	unit->Install();
+	ResultType load_result = g_script.LoadFromText(script, _T(""), false);
+	unit->Uninstall();
+	if (load_result != OK) // || !g_script.PreparseBlocks(oldLastLine->mNextLine))
 	{
+		unit->Keep(); // Whatever was loaded before the failure isn't deleted, so neither is its memory.
+		delete unit;
 		g->CurrentFunc = aCurrFunc;
 		if (g_script.mPlaceholderLabel)
 			delete g_script.mPlaceholderLabel;
@@ -595,18 +1099,55 @@ EXPORT int ahkExec(LPTSTR script)
 	g->CurrentFunc = aCurrFunc;
 	Line *aTempLine = g_script.mLastLine;
 	Line *aExecLine = g_script.mFirstLine;
+	// Functions, classes, labels, hotkeys, #If criteria and static initializers outlive the lines, so keep
+	// the memory if any were defined (including by auto-included library files):
+	bool keep_unit = g_script.mFuncCount > aFuncCount || g_script.mClassDefinitionCount != aClassDefinitionCount
+		|| g_script.mLastLabel != aLastLabel || g_script.mFirstStaticLine
+#ifndef MINIDLL
+		|| Hotkey::sHotkeyCount > HotkeyCount || g_LastHotCriterion != aLastHotCriterion
+#endif
+		;
 	delete g_script.mPlaceholderLabel;
 	RESTORE_G_SCRIPT
+	// Otherwise, cache the lines so that next time the same code can be executed without loading it.
+	// Since they outlive this call, the lines all refer to one source file (named "") which is kept for
+	// the life of the script, so that cached and evicted snippets don't use up source file indices.
+	bool cacheable = !keep_unit && Line::sSourceFileCount == aSourceFileIdx + 1;
+	if (cacheable)
+	{
+		if (sExecSourceFileIndex < 0)
+			sExecSourceFileIndex = aSourceFileIdx++; // Keep this one.
+		else
+		{
+			for (Line *line = aExecLine; ; line = line->mNextLine)
+			{
+				line->mFileIndex = (FileIndexType)sExecSourceFileIndex;
+				if (line == aTempLine)
+					break;
+			}
+			free(Line::sSourceFile[--Line::sSourceFileCount]);
+		}
+	}
+	ParsedSnippet *cached = cacheable ? CacheParsedSnippet(script, false, aExecLine, aTempLine, unit) : NULL;
 	g_ReturnNotExit = true;
 	SendMessage(g_hWnd, AHK_EXECUTE, (WPARAM)aExecLine, (LPARAM)NULL);
 	g_ReturnNotExit = false;
-	Line *prevLine = aTempLine->mPrevLine;
-	for(; prevLine; prevLine = prevLine->mPrevLine)
+	if (cached)
 	{
-		prevLine->mNextLine->FreeDerefBufIfLarge();
-		delete prevLine->mNextLine;
+		ReleaseParsedSnippet(cached);
+		return OK;
+	}
+	if (keep_unit)
+	{
+		// Functions, labels and class methods refer to the lines as well as their args, so keep both
+		// (and the source file names which the lines refer to).
+		unit->Keep();
+		delete unit;
+		return OK;
 	}
-	delete aExecLine;
+	DeleteExecLines(aExecLine, aTempLine);
+	unit->Release();
+	delete unit;
 	for (;Line::sSourceFileCount>aSourceFileIdx;)
 		if (Line::sSourceFile[--Line::sSourceFileCount] != g_script.mOurEXE)
 			free(Line::sSourceFile[Line::sSourceFileCount]);
@@ -820,12 +1361,164 @@ EXPORT LPTSTR ahkFunction(LPTSTR func, LPTSTR param1, LPTSTR param2, LPTSTR para
 		return _T(""); 
 }
 
+#define AHKCALL_MAX_STACK_PARAMS 64 // ahkCallFunction allocates space for more parameters than this on the heap.
+
+EXPORT int ahkCallFunction(LPTSTR aFuncName, AhkValue *aParam, int aParamCount, AhkValue *aResult)
+// Calls a function with typed parameters and retrieves its typed result, avoiding the conversion of each
+// value to and from a string which ahkFunction requires.  Any number of parameters can be passed.
+// Returns 0 on success, or -1 if the function wasn't found, couldn't be called or didn't return normally
+// (e.g. it threw an exception).  aResult may be NULL if the result isn't needed; otherwise the caller
+// must pass it to ahkFreeValue when done.
+{
+	if (aResult)
+		aResult->Type = AHK_TYPE_NONE;
+	// Each parameter needs a token, a pointer to it and possibly a copy of its string.
+	const size_t space_per_param = sizeof(ExprTokenType) + sizeof(ExprTokenType *) + sizeof(LPTSTR);
+	if (!g_script.mIsReadyToExecute || aParamCount < 0 || (size_t)aParamCount > MAXINT_PTR / space_per_param)
+		return -1;
+	Func *aFunc = g_script.FindFunc(aFuncName);
+	if (!aFunc)
+		return -1;
+	if (aParamCount < aFunc->mMinParams)
+	{
+		g_script.ScriptError(ERR_TOO_FEW_PARAMS, aFuncName);
+		return -1;
+	}
+	// Since each call has its own FuncAndToken and SendMessage() executes calls one at a time on the
+	// script's thread, g_CriticalAhkFunction isn't needed.
+	FuncAndToken call;
+	ZeroMemory(&call, sizeof(call));
+	TCHAR result_buf[MAX_NUMBER_SIZE];
+	AhkValue discarded_result;
+	// The host controls the number of parameters, so only put a small number of them on the stack:
+	size_t space = aParamCount * space_per_param;
+	void *heap_space = NULL;
+	ExprTokenType *token = (ExprTokenType *)(aParamCount <= AHKCALL_MAX_STACK_PARAMS ? _alloca(space) : (heap_space = malloc(space)));
+	if (!token && space)
+	{
+		g_script.ScriptError(ERR_OUTOFMEM, aFuncName);
+		return -1;
+	}
+	ExprTokenType **param = (ExprTokenType **)(token + aParamCount);
+	LPTSTR *string_copy = (LPTSTR *)(param + aParamCount); // Strings which weren't null-terminated.
+	int i, string_copy_count = 0;
+	for (i = 0; i < aParamCount; ++i)
+	{
+		AhkValue &value = aParam[i];
+		param[i] = &token[i];
+		switch (value.Type)
+		{
+		case AHK_TYPE_INT64: token[i].SetValue(value.Int64); break;
+		case AHK_TYPE_DOUBLE: token[i].SetValue(value.Double); break;
+		case AHK_TYPE_PTR: token[i].SetValue((__int64)(INT_PTR)value.Ptr); break;
+		case AHK_TYPE_OBJECT: token[i].SetValue(value.Object); break; // The function call adds its own references as needed.
+		case AHK_TYPE_STRING:
+			if (value.Length < 0)
+				token[i].SetValue(value.String);
+			else
+			{
+				LPTSTR str = tmalloc(value.Length + 1);
+				if (!str)
+				{
+					g_script.ScriptError(ERR_OUTOFMEM, aFuncName);
+					aParamCount = -1; // Indicate failure below.
+					break;
+				}
+				tmemcpy(str, value.String, value.Length);
+				str[value.Length] = '\0';
+				token[i].SetValue(string_copy[string_copy_count++] = str);
+			}
+			break;
+		default: token[i].symbol = SYM_MISSING; break;
+		}
+		if (aParamCount < 0)
+			break;
+	}
+	if (aParamCount >= 0)
+	{
+		call.mFunc = aFunc;
+		call.param = param;
+		call.mParamCount = aFunc->mParamCount < aParamCount && !aFunc->mIsVariadic ? aFunc->mParamCount : aParamCount;
+		call.mToken.buf = result_buf;
+		call.mTypedResult = aResult ? aResult : &discarded_result;
+		call.mTypedResult->Type = AHK_TYPE_NONE;
+		call.mFailed = true; // In case the message isn't processed.
+		SendMessage(g_hWnd, AHK_EXECUTE_FUNCTION_DLL, (WPARAM)&call, NULL);
+		if (!aResult)
+			ahkFreeValue(&discarded_result);
+	}
+	for (i = 0; i < string_copy_count; ++i)
+		free(string_copy[i]);
+	free(heap_space);
+	return aParamCount < 0 || call.mFailed ? -1 : 0;
+}
+
+EXPORT void ahkFreeValue(AhkValue *aValue)
+// Frees a result returned by ahkCallFunction.
+{
+	if (aValue->Type == AHK_TYPE_STRING)
+		free(aValue->String);
+	else if (aValue->Type == AHK_TYPE_OBJECT)
+		aValue->Object->Release();
+	aValue->Type = AHK_TYPE_NONE;
+}
+
+static void TokenToAhkValue(ExprTokenType &aToken, AhkValue &aValue)
+// Stores the result of a function called by ahkCallFunction in aValue, taking ownership of any memory
+// or object reference held by aToken.
+{
+	aValue.Length = 0;
+	if (aToken.symbol == SYM_VAR && aToken.var->HasObject())
+	{
+		aValue.Type = AHK_TYPE_OBJECT;
+		aValue.Object = aToken.var->Object();
+		aValue.Object->AddRef();
+		return;
+	}
+	switch (aToken.symbol)
+	{
+	case SYM_INTEGER:
+		aValue.Type = AHK_TYPE_INT64;
+		aValue.Int64 = aToken.value_int64;
+		return;
+	case SYM_FLOAT:
+		aValue.Type = AHK_TYPE_DOUBLE;
+		aValue.Double = aToken.value_double;
+		return;
+	case SYM_OBJECT:
+		aValue.Type = AHK_TYPE_OBJECT;
+		aValue.Object = aToken.object; // Take over the token's reference.
+		return;
+	case SYM_VAR:
+	case SYM_STRING:
+	case SYM_OPERAND:
+	{
+		LPTSTR str = TokenToString(aToken);
+		size_t length = (aToken.symbol == SYM_VAR) ? aToken.var->CharLength() : _tcslen(str);
+		if (aValue.String = tmalloc(length + 1))
+		{
+			tmemcpy(aValue.String, str, length + 1);
+			aValue.Type = AHK_TYPE_STRING;
+			aValue.Length = (int)length;
+		}
+		else
+			aValue.Type = AHK_TYPE_NONE;
+		break;
+	}
+	default:
+		aValue.Type = AHK_TYPE_NONE;
+	}
+	if (aToken.mem_to_free) // Only strings are expected to have this.
+		free(aToken.mem_to_free);
+}
+
 //H30 changed to not return anything since it is not used
 void callFuncDll(FuncAndToken *aFuncAndToken)
 {
  	Func &func =  *(aFuncAndToken->mFunc); 
 	ExprTokenType & aResultToken = aFuncAndToken->mToken ;
 	// Func &func = *(Func *)g_script.mTempFunc ;
+	aFuncAndToken->mFailed = true; // Until the function returns normally.
 	if (!INTERRUPTIBLE_IN_EMERGENCY)
 		return;
 	if (g_nThreads >= g_MaxThreadsTotal)
@@ -833,7 +1526,7 @@ void callFuncDll(FuncAndToken *aFuncAndToken)
 		// 1) The omitted action types seem too obscure to grant always-run permission for msg-monitor events.
 		// 2) Reduction in code size.
 		if (g_nThreads >= MAX_THREADS_EMERGENCY // To avoid array overflow, this limit must by obeyed except where otherwise documented.
-			|| func.mJumpToLine->mActionType != ACT_EXITAPP && func.mJumpToLine->mActionType != ACT_RELOAD)
+			|| func.mIsBuiltIn || func.mJumpToLine->mActionType != ACT_EXITAPP && func.mJumpToLine->mActionType != ACT_RELOAD)
 			return;
 
 	// Need to check if backup is needed in case script explicitly called the function rather than using
@@ -853,7 +1546,7 @@ void callFuncDll(FuncAndToken *aFuncAndToken)
 	// See MsgSleep() for comments about the following section.
 	TCHAR ErrorLevel_saved[ERRORLEVEL_SAVED_SIZE];
 	tcslcpy(ErrorLevel_saved, g_ErrorLevel->Contents(), _countof(ErrorLevel_saved));
-	InitNewThread(0, false, true, func.mJumpToLine->mActionType);
+	InitNewThread(0, false, true, func.mIsBuiltIn ? ACT_EXPRESSION : func.mJumpToLine->mActionType); // Built-in functions can be posted by ahkPostFunctionEx.
 
 	//for (int aParamCount = 0;func.mParamCount > aParamCount && aFuncAndToken->mParamCount > aParamCount;aParamCount++)
 	//	func.mParam[aParamCount].var->AssignString(aFuncAndToken->param[aParamCount]);
@@ -872,6 +1565,14 @@ void callFuncDll(FuncAndToken *aFuncAndToken)
 	bool result = func.Call(func_call,aResult,aResultToken,aFuncAndToken->param,(int) aFuncAndToken->mParamCount,false); // Call the UDF.
 
 	DEBUGGER_STACK_POP()
+	aFuncAndToken->mFailed = !result;
+	if (aFuncAndToken->mTypedResult) // Called by ahkCallFunction.
+	{
+		if (result)
+			TokenToAhkValue(aResultToken, *aFuncAndToken->mTypedResult);
+		ResumeUnderlyingThread(ErrorLevel_saved);
+		return;
+	}
 	LPTSTR new_buf;
 	if (result)
 	{
@@ -884,7 +1585,8 @@ void callFuncDll(FuncAndToken *aFuncAndToken)
 				if (!new_buf)
 				{
 					g_script.ScriptError(ERR_OUTOFMEM,func.mName);
-					return;
+					aFuncAndToken->mFailed = true;
+					break;
 				}
 				aFuncAndToken->result_to_return_dll = new_buf;
 				_tcscpy(aFuncAndToken->result_to_return_dll,aFuncAndToken->mToken.var->Contents()); // Contents() vs. mContents to support VAR_CLIPBOARD, and in case mContents needs to be updated by Contents().
@@ -900,7 +1602,8 @@ void callFuncDll(FuncAndToken *aFuncAndToken)
 				if (!new_buf)
 				{
 					g_script.ScriptError(ERR_OUTOFMEM,func.mName);
-					return;
+					aFuncAndToken->mFailed = true;
+					break;
 				}
 				aFuncAndToken->result_to_return_dll = new_buf;
 				_tcscpy(aFuncAndToken->result_to_return_dll,aFuncAndToken->mToken.marker);
@@ -909,23 +1612,25 @@ void callFuncDll(FuncAndToken *aFuncAndToken)
 				*aFuncAndToken->result_to_return_dll = '\0';
 			break;
 		case SYM_INTEGER:
-			new_buf = (LPTSTR )realloc((LPTSTR )aFuncAndToken->result_to_return_dll,MAX_INTEGER_LENGTH);
+			new_buf = (LPTSTR )realloc((LPTSTR )aFuncAndToken->result_to_return_dll,MAX_INTEGER_SIZE * sizeof(TCHAR));
 			if (!new_buf)
 			{
 				g_script.ScriptError(ERR_OUTOFMEM,func.mName);
-				return;
+				aFuncAndToken->mFailed = true;
+				break;
 			}
 			aFuncAndToken->result_to_return_dll = new_buf;
 			ITOA64(aFuncAndToken->mToken.value_int64, aFuncAndToken->result_to_return_dll);
 			break;
 		case SYM_FLOAT:
-			new_buf = (LPTSTR )realloc((LPTSTR )aFuncAndToken->result_to_return_dll,MAX_INTEGER_LENGTH);
+			new_buf = (LPTSTR )realloc((LPTSTR )aFuncAndToken->result_to_return_dll,MAX_NUMBER_SIZE * sizeof(TCHAR));
 			if (!new_buf)
 			{
 				g_script.ScriptError(ERR_OUTOFMEM,func.mName);
-				return;
+				aFuncAndToken->mFailed = true;
+				break;
 			}
-			result_to_return_dll = new_buf;
+			aFuncAndToken->result_to_return_dll = new_buf;
 			sntprintf(aFuncAndToken->result_to_return_dll, MAX_NUMBER_SIZE, g->FormatFloat, aFuncAndToken->mToken.value_double);
 			break;
 		//case SYM_OBJECT: // L31: Treat objects as empty strings (or TRUE where appropriate).
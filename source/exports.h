@@ -4,6 +4,22 @@
 
 #define EXPORT extern "C" __declspec(dllexport)
 
+// Value types for ahkCallFunction, which passes parameters and the result without converting them to strings.
+enum AhkValueType {AHK_TYPE_NONE, AHK_TYPE_INT64, AHK_TYPE_DOUBLE, AHK_TYPE_STRING, AHK_TYPE_PTR, AHK_TYPE_OBJECT};
+struct AhkValue
+{
+	int Type;   // One of the AhkValueType values.  AHK_TYPE_NONE as a parameter means it was omitted.
+	int Length; // For AHK_TYPE_STRING: the length in characters, or -1 if String is null-terminated.
+	union
+	{
+		__int64 Int64;
+		double Double;
+		LPTSTR String; // A result string is allocated by the script and must be freed with ahkFreeValue.
+		void *Ptr;
+		IObject *Object; // A result object holds a reference which must be released with ahkFreeValue or Release().
+	};
+};
+
 EXPORT int ahkPause(LPTSTR aChangeTo);
 EXPORT UINT_PTR ahkFindLabel(LPTSTR aLabelName);
 EXPORT LPTSTR ahkgetvar(LPTSTR name,unsigned int getVar = 0);
@@ -13,15 +29,32 @@ EXPORT int ahkLabel(LPTSTR aLabelName, unsigned int nowait = 0);
 EXPORT UINT_PTR ahkFindFunc(LPTSTR funcname) ;
 EXPORT LPTSTR ahkFunction(LPTSTR func, LPTSTR param1 = _T(""), LPTSTR param2 = _T(""), LPTSTR param3 = _T(""), LPTSTR param4 = _T(""), LPTSTR param5 = _T(""), LPTSTR param6 = _T(""), LPTSTR param7 = _T(""), LPTSTR param8 = _T(""), LPTSTR param9 = _T(""), LPTSTR param10 = _T(""));
 EXPORT int ahkPostFunction(LPTSTR func, LPTSTR param1 = _T(""), LPTSTR param2 = _T(""), LPTSTR param3 = _T(""), LPTSTR param4 = _T(""), LPTSTR param5 = _T(""), LPTSTR param6 = _T(""), LPTSTR param7 = _T(""), LPTSTR param8 = _T(""), LPTSTR param9 = _T(""), LPTSTR param10 = _T(""));
+EXPORT UINT_PTR ahkPostFunctionEx(LPTSTR func, LPTSTR param1 = _T(""), LPTSTR param2 = _T(""), LPTSTR param3 = _T(""), LPTSTR param4 = _T(""), LPTSTR param5 = _T(""), LPTSTR param6 = _T(""), LPTSTR param7 = _T(""), LPTSTR param8 = _T(""), LPTSTR param9 = _T(""), LPTSTR param10 = _T(""));
+EXPORT LPTSTR ahkWaitFunction(UINT_PTR aCall, DWORD aTimeout = 0);
+EXPORT int ahkFunctionStatus(UINT_PTR aCall);
+EXPORT void ahkFreeFunction(UINT_PTR aCall);
+EXPORT UINT_PTR ahkHeapInfo(int aType);
+EXPORT int ahkCallFunction(LPTSTR aFuncName, AhkValue *aParam, int aParamCount, AhkValue *aResult);
+EXPORT void ahkFreeValue(AhkValue *aValue);
 
 #ifndef AUTOHOTKEYSC
 EXPORT UINT_PTR addFile(LPTSTR fileName, int waitexecute = 0);
 EXPORT UINT_PTR addScript(LPTSTR script, int waitexecute = 0);
 EXPORT int ahkExec(LPTSTR script);
+
+// Commands for ahkParseCache, which reports on or controls the cache of code loaded by ahkExec and addScript.
+enum ParseCacheCommand {PARSECACHE_HITS, PARSECACHE_MISSES, PARSECACHE_COUNT, PARSECACHE_BYTES
+	, PARSECACHE_LIMIT, PARSECACHE_SET_LIMIT, PARSECACHE_REMOVE, PARSECACHE_CLEAR, PARSECACHE_RESET_STATS};
+EXPORT UINT_PTR ahkParseCache(int aCommand, UINT_PTR aValue = 0);
+void ParseCacheClear();
+EXPORT int ahkProfile(int aCommand, LPTSTR aFileName = NULL); // See ProfileCommand.
+int ExecuteProfileCommand(int aCommand, LPTSTR aFileName);
 #endif
 
 void callFuncDllVariant(FuncAndToken *aFuncAndToken); 
 void callFuncDll(FuncAndToken *aFuncAndToken); 
+void callPostedFuncs();
+void PostedFuncsClear();
 
 int initPlugins();
 
@@ -37,6 +70,11 @@ EXPORT int com_ahkReload();
 void reloadDll();
 ResultType terminateDll(int aExitReason);
 EXPORT int ahkIsUnicode();
+EXPORT UINT_PTR ahkPoolCreate(int aSize, LPTSTR aScript, LPTSTR aArgs = _T(""));
+EXPORT UINT_PTR ahkPoolExec(UINT_PTR aPool, LPTSTR aScript, int aAddScript = 0);
+EXPORT BOOL ahkPoolWait(UINT_PTR aJob, DWORD aTimeout, UINT_PTR *aResult);
+EXPORT void ahkPoolFreeJob(UINT_PTR aJob);
+EXPORT void ahkPoolDestroy(UINT_PTR aPool);
 #endif
 
 #ifndef MINIDLL
@@ -93,6 +131,12 @@ int com_ahkIsUnicode();
 #pragma comment(linker, "/export:AhkExec=_ahkExec")
 #pragma comment(linker, "/export:Ahkexec=_ahkExec")
 #pragma comment(linker, "/export:ahkexec=_ahkExec")
+#pragma comment(linker, "/export:AHKPARSECACHE=_ahkParseCache")
+#pragma comment(linker, "/export:AhkParseCache=_ahkParseCache")
+#pragma comment(linker, "/export:ahkparsecache=_ahkParseCache")
+#pragma comment(linker, "/export:AHKPROFILE=_ahkProfile")
+#pragma comment(linker, "/export:AhkProfile=_ahkProfile")
+#pragma comment(linker, "/export:ahkprofile=_ahkProfile")
 #endif
 #pragma comment(linker, "/export:AHKEXECUTELINE=_ahkExecuteLine")
 #pragma comment(linker, "/export:AhkExecuteLine=_ahkExecuteLine")
@@ -130,6 +174,15 @@ int com_ahkIsUnicode();
 #pragma comment(linker, "/export:ahkGetVar=_ahkgetvar")
 #pragma comment(linker, "/export:ahkGetvar=_ahkgetvar")
 #pragma comment(linker, "/export:ahkgetVar=_ahkgetvar")
+#pragma comment(linker, "/export:AHKHEAPINFO=_ahkHeapInfo")
+#pragma comment(linker, "/export:AhkHeapInfo=_ahkHeapInfo")
+#pragma comment(linker, "/export:ahkheapinfo=_ahkHeapInfo")
+#pragma comment(linker, "/export:AHKCALLFUNCTION=_ahkCallFunction")
+#pragma comment(linker, "/export:AhkCallFunction=_ahkCallFunction")
+#pragma comment(linker, "/export:ahkcallfunction=_ahkCallFunction")
+#pragma comment(linker, "/export:AHKFREEVALUE=_ahkFreeValue")
+#pragma comment(linker, "/export:AhkFreeValue=_ahkFreeValue")
+#pragma comment(linker, "/export:ahkfreevalue=_ahkFreeValue")
 #pragma comment(linker, "/export:AHKISUNICODE=_ahkIsUnicode")
 #pragma comment(linker, "/export:AhkIsUnicode=_ahkIsUnicode")
 #pragma comment(linker, "/export:AhkIsunicode=_ahkIsUnicode")
@@ -154,7 +207,34 @@ int com_ahkIsUnicode();
 #pragma comment(linker, "/export:ahkPostfunction=_ahkPostFunction")
 #pragma comment(linker, "/export:ahkpostFunction=_ahkPostFunction")
 #pragma comment(linker, "/export:ahkpostfunction=_ahkPostFunction")
+#pragma comment(linker, "/export:AHKPOSTFUNCTIONEX=_ahkPostFunctionEx")
+#pragma comment(linker, "/export:AhkPostFunctionEx=_ahkPostFunctionEx")
+#pragma comment(linker, "/export:ahkpostfunctionex=_ahkPostFunctionEx")
+#pragma comment(linker, "/export:AHKWAITFUNCTION=_ahkWaitFunction")
+#pragma comment(linker, "/export:AhkWaitFunction=_ahkWaitFunction")
+#pragma comment(linker, "/export:ahkwaitfunction=_ahkWaitFunction")
+#pragma comment(linker, "/export:AHKFUNCTIONSTATUS=_ahkFunctionStatus")
+#pragma comment(linker, "/export:AhkFunctionStatus=_ahkFunctionStatus")
+#pragma comment(linker, "/export:ahkfunctionstatus=_ahkFunctionStatus")
+#pragma comment(linker, "/export:AHKFREEFUNCTION=_ahkFreeFunction")
+#pragma comment(linker, "/export:AhkFreeFunction=_ahkFreeFunction")
+#pragma comment(linker, "/export:ahkfreefunction=_ahkFreeFunction")
 #ifdef _USRDLL
+#pragma comment(linker, "/export:AHKPOOLCREATE=_ahkPoolCreate")
+#pragma comment(linker, "/export:AhkPoolCreate=_ahkPoolCreate")
+#pragma comment(linker, "/export:ahkpoolcreate=_ahkPoolCreate")
+#pragma comment(linker, "/export:AHKPOOLEXEC=_ahkPoolExec")
+#pragma comment(linker, "/export:AhkPoolExec=_ahkPoolExec")
+#pragma comment(linker, "/export:ahkpoolexec=_ahkPoolExec")
+#pragma comment(linker, "/export:AHKPOOLWAIT=_ahkPoolWait")
+#pragma comment(linker, "/export:AhkPoolWait=_ahkPoolWait")
+#pragma comment(linker, "/export:ahkpoolwait=_ahkPoolWait")
+#pragma comment(linker, "/export:AHKPOOLFREEJOB=_ahkPoolFreeJob")
+#pragma comment(linker, "/export:AhkPoolFreeJob=_ahkPoolFreeJob")
+#pragma comment(linker, "/export:ahkpoolfreejob=_ahkPoolFreeJob")
+#pragma comment(linker, "/export:AHKPOOLDESTROY=_ahkPoolDestroy")
+#pragma comment(linker, "/export:AhkPoolDestroy=_ahkPoolDestroy")
+#pragma comment(linker, "/export:ahkpooldestroy=_ahkPoolDestroy")
 #pragma comment(linker, "/export:AHKREADY=_ahkReady")
 #pragma comment(linker, "/export:AhkReady=_ahkReady")
 #pragma comment(linker, "/export:Ahkready=_ahkReady")
@@ -202,6 +282,12 @@ int com_ahkIsUnicode();
 #pragma comment(linker, "/export:AhkExec=ahkExec")
 #pragma comment(linker, "/export:Ahkexec=ahkExec")
 #pragma comment(linker, "/export:ahkexec=ahkExec")
+#pragma comment(linker, "/export:AHKPARSECACHE=ahkParseCache")
+#pragma comment(linker, "/export:AhkParseCache=ahkParseCache")
+#pragma comment(linker, "/export:ahkparsecache=ahkParseCache")
+#pragma comment(linker, "/export:AHKPROFILE=ahkProfile")
+#pragma comment(linker, "/export:AhkProfile=ahkProfile")
+#pragma comment(linker, "/export:ahkprofile=ahkProfile")
 #endif
 #pragma comment(linker, "/export:AHKEXECUTELINE=ahkExecuteLine")
 #pragma comment(linker, "/export:AhkExecuteLine=ahkExecuteLine")
@@ -239,6 +325,15 @@ int com_ahkIsUnicode();
 #pragma comment(linker, "/export:ahkGetVar=ahkgetvar")
 #pragma comment(linker, "/export:ahkGetvar=ahkgetvar")
 #pragma comment(linker, "/export:ahkgetVar=ahkgetvar")
+#pragma comment(linker, "/export:AHKHEAPINFO=ahkHeapInfo")
+#pragma comment(linker, "/export:AhkHeapInfo=ahkHeapInfo")
+#pragma comment(linker, "/export:ahkheapinfo=ahkHeapInfo")
+#pragma comment(linker, "/export:AHKCALLFUNCTION=ahkCallFunction")
+#pragma comment(linker, "/export:AhkCallFunction=ahkCallFunction")
+#pragma comment(linker, "/export:ahkcallfunction=ahkCallFunction")
+#pragma comment(linker, "/export:AHKFREEVALUE=ahkFreeValue")
+#pragma comment(linker, "/export:AhkFreeValue=ahkFreeValue")
+#pragma comment(linker, "/export:ahkfreevalue=ahkFreeValue")
 #pragma comment(linker, "/export:AHKISUNICODE=ahkIsUnicode")
 #pragma comment(linker, "/export:AhkIsUnicode=ahkIsUnicode")
 #pragma comment(linker, "/export:AhkIsunicode=ahkIsUnicode")
@@ -263,7 +358,34 @@ int com_ahkIsUnicode();
 #pragma comment(linker, "/export:ahkPostfunction=ahkPostFunction")
 #pragma comment(linker, "/export:ahkpostFunction=ahkPostFunction")
 #pragma comment(linker, "/export:ahkpostfunction=ahkPostFunction")
+#pragma comment(linker, "/export:AHKPOSTFUNCTIONEX=ahkPostFunctionEx")
+#pragma comment(linker, "/export:AhkPostFunctionEx=ahkPostFunctionEx")
+#pragma comment(linker, "/export:ahkpostfunctionex=ahkPostFunctionEx")
+#pragma comment(linker, "/export:AHKWAITFUNCTION=ahkWaitFunction")
+#pragma comment(linker, "/export:AhkWaitFunction=ahkWaitFunction")
+#pragma comment(linker, "/export:ahkwaitfunction=ahkWaitFunction")
+#pragma comment(linker, "/export:AHKFUNCTIONSTATUS=ahkFunctionStatus")
+#pragma comment(linker, "/export:AhkFunctionStatus=ahkFunctionStatus")
+#pragma comment(linker, "/export:ahkfunctionstatus=ahkFunctionStatus")
+#pragma comment(linker, "/export:AHKFREEFUNCTION=ahkFreeFunction")
+#pragma comment(linker, "/export:AhkFreeFunction=ahkFreeFunction")
+#pragma comment(linker, "/export:ahkfreefunction=ahkFreeFunction")
 #ifdef _USRDLL
+#pragma comment(linker, "/export:AHKPOOLCREATE=ahkPoolCreate")
+#pragma comment(linker, "/export:AhkPoolCreate=ahkPoolCreate")
+#pragma comment(linker, "/export:ahkpoolcreate=ahkPoolCreate")
+#pragma comment(linker, "/export:AHKPOOLEXEC=ahkPoolExec")
+#pragma comment(linker, "/export:AhkPoolExec=ahkPoolExec")
+#pragma comment(linker, "/export:ahkpoolexec=ahkPoolExec")
+#pragma comment(linker, "/export:AHKPOOLWAIT=ahkPoolWait")
+#pragma comment(linker, "/export:AhkPoolWait=ahkPoolWait")
+#pragma comment(linker, "/export:ahkpoolwait=ahkPoolWait")
+#pragma comment(linker, "/export:AHKPOOLFREEJOB=ahkPoolFreeJob")
+#pragma comment(linker, "/export:AhkPoolFreeJob=ahkPoolFreeJob")
+#pragma comment(linker, "/export:ahkpoolfreejob=ahkPoolFreeJob")
+#pragma comment(linker, "/export:AHKPOOLDESTROY=ahkPoolDestroy")
+#pragma comment(linker, "/export:AhkPoolDestroy=ahkPoolDestroy")
+#pragma comment(linker, "/export:ahkpooldestroy=ahkPoolDestroy")
 #pragma comment(linker, "/export:AHKREADY=ahkReady")
 #pragma comment(linker, "/export:AhkReady=ahkReady")
 #pragma comment(linker, "/export:Ahkready=ahkReady")
@@ -54,7 +54,7 @@ HANDLE g_hThread = OpenThread(THREAD_ALL_ACCESS, FALSE, g_MainThreadID);
 DWORD g_HookThreadID; // Not initialized by design because 0 itself might be a valid thread ID.
 ATOM g_ClassRegistered = 0;
 ATOM g_ClassSplashRegistered = 0;
-CRITICAL_SECTION g_CriticalRegExCache;
+CRITICAL_SECTION g_CriticalRegExCache[PCRE_CACHE_SHARD_COUNT];
 #ifdef _USRDLL
 CRITICAL_SECTION g_CriticalHeapBlocks;
 #endif
@@ -152,6 +152,9 @@ DWORD g_InputTimeoutAt = 0;
 // as the maximum memory size of a variable, including the string's zero terminator.
 // The chosen default seems big enough to be flexible, yet small enough to not be a problem on 99% of systems:
 VarSizeType g_MaxVarCapacity = 64 * 1024 * 1024;
+int g_RegExCacheSize = PCRE_CACHE_DEFAULT_SIZE; // Total number of compiled RegEx's kept in the cache (see #RegExCacheSize).
+bool g_RegExJIT = false; // Whether RegEx's are JIT-compiled by default (see #RegExJIT and the T option).
+DWORD g_LoopReadBufferSize = LOOP_READ_BUFFER_DEFAULT_SIZE;
 UCHAR g_MaxThreadsPerHotkey = 1;
 int g_MaxThreadsTotal = MAX_THREADS_DEFAULT;
 // On my system, the repeat-rate (which is probably set to XP's default) is such that between 20
@@ -203,11 +206,7 @@ int g_guiCount = 0, g_guiCountMax = 0;
 HWND g_hWndToolTip[MAX_TOOLTIPS] = {NULL};
 MsgMonitorList g_MsgMonitor;
 
-// Init not needed for these:
-UCHAR g_SortCaseSensitive;
-bool g_SortNumeric;
-bool g_SortReverse;
-int g_SortColumnOffset;
+// Init not needed for this:
 Func *g_SortFunc;
 
 TCHAR g_delimiter = ',';
@@ -47,7 +47,7 @@ extern HANDLE g_hThread;
 extern DWORD g_HookThreadID;
 extern ATOM g_ClassRegistered;
 extern ATOM g_ClassSplashRegistered;
-extern CRITICAL_SECTION g_CriticalRegExCache;
+extern CRITICAL_SECTION g_CriticalRegExCache[PCRE_CACHE_SHARD_COUNT];
 #ifdef _USRDLL
 extern CRITICAL_SECTION g_CriticalHeapBlocks;
 #endif
@@ -147,6 +147,9 @@ extern DWORD g_InputTimeoutAt;
 #endif
 
 extern VarSizeType g_MaxVarCapacity;
+extern int g_RegExCacheSize;
+extern bool g_RegExJIT;
+extern DWORD g_LoopReadBufferSize;
 #ifndef MINIDLL
 extern UCHAR g_MaxThreadsPerHotkey;
 #endif
@@ -183,10 +186,6 @@ extern int g_guiCount, g_guiCountMax;
 extern HWND g_hWndToolTip[MAX_TOOLTIPS];
 extern MsgMonitorList g_MsgMonitor;
 
-extern UCHAR g_SortCaseSensitive;
-extern bool g_SortNumeric;
-extern bool g_SortReverse;
-extern int g_SortColumnOffset;
 extern Func *g_SortFunc;
 
 extern TCHAR g_delimiter;
@@ -48,6 +48,7 @@ enum UserMessages {AHK_HOOK_HOTKEY = WM_USER, AHK_HOTSTRING, AHK_USER_MENU, AHK_
 	, AHK_EXECUTE_FUNCTION_VARIANT
 	, AHK_EXECUTE_LABEL
 	, AHK_EXECUTE_FUNCTION_DLL // HotkeyIt for ahkFunction
+	, AHK_PROFILE // For ahkProfile(), so that the profiler is only started or stopped by the script's thread.
 };
 // NOTE: TRY NEVER TO CHANGE the specific numbers of the above messages, since some users might be
 // using the Post/SendMessage commands to automate AutoHotkey itself.  Here is the original order
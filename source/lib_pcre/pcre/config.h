@@ -311,8 +311,9 @@ set the limit at 16000 recursions. A 64Mb stack, on the other hand, can support
 #define STDC_HEADERS 1
 #endif
 
-/* Define to enable support for Just-In-Time compiling. */
-/* #undef SUPPORT_JIT */
+/* Define to enable support for Just-In-Time compiling.
+   AutoHotkey: Used by the RegEx T option and #RegExJIT. */
+#define SUPPORT_JIT
 
 /* Define to allow pcregrep to be linked with libbz2, so that it is able to
    handle .bz2 files. */
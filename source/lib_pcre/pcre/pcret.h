@@ -34,6 +34,7 @@
 #define pcret_free_study					pcre16_free_study
 #define pcret_version						pcre16_version
 #define pcret_pattern_to_host_byte_order	pcre16_pattern_to_host_byte_order
+#define pcret_jit_stack						pcre16_jit_stack
 #define pcret_jit_stack_alloc				pcre16_jit_stack_alloc
 #define pcret_jit_stack_free				pcre16_jit_stack_free
 #define pcret_assign_jit_stack				pcre16_assign_jit_stack
@@ -73,6 +74,7 @@
 #define pcret_free_study					pcre_free_study
 #define pcret_version						pcre_version
 #define pcret_pattern_to_host_byte_order	pcre_pattern_to_host_byte_order
+#define pcret_jit_stack						pcre_jit_stack
 #define pcret_jit_stack_alloc				pcre_jit_stack_alloc
 #define pcret_jit_stack_free				pcre_jit_stack_free
 #define pcret_assign_jit_stack				pcre_assign_jit_stack
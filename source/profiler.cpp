@@ -0,0 +1,459 @@
+/*
+AutoHotkey
+
+Copyright 2003-2009 Chris Mallett (support@autohotkey.com)
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+
+#include "stdafx.h" // pre-compiled headers
+#include "globaldata.h" // for g_script and Line
+#include "TextIO.h"
+#include "profiler.h"
+
+Profiler g_Profiler;
+
+// Nodes and line stats are only ever added (and only freed by Finish()), so that Write() can safely
+// read them from another thread while the script runs; see ahkProfile().
+#define PROFILER_MAX_PATH 65536
+
+
+Profiler::Node *Profiler::FindChild(Node *aParent, NodeType aType, void *aKey, LPTSTR aName)
+{
+	Node *node;
+	for (node = aParent->mFirstChild; node; node = node->mNextSibling)
+		if (node->mType == aType && (aType == NODE_THREAD ? !_tcscmp(node->mName, aName) : node->mKey == aKey))
+			return node;
+	if (  !(node = (Node *)calloc(1, sizeof(Node)))  )
+		return NULL;
+	if (  !(node->mName = aType == NODE_THREAD ? _tcsdup(aName) : aName)  ) // Thread descriptions aren't necessarily permanent.
+	{
+		free(node);
+		return NULL;
+	}
+	node->mParent = aParent;
+	node->mKey = aKey;
+	node->mType = aType;
+	node->mNextInList = mFirstNode;
+	mFirstNode = node;
+	node->mNextSibling = aParent->mFirstChild;
+	InterlockedExchangePointer((PVOID *)&aParent->mFirstChild, node); // Publish it only once it is complete.
+	return node;
+}
+
+
+
+Profiler::LineStat *Profiler::FindLineStat(Node *aNode, Line *aLine)
+{
+	size_t bucket = LineBucket(aLine);
+	LineStat *stat;
+	for (stat = mBucket[bucket]; stat; stat = stat->mNextInBucket)
+		if (stat->mLine == aLine && stat->mNode == aNode)
+			return stat;
+	// Copy what Write() needs from the line, since lines loaded by ahkExec() are deleted after they run.
+	TCHAR text[500];
+	LPTSTR file_name = Line::sSourceFile[aLine->mFileIndex], cp = _tcsrchr(file_name, '\\');
+	if (cp && cp[1])
+		file_name = cp + 1;
+	size_t file_name_length = _tcslen(file_name);
+	size_t text_length = aLine->ToText(text, _countof(text), false) - text; // Includes the line number and a line break.
+	if (  !(stat = (LineStat *)calloc(1, sizeof(LineStat) + (file_name_length + text_length + 2) * sizeof(TCHAR)))  )
+	{
+		mIsEnabled = false; // Out of memory, so stop profiling rather than report incomplete results.
+		return &mDiscard;
+	}
+	stat->mNode = aNode;
+	stat->mLine = aLine;
+	stat->mFileName = (LPTSTR)(stat + 1);
+	tmemcpy(stat->mFileName, file_name, file_name_length + 1);
+	stat->mText = stat->mFileName + file_name_length + 1;
+	tmemcpy(stat->mText, text, text_length);
+	stat->mText[text_length] = '\0';
+	stat->mLineNumber = aLine->mLineNumber;
+	stat->mNextInBucket = mBucket[bucket];
+	InterlockedExchangePointer((PVOID *)&mBucket[bucket], stat);
+	++mLineStatCount;
+	return stat;
+}
+
+
+
+void Profiler::ForgetLines(Line *aFirstLine, Line *aLastLine)
+// Detaches the stats of lines which are about to be deleted, so that a line later allocated at the
+// same address starts with its own stats.  The stats themselves are kept for Write().
+{
+	if (!mLineStatCount)
+		return;
+	for (Line *line = aLastLine; ; line = line->mPrevLine)
+	{
+		// All stats of a line are in the same bucket regardless of the call stack.
+		for (LineStat *stat = mBucket[LineBucket(line)]; stat; stat = stat->mNextInBucket)
+			if (stat->mLine == line)
+				stat->mLine = NULL;
+		if (line == aFirstLine)
+			break;
+	}
+}
+
+
+
+void Profiler::Enter(NodeType aType, void *aKey, LPTSTR aName)
+{
+	unsigned __int64 now = __rdtsc();
+	Charge(now);
+	if (mFrameCount == mFrameCapacity)
+	{
+		int new_capacity = mFrameCapacity ? mFrameCapacity * 2 : 128;
+		Frame *new_frame = (Frame *)realloc(mFrame, new_capacity * sizeof(Frame));
+		if (!new_frame)
+		{
+			mIsEnabled = false;
+			return;
+		}
+		mFrame = new_frame;
+		mFrameCapacity = new_capacity;
+	}
+	// Threads start a new stack rather than appearing to be called by whichever thread they interrupted.
+	Node *node = FindChild(aType == NODE_THREAD ? &mRoot : mNode, aType, aKey, aName ? aName : (LPTSTR)_T(""));
+	if (!node)
+	{
+		mIsEnabled = false;
+		return;
+	}
+	Frame &frame = mFrame[mFrameCount++];
+	frame.mNode = mNode;
+	frame.mLineStat = mLineStat;
+	frame.mStartTick = now;
+	++node->mCalls;
+	mNode = node;
+	mLineStat = NULL; // Until the first line of the thread, sub or function executes.
+}
+
+
+
+void Profiler::EnterSub(Label *aSub)
+{
+	Enter(NODE_SUB, aSub, aSub->mName);
+}
+
+
+
+void Profiler::EnterFunc(Func *aFunc)
+{
+	Enter(NODE_FUNC, aFunc, aFunc->mName);
+}
+
+
+
+void Profiler::Leave()
+{
+	unsigned __int64 now = __rdtsc();
+	Charge(now);
+	if (!mFrameCount) // Profiling was started inside this thread, sub or function.
+	{
+		mNode = &mRoot;
+		mLineStat = NULL;
+		return;
+	}
+	Frame &frame = mFrame[--mFrameCount];
+	mNode->mInclusiveTicks += now - frame.mStartTick;
+	mNode = frame.mNode;
+	mLineStat = frame.mLineStat; // Resume timing the line which made the call.
+}
+
+
+
+bool Profiler::Start(LPTSTR aFileName)
+// aFileName is where to write the results when the script exits, or NULL to keep the current setting.
+{
+	if (aFileName && *aFileName)
+	{
+		LPTSTR file_name = _tcsdup(aFileName);
+		if (!file_name)
+			return false;
+		free(mFileName);
+		mFileName = file_name;
+	}
+	if (mIsEnabled)
+		return true;
+	if (!mBucket)
+	{
+		if (  !(mBucket = (LineStat **)calloc(PROFILER_BUCKET_COUNT, sizeof(LineStat *)))  )
+			return false;
+		QueryPerformanceCounter(&mStartTime);
+		mStartTick = __rdtsc();
+	}
+	// Any threads, subs or functions which are already running are treated as part of the root,
+	// since they won't be left through the profiler.
+	mFrameCount = 0;
+	mNode = &mRoot;
+	mLineStat = NULL;
+	mLastTick = __rdtsc();
+	mIsEnabled = true;
+	return true;
+}
+
+
+
+void Profiler::Stop()
+{
+	if (!mIsEnabled)
+		return;
+	mIsEnabled = false;
+	Charge(__rdtsc());
+	mLineStat = NULL;
+}
+
+
+
+void Profiler::Reset()
+// Zeroes the results rather than freeing them, since the script might be using them right now.
+{
+	for (Node *node = mFirstNode; node; node = node->mNextInList)
+		node->mCalls = node->mInclusiveTicks = node->mSelfTicks = 0;
+	mRoot.mSelfTicks = 0;
+	if (mBucket)
+		for (size_t i = 0; i < PROFILER_BUCKET_COUNT; ++i)
+			for (LineStat *stat = mBucket[i]; stat; stat = stat->mNextInBucket)
+				stat->mHits = stat->mTicks = 0;
+	// Frames which are still active will add their whole inclusive time when they are left.
+	for (int i = 0; i < mFrameCount; ++i)
+		mFrame[i].mStartTick = mLastTick;
+}
+
+
+
+void Profiler::Finish()
+// Writes the results to the file given to Start() and frees everything, since the script is exiting.
+{
+	if (!mBucket)
+		return;
+	Stop();
+	if (mFileName)
+		Write(mFileName);
+	while (Node *node = mFirstNode)
+	{
+		mFirstNode = node->mNextInList;
+		if (node->mType == NODE_THREAD)
+			free(node->mName);
+		free(node);
+	}
+	for (size_t i = 0; i < PROFILER_BUCKET_COUNT; ++i)
+		while (LineStat *stat = mBucket[i])
+		{
+			mBucket[i] = stat->mNextInBucket;
+			free(stat);
+		}
+	free(mBucket);
+	free(mFrame);
+	free(mFileName);
+	mBucket = NULL;
+	mFrame = NULL;
+	mFileName = NULL;
+	mFrameCount = mFrameCapacity = 0;
+	mLineStatCount = 0;
+	ZeroMemory(&mRoot, sizeof(mRoot));
+	mRoot.mType = NODE_ROOT;
+	mNode = &mRoot;
+}
+
+
+
+static LPTSTR AppendFrameName(LPTSTR aBuf, LPTSTR aBufEnd, LPCTSTR aName)
+// Appends aName to a collapsed stack, in which ';' separates frames and a line break ends the stack.
+{
+	for (LPCTSTR cp = aName; *cp && aBuf < aBufEnd; ++cp)
+		*aBuf++ = (*cp == ';') ? ',' : (*cp == '\n' || *cp == '\r') ? ' ' : *cp;
+	return aBuf;
+}
+
+LPTSTR Profiler::AppendPath(LPTSTR aBuf, LPTSTR aBufEnd, Node *aNode)
+// Appends the collapsed stack of aNode, outermost frame first.
+{
+	if (aNode->mType == NODE_ROOT)
+		return aBuf;
+	if (aNode->mParent->mType != NODE_ROOT)
+	{
+		aBuf = AppendPath(aBuf, aBufEnd, aNode->mParent);
+		if (aBuf < aBufEnd)
+			*aBuf++ = ';';
+	}
+	if (aNode->mType == NODE_FUNC)
+	{
+		aBuf = AppendFrameName(aBuf, aBufEnd, aNode->mName);
+		return AppendFrameName(aBuf, aBufEnd, _T("()"));
+	}
+	return AppendFrameName(aBuf, aBufEnd, aNode->mName);
+}
+
+
+
+struct ProfileTotal
+{
+	void *key; // Node or LineStat.
+	unsigned __int64 count, inclusive_ticks, exclusive_ticks;
+};
+
+static int ProfileTotalCompare(const void *a, const void *b)
+// Sorts by exclusive time, highest first.
+{
+	unsigned __int64 x = ((ProfileTotal *)a)->exclusive_ticks, y = ((ProfileTotal *)b)->exclusive_ticks;
+	return x > y ? -1 : x < y;
+}
+
+int Profiler::LineStatCompare(const void *a, const void *b)
+// Sorts by line so that each line's stats can be combined.  Lines are compared by their copied text
+// rather than by address since each run of an ahkExec() snippet loads new lines.
+{
+	LineStat *x = *(LineStat **)a, *y = *(LineStat **)b;
+	int result = _tcscmp(x->mFileName, y->mFileName);
+	return result ? result : _tcscmp(x->mText, y->mText);
+}
+
+
+
+ResultType Profiler::Write(LPTSTR aFileName)
+// Writes the collapsed stacks to aFileName and a summary of functions and lines to aFileName.txt.
+{
+	if (!aFileName || !*aFileName)
+		aFileName = mFileName;
+	if (!aFileName || !mBucket)
+		return FAIL;
+
+	// Convert TSC ticks to microseconds using the rate observed since profiling first started.
+	LARGE_INTEGER now, frequency;
+	QueryPerformanceCounter(&now);
+	QueryPerformanceFrequency(&frequency);
+	double elapsed_us = (double)(now.QuadPart - mStartTime.QuadPart) * 1000000.0 / (double)frequency.QuadPart;
+	double ticks_per_us = elapsed_us > 0 ? (double)(__rdtsc() - mStartTick) / elapsed_us : 1.0;
+	if (ticks_per_us <= 0)
+		ticks_per_us = 1.0;
+
+	size_t line_stat_count = mLineStatCount, node_count = 0, total_count, i, j, k;
+	Node *node;
+	LPTSTR path_end, cp;
+	for (node = mFirstNode; node; node = node->mNextInList)
+	{
+		node->mLineTicks = 0;
+		++node_count;
+	}
+	LineStat **line_stat = (LineStat **)malloc(line_stat_count * sizeof(LineStat *) + 1);
+	ProfileTotal *total = (ProfileTotal *)malloc((node_count + line_stat_count) * sizeof(ProfileTotal) + 1);
+	LPTSTR path = (LPTSTR)malloc(PROFILER_MAX_PATH * sizeof(TCHAR));
+	TextFile file, summary;
+	CString summary_name;
+	summary_name.Format(_T("%s.txt"), aFileName);
+	ResultType result = FAIL;
+	if (   !line_stat || !total || !path
+		|| !file.Open(aFileName, TextStream::WRITE, CP_UTF8) // No BOM, since flame graph tools don't expect one.
+		|| !summary.Open(summary_name, TextStream::WRITE | TextStream::EOL_CRLF | TextStream::BOM_UTF8, CP_UTF8)   )
+		goto end;
+
+	// Write a collapsed stack for each line within each call stack, then for time spent in each call
+	// stack but outside any line (such as on the way into or out of a function).
+	path_end = path + PROFILER_MAX_PATH - 32; // Leave room for the value and line break.
+	for (i = j = 0; i < PROFILER_BUCKET_COUNT && j < line_stat_count; ++i)
+		for (LineStat *stat = mBucket[i]; stat && j < line_stat_count; stat = stat->mNextInBucket)
+		{
+			line_stat[j++] = stat;
+			stat->mNode->mLineTicks += stat->mTicks;
+			unsigned __int64 us = (unsigned __int64)(stat->mTicks / ticks_per_us);
+			if (!us)
+				continue;
+			cp = AppendPath(path, path_end, stat->mNode);
+			if (cp > path && cp < path_end)
+				*cp++ = ';';
+			cp = AppendFrameName(cp, path_end, stat->mFileName);
+			cp += sntprintf(cp, (int)(path_end - cp) + 1, _T(":%u"), stat->mLineNumber);
+			sntprintf(cp, 32, _T(" %I64u\n"), us);
+			file.Write(path);
+		}
+	line_stat_count = j; // In case the script is still running and more were added.
+	for (node = mFirstNode; node; node = node->mNextInList)
+	{
+		unsigned __int64 us = (unsigned __int64)(node->mSelfTicks / ticks_per_us);
+		if (!us)
+			continue;
+		cp = AppendPath(path, path_end, node);
+		sntprintf(cp, 32, _T(" %I64u\n"), us);
+		file.Write(path);
+	}
+
+	// Summarize each thread, sub and function.  A recursive call's inclusive time is already part of
+	// the outer call's, so it isn't counted again.
+	summary.Format(_T("Time is in milliseconds.  Exclusive time excludes called functions and subroutines.\n\n")
+		_T("%-12s %12s %12s %12s  %s\n"), _T("Type"), _T("Calls"), _T("Inclusive"), _T("Exclusive"), _T("Name"));
+	total_count = 0;
+	for (node = mFirstNode; node; node = node->mNextInList)
+	{
+		for (k = 0; k < total_count; ++k)
+		{
+			Node *other = (Node *)total[k].key;
+			if (other->mType == node->mType && (node->mType == NODE_THREAD ? !_tcscmp(other->mName, node->mName) : other->mKey == node->mKey))
+				break;
+		}
+		if (k == total_count)
+		{
+			total[k].key = node;
+			total[k].count = total[k].inclusive_ticks = total[k].exclusive_ticks = 0;
+			++total_count;
+		}
+		total[k].count += node->mCalls;
+		total[k].exclusive_ticks += node->mSelfTicks + node->mLineTicks;
+		Node *outer;
+		for (outer = node->mParent; outer->mType != NODE_ROOT; outer = outer->mParent)
+			if (outer->mType == node->mType && outer->mKey == node->mKey && node->mType != NODE_THREAD)
+				break;
+		if (outer->mType == NODE_ROOT)
+			total[k].inclusive_ticks += node->mInclusiveTicks;
+	}
+	qsort(total, total_count, sizeof(ProfileTotal), ProfileTotalCompare);
+	for (k = 0; k < total_count; ++k)
+	{
+		node = (Node *)total[k].key;
+		summary.Format(_T("%-12s %12I64u %12.3f %12.3f  %s%s\n")
+			, node->mType == NODE_FUNC ? _T("Function") : node->mType == NODE_SUB ? _T("Subroutine") : _T("Thread")
+			, total[k].count, total[k].inclusive_ticks / ticks_per_us / 1000.0, total[k].exclusive_ticks / ticks_per_us / 1000.0
+			, node->mName, node->mType == NODE_FUNC ? _T("()") : _T(""));
+	}
+
+	// Summarize each line regardless of which call stack it was in.
+	qsort(line_stat, line_stat_count, sizeof(LineStat *), LineStatCompare);
+	for (i = total_count = 0; i < line_stat_count; ++i)
+	{
+		if (!i || LineStatCompare(&line_stat[i], &line_stat[i - 1]))
+		{
+			total[total_count].key = line_stat[i];
+			total[total_count].count = total[total_count].exclusive_ticks = 0;
+			++total_count;
+		}
+		total[total_count - 1].count += line_stat[i]->mHits;
+		total[total_count - 1].exclusive_ticks += line_stat[i]->mTicks;
+	}
+	qsort(total, total_count, sizeof(ProfileTotal), ProfileTotalCompare);
+	summary.Format(_T("\n%12s %12s  %s\n"), _T("Hits"), _T("Time"), _T("Line"));
+	for (k = 0; k < total_count; ++k)
+	{
+		LineStat *stat = (LineStat *)total[k].key;
+		cp = path + sntprintf(path, 64, _T("%12I64u %12.3f  "), total[k].count, total[k].exclusive_ticks / ticks_per_us / 1000.0);
+		cp = AppendFrameName(cp, path + 1024, stat->mFileName);
+		*cp++ = ' ';
+		sntprintf(cp, (int)(path_end - cp), _T("%s"), stat->mText); // Includes the line number and a line break.
+		summary.Write(path);
+	}
+	result = OK;
+
+end:
+	free(line_stat);
+	free(total);
+	free(path);
+	return result;
+}
@@ -0,0 +1,136 @@
+/*
+AutoHotkey
+
+Copyright 2003-2009 Chris Mallett (support@autohotkey.com)
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+
+#ifndef profiler_h
+#define profiler_h
+
+// The profiler counts how often each line runs and how much time (measured with the TSC) is spent on
+// it, separately for each call stack it runs in.  Call stacks are built from the threads, subroutines
+// and functions pushed onto the debugger's call stack (DbgStack), so they are only available when
+// CONFIG_DEBUGGER is defined.  While profiling is disabled, the only cost is the check of mIsEnabled
+// in Line::ExecUntil() and DbgStack's push/pop.
+//
+// Write() produces the "collapsed stack" format accepted by flame graph tools, with one line per stack
+// and the time in microseconds, plus a summary of functions and lines in the same file with ".txt" added.
+
+#include <intrin.h> // for __rdtsc()
+
+class Line;
+class Label;
+class Func;
+
+// Commands for ahkProfile.
+enum ProfileCommand {PROFILE_STOP, PROFILE_START, PROFILE_WRITE, PROFILE_RESET, PROFILE_IS_ENABLED};
+
+#define PROFILER_BUCKET_COUNT 16384 // Must be a power of 2.  The line table never grows; see Profiler::Write().
+
+class Profiler
+{
+	enum NodeType {NODE_ROOT, NODE_THREAD, NODE_SUB, NODE_FUNC};
+
+	struct Node // A unique call stack, i.e. a node of the call tree.
+	{
+		Node *mParent, *mFirstChild, *mNextSibling;
+		Node *mNextInList; // All nodes except mRoot, for Reset(), Write() and Finish().
+		void *mKey; // Func or Label.  For threads, mName is compared instead since the desc may be a temporary string.
+		LPTSTR mName;
+		NodeType mType;
+		unsigned __int64 mCalls, mInclusiveTicks, mSelfTicks; // mSelfTicks excludes time spent on lines (see LineStat).
+		unsigned __int64 mLineTicks; // Used only by Write().
+	};
+
+	struct LineStat // A line within a call stack.
+	{
+		LineStat *mNextInBucket;
+		Node *mNode;
+		Line *mLine; // Used only to find the stat; NULL once the line has been deleted (see ForgetLines()).
+		LPTSTR mFileName, mText; // Copied from the line, which might not outlive the stat.
+		UINT mLineNumber;
+		unsigned __int64 mHits, mTicks;
+	};
+
+	struct Frame
+	{
+		Node *mNode;
+		LineStat *mLineStat;
+		unsigned __int64 mStartTick;
+	};
+
+	Node mRoot;
+	Node *mFirstNode;
+	Node *mNode; // The current call stack.
+	LineStat *mLineStat; // The line currently being timed, or NULL.
+	unsigned __int64 mLastTick;
+	Frame *mFrame;
+	int mFrameCount, mFrameCapacity;
+	LineStat **mBucket;
+	LineStat mDiscard; // Used if a LineStat can't be allocated.
+	size_t mLineStatCount;
+	unsigned __int64 mStartTick;
+	LARGE_INTEGER mStartTime;
+	LPTSTR mFileName; // Where to write the results when the script exits.
+
+	void Charge(unsigned __int64 aNow)
+	{
+		if (mLineStat)
+			mLineStat->mTicks += aNow - mLastTick;
+		else
+			mNode->mSelfTicks += aNow - mLastTick;
+		mLastTick = aNow;
+	}
+	static size_t LineBucket(Line *aLine) { return ((size_t)aLine / sizeof(void *)) & (PROFILER_BUCKET_COUNT - 1); }
+	Node *FindChild(Node *aParent, NodeType aType, void *aKey, LPTSTR aName);
+	LineStat *FindLineStat(Node *aNode, Line *aLine);
+	void Enter(NodeType aType, void *aKey, LPTSTR aName);
+	static LPTSTR AppendPath(LPTSTR aBuf, LPTSTR aBufEnd, Node *aNode);
+	static int LineStatCompare(const void *a, const void *b);
+
+public:
+	bool mIsEnabled;
+
+	Profiler() : mIsEnabled(false), mFirstNode(NULL), mNode(&mRoot), mLineStat(NULL), mFrame(NULL), mFrameCount(0), mFrameCapacity(0)
+		, mBucket(NULL), mLineStatCount(0), mFileName(NULL)
+	{
+		ZeroMemory(&mRoot, sizeof(mRoot));
+		ZeroMemory(&mDiscard, sizeof(mDiscard));
+		mRoot.mType = NODE_ROOT;
+	}
+
+	// Called by Line::ExecUntil() immediately before each line executes.
+	void ExecLine(Line *aLine)
+	{
+		Charge(__rdtsc());
+		mLineStat = FindLineStat(mNode, aLine);
+		++mLineStat->mHits;
+	}
+
+	// Called by DbgStack::Push() and Pop().
+	void EnterThread(LPTSTR aDesc) { Enter(NODE_THREAD, NULL, aDesc); }
+	void EnterSub(Label *aSub);
+	void EnterFunc(Func *aFunc);
+	void Leave();
+
+	bool Start(LPTSTR aFileName);
+	void Stop();
+	void Reset();
+	ResultType Write(LPTSTR aFileName);
+	void ForgetLines(Line *aFirstLine, Line *aLastLine); // Called before deleting lines loaded by ahkExec().
+	void Finish(); // Called when the script exits.
+};
+
+extern Profiler g_Profiler;
+
+#endif
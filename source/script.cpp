@@ -279,12 +279,13 @@ Script::Script()
 	, mFirstLabel(NULL), mLastLabel(NULL)
 	, mFunc(NULL), mFuncCount(0), mFuncCountMax(0)
 	, mFirstTimer(NULL), mLastTimer(NULL), mTimerEnabledCount(0), mTimerCount(0)
+	, mTimerHeap(NULL), mTimerHeapSize(0), mTimerBucket(NULL), mTimerBucketCount(0), mTimerTickHigh(0), mTimerTickLow(0)
 #ifndef MINIDLL
 	, mFirstMenu(NULL), mLastMenu(NULL), mMenuCount(0), mThisMenuItem(NULL)
 #endif
 	, mVar(NULL), mVarCount(0), mVarCountMax(0), mLazyVar(NULL), mLazyVarCount(0)
 	, mCurrentFuncOpenBlockCount(0), mNextLineIsFunctionBody(false), mNoUpdateLabels(false)
-	, mClassObjectCount(0), mUnresolvedClasses(NULL), mClassProperty(NULL), mClassPropertyDef(NULL)
+	, mClassObjectCount(0), mClassDefinitionCount(0), mUnresolvedClasses(NULL), mClassProperty(NULL), mClassPropertyDef(NULL)
 	, mCurrFileIndex(0), mCombinedLineNumber(0), mNoHotkeyLabels(true)
 #ifndef MINIDLL
 	, mMenuUseErrorLevel(false)
@@ -293,7 +294,7 @@ Script::Script()
 	, mIsReadyToExecute(false), mAutoExecSectionIsRunning(false)
 	, mIsRestart(false), mErrorStdOut(false)
 #ifndef AUTOHOTKEYSC
-	, mIncludeLibraryFunctionsThenExit(NULL)
+	, mIncludeLibraryFunctionsThenExit(NULL), mIncludeCache(NULL)
 #endif
 	, mLinesExecutedThisCycle(0), mUninterruptedLineCountMax(1000), mUninterruptibleTime(15)
 #ifndef MINIDLL
@@ -520,6 +521,17 @@ Script::~Script() // Destructor.
 void Script::Destroy()
 // HotKeyIt H1 destroy script for ahkTerminate and ahkReload and ExitApp for dll
 {
+	PostedFuncsClear(); // Queued calls refer to the script's functions.
+#ifndef AUTOHOTKEYSC
+	ParseCacheClear(); // Cached lines refer to the script's vars, functions, etc.
+	g_Profiler.Finish(); // Must be done before the lines and source file names are freed.
+	delete mIncludeCache; // Only non-NULL if an include cache failed to load.
+	mIncludeCache = NULL;
+#endif
+	Struct::ClearLayoutCache();
+#ifdef ENABLE_DLLCALL
+	ClearDllSignatureCache();
+#endif
 	//reset count for OnMessage
 	if (g_MsgMonitor.Count())
 		g_MsgMonitor.RemoveAll();
@@ -628,6 +640,7 @@ void Script::Destroy()
 	free(mLazyVar);
 	mLazyVar = NULL;
 	mLazyVarCount = 0;
+	mVarHash.Clear();
 	// delete static func vars first
 	for (i = 0; i < mFuncCount; i++)
 	{
@@ -693,6 +706,7 @@ void Script::Destroy()
 		free(Line::sDerefBuf);
 		Line::sDerefBuf = NULL;
 	}
+	Line::sExprScratch.Free();
 	
 	Script::~Script(); // destroy main script before resetting variables
 
@@ -714,6 +728,15 @@ void Script::Destroy()
 	mFirstGroup = NULL;
 	mLastGroup = NULL;
 	mFirstTimer = NULL;
+	mLastTimer = NULL;
+	mTimerCount = 0;
+	mTimerEnabledCount = 0;
+	free(mTimerHeap);
+	mTimerHeap = NULL;
+	mTimerHeapSize = 0;
+	free(mTimerBucket);
+	mTimerBucket = NULL;
+	mTimerBucketCount = 0;
 	mOnExitLabel = NULL;
 	mOnClipboardChangeLabel = NULL;
 	
@@ -848,6 +871,9 @@ void Script::Destroy()
 	g_NoEnv  =  TRUE;                    // HotKeyIt H5 new default
 	// g_MaxVarCapacity is used to prevent a buggy script from consuming all available system RAM. It is defined = 
 	g_MaxVarCapacity  =  64 * 1024 * 1024;
+	g_RegExCacheSize  =  PCRE_CACHE_DEFAULT_SIZE;
+	g_RegExJIT  =  false;
+	g_LoopReadBufferSize  =  LOOP_READ_BUFFER_DEFAULT_SIZE;
 #ifndef MINIDLL
 	//g_ScreenDPI  =  GetScreenDPI();
 	//HDC hdc = GetDC(NULL);
@@ -896,7 +922,7 @@ void Script::Destroy()
 #endif // MINIDLL
 	RemoveVectoredExceptionHandler(g_ExceptionHandler); // Exception handler to remove hooks to avoid system/mouse freeze
 	// done on DLL_PROCESS_DETACH
-	// DeleteCriticalSection(&g_CriticalRegExCache); // g_CriticalRegExCache is used elsewhere for thread-safety.
+	// DeleteCriticalSection(&g_CriticalRegExCache[i]); // g_CriticalRegExCache is used elsewhere for thread-safety.
 	// DeleteCriticalSection(&g_CriticalAhkFunction); // used to call a function in multithreading environment.
 	
 	// PeekMessage is required to make sure that OleUninitialize does not hang
@@ -1769,6 +1795,7 @@ void Script::TerminateApp(ExitReasons aExitReason, int aExitCode)
 #ifdef CONFIG_DEBUGGER // L34: Exit debugger *after* the above to allow debugging of any invoked __Delete handlers.
 	g_Debugger.Exit(aExitReason);
 #endif
+	g_Profiler.Finish(); // Write the results, if profiling was started with a file name.
 
 	// We call DestroyWindow() because MainWindowProc() has left that up to us.
 	// DestroyWindow() will cause MainWindowProc() to immediately receive and process the
@@ -1958,6 +1985,27 @@ UINT Script::LoadFromFile()
 	if (   !(mPlaceholderLabel = new Label(_T("")))   ) // Not added to linked list since it's never looked up.
 		return LOADING_FAILED;
 
+#ifndef AUTOHOTKEYSC
+	// If the script file is an include cache (see /includecache), load the script by replaying it.
+	if (!mIncludeCache && !g_RunStdIn && !g_hResource)
+	{
+		IncludeCache *cache = new IncludeCache;
+		ResultType result = cache->Load(mFileSpec);
+		if (result == OK)
+			mIncludeCache = cache;
+		else
+		{
+			delete cache;
+			if (result == FAIL)
+			{
+				MsgBox(_T("This include cache is invalid or was created by a different version of AutoHotkey."), MB_ICONHAND, mFileSpec);
+				return LOADING_FAILED;
+			}
+			//else CONDITION_FALSE: it's an ordinary script file.
+		}
+	}
+#endif
+
 	// L4: Changed this next section to support lines added for #if (expression).
 	// Each #if (expression) is pre-parsed *before* the main script in order for
 	// function library auto-inclusions to be processed correctly.
@@ -2022,6 +2070,22 @@ UINT Script::LoadFromFile()
 		delete mIncludeLibraryFunctionsThenExit;
 		return 0; // Tell our caller to do a normal exit.
 	}
+	if (mIncludeCache) // Everything which could load a file has been done by this point.
+	{
+		IncludeCache *cache = mIncludeCache;
+		mIncludeCache = NULL; // Any libraries loaded at run-time (e.g. by addScript) are loaded normally.
+		ResultType result = cache->IsReading() ? (cache->IsCorrupt() ? FAIL : OK) : cache->Save();
+		bool is_reading = cache->IsReading();
+		delete cache;
+		if (!result)
+		{
+			MsgBox(is_reading ? _T("This include cache is corrupt.") : _T("Could not write the include cache.")
+				, MB_ICONHAND, mFileSpec);
+			return LOADING_FAILED;
+		}
+		if (!is_reading)
+			return 0; // Tell our caller to do a normal exit.
+	}
 #endif
 
 	// v1.0.35.11: Restore original working directory so that changes made to it by the above (via
@@ -2161,29 +2225,13 @@ ResultType Script::OpenIncludedFile(TextStream &ts, LPTSTR aFileSpec, bool aAllo
 
 #ifndef AUTOHOTKEYSC
 
+	if (mIncludeCache && mIncludeCache->IsReading())
+		return OpenIncludedFileFromCache();
+
 	if (!aFileSpec || !*aFileSpec) return FAIL;
 
-	if (Line::sSourceFileCount >= Line::sMaxSourceFiles)
-	{
-		if (Line::sSourceFileCount >= ABSOLUTE_MAX_SOURCE_FILES)
-			return ScriptError(_T("Too many includes.")); // Short msg since so rare.
-		int new_max;
-		if (Line::sMaxSourceFiles)
-		{
-			new_max = 2*Line::sMaxSourceFiles;
-			if (new_max > ABSOLUTE_MAX_SOURCE_FILES)
-				new_max = ABSOLUTE_MAX_SOURCE_FILES;
-		}
-		else
-			new_max = 100;
-		// For simplicity and due to rarity of every needing to, expand by reallocating the array.
-		// Use a temp var. because realloc() returns NULL on failure but leaves original block allocated.
-		LPTSTR *realloc_temp = (LPTSTR *)realloc(Line::sSourceFile, new_max * sizeof(LPTSTR)); // If passed NULL, realloc() will do a malloc().
-		if (!realloc_temp)
-			return ScriptError(ERR_OUTOFMEM); // Short msg since so rare.
-		Line::sSourceFile = realloc_temp;
-		Line::sMaxSourceFiles = new_max;
-	}
+	if (!ReserveSourceFile())
+		return FAIL;
 
 	// Use of stack memory here to build the full path is the most efficient method,
 	// but utilizes 64KB per buffer on Unicode builds.  There is virtually no cost
@@ -2237,7 +2285,11 @@ ResultType Script::OpenIncludedFile(TextStream &ts, LPTSTR aFileSpec, bool aAllo
 			if (!aAllowDuplicateInclude)
 				for (int f = 0; f < source_file_index; ++f) // Here, source_file_index==Line::sSourceFileCount
 					if (!lstrcmpi(Line::sSourceFile[f], full_path)) // Case insensitive like the file system (testing shows that "" == "" in the NTFS, which is hopefully how lstrcmpi works regardless of locale).
+					{
+						if (mIncludeCache)
+							mIncludeCache->PutOpen(OK, NULL);
 						return OK;
+					}
 			// The file is added to the list further below, after the file has been opened, in case the
 			// opening fails and aIgnoreLoadFailure==true.
 		}
@@ -2247,7 +2299,11 @@ ResultType Script::OpenIncludedFile(TextStream &ts, LPTSTR aFileSpec, bool aAllo
 			if (!ts.Open(aFileSpec, DEFAULT_READ_FLAGS, g_DefaultScriptCodepage))
 			{
 				if (aIgnoreLoadFailure)
+				{
+					if (mIncludeCache)
+						mIncludeCache->PutOpen(OK, NULL);
 					return OK;
+				}
 				TCHAR msg_text[T_MAX_PATH + 64]; // T_MAX_PATH vs. MAX_PATH because the full length could be utilized with ErrorStdOut.
 				sntprintf(msg_text, _countof(msg_text), _T("%s file \"%s\" cannot be opened.")
 					, Line::sSourceFileCount > 0 ? _T("#Include") : _T("Script"), full_path);
@@ -2358,11 +2414,273 @@ ResultType Script::OpenIncludedFile(TextStream &ts, LPTSTR aFileSpec, bool aAllo
 	
 	// Since above did not continue, proceed with loading the file.
 	++Line::sSourceFileCount;
+#ifndef AUTOHOTKEYSC
+	if (mIncludeCache)
+		mIncludeCache->PutOpen(CONDITION_TRUE, Line::sSourceFile[Line::sSourceFileCount - 1]);
+#endif
+	return CONDITION_TRUE;
+}
+
+
+
+#ifndef AUTOHOTKEYSC
+ResultType Script::ReserveSourceFile()
+// Ensures Line::sSourceFile has room for one more file.
+{
+	if (Line::sSourceFileCount >= Line::sMaxSourceFiles)
+	{
+		if (Line::sSourceFileCount >= ABSOLUTE_MAX_SOURCE_FILES)
+			return ScriptError(_T("Too many includes.")); // Short msg since so rare.
+		int new_max;
+		if (Line::sMaxSourceFiles)
+		{
+			new_max = 2*Line::sMaxSourceFiles;
+			if (new_max > ABSOLUTE_MAX_SOURCE_FILES)
+				new_max = ABSOLUTE_MAX_SOURCE_FILES;
+		}
+		else
+			new_max = 100;
+		// For simplicity and due to rarity of every needing to, expand by reallocating the array.
+		// Use a temp var. because realloc() returns NULL on failure but leaves original block allocated.
+		LPTSTR *realloc_temp = (LPTSTR *)realloc(Line::sSourceFile, new_max * sizeof(LPTSTR)); // If passed NULL, realloc() will do a malloc().
+		if (!realloc_temp)
+			return ScriptError(ERR_OUTOFMEM); // Short msg since so rare.
+		Line::sSourceFile = realloc_temp;
+		Line::sMaxSourceFiles = new_max;
+	}
+	return OK;
+}
+
+
+
+ResultType Script::OpenIncludedFileFromCache()
+// Counterpart of OpenIncludedFile() for replaying an include cache: registers the file which was opened
+// when the cache was created.  The lines of the file are then provided by GetLine().
+{
+	LPCTSTR source_file;
+	ResultType result = mIncludeCache->GetOpen(source_file);
+	if (result != CONDITION_TRUE)
+		return result == OK ? OK : ScriptError(_T("This include cache is corrupt."));
+	if (!ReserveSourceFile())
+		return FAIL;
+	int source_file_index = Line::sSourceFileCount;
+	if (!source_file_index)
+		Line::sSourceFile[source_file_index] = mFileSpec; // The main script file is the cache itself.
+	else if (  !(Line::sSourceFile[source_file_index] = SimpleHeap::Malloc((LPTSTR)source_file))  )
+		return ScriptError(ERR_OUTOFMEM);
+	++Line::sSourceFileCount;
 	return CONDITION_TRUE;
 }
 
 
 
+struct IncludeCacheHeader
+{
+	char signature[sizeof(INCLUDE_CACHE_SIGNATURE) - 1];
+	int format_version, char_size;
+	char ahk_version[16]; // Other versions might not load a script in the same order.
+};
+
+static void InitIncludeCacheHeader(IncludeCacheHeader &aHeader)
+{
+	ZeroMemory(&aHeader, sizeof(aHeader));
+	memcpy(aHeader.signature, INCLUDE_CACHE_SIGNATURE, sizeof(aHeader.signature));
+	aHeader.format_version = INCLUDE_CACHE_VERSION;
+	aHeader.char_size = sizeof(TCHAR);
+	strncpy(aHeader.ahk_version, AHK_VERSION, sizeof(aHeader.ahk_version) - 1);
+}
+
+ResultType IncludeCache::Load(LPCTSTR aFileSpec)
+// Returns OK if aFileSpec is an include cache, CONDITION_FALSE if it isn't (or can't be opened, in which
+// case the caller reports it as usual), or FAIL if it's a cache which this build can't replay.
+{
+	HANDLE hfile = CreateFile(aFileSpec, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hfile == INVALID_HANDLE_VALUE)
+		return CONDITION_FALSE;
+	IncludeCacheHeader header, expected_header;
+	InitIncludeCacheHeader(expected_header);
+	ResultType result = CONDITION_FALSE;
+	DWORD size = GetFileSize(hfile, NULL), bytes_read;
+	if (ReadFile(hfile, &header, sizeof(header), &bytes_read, NULL) && bytes_read == sizeof(header)
+		&& !memcmp(header.signature, expected_header.signature, sizeof(header.signature)))
+	{
+		result = FAIL;
+		if (!memcmp(&header, &expected_header, sizeof(header)) && size != INVALID_FILE_SIZE)
+		{
+			mLength = size - sizeof(header);
+			if (   (mData = (LPBYTE)malloc(mLength + 1)) // +1 in case mLength is zero.
+				&& ReadFile(hfile, mData, (DWORD)mLength, &bytes_read, NULL) && bytes_read == mLength
+				&& PeekRecord(INCLUDE_CACHE_OPEN)   ) // The cache always starts by opening the main script file.
+				result = OK;
+		}
+	}
+	CloseHandle(hfile);
+	return result;
+}
+
+ResultType IncludeCache::Save()
+{
+	if (mIsCorrupt) // Ran out of memory while recording.
+		return FAIL;
+	IncludeCacheHeader header;
+	InitIncludeCacheHeader(header);
+	HANDLE hfile = CreateFile(mFileToWrite, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hfile == INVALID_HANDLE_VALUE)
+		return FAIL;
+	DWORD bytes_written;
+	BOOL success = WriteFile(hfile, &header, sizeof(header), &bytes_written, NULL)
+		&& WriteFile(hfile, mData, (DWORD)mLength, &bytes_written, NULL) && bytes_written == mLength;
+	CloseHandle(hfile);
+	return success ? OK : FAIL;
+}
+
+void IncludeCache::Write(const void *aData, size_t aSize)
+{
+	if (mIsCorrupt)
+		return;
+	if (mLength + aSize > mCapacity)
+	{
+		size_t new_capacity = mCapacity ? mCapacity * 2 : 0x10000;
+		while (new_capacity < mLength + aSize)
+			new_capacity *= 2;
+		LPBYTE new_data = (LPBYTE)realloc(mData, new_capacity);
+		if (!new_data)
+		{
+			mIsCorrupt = true; // Save() will fail.
+			return;
+		}
+		mData = new_data;
+		mCapacity = new_capacity;
+	}
+	memcpy(mData + mLength, aData, aSize);
+	mLength += aSize;
+}
+
+const void *IncludeCache::Read(size_t aSize)
+{
+	if (mIsCorrupt || aSize > mLength - mPos)
+	{
+		mIsCorrupt = true;
+		return NULL;
+	}
+	const void *data = mData + mPos;
+	mPos += aSize;
+	return data;
+}
+
+bool IncludeCache::ReadInt(int &aValue)
+{
+	const void *data = Read(sizeof(int));
+	if (!data)
+		return false;
+	memcpy(&aValue, data, sizeof(int)); // Ints aren't necessarily aligned in ANSI builds.
+	return true;
+}
+
+void IncludeCache::WriteString(LPCTSTR aString)
+{
+	int length = (int)_tcslen(aString);
+	WriteInt(length);
+	Write(aString, (length + 1) * sizeof(TCHAR));
+}
+
+LPCTSTR IncludeCache::ReadString(size_t &aLength)
+// Returns a pointer into the cache, which stays valid until the cache is deleted.
+{
+	int length;
+	if (!ReadInt(length) || length < 0 || (size_t)length >= mLength)
+	{
+		mIsCorrupt = true;
+		return NULL;
+	}
+	LPCTSTR string = (LPCTSTR)Read((length + 1) * sizeof(TCHAR));
+	if (!string || string[length])
+	{
+		mIsCorrupt = true;
+		return NULL;
+	}
+	aLength = length;
+	return string;
+}
+
+bool IncludeCache::ReadRecord(IncludeCacheRecordType aType)
+{
+	int type;
+	if (!ReadInt(type))
+		return false;
+	if (type != aType)
+		mIsCorrupt = true;
+	return !mIsCorrupt;
+}
+
+bool IncludeCache::PeekRecord(IncludeCacheRecordType aType)
+{
+	int type;
+	if (mIsCorrupt || sizeof(int) > mLength - mPos)
+		return false;
+	memcpy(&type, mData + mPos, sizeof(int));
+	return type == aType;
+}
+
+bool IncludeCache::GetMarker(IncludeCacheRecordType aType, int *aValue)
+{
+	int value;
+	if (!ReadRecord(aType) || !ReadInt(value))
+		return false;
+	if (aValue)
+		*aValue = value;
+	return true;
+}
+
+void IncludeCache::PutLine(LPCTSTR aBuf, size_t aLength)
+{
+	WriteInt(INCLUDE_CACHE_LINE);
+	WriteInt((int)aLength); // GetLine() also returns -1 and -2 as special values.
+	WriteString(aBuf);
+}
+
+size_t IncludeCache::GetLine(LPTSTR aBuf, int aMaxCharsToRead)
+{
+	int result;
+	size_t length;
+	LPCTSTR line;
+	if (   !ReadRecord(INCLUDE_CACHE_LINE) || !ReadInt(result) || !(line = ReadString(length))
+		|| length > (size_t)aMaxCharsToRead   )
+	{
+		mIsCorrupt = true; // LoadFromFile() reports this after loading.
+		*aBuf = '\0';
+		return -1; // Treat it as end-of-file.
+	}
+	tmemcpy(aBuf, line, length + 1);
+	return (size_t)result;
+}
+
+void IncludeCache::PutOpen(ResultType aResult, LPCTSTR aSourceFile)
+// aResult is CONDITION_TRUE if the file was opened, or OK if it was skipped (a duplicate or *i).
+{
+	WriteInt(INCLUDE_CACHE_OPEN);
+	WriteInt(aResult);
+	if (aResult == CONDITION_TRUE)
+		WriteString(aSourceFile);
+}
+
+ResultType IncludeCache::GetOpen(LPCTSTR &aSourceFile)
+{
+	int result;
+	size_t length;
+	if (!ReadRecord(INCLUDE_CACHE_OPEN) || !ReadInt(result))
+		return FAIL;
+	if (result == CONDITION_TRUE)
+		return (aSourceFile = ReadString(length)) ? CONDITION_TRUE : FAIL;
+	if (result == OK)
+		return OK;
+	mIsCorrupt = true;
+	return FAIL;
+}
+#endif
+
+
+
 
 #ifndef AUTOHOTKEYSC
 ResultType Script::LoadIncludedText(LPTSTR aScript, LPCTSTR aPathToShow)
@@ -3999,6 +4317,25 @@ UTF8ToASCII(unsigned char* out, size_t outlen,const unsigned char* in, size_t in
 #endif
 
 size_t Script::GetLine(LPTSTR aBuf, int aMaxCharsToRead, int aInContinuationSection, TextStream *ts)
+// Returns the next line of the file being loaded, as prepared by ReadScriptLine().  If an include cache
+// is being recorded or replayed, the line is also written to it or is instead taken from it.
+{
+#ifndef AUTOHOTKEYSC
+	if (mIncludeCache)
+	{
+		if (mIncludeCache->IsReading())
+			return mIncludeCache->GetLine(aBuf, aMaxCharsToRead);
+		size_t aBuf_length = ReadScriptLine(aBuf, aMaxCharsToRead, aInContinuationSection, ts);
+		mIncludeCache->PutLine(aBuf, aBuf_length);
+		return aBuf_length;
+	}
+#endif
+	return ReadScriptLine(aBuf, aMaxCharsToRead, aInContinuationSection, ts);
+}
+
+
+
+size_t Script::ReadScriptLine(LPTSTR aBuf, int aMaxCharsToRead, int aInContinuationSection, TextStream *ts)
 {
 	size_t aBuf_length = 0;
 
@@ -4237,8 +4574,17 @@ inline ResultType Script::IsDirective(LPTSTR aBuf)
 		if (!DerefInclude(include_path, parameter))
 			return FAIL;
 
-		DWORD attr = GetFileAttributes(include_path);
-		if (attr != 0xFFFFFFFF && (attr & FILE_ATTRIBUTE_DIRECTORY)) // File exists and its a directory (possibly A_ScriptDir or A_AppData set above).
+		bool is_directory;
+		if (mIncludeCache && mIncludeCache->IsReading())
+			is_directory = mIncludeCache->GetDecision();
+		else
+		{
+			DWORD attr = GetFileAttributes(include_path);
+			is_directory = attr != 0xFFFFFFFF && (attr & FILE_ATTRIBUTE_DIRECTORY); // File exists and its a directory (possibly A_ScriptDir or A_AppData set above).
+			if (mIncludeCache)
+				mIncludeCache->PutDecision(is_directory);
+		}
+		if (is_directory)
 		{
 			// v1.0.35.11 allow changing of load-time directory to increase flexibility.  This feature has
 			// been asked for directly or indirectly several times.
@@ -4547,6 +4893,45 @@ inline ResultType Script::IsDirective(LPTSTR aBuf)
 		}
 		return CONDITION_TRUE;
 	}
+	if (IS_DIRECTIVE_MATCH(_T("#RegExCacheSize")))
+	{
+		// The total number of compiled RegEx's to keep.  Excess entries are evicted least-recently-used
+		// first the next time a new pattern is compiled, so lowering it at runtime (e.g. via addScript)
+		// takes effect gradually.
+		if (parameter)
+		{
+			g_RegExCacheSize = ATOI(parameter);
+			if (g_RegExCacheSize < PCRE_CACHE_SHARD_COUNT)
+				g_RegExCacheSize = PCRE_CACHE_SHARD_COUNT; // At least one entry per shard.
+			else if (g_RegExCacheSize > 65536)
+				g_RegExCacheSize = 65536;
+		}
+		return CONDITION_TRUE;
+	}
+	if (IS_DIRECTIVE_MATCH(_T("#RegExJIT")))
+	{
+		// Makes the T (JIT) option the default for all RegEx's compiled from now on.
+		ToggleValueType toggle = parameter ? Line::ConvertOnOff(parameter) : NEUTRAL;
+		if (toggle != TOGGLED_ON && toggle != TOGGLED_OFF)
+			return ScriptError(parameter ? ERR_PARAM1_INVALID : ERR_PARAM1_REQUIRED, aBuf);
+		g_RegExJIT = toggle == TOGGLED_ON;
+		return CONDITION_TRUE;
+	}
+	if (IS_DIRECTIVE_MATCH(_T("#LoopReadBuffer")))
+	{
+		// The size in KB of the read-ahead buffer used by file-reading loops.  Larger sizes mean fewer
+		// (but larger) reads, which helps when reading through very large files.
+		if (parameter)
+		{
+			int value = ATOI(parameter);
+			if (value < TEXT_IO_BLOCK / 1024)
+				value = TEXT_IO_BLOCK / 1024;
+			else if (value > 64 * 1024) // 64 MB, which is far more than could make any difference.
+				value = 64 * 1024;
+			g_LoopReadBufferSize = value * 1024;
+		}
+		return CONDITION_TRUE;
+	}
 #ifndef MINIDLL
 	if (IS_DIRECTIVE_MATCH(_T("#KeyHistory")))
 	{
@@ -4755,7 +5140,7 @@ inline ResultType Script::IsDirective(LPTSTR aBuf)
 void ScriptTimer::Disable()
 {
 	mEnabled = false;
-	--g_script.mTimerEnabledCount;
+	g_script.UnscheduleTimer(this); // This also decrements mTimerEnabledCount.
 #ifndef MINIDLL
 	if (!g_script.mTimerEnabledCount && !g_nLayersNeedingTimer && !Hotkey::sJoyHotkeyCount)
 #else
@@ -4786,20 +5171,23 @@ ResultType Script::UpdateOrCreateTimer(IObject *aLabel, LPTSTR aPeriod, LPTSTR a
 // for a non-existent timer, that timer will be created with the default period as specified in
 // the constructor.
 {
-	ScriptTimer *timer;
-	for (timer = mFirstTimer; timer != NULL; timer = timer->mNextTimer)
-		if (timer->mLabel == aLabel) // Match found.
-			break;
+	ScriptTimer *timer = FindTimer(aLabel);
 	bool timer_existed = (timer != NULL);
 	if (!timer_existed)  // Create it.
 	{
 		if (   !(timer = new ScriptTimer(aLabel))   )
 			return ScriptError(ERR_OUTOFMEM);
+		if (!HashTimer(timer))
+		{
+			delete timer;
+			return ScriptError(ERR_OUTOFMEM);
+		}
 		if (!mFirstTimer)
 			mFirstTimer = mLastTimer = timer;
 		else
 		{
 			mLastTimer->mNextTimer = timer;
+			timer->mPrevTimer = mLastTimer;
 			// This must be done after the above:
 			mLastTimer = timer;
 		}
@@ -4811,8 +5199,9 @@ ResultType Script::UpdateOrCreateTimer(IObject *aLabel, LPTSTR aPeriod, LPTSTR a
 		// The exception is if the timer already existed but the caller only wanted its priority changed:
 		if (!(timer_existed && aUpdatePriorityOnly))
 		{
+			if (!ScheduleTimer(timer)) // This also increments mTimerEnabledCount.
+				return ScriptError(ERR_OUTOFMEM);
 			timer->mEnabled = true;
-			++mTimerEnabledCount;
 			SET_MAIN_TIMER  // Ensure the API timer is always running when there is at least one enabled timed subroutine.
 		}
 		//else do nothing, leave it disabled.
@@ -4846,6 +5235,9 @@ ResultType Script::UpdateOrCreateTimer(IObject *aLabel, LPTSTR aPeriod, LPTSTR a
 		// Instead, we want it to occur only when the full 5 seconds have elapsed:
 		timer->mTimeLastRun = GetTickCount();
 
+	if (timer->mEnabled)
+		ScheduleTimer(timer); // Update its position in the heap to reflect any change above.
+
     // Below is obsolete, see above for why:
 	// We don't have to kill or set the main timer because the only way this function is called
 	// is directly from the execution of a script line inside ExecUntil(), in which case:
@@ -4859,38 +5251,213 @@ ResultType Script::UpdateOrCreateTimer(IObject *aLabel, LPTSTR aPeriod, LPTSTR a
 
 void Script::DeleteTimer(IObject *aLabel)
 {
-	ScriptTimer *timer, *previous = NULL;
-	for (timer = mFirstTimer; timer != NULL; previous = timer, timer = timer->mNextTimer)
+	ScriptTimer *timer = FindTimer(aLabel);
+	if (!timer)
+		return;
+	// Disable it, even if it's not technically being deleted yet.
+	if (timer->mEnabled)
+		timer->Disable(); // Keeps track of mTimerEnabledCount and whether the main timer is needed.
+	if (timer->mExistingThreads) // This condition differs from g->CurrentTimer == timer, which only detects the "top-most" timer.
+	{
+		// In this case we can't delete the timer yet, so mark it for later deletion.
+		UnhashTimer(timer);
+		timer->mLabel = NULL;
+		// Clearing mLabel:
+		//  1) Marks the timer to be deleted (by CheckScriptTimers) after its last thread finishes.
+		//  2) Ensures any subsequently created timer will get default settings.
+		//  3) Allows the object to be freed before the timer subroutine returns
+		//     if all other references to it are released.
+		return;
+	}
+	DestroyTimer(timer);
+}
+
+
+
+void Script::DestroyTimer(ScriptTimer *aTimer)
+// Removes a timer which has no running threads from the list and deletes it.
+{
+	if (aTimer->mEnabled)
+		aTimer->Disable();
+	if (aTimer->mLabel != NULL)
+		UnhashTimer(aTimer);
+	// Remove it from the list.
+	if (aTimer->mPrevTimer)
+		aTimer->mPrevTimer->mNextTimer = aTimer->mNextTimer;
+	else
+		mFirstTimer = aTimer->mNextTimer;
+	if (aTimer->mNextTimer)
+		aTimer->mNextTimer->mPrevTimer = aTimer->mPrevTimer;
+	else
+		mLastTimer = aTimer->mPrevTimer;
+	mTimerCount--;
+	// Delete the timer, automatically releasing its reference to the object.
+	delete aTimer;
+}
+
+
+
+#define TIMER_BUCKET(label) ((((UINT)(size_t)(label) >> 4) ^ ((UINT)(size_t)(label) >> 12)) & (mTimerBucketCount - 1))
+
+ScriptTimer *Script::FindTimer(IObject *aLabel)
+{
+	if (!mTimerBucketCount)
+		return NULL;
+	ScriptTimer *timer;
+	for (timer = mTimerBucket[TIMER_BUCKET(aLabel)]; timer; timer = timer->mNextInBucket)
 		if (timer->mLabel == aLabel) // Match found.
+			break;
+	return timer;
+}
+
+
+
+bool Script::HashTimer(ScriptTimer *aTimer)
+// Adds aTimer to the hash table, which is first expanded if there are more timers than buckets.
+// Returns false only if there were no buckets and none could be allocated.
+{
+	if (mTimerCount >= mTimerBucketCount)
+	{
+		UINT new_count = mTimerBucketCount ? mTimerBucketCount * 2 : 16;
+		ScriptTimer **new_bucket = (ScriptTimer **)calloc(new_count, sizeof(ScriptTimer *));
+		if (new_bucket)
 		{
-			// Disable it, even if it's not technically being deleted yet.
-			if (timer->mEnabled)
-				timer->Disable(); // Keeps track of mTimerEnabledCount and whether the main timer is needed.
-			if (timer->mExistingThreads) // This condition differs from g->CurrentTimer == timer, which only detects the "top-most" timer.
-			{
-				if (!aLabel) // Caller requested we delete a previously marked timer which
-					continue; // has now finished, but this one hasn't, so keep looking.
-				// In this case we can't delete the timer yet, so mark it for later deletion.
-				timer->mLabel = NULL;
-				// Clearing mLabel:
-				//  1) Marks the timer to be deleted after its last thread finishes.
-				//  2) Ensures any subsequently created timer will get default settings.
-				//  3) Allows the object to be freed before the timer subroutine returns
-				//     if all other references to it are released.
-				break;
-			}
-			// Remove it from the list.
-			if (previous)
-				previous->mNextTimer = timer->mNextTimer;
-			else
-				mFirstTimer = timer->mNextTimer;
-			if (mLastTimer == timer)
-				mLastTimer = previous;
-			mTimerCount--;
-			// Delete the timer, automatically releasing its reference to the object.
-			delete timer;
+			free(mTimerBucket);
+			mTimerBucket = new_bucket;
+			mTimerBucketCount = new_count;
+			for (ScriptTimer *timer = mFirstTimer; timer; timer = timer->mNextTimer)
+				if (timer->mLabel != NULL) // Otherwise, it's pending deletion and was already removed.
+				{
+					ScriptTimer *&bucket = mTimerBucket[TIMER_BUCKET(timer->mLabel.ToObject())];
+					timer->mNextInBucket = bucket;
+					bucket = timer;
+				}
+		}
+		else if (!mTimerBucketCount)
+			return false;
+		// Otherwise, continue using the old buckets.
+	}
+	ScriptTimer *&bucket = mTimerBucket[TIMER_BUCKET(aTimer->mLabel.ToObject())];
+	aTimer->mNextInBucket = bucket;
+	bucket = aTimer;
+	return true;
+}
+
+
+
+void Script::UnhashTimer(ScriptTimer *aTimer)
+{
+	for (ScriptTimer **link = &mTimerBucket[TIMER_BUCKET(aTimer->mLabel.ToObject())]; *link; link = &(*link)->mNextInBucket)
+		if (*link == aTimer)
+		{
+			*link = aTimer->mNextInBucket;
 			break;
 		}
+	aTimer->mNextInBucket = NULL;
+}
+
+
+
+unsigned __int64 Script::TimerTick()
+// Returns GetTickCount() extended to 64 bits, so that the timer heap's order isn't upset when the tick
+// count wraps around.  This relies on being called at least once every 49.7 days while timers are
+// enabled, which CheckScriptTimers() normally ensures.
+{
+	DWORD tick = GetTickCount();
+	if (tick < mTimerTickLow)
+		mTimerTickHigh += (unsigned __int64)1 << 32;
+	mTimerTickLow = tick;
+	return mTimerTickHigh | tick;
+}
+
+
+
+bool Script::ScheduleTimer(ScriptTimer *aTimer)
+// Adds aTimer to the heap if it isn't already there, or updates its position to reflect a change
+// in mTimeLastRun or mPeriod.  Returns false only if the heap could not be expanded.
+{
+	if (aTimer->mHeapIndex < 0)
+	{
+		if (mTimerEnabledCount == mTimerHeapSize)
+		{
+			UINT new_size = mTimerHeapSize ? mTimerHeapSize * 2 : 16;
+			ScriptTimer **new_heap = (ScriptTimer **)realloc(mTimerHeap, new_size * sizeof(ScriptTimer *));
+			if (!new_heap)
+				return false;
+			mTimerHeap = new_heap;
+			mTimerHeapSize = new_size;
+		}
+		aTimer->mHeapIndex = mTimerEnabledCount;
+		mTimerHeap[mTimerEnabledCount++] = aTimer;
+	}
+	// As in CheckScriptTimers(), a timer is due once mPeriod has elapsed since mTimeLastRun.
+	unsigned __int64 now = TimerTick();
+	DWORD elapsed = (DWORD)now - aTimer->mTimeLastRun;
+	aTimer->mTimeDue = now + (elapsed < aTimer->mPeriod ? aTimer->mPeriod - elapsed : 0);
+	SiftTimer(aTimer->mHeapIndex);
+	return true;
+}
+
+
+
+void Script::UnscheduleTimer(ScriptTimer *aTimer)
+{
+	int index = aTimer->mHeapIndex;
+	if (index < 0)
+		return;
+	aTimer->mHeapIndex = -1;
+	ScriptTimer *last = mTimerHeap[--mTimerEnabledCount];
+	if (last != aTimer)
+	{
+		mTimerHeap[index] = last;
+		last->mHeapIndex = index;
+		SiftTimer(index);
+	}
+}
+
+
+
+void Script::SiftTimer(int aIndex)
+// Moves mTimerHeap[aIndex] up or down as needed to restore the heap order.
+{
+	ScriptTimer *timer = mTimerHeap[aIndex];
+	int parent, child, count = (int)mTimerEnabledCount;
+	for ( ; aIndex > 0 && mTimerHeap[parent = (aIndex - 1) / 2]->mTimeDue > timer->mTimeDue; aIndex = parent)
+	{
+		mTimerHeap[aIndex] = mTimerHeap[parent];
+		mTimerHeap[aIndex]->mHeapIndex = aIndex;
+	}
+	for ( ; (child = aIndex * 2 + 1) < count; aIndex = child)
+	{
+		if (child + 1 < count && mTimerHeap[child + 1]->mTimeDue < mTimerHeap[child]->mTimeDue)
+			++child;
+		if (mTimerHeap[child]->mTimeDue >= timer->mTimeDue)
+			break;
+		mTimerHeap[aIndex] = mTimerHeap[child];
+		mTimerHeap[aIndex]->mHeapIndex = aIndex;
+	}
+	mTimerHeap[aIndex] = timer;
+	timer->mHeapIndex = aIndex;
+}
+
+
+
+ScriptTimer *Script::FindDueTimer(UINT aIndex, unsigned __int64 aNow, UINT aPass)
+// Returns a timer at or below mTimerHeap[aIndex] which is due and eligible to run, or NULL if none.
+// Since the timers which are due form a subtree at the top of the heap, only those and their
+// immediate children are visited.
+{
+	if (aIndex >= mTimerEnabledCount)
+		return NULL;
+	ScriptTimer *timer = mTimerHeap[aIndex];
+	if (timer->mTimeDue > aNow) // Neither this timer nor any below it are due.
+		return NULL;
+	if (!timer->mExistingThreads && timer->mPriority >= g->Priority // thread priorities
+		&& timer->mCheckPass != aPass) // Not already launched by this call to CheckScriptTimers().
+		return timer;
+	if (timer = FindDueTimer(aIndex * 2 + 1, aNow, aPass))
+		return timer;
+	return FindDueTimer(aIndex * 2 + 2, aNow, aPass);
 }
 
 
@@ -6517,7 +7084,7 @@ ResultType Script::AddLine(ActionTypeType aActionType, LPTSTR aArg[], int aArgc,
 		new_arg = NULL;  // Just need an empty array in this case.
 	else
 	{
-		if (   !(new_arg = (ArgStruct *)SimpleHeap::Malloc(aArgc * sizeof(ArgStruct)))   )
+		if (   !(new_arg = (ArgStruct *)SimpleHeap::MallocLine(aArgc * sizeof(ArgStruct)))   )
 			return ScriptError(ERR_OUTOFMEM);
 
 		int i, j;
@@ -6629,7 +7196,7 @@ ResultType Script::AddLine(ActionTypeType aActionType, LPTSTR aArg[], int aArgc,
 			// The length must fit into a WORD, which it will since each arg is literal text from a script's line,
 			// which is limited to LINE_SIZE. The length member was added in v1.0.44.14 to boost runtime performance.
 			this_new_arg.length = (WORD)_tcslen(this_aArg);
-			if (   !(this_new_arg.text = SimpleHeap::Malloc(this_aArg, this_new_arg.length))   )
+			if (   !(this_new_arg.text = SimpleHeap::MallocLine(this_aArg, this_new_arg.length))   )
 				return FAIL;  // It already displayed the error for us.
 
 			////////////////////////////////////////////////////
@@ -7036,7 +7603,7 @@ ResultType Script::AddLine(ActionTypeType aActionType, LPTSTR aArg[], int aArgc,
 			if (deref_count)
 			{
 				// +1 for the "NULL-item" terminator:
-				if (   !(this_new_arg.deref = (DerefType *)SimpleHeap::Malloc((deref_count + 1) * sizeof(DerefType)))   )
+				if (   !(this_new_arg.deref = (DerefType *)SimpleHeap::MallocLine((deref_count + 1) * sizeof(DerefType)))   )
 					return ScriptError(ERR_OUTOFMEM);
 				memcpy(this_new_arg.deref, deref, deref_count * sizeof(DerefType));
 				// Terminate the list of derefs with a deref that has a NULL marker:
@@ -7146,7 +7713,7 @@ ResultType Script::AddLine(ActionTypeType aActionType, LPTSTR aArg[], int aArgc,
 							// by such assignments when it wasn't before.
 						))   )
 			{
-				if (   !(new_arg[arg_index].postfix = (ExprTokenType *)SimpleHeap::Malloc(sizeof(__int64)))   )
+				if (   !(new_arg[arg_index].postfix = (ExprTokenType *)SimpleHeap::MallocLine(sizeof(__int64)))   )
 					return ScriptError(ERR_OUTOFMEM);
 				*(__int64 *)new_arg[arg_index].postfix = ATOI64(new_arg[arg_index].text);
 			}
@@ -8821,6 +9388,7 @@ ResultType Script::DefineClass(LPTSTR aBuf)
 	class_object->SetBase(base_class); // May be NULL.
 
 	++mClassObjectCount;
+	++mClassDefinitionCount;
 	return OK;
 }
 
@@ -9216,6 +9784,71 @@ void Script::InitFuncLibrary(FuncLibrary &aLib, LPTSTR aPathBase, LPTSTR aPathSu
 Func *Script::FindFuncInLibrary(LPTSTR aFuncName, size_t aFuncNameLength, bool &aErrorWasShown, bool &aFileWasFound, bool aIsAutoInclude)
 // Caller must ensure that aFuncName doesn't already exist as a defined function.
 // If aFuncNameLength is 0, the entire length of aFuncName is used.
+{
+	if (!mIncludeCache)
+		return SearchFuncLibraries(aFuncName, aFuncNameLength, aErrorWasShown, aFileWasFound, aIsAutoInclude);
+	if (mIncludeCache->IsReading())
+		return FindFuncInCache(aFuncName, aFuncNameLength, aErrorWasShown, aFileWasFound, aIsAutoInclude);
+	// Bracket the search so that the files it loads can be told apart from those loaded afterward.
+	mIncludeCache->PutMarker(INCLUDE_CACHE_LIB_BEGIN);
+	Func *func = SearchFuncLibraries(aFuncName, aFuncNameLength, aErrorWasShown, aFileWasFound, aIsAutoInclude);
+	mIncludeCache->PutMarker(INCLUDE_CACHE_LIB_END, aFileWasFound);
+	return func;
+}
+
+
+
+Func *Script::FindFuncInCache(LPTSTR aFuncName, size_t aFuncNameLength, bool &aErrorWasShown, bool &aFileWasFound, bool aIsAutoInclude)
+// Replays a library search recorded by FindFuncInLibrary(): loads whichever files the search loaded
+// when the include cache was created, without searching the library directories or resources.
+{
+	aErrorWasShown = false; // Set default for this output parameter.
+	aFileWasFound = false;
+
+	if (!aFuncNameLength) // Caller didn't specify, so use the entire string.
+		aFuncNameLength = _tcslen(aFuncName);
+
+	int file_was_found;
+	if (mIncludeCache->GetMarker(INCLUDE_CACHE_LIB_BEGIN))
+	{
+		while (mIncludeCache->PeekRecord(INCLUDE_CACHE_OPEN))
+		{
+			// See SearchFuncLibraries() for comments.
+			Func *current_func = g->CurrentFunc;
+			g->CurrentFunc = NULL;
+			ResultType result = LoadIncludedFile(mFileSpec, false, false); // The file spec is ignored since the file comes from the cache.
+			g->CurrentFunc = current_func;
+			if (!result)
+			{
+				aErrorWasShown = true;
+				return NULL;
+			}
+		}
+		Func *func;
+		if (mIncludeCache->PeekRecord(INCLUDE_CACHE_LIB_WINAPI))
+		{
+			mIncludeCache->GetMarker(INCLUDE_CACHE_LIB_WINAPI);
+			if (!sLib[0].path) // The WinAPI definitions are loaded along with the library paths.
+				InitFuncLibraries(sLib);
+			func = FindFuncInWinAPI(aFuncName, aFuncNameLength, aIsAutoInclude);
+		}
+		else
+			func = FindFunc(aFuncName, aFuncNameLength);
+		if (mIncludeCache->GetMarker(INCLUDE_CACHE_LIB_END, &file_was_found))
+		{
+			aFileWasFound = file_was_found != 0;
+			return func;
+		}
+	}
+	aErrorWasShown = true;
+	ScriptError(_T("This include cache is corrupt."));
+	return NULL;
+}
+
+
+
+Func *Script::SearchFuncLibraries(LPTSTR aFuncName, size_t aFuncNameLength, bool &aErrorWasShown, bool &aFileWasFound, bool aIsAutoInclude)
+// Searches the function libraries and LIB resources for aFuncName; see FindFuncInLibrary().
 {
 	aErrorWasShown = false; // Set default for this output parameter.
 	aFileWasFound = false;
@@ -9449,6 +10082,17 @@ Func *Script::FindFuncInLibrary(LPTSTR aFuncName, size_t aFuncNameLength, bool &
 	g->CurrentFunc = current_func; // Restore.
 	return FindFunc(aFuncName, aFuncNameLength);
 winapi:
+	return FindFuncInWinAPI(aFuncName, aFuncNameLength, aIsAutoInclude);
+}
+
+
+
+Func *Script::FindFuncInWinAPI(LPTSTR aFuncName, size_t aFuncNameLength, bool aIsAutoInclude)
+// Defines aFuncName via #DllImport if it is one of the built-in WinAPI definitions.
+{
+	if (mIncludeCache && !mIncludeCache->IsReading())
+		mIncludeCache->PutMarker(INCLUDE_CACHE_LIB_WINAPI);
+
 	TCHAR parameter[512] = { L'#', L'D', L'l', L'l', L'I', L'm', L'p', L'o', L'r', L't', L',' }; // Should be enough room for any dll function definition
 	memcpy(&parameter[11], aFuncName, aFuncNameLength*sizeof(TCHAR));
 	parameter[aFuncNameLength + 11] = L',';
@@ -9879,6 +10523,12 @@ Func *Script::FindFunc(LPCTSTR aFuncName, size_t aFuncNameLength, int *apInsertP
 		min_params = 2;
 		max_params = 6;
 	}
+	else if (!_tcsicmp(func_name, _T("RegExCacheInfo")))
+	{
+		bif = BIF_RegExCacheInfo;
+		min_params = 0;
+		max_params = 0;
+	}
 	else if (!_tcsicmp(func_name, _T("StrReplace")))
 	{
 		bif = BIF_StrReplace;
@@ -10777,222 +11427,57 @@ Var *Script::FindVar(LPTSTR aVarName, size_t aVarNameLength, int *apInsertPos, i
 	bool search_static = search_local && g.CurrentFunc && ((aScope & VAR_LOCAL_STATIC) || (g.CurrentFunc->mDefaultVarType == VAR_DECLARE_STATIC && (aScope & VAR_GLOBAL)));
 	// Above has ensured that g.CurrentFunc!=NULL whenever search_local==true.
 
-	// Init for binary search loop:
-	int left, right, mid, result;  // left/right must be ints to allow them to go negative and detect underflow.
-	Var **var;  // An array of pointers-to-var.
-	if (search_static)
-	{
-		// double ckeck local list
-		var = g.CurrentFunc->mVar;
-		right = g.CurrentFunc->mVarCount - 1;
-
-		// Binary search:
-		for (left = 0; left <= right;) // "right" was already initialized above.
-		{
-			mid = (left + right) / 2;
-			result = _tcsicmp(var_name, var[mid]->mName); // lstrcmpi() is not used: 1) avoids breaking existing scripts; 2) provides consistent behavior across multiple locales; 3) performance.
-			if (result > 0)
-				left = mid + 1;
-			else if (result < 0)
-				right = mid - 1;
-			else // Match found.
-				return var[mid];
-		}
-	
-		var = g.CurrentFunc->mLazyVar;
-		right = g.CurrentFunc->mLazyVarCount - 1;
-
-		if (var) // There is a lazy list to search (and even if the list is empty, left must be reset to 0 below).
-		{
-			// Binary search:
-			for (left = 0; left <= right;)  // "right" was already initialized above.
-			{
-				mid = (left + right) / 2;
-				result = _tcsicmp(var_name, var[mid]->mName); // lstrcmpi() is not used: 1) avoids breaking existing scripts; 2) provides consistent behavior across multiple locales; 3) performance.
-				if (result > 0)
-					left = mid + 1;
-				else if (result < 0)
-					right = mid - 1;
-				else // Match found.
-					return var[mid];
-			}
+	// Each list (together with its lazy list) is indexed by a VarHash, so the sorted arrays don't need
+	// to be binary searched unless an insertion point is required.  The hash is calculated only once.
+	UINT hash = VarHash::Hash(var_name);
+	Var *found;
+	Var **var, **lazy_var;  // The list which would receive a new variable, and its lazy list (if any).
+	int var_count, lazy_var_count;
+	if (search_local)
+	{
+		Func &func = *g.CurrentFunc;
+		// Both the local and static lists are searched, but the order depends on the type being sought:
+		VarHash &first = search_static ? func.mVarHash : func.mStaticVarHash;
+		VarHash &second = search_static ? func.mStaticVarHash : func.mVarHash;
+		if ((found = first.Find(var_name, hash)) || (found = second.Find(var_name, hash)))
+			return found;
+		if (search_static)
+		{
+			var = func.mStaticVar, var_count = func.mStaticVarCount;
+			lazy_var = func.mStaticLazyVar, lazy_var_count = func.mStaticLazyVarCount;
 		}
-
-
-
-
-		// Since above didn't return, no match was found in main lists, so search the static list if there
-		// is one.  If there's no lazy list, the value of "left" established above will be used as the
-		// insertion point further below:
-		var = g.CurrentFunc->mStaticVar;
-		right = g.CurrentFunc->mStaticVarCount - 1;
-		// Binary search:
-		for (left = 0; left <= right;) // "right" was already initialized above.
-		{
-			mid = (left + right) / 2;
-			result = _tcsicmp(var_name, var[mid]->mName); // lstrcmpi() is not used: 1) avoids breaking existing scripts; 2) provides consistent behavior across multiple locales; 3) performance.
-			if (result > 0)
-				left = mid + 1;
-			else if (result < 0)
-				right = mid - 1;
-			else // Match found.
-				return var[mid];
-		}
-	
-		// Since above didn't return, no match was found in the main static list, so search the static lazy list if there
-		// is one.  If there's no lazy list, the value of "left" established above will be used as the
-		// insertion point further below:
-		var = g.CurrentFunc->mStaticLazyVar;
-		right = g.CurrentFunc->mStaticLazyVarCount - 1;
-
-		if (var) // There is a lazy list to search (and even if the list is empty, left must be reset to 0 below).
+		else
 		{
-			// Binary search:
-			for (left = 0; left <= right;)  // "right" was already initialized above.
-			{
-				mid = (left + right) / 2;
-				result = _tcsicmp(var_name, var[mid]->mName); // lstrcmpi() is not used: 1) avoids breaking existing scripts; 2) provides consistent behavior across multiple locales; 3) performance.
-				if (result > 0)
-					left = mid + 1;
-				else if (result < 0)
-					right = mid - 1;
-				else // Match found.
-					return var[mid];
-			}
+			var = func.mVar, var_count = func.mVarCount;
+			lazy_var = func.mLazyVar, lazy_var_count = func.mLazyVarCount;
 		}
 	}
-	else if (search_local)
+	else
 	{
-		// double check static lists
-		var = g.CurrentFunc->mStaticVar;
-		right = g.CurrentFunc->mStaticVarCount - 1;
-		// Binary search:
-		for (left = 0; left <= right;) // "right" was already initialized above.
-		{
-			mid = (left + right) / 2;
-			result = _tcsicmp(var_name, var[mid]->mName); // lstrcmpi() is not used: 1) avoids breaking existing scripts; 2) provides consistent behavior across multiple locales; 3) performance.
-			if (result > 0)
-				left = mid + 1;
-			else if (result < 0)
-				right = mid - 1;
-			else // Match found.
-				return var[mid];
-		}
-	
-		// Since above didn't return, no match was found in the main static list, so search the static lazy list if there
-		// is one.  If there's no lazy list, the value of "left" established above will be used as the
-		// insertion point further below:
-		var = g.CurrentFunc->mStaticLazyVar;
-		right = g.CurrentFunc->mStaticLazyVarCount - 1;
-
-		if (var) // There is a lazy list to search (and even if the list is empty, left must be reset to 0 below).
-		{
-			// Binary search:
-			for (left = 0; left <= right;)  // "right" was already initialized above.
-			{
-				mid = (left + right) / 2;
-				result = _tcsicmp(var_name, var[mid]->mName); // lstrcmpi() is not used: 1) avoids breaking existing scripts; 2) provides consistent behavior across multiple locales; 3) performance.
-				if (result > 0)
-					left = mid + 1;
-				else if (result < 0)
-					right = mid - 1;
-				else // Match found.
-					return var[mid];
-			}
-		}
-
-
-
-
-		// Since above didn't return, no match was found in static lists, so search the main lists if there
-		// is one.  If there's no lazy list, the value of "left" established above will be used as the
-		// insertion point further below:
-		var = g.CurrentFunc->mVar;
-		right = g.CurrentFunc->mVarCount - 1;
-
-		// Binary search:
-		for (left = 0; left <= right;) // "right" was already initialized above.
-		{
-			mid = (left + right) / 2;
-			result = _tcsicmp(var_name, var[mid]->mName); // lstrcmpi() is not used: 1) avoids breaking existing scripts; 2) provides consistent behavior across multiple locales; 3) performance.
-			if (result > 0)
-				left = mid + 1;
-			else if (result < 0)
-				right = mid - 1;
-			else // Match found.
-				return var[mid];
-		}
-	
-		// Since above didn't return, no match was found in the static list either, so search the lazy list if there
-		// is one.  If there's no lazy list, the value of "left" established above will be used as the
-		// insertion point further below:
-		var = g.CurrentFunc->mLazyVar;
-		right = g.CurrentFunc->mLazyVarCount - 1;
+		if (found = mVarHash.Find(var_name, hash))
+			return found;
+		var = mVar, var_count = mVarCount;
+		lazy_var = mLazyVar, lazy_var_count = mLazyVarCount;
+	}
 
-		if (var) // There is a lazy list to search (and even if the list is empty, left must be reset to 0 below).
-		{
-			// Binary search:
-			for (left = 0; left <= right;)  // "right" was already initialized above.
-			{
-				mid = (left + right) / 2;
-				result = _tcsicmp(var_name, var[mid]->mName); // lstrcmpi() is not used: 1) avoids breaking existing scripts; 2) provides consistent behavior across multiple locales; 3) performance.
-				if (result > 0)
-					left = mid + 1;
-				else if (result < 0)
-					right = mid - 1;
-				else // Match found.
-					return var[mid];
-			}
-		}
-	} 
-	else // !search_static && !search_local
+	// Since above didn't return, no match was found.  If the caller will be inserting a new variable,
+	// give it the position which keeps the list sorted.  The item is always inserted into the lazy list
+	// unless there is no lazy list.
+	if (apInsertPos) // Caller wants this value even if we'll be resorting to searching the global list below.
 	{
-		var = mVar;
-		right = mVarCount - 1;
-	
-	
-		// Binary search:
-		for (left = 0; left <= right;) // "right" was already initialized above.
+		if (lazy_var) // There is a lazy list (and even if the list is empty, the insertion point is for it).
+			var = lazy_var, var_count = lazy_var_count;
+		int left, right, mid;  // left/right must be ints to allow them to go negative and detect underflow.
+		for (left = 0, right = var_count - 1; left <= right;)
 		{
 			mid = (left + right) / 2;
-			result = _tcsicmp(var_name, var[mid]->mName); // lstrcmpi() is not used: 1) avoids breaking existing scripts; 2) provides consistent behavior across multiple locales; 3) performance.
-			if (result > 0)
+			if (_tcsicmp(var_name, var[mid]->mName) > 0) // lstrcmpi() is not used: 1) avoids breaking existing scripts; 2) provides consistent behavior across multiple locales; 3) performance.
 				left = mid + 1;
-			else if (result < 0)
+			else // It can't be a match because the hash lookup above would have found it.
 				right = mid - 1;
-			else // Match found.
-				return var[mid];
-		}
-
-		if (!search_local)
-		{
-			var = mLazyVar;
-			right = mLazyVarCount - 1;
-		}
-
-		if (var) // There is a lazy list to search (and even if the list is empty, left must be reset to 0 below).
-		{
-			// Binary search:
-			for (left = 0; left <= right;)  // "right" was already initialized above.
-			{
-				mid = (left + right) / 2;
-				result = _tcsicmp(var_name, var[mid]->mName); // lstrcmpi() is not used: 1) avoids breaking existing scripts; 2) provides consistent behavior across multiple locales; 3) performance.
-				if (result > 0)
-					left = mid + 1;
-				else if (result < 0)
-					right = mid - 1;
-				else // Match found.
-					return var[mid];
-			}
 		}
-	}
-
-	// Since above didn't return, no match was found and "left" always contains the position where aVarName
-	// should be inserted to keep the list sorted.  The item is always inserted into the lazy list unless
-	// there is no lazy list.
-	// Set the output parameter, if present:
-	if (apInsertPos) // Caller wants this value even if we'll be resorting to searching the global list below.
 		*apInsertPos = left; // This is the index a newly inserted item should have to keep alphabetical order.
+	}
 	
 	if (apIsLocal) // Its purpose is to inform caller of type it would have been in case we don't find a match.
 		*apIsLocal = search_local;
@@ -11096,6 +11581,14 @@ Var *Script::AddVar(LPTSTR aVarName, size_t aVarNameLength, int aInsertPos, int
 		return NULL;
 	}
 
+	// Index the new variable so that FindVar() can find it without searching the lists below:
+	VarHash &var_hash = aIsStatic ? g->CurrentFunc->mStaticVarHash : (aIsLocal ? g->CurrentFunc->mVarHash : mVarHash);
+	if (!var_hash.Insert(the_new_var))
+	{
+		ScriptError(ERR_OUTOFMEM);
+		return NULL;
+	}
+
 	// If there's a lazy var list, aInsertPos provided by the caller is for it, so this new variable
 	// always gets inserted into that list because there's always room for one more (because the
 	// previously added variable would have purged it if it had reached capacity).
@@ -11189,10 +11682,9 @@ Var *Script::AddVar(LPTSTR aVarName, size_t aVarNameLength, int aInsertPos, int
 	// increased its capacity by an amount far larger than the number of items contained
 	// in the lazy list).
 
-	// LAZY LIST: Although it's not nearly as good as hashing (which might be implemented in the future,
-	// though it would be no small undertaking since it affects so many design aspects, both load-time
-	// and runtime for scripts), this method of accelerating insertions into a binary search array is
-	// enormously beneficial because it improves the scalability of binary-search by two orders
+	// LAZY LIST: Lookups are done via VarHash, but the sorted lists are still needed for ListVars and
+	// the debugger, and to provide insertion points.  This method of accelerating insertions into a
+	// binary search array is enormously beneficial because it improves the scalability of binary-search by two orders
 	// of magnitude (from about 100,000 variables to at least 5M).  Credit for the idea goes to Lazlo.
 	// DETAILS:
 	// The fact that this merge operation is so much faster than total work required
@@ -12297,7 +12789,7 @@ ResultType Line::ExpressionToPostfix(ArgStruct &aArg)
 					}
 					else
 					{
-						if (  !(deref_new = (DerefType *)SimpleHeap::Malloc(sizeof(DerefType)))  )
+						if (  !(deref_new = (DerefType *)SimpleHeap::MallocLine(sizeof(DerefType)))  )
 							return LineError(ERR_OUTOFMEM);
 						if (  !(infix_count && YIELDS_AN_OPERAND(infix[infix_count - 1].symbol))  )
 						{	// Array constructor; e.g. x := [1,2,3]
@@ -12327,7 +12819,7 @@ ResultType Line::ExpressionToPostfix(ArgStruct &aArg)
 				case '{':
 					if (infix_count && YIELDS_AN_OPERAND(infix[infix_count - 1].symbol))
 						return LineError(_T("Unexpected \"{\""));
-					if (  !(deref_new = (DerefType *)SimpleHeap::Malloc(sizeof(DerefType)))  )
+					if (  !(deref_new = (DerefType *)SimpleHeap::MallocLine(sizeof(DerefType)))  )
 						return LineError(ERR_OUTOFMEM);
 					deref_new->func = g_script.FindFunc(_T("Object"));
 					deref_new->is_function = true;
@@ -12445,7 +12937,7 @@ ResultType Line::ExpressionToPostfix(ArgStruct &aArg)
 					if (cp1 == '=')
 					{
 						++cp;
-						if (   !(this_infix_item.deref = (DerefType *)SimpleHeap::Malloc(sizeof(DerefType)))   )
+						if (   !(this_infix_item.deref = (DerefType *)SimpleHeap::MallocLine(sizeof(DerefType)))   )
 							return LineError(ERR_OUTOFMEM);
 						this_infix_item.deref->func = g_script.FindFunc(_T("RegExMatch"));
 						this_infix_item.deref->is_function = true;
@@ -12507,7 +12999,7 @@ ResultType Line::ExpressionToPostfix(ArgStruct &aArg)
 
 					// MUST NOT REFER TO this_infix_item IN CASE HIGHER ABOVE DID ++infix_count:
 					infix[infix_count].symbol = SYM_STRING; // Marked explicitly as string vs. SYM_OPERAND to prevent it from being seen as a number, e.g. if (var == "12.0") would be false if var contains "12" with no trailing ".0".
-					if (   !(infix[infix_count].marker = SimpleHeap::Malloc(cp, op_end - cp - 1))   ) // -1 to omit the ending quote.  cp was already adjusted to omit the starting quote.
+					if (   !(infix[infix_count].marker = SimpleHeap::MallocLine(cp, op_end - cp - 1))   ) // -1 to omit the ending quote.  cp was already adjusted to omit the starting quote.
 						return LineError(ERR_OUTOFMEM);
 					StrReplace(infix[infix_count].marker, _T("\"\""), _T("\""), SCS_SENSITIVE); // Resolve each "" into a single ".  Consequently, a little bit of memory in "marker" might be wasted, but it doesn't seem worth the code size to compensate for this.
 					cp = omit_leading_whitespace(op_end); // Have the loop process whatever lies at op_end and beyond.
@@ -12590,13 +13082,13 @@ ResultType Line::ExpressionToPostfix(ArgStruct &aArg)
 
 							// Output a SYM_OPERAND for the text following '.'
 							infix[infix_count].symbol = SYM_OPERAND;
-							if (   !(infix[infix_count].marker = SimpleHeap::Malloc(cp, op_end - cp))   )
+							if (   !(infix[infix_count].marker = SimpleHeap::MallocLine(cp, op_end - cp))   )
 								return LineError(ERR_OUTOFMEM);
 							++infix_count;
 
 							SymbolType new_symbol; // Type of token: SYM_FUNC or SYM_DOT (which must be treated differently as it doesn't have parentheses).
 							DerefType *new_deref; // Holds a reference to the appropriate function, and parameter count.
-							if (   !(new_deref = (DerefType *)SimpleHeap::Malloc(sizeof(DerefType)))   )
+							if (   !(new_deref = (DerefType *)SimpleHeap::MallocLine(sizeof(DerefType)))   )
 								return LineError(ERR_OUTOFMEM);
 							new_deref->marker = cp - 1; // Not typically needed, set for error-reporting.
 							new_deref->param_count = 2; // Initially two parameters: the object and identifier.
@@ -12671,7 +13163,7 @@ ResultType Line::ExpressionToPostfix(ArgStruct &aArg)
 							// A previous stage ensured this "new" is followed by something which looks like
 							// a function call.  Push this pseudo-operator onto the stack.  When the open-
 							// parenthesis is encountered, symbol will be changed to SYM_FUNC.
-							if (  !(deref_new = (DerefType *)SimpleHeap::Malloc(sizeof(DerefType)))  )
+							if (  !(deref_new = (DerefType *)SimpleHeap::MallocLine(sizeof(DerefType)))  )
 								return LineError(ERR_OUTOFMEM);
 							deref_new->marker = cp; // For error-reporting.
 							deref_new->param_count = 1; // Start counting at the class object, which precedes the open-parenthesis.
@@ -12712,7 +13204,7 @@ numeric_literal:
 					}
 					// MUST NOT REFER TO this_infix_item IN CASE ABOVE DID ++infix_count:
 					infix[infix_count].symbol = SYM_OPERAND;
-					if (   !(infix[infix_count].marker = SimpleHeap::Malloc(cp, op_end - cp))   )
+					if (   !(infix[infix_count].marker = SimpleHeap::MallocLine(cp, op_end - cp))   )
 						return LineError(ERR_OUTOFMEM);
 					cp = op_end; // Have the loop process whatever lies at op_end and beyond.
 					continue; // "Continue" to avoid the ++cp at the bottom.
@@ -12818,7 +13310,7 @@ double_deref: // Caller has set cp to be start and op_end to be the character af
 		}
 
 		infix[infix_count].symbol = SYM_DYNAMIC;
-		if (   !(infix[infix_count].buf = SimpleHeap::Malloc(cp, op_end - cp))   ) // Example string: "Array%i%"
+		if (   !(infix[infix_count].buf = SimpleHeap::MallocLine(cp, op_end - cp))   ) // Example string: "Array%i%"
 			return LineError(ERR_OUTOFMEM);
 
 		// Set "deref" properly for the loop to resume processing at the item after this double deref.
@@ -12833,7 +13325,7 @@ double_deref: // Caller has set cp to be start and op_end to be the character af
 		// can't be safely overloaded at this stage), so allocate a little bit of stack memory, just enough for the
 		// number of derefs (variables) whose contents comprise the name of this double-deref variable (typically
 		// there's only one; e.g. the "i" in Array%i%).
-		if (   !(deref_new = (DerefType *)SimpleHeap::Malloc((derefs_in_this_double + 1) * sizeof(DerefType)))   ) // Provides one extra at the end as a terminator.
+		if (   !(deref_new = (DerefType *)SimpleHeap::MallocLine((derefs_in_this_double + 1) * sizeof(DerefType)))   ) // Provides one extra at the end as a terminator.
 			return LineError(ERR_OUTOFMEM);
 		memcpy(deref_new, deref_start, derefs_in_this_double * sizeof(DerefType));
 		deref_new[derefs_in_this_double].marker = NULL; // Put a NULL in the last item, which terminates the array.
@@ -13372,7 +13864,7 @@ standard_pop_into_postfix: // Use of a goto slightly reduces code size.
 						ExprTokenType *&that_postfix = postfix[postfix_count]; // In case above did postfix_count++.
 						that_postfix = (ExprTokenType *)_alloca(sizeof(ExprTokenType));
 						that_postfix->symbol = SYM_FUNC;
-						if (  !(that_postfix->deref = (DerefType *)SimpleHeap::Malloc(sizeof(DerefType)))  ) // Must be persistent memory, unlike that_postfix itself.
+						if (  !(that_postfix->deref = (DerefType *)SimpleHeap::MallocLine(sizeof(DerefType)))  ) // Must be persistent memory, unlike that_postfix itself.
 							return LineError(ERR_OUTOFMEM);
 						that_postfix->deref->func = &g_ObjGetInPlace;
 						that_postfix->deref->is_function = true;
@@ -13472,7 +13964,7 @@ end_of_infix_to_postfix:
 	// any 8-byte members like __int64 or double in the compressed struct because that would change the default
 	// alignment to 64-bit vs. 32-bit, which would keep the struct size at 16 bytes rather than allowing it to
 	// fall to 12 bytes.
-	if (   !(aArg.postfix = (ExprTokenType *)SimpleHeap::Malloc((postfix_count+1)*sizeof(ExprTokenType)))   ) // +1 for the terminator item added below.
+	if (   !(aArg.postfix = (ExprTokenType *)SimpleHeap::MallocLine((postfix_count+1)*sizeof(ExprTokenType)))   ) // +1 for the terminator item added below.
 		return LineError(ERR_OUTOFMEM);
 
 	int i, j;
@@ -13486,7 +13978,7 @@ end_of_infix_to_postfix:
 				new_token.buf = NULL; // Indicate that this SYM_OPERAND token LACKS a pre-converted binary integer.
 			else // Pre-convert to binary integer, which can increase performance of complex expressions by up to 20%.
 			{
-				if (   !(new_token.buf = (LPTSTR) SimpleHeap::Malloc(sizeof(__int64)))   )
+				if (   !(new_token.buf = (LPTSTR) SimpleHeap::MallocLine(sizeof(__int64)))   )
 					return LineError(ERR_OUTOFMEM);
 				*(__int64 *)new_token.buf = ATOI64(new_token.marker);
 			}
@@ -13520,6 +14012,7 @@ int Line::sLogNext = 0;  // Start at the first element.
 LPTSTR Line::sDerefBuf = NULL;  // Buffer to hold the values of any args that need to be dereferenced.
 size_t Line::sDerefBufSize = 0;
 int Line::sLargeDerefBufs = 0; // Keeps track of how many large bufs exist on the call-stack, for the purpose of determining when to stop the buffer-freeing timer.
+ExprScratch Line::sExprScratch;
 LPTSTR Line::sArgDeref[MAX_ARGS]; // No init needed.
 Var *Line::sArgVar[MAX_ARGS]; // Same.
 
@@ -13674,6 +14167,9 @@ ResultType Line::ExecUntil(ExecUntilMode aMode, ExprTokenType *aResultToken, Lin
 		if (g.ListLinesIsEnabled)
 			LOG_LINE(line)
 
+		if (g_Profiler.mIsEnabled)
+			g_Profiler.ExecLine(line);
+
 #ifdef CONFIG_DEBUGGER
 		if (g_Debugger.IsConnected() && line->mActionType != ACT_WHILE) // L31: PreExecLine of ACT_WHILE is now handled in PerformLoopWhile() where inspecting A_Index will yield the correct result.
 			g_Debugger.PreExecLine(line);
@@ -14214,6 +14710,7 @@ ResultType Line::ExecUntil(ExecUntilMode aMode, ExprTokenType *aResultToken, Lin
 			case (size_t)ATTR_LOOP_READ_FILE:
 				{
 					TextFile tfile;
+					tfile.SetBufferSize(g_LoopReadBufferSize);
 					if (*ARG2 && tfile.Open(ARG2, DEFAULT_READ_FLAGS, g.Encoding & CP_AHKCP)) // v1.0.47: Added check for "" to avoid debug-assertion failure while in debug mode (maybe it's bad to to open file "" in release mode too).
 					{
 						result = line->PerformLoopReadFile(aResultToken, continue_main_loop, jump_to_line, until
@@ -15956,88 +16453,128 @@ ResultType Line::PerformLoopReg(ExprTokenType *aResultToken, bool &aContinueMain
 
 
 
+// Parsing loops read their input in place (see PerformLoopParse()) and copy only the current field
+// into a buffer that starts on the stack and grows as needed for longer fields:
+#define LOOP_PARSE_BUF_SIZE 40000     // Inputs up to this size which can't be borrowed are copied onto the stack.
+#define LOOP_PARSE_FIELD_BUF_SIZE 512 // In chars.
+
+static bool ReserveLoopField(LPTSTR &aBuf, size_t &aBufSize, LPTSTR aStackBuf, size_t aLength)
+// Ensures aBuf has room for aLength chars plus a terminator.  Its contents aren't preserved.
+// Returns false if out of memory.
+{
+	if (aLength < aBufSize)
+		return true;
+	size_t new_size = aBufSize * 2 > aLength ? aBufSize * 2 : aLength + 1;
+	LPTSTR new_buf = tmalloc(new_size);
+	if (!new_buf)
+		return false;
+	if (aBuf != aStackBuf)
+		free(aBuf);
+	aBuf = new_buf;
+	aBufSize = new_size;
+	return true;
+}
+
+// Also used by the CSV version of PerformLoopParse():
+#define PREPARE_PARSE_INPUT \
+	size_t input_length = _tcslen(ARG2); /* Not ArgLength() because parsing has always stopped at the first binary zero. */ \
+	VarBorrow input; \
+	Var *input_var = ARGVAR2; \
+	bool input_is_borrowed = input_var && input_var->Borrow(input, ARG2); \
+	LPTSTR stack_buf = NULL, buf = NULL; \
+	if (input_is_borrowed) \
+		input.mLength = input_length; /* Only this much needs to be copied if the variable changes. */ \
+	else \
+	{ \
+		if (input_length < LOOP_PARSE_BUF_SIZE) \
+			buf = stack_buf = (LPTSTR)talloca(input_length + 1); \
+		else if (   !(buf = tmalloc(input_length + 1))   ) \
+			return LineError(ERR_OUTOFMEM, FAIL, ARG2); \
+		tmemcpy(buf, ARG2, input_length + 1); \
+		input.mContents = buf; \
+		input.mLength = input_length; \
+	} \
+	TCHAR field_stack_buf[LOOP_PARSE_FIELD_BUF_SIZE]; \
+	LPTSTR field_buf = field_stack_buf; \
+	size_t field_buf_size = _countof(field_stack_buf);
+#define FREE_PARSE_MEMORY \
+	{ \
+		if (input_is_borrowed) \
+			Var::EndBorrow(input); \
+		else if (buf != stack_buf) \
+			free(buf); \
+		if (field_buf != field_stack_buf) \
+			free(field_buf); \
+	}
+
 ResultType Line::PerformLoopParse(ExprTokenType *aResultToken, bool &aContinueMainLoop, Line *&aJumpToLine, Line *aUntil)
 {
 	if (!*ARG2) // Since the input variable's contents are blank, the loop will execute zero times.
 		return OK;
 
-	// The following will be used to hold the parsed items.  It needs to have its own storage because
-	// even though ARG2 might always be a writable memory area, we can't rely upon it being
-	// persistent because it might reside in the deref buffer, in which case the other commands
-	// in the loop's body would probably overwrite it.  Even if the ARG2's contents aren't in
-	// the deref buffer, we still can't modify it (i.e. to temporarily terminate it and thus
-	// bypass the need for malloc() below) because that might modify the variable contents, and
-	// that variable may be referenced elsewhere in the body of the loop (which would result
-	// in unexpected side-effects).  So, rather than have a limit of 64K or something (which
-	// would limit this feature's usefulness for parsing a large list of filenames, for example),
-	// it seems best to dynamically allocate a temporary buffer large enough to hold the
-	// contents of ARG2 (the input variable).  Update: Since these loops tend to be enclosed
-	// by file-read loops, and thus may be called thousands of times in a short period,
-	// it should help average performance to use the stack for small vars rather than
-	// constantly doing malloc() and free(), which are much higher overhead and probably
-	// cause memory fragmentation (especially with thousands of calls):
-	size_t space_needed = ArgLength(2) + 1;  // +1 for the zero terminator.
-	LPTSTR stack_buf, buf;
-	#define FREE_PARSE_MEMORY if (buf != stack_buf) free(buf)  // Also used by the CSV version of this function.
-	#define LOOP_PARSE_BUF_SIZE 40000                          //
-	if (space_needed <= LOOP_PARSE_BUF_SIZE)
-	{
-		stack_buf = (LPTSTR)talloca(space_needed); // Helps performance.  See comments above.
-		buf = stack_buf;
-	}
-	else
-	{
-		if (   !(buf = tmalloc(space_needed))   )
-			// Probably best to consider this a critical error, since on the rare times it does happen, the user
-			// would probably want to know about it immediately.
-			return LineError(ERR_OUTOFMEM, FAIL, ARG2);
-		stack_buf = NULL; // For comparison purposes later below.
-	}
-	_tcscpy(buf, ARG2); // Make the copy.
+	// ARG2 can't be parsed in place because it might reside in the deref buffer, in which case the
+	// commands in the loop's body would probably overwrite it.  Even if it doesn't, it can't be modified
+	// (e.g. to temporarily terminate each field) because it might be the contents of a variable that is
+	// referenced elsewhere in the body of the loop.  Formerly, the whole input was copied for these reasons,
+	// which doubled the memory needed to parse a large variable.  Now, when ARG2 is simply the contents of
+	// a variable, the loop borrows those contents and reads them in place; if the body changes that variable,
+	// Var gives the loop a private copy of the original contents first (see VarBorrow).  Otherwise, the
+	// input is copied as before, onto the stack if it's small since these loops tend to be enclosed by
+	// file-read loops, and thus may be called thousands of times in a short period.  Either way, the input
+	// isn't modified: each field is copied into field_buf, which only needs to be as large as the longest field.
+	PREPARE_PARSE_INPUT
 
 	// Make a copy of ARG3 and ARG4 in case either one's contents are in the deref buffer, which would
 	// probably be overwritten by the commands in the script loop's body:
 	TCHAR delimiters[512], omit_list[512];
 	tcslcpy(delimiters, ARG3, _countof(delimiters));
 	tcslcpy(omit_list, ARG4, _countof(omit_list));
+	size_t delimiter_count = _tcslen(delimiters);
 
 	ResultType result;
 	Line *jump_to_line;
-	TCHAR *field, *field_end, saved_char;
-	size_t field_length;
+	TCHAR *field, *field_end;
+	size_t pos, field_length;
 	global_struct &g = *::g; // Primarily for performance in this case.
 
-	for (field = buf;;)
-	{ 
+	for (pos = 0;;) // pos is the offset of the current field, since input.mContents may change between iterations.
+	{
+		if (!input.mContents) // The body changed the input variable and there wasn't enough memory to copy the original.
+			goto out_of_memory;
+		field = input.mContents + pos;
 		if (*delimiters)
 		{
-			if (   !(field_end = StrChrAny(field, delimiters))   ) // No more delimiters found.
-				field_end = field + _tcslen(field);  // Set it to the position of the zero terminator instead.
+			if (   !(field_end = tmemchrany(field, input_length - pos, delimiters, delimiter_count))   ) // No more delimiters found.
+				field_end = input.mContents + input_length;  // Set it to the position of the zero terminator instead.
 		}
 		else // Since no delimiters, every char in the input string is treated as a separate field.
 		{
 			// But exclude this char if it's in the omit_list:
 			if (*omit_list && _tcschr(omit_list, *field))
 			{
-				++field; // Move on to the next char.
-				if (!*field) // The end of the string has been reached.
+				if (++pos == input_length) // The end of the string has been reached.
 					break;
-				continue;
+				continue; // Move on to the next char.
 			}
 			field_end = field + 1;
 		}
 
-		saved_char = *field_end;  // In case it's a non-delimited list of single chars.
-		*field_end = '\0';  // Temporarily terminate so that GetLoopField() will see the correct substring.
+		field_length = field_end - field;
+		if (!ReserveLoopField(field_buf, field_buf_size, field_stack_buf, field_length))
+			goto out_of_memory;
+		tmemcpy(field_buf, field, field_length);
+		field_buf[field_length] = '\0';
+		pos = field_end - input.mContents; // Position of the delimiter, or of the terminator if this is the last field.
+		field = field_buf;
 
 		if (*omit_list && *field && *delimiters)  // If no delimiters, the omit_list has already been handled above.
 		{
 			// Process the omit list.
-			field = omit_leading_any(field, omit_list, field_end - field);
+			field = omit_leading_any(field, omit_list, field_length);
 			if (*field) // i.e. the above didn't remove all the chars due to them all being in the omit-list.
 			{
-				field_length = omit_trailing_any(field, omit_list, field_end - 1);
-				field[field_length] = '\0';  // Terminate here, but don't update field_end, since saved_char needs it.
+				field_length = omit_trailing_any(field, omit_list, field_buf + field_length - 1);
+				field[field_length] = '\0';
 			}
 		}
 
@@ -16066,14 +16603,18 @@ ResultType Line::PerformLoopParse(ExprTokenType *aResultToken, bool &aContinueMa
 			return result;
 		}
 
-		if (!saved_char) // The last item in the list has just been processed, so the loop is done.
+		if (pos == input_length) // The last item in the list has just been processed, so the loop is done.
 			break;
-		*field_end = saved_char;  // Undo the temporary termination, in case the list of delimiters is blank.
-		field = *delimiters ? field_end + 1 : field_end;  // Move on to the next field.
+		if (*delimiters)
+			++pos;  // Move on to the next field.
 		++g.mLoopIteration;
 	}
 	FREE_PARSE_MEMORY;
 	return OK;
+
+out_of_memory:
+	FREE_PARSE_MEMORY;
+	return LineError(ERR_OUTOFMEM);
 }
 
 
@@ -16086,34 +16627,24 @@ ResultType Line::PerformLoopParseCSV(ExprTokenType *aResultToken, bool &aContinu
 	if (!*ARG2) // Since the input variable's contents are blank, the loop will execute zero times.
 		return OK;
 
-	// See comments in PerformLoopParse() for details.
-	size_t space_needed = ArgLength(2) + 1;  // +1 for the zero terminator.
-	LPTSTR stack_buf, buf;
-	if (space_needed <= LOOP_PARSE_BUF_SIZE)
-	{
-		stack_buf = (LPTSTR)talloca(space_needed); // Helps performance.  See comments above.
-		buf = stack_buf;
-	}
-	else
-	{
-		if (   !(buf = tmalloc(space_needed))   )
-			return LineError(ERR_OUTOFMEM, FAIL, ARG2);
-		stack_buf = NULL; // For comparison purposes later below.
-	}
-	_tcscpy(buf, ARG2); // Make the copy.
+	PREPARE_PARSE_INPUT // See comments in PerformLoopParse() for details.
 
 	TCHAR omit_list[512];
 	tcslcpy(omit_list, ARG4, _countof(omit_list));
 
 	ResultType result;
 	Line *jump_to_line;
-	TCHAR *field, *field_end, saved_char;
-	size_t field_length;
+	TCHAR *field, *field_end, *input_end, *cp, *dest;
+	size_t pos, field_length;
 	bool field_is_enclosed_in_quotes;
 	global_struct &g = *::g; // Primarily for performance in this case.
 
-	for (field = buf;;)
+	for (pos = 0;;)
 	{
+		if (!input.mContents)
+			goto out_of_memory;
+		field = input.mContents + pos;
+		input_end = input.mContents + input_length;
 		if (*field == '"')
 		{
 			// For each field, check if the optional leading double-quote is present.  If it is,
@@ -16129,41 +16660,54 @@ ResultType Line::PerformLoopParseCSV(ExprTokenType *aResultToken, bool &aContinu
 
 		for (field_end = field;;)
 		{
-			if (   !(field_end = _tcschr(field_end, field_is_enclosed_in_quotes ? '"' : ','))   )
+			if (   !(field_end = tmemchrany(field_end, input_end - field_end, field_is_enclosed_in_quotes ? _T("\"") : _T(","), 1))   )
 			{
 				// This is the last field in the string, so set field_end to the position of
 				// the zero terminator instead:
-				field_end = field + _tcslen(field);
+				field_end = input_end;
 				break;
 			}
-			if (field_is_enclosed_in_quotes)
+			// The quote discovered above marks the end of the string if it isn't followed by another
+			// quote.  But if it is a pair of quotes, it represents a single literal double-quote, so
+			// keep searching for the real ending quote:
+			if (field_is_enclosed_in_quotes && field_end[1] == '"')
 			{
-				// The quote discovered above marks the end of the string if it isn't followed
-				// by another quote.  But if it is a pair of quotes, replace it with a single
-				// literal double-quote and then keep searching for the real ending quote:
-				if (field_end[1] == '"')  // A pair of quotes was encountered.
-				{
-					tmemmove(field_end, field_end + 1, _tcslen(field_end + 1) + 1); // +1 to include terminator.
-					++field_end; // Skip over the literal double quote that we just produced.
-					continue; // Keep looking for the "real" ending quote.
-				}
-				// Otherwise, this quote marks the end of the field, so just fall through and break.
+				field_end += 2;
+				continue;
 			}
-			// else field is not enclosed in quotes, so the comma discovered above must be a delimiter.
+			// Otherwise, this quote marks the end of the field, or the field is not enclosed in quotes,
+			// in which case the comma discovered above must be a delimiter.
 			break;
 		}
 
-		saved_char = *field_end; // This can be the terminator, a comma, or a double-quote.
-		*field_end = '\0';  // Terminate here so that GetLoopField() will see the correct substring.
+		// Copy the field, reducing each pair of quotes to a single literal quote.  The pairs are the only
+		// quotes inside a quoted field since the search above stopped at the first lone quote.
+		if (!ReserveLoopField(field_buf, field_buf_size, field_stack_buf, field_end - field))
+			goto out_of_memory;
+		if (field_is_enclosed_in_quotes)
+		{
+			for (cp = field, dest = field_buf; cp < field_end; ++cp)
+				if ((*dest++ = *cp) == '"')
+					++cp; // Skip the second quote of the pair.
+			field_length = dest - field_buf;
+		}
+		else
+		{
+			field_length = field_end - field;
+			tmemcpy(field_buf, field, field_length);
+		}
+		field_buf[field_length] = '\0';
+		pos = field_end - input.mContents; // Position of the comma, closing quote or terminator.
+		field = field_buf;
 
 		if (*omit_list && *field)
 		{
 			// Process the omit list.
-			field = omit_leading_any(field, omit_list, field_end - field);
+			field = omit_leading_any(field, omit_list, field_length);
 			if (*field) // i.e. the above didn't remove all the chars due to them all being in the omit-list.
 			{
-				field_length = omit_trailing_any(field, omit_list, field_end - 1);
-				field[field_length] = '\0';  // Terminate here, but don't update field_end, since we need its pos.
+				field_length = omit_trailing_any(field, omit_list, field_buf + field_length - 1);
+				field[field_length] = '\0';
 			}
 		}
 
@@ -16192,26 +16736,30 @@ ResultType Line::PerformLoopParseCSV(ExprTokenType *aResultToken, bool &aContinu
 			return result;
 		}
 
-		if (!saved_char) // The last item in the list has just been processed, so the loop is done.
+		if (pos == input_length) // The last item in the list has just been processed, so the loop is done.
 			break;
-		if (saved_char == ',') // Set "field" to be the position of the next field.
-			field = field_end + 1;
-		else // saved_char must be a double-quote char.
+		++pos; // Set pos to be the position of the next field, unless the field ended at its closing quote:
+		if (field_is_enclosed_in_quotes)
 		{
-			field = field_end + 1;
-			if (!*field) // No more fields occur after this one.
+			if (pos == input_length) // No more fields occur after this one.
 				break;
+			if (!input.mContents)
+				goto out_of_memory;
 			// Find the next comma, which must be a real delimiter since we're in between fields:
-			if (   !(field = _tcschr(field, ','))   ) // No more fields.
+			if (   !(cp = tmemchrany(input.mContents + pos, input_length - pos, _T(","), 1))   ) // No more fields.
 				break;
 			// Set it to be the first character of the next field, which might be a double-quote
 			// or another comma (if the field is empty).
-			++field;
+			pos = cp - input.mContents + 1;
 		}
 		++g.mLoopIteration;
 	}
 	FREE_PARSE_MEMORY;
 	return OK;
+
+out_of_memory:
+	FREE_PARSE_MEMORY;
+	return LineError(ERR_OUTOFMEM);
 }
 
 
@@ -16679,7 +17227,8 @@ __forceinline ResultType Line::Perform() // As of 2/9/2009, __forceinline() redu
 						size_t needle_length = ArgLength(3);
 						int i;
 						for (i = 1, found = haystack + offset; ; ++i, found += needle_length)
-							if (!(found = g_tcsstr(found, needle)) || i == occurrence_number)
+							if (   !(found = tmemsearch(found, haystack_length - (found - haystack), needle, needle_length, (StringCaseSenseType)g.StringCaseSense))
+								|| i == occurrence_number   )
 								break;
 					}
 					if (found)
@@ -686,6 +686,53 @@ enum WinSetAttributes {WINSET_INVALID, WINSET_TRANSPARENT, WINSET_TRANSCOLOR, WI
 	, WINSET_REGION};
 
 
+// ExprScratch: Bump allocator for intermediate results of ExpandExpression() which don't fit at the end
+// of the deref buffer.  Each call takes a Mark on entry and rolls back to it on exit, so recursion via
+// function calls simply stacks on top of the caller's allocations.  Memory handed over by functions via
+// mem_to_free is recorded here too, so there's no fixed limit on the number of such items per line.
+#define EXPR_SCRATCH_BLOCK_SIZE (64 * 1024) // Bytes per block, including the header.  Larger requests get a dedicated block.
+class ExprScratch
+{
+	struct Block
+	{
+		Block *mPrev;
+		size_t mSize, mUsed; // In bytes, including this header.
+	};
+	struct Owned
+	{
+		Owned *mNext;
+		void *mMem;
+	};
+	Block *mBlock; // The block currently being allocated from (most recent).
+	Block *mSpare; // One standard-size block kept after release to avoid malloc/free churn on every line.
+	Owned *mOwned; // Memory to be freed at the next Release().
+	LPTSTR mLast;  // The most recent allocation, which is the only one Extend() can grow.
+
+public:
+	struct Mark
+	{
+		Block *block;
+		size_t used;
+		Owned *owned;
+	};
+
+	ExprScratch() : mBlock(NULL), mSpare(NULL), mOwned(NULL), mLast(NULL) {}
+	~ExprScratch() { Free(); }
+
+	void GetMark(Mark &aMark)
+	{
+		aMark.block = mBlock;
+		aMark.used = mBlock ? mBlock->mUsed : 0;
+		aMark.owned = mOwned;
+	}
+	LPTSTR Alloc(size_t aChars);
+	bool Extend(LPTSTR aMem, size_t aNewChars);
+	bool TakeOwnership(void *aMem);
+	void Release(Mark &aMark);
+	void Free();
+};
+
+
 class Label; // Forward declaration so that each can use the other.
 class Line
 {
@@ -893,6 +940,7 @@ public:
 	static LPTSTR sDerefBuf;  // Buffer to hold the values of any args that need to be dereferenced.
 	static size_t sDerefBufSize;
 	static int sLargeDerefBufs;
+	static ExprScratch sExprScratch; // Intermediate expression results; see ExprScratch.
 
 	// Static because only one line can be Expanded at a time (not to mention the fact that we
 	// wouldn't want the size of each line to be expanded by this size):
@@ -2332,6 +2380,7 @@ struct DYNAPARM
 };
 
 void ConvertDllArgType(LPTSTR aBuf[], DYNAPARM &aDynaParam);
+void ClearDllSignatureCache();
 #endif
 
 enum FuncParamDefaults {PARAM_DEFAULT_NONE, PARAM_DEFAULT_STR, PARAM_DEFAULT_INT, PARAM_DEFAULT_FLOAT};
@@ -2369,6 +2418,7 @@ public:
 	Var **mStaticVar, **mStaticLazyVar;
 	// Count of items in the above array as well as the maximum capacity.
 	int mGlobalVarCount, mVarCount, mVarCountMax, mLazyVarCount, mStaticVarCount, mStaticVarCountMax, mStaticLazyVarCount; 
+	VarHash mVarHash, mStaticVarHash; // Hashed indexes of mVar+mLazyVar and mStaticVar+mStaticLazyVar, used by FindVar().
 	int mInstances; // How many instances currently exist on the call stack (due to recursion or thread interruption).  Future use: Might be used to limit how deep recursion can go to help prevent stack overflow.
 
 	// Keep small members adjacent to each other to save space and improve perf. due to byte alignment:
@@ -2513,13 +2563,18 @@ public:
 	UCHAR mExistingThreads;  // Whether this timer is already running its subroutine.
 	bool mEnabled;
 	bool mRunOnlyOnce;
-	ScriptTimer *mNextTimer;  // Next items in linked list
+	ScriptTimer *mNextTimer, *mPrevTimer;  // Next and previous items in linked list
+	ScriptTimer *mNextInBucket; // Next timer in the same bucket of Script::mTimerBucket.
+	unsigned __int64 mTimeDue; // Script::TimerTick() at which the timer is next due.  Valid only while mEnabled.
+	int mHeapIndex; // Index in Script::mTimerHeap, or -1 if not enabled.
+	UINT mCheckPass; // Used by CheckScriptTimers() to launch each timer at most once per call.
 	void ScriptTimer::Disable();
 	ScriptTimer(IObject *aLabel)
 		#define DEFAULT_TIMER_PERIOD 250
 		: mLabel(aLabel), mPeriod(DEFAULT_TIMER_PERIOD), mPriority(0) // Default is always 0.
 		, mExistingThreads(0), mTimeLastRun(0)
-		, mEnabled(false), mRunOnlyOnce(false), mNextTimer(NULL)  // Note that mEnabled must default to false for the counts to be right.
+		, mEnabled(false), mRunOnlyOnce(false), mNextTimer(NULL), mPrevTimer(NULL)  // Note that mEnabled must default to false for the counts to be right.
+		, mNextInBucket(NULL), mTimeDue(0), mHeapIndex(-1), mCheckPass(0)
 	{}
 };
 
@@ -3055,6 +3110,51 @@ typedef int (* ahkx_int_str_str)(LPTSTR ahkx_str, LPTSTR ahkx_str2); // ahkx N11
 typedef BOOL(_stdcall *MyCryptEncrypt)(HCRYPTKEY, HCRYPTHASH, BOOL, DWORD, BYTE *, DWORD *, DWORD);
 typedef BOOL(_stdcall *MyCryptDecrypt)(HCRYPTKEY, HCRYPTHASH, BOOL, DWORD, BYTE *, DWORD *);
 
+#ifndef AUTOHOTKEYSC
+// An include cache saves the work of finding and reading a script's files: each line returned by GetLine(),
+// each file opened for #Include or a library, and each check of the file system which decided what to load
+// next.  Loading the cache replays these in the same order, so no file is read, decoded or searched for.
+// It is not a compiled form of the script: the cache holds the source text, which is still parsed as usual.
+enum IncludeCacheRecordType {INCLUDE_CACHE_LINE = 1, INCLUDE_CACHE_OPEN, INCLUDE_CACHE_DECISION, INCLUDE_CACHE_LIB_BEGIN, INCLUDE_CACHE_LIB_WINAPI, INCLUDE_CACHE_LIB_END};
+#define INCLUDE_CACHE_SIGNATURE "AHKINCLUDECACHE"
+#define INCLUDE_CACHE_VERSION 1
+
+class IncludeCache
+{
+	LPBYTE mData;
+	size_t mLength, mCapacity, mPos;
+	LPTSTR mFileToWrite; // NULL when the cache is being replayed.
+	bool mIsCorrupt;
+
+	void Write(const void *aData, size_t aSize);
+	const void *Read(size_t aSize);
+	void WriteInt(int aValue) { Write(&aValue, sizeof(int)); }
+	bool ReadInt(int &aValue);
+	void WriteString(LPCTSTR aString);
+	LPCTSTR ReadString(size_t &aLength);
+	bool ReadRecord(IncludeCacheRecordType aType);
+
+public:
+	IncludeCache(LPTSTR aFileToWrite = NULL)
+		: mData(NULL), mLength(0), mCapacity(0), mPos(0), mFileToWrite(aFileToWrite), mIsCorrupt(false) {}
+	~IncludeCache() { free(mData); }
+	bool IsReading() { return !mFileToWrite; }
+	bool IsCorrupt() { return mIsCorrupt; }
+	ResultType Load(LPCTSTR aFileSpec);
+	ResultType Save();
+
+	void PutLine(LPCTSTR aBuf, size_t aLength);
+	size_t GetLine(LPTSTR aBuf, int aMaxCharsToRead);
+	void PutOpen(ResultType aResult, LPCTSTR aSourceFile);
+	ResultType GetOpen(LPCTSTR &aSourceFile);
+	void PutDecision(bool aValue) { WriteInt(INCLUDE_CACHE_DECISION); WriteInt(aValue); }
+	bool GetDecision() { int value; return ReadRecord(INCLUDE_CACHE_DECISION) && ReadInt(value) && value; }
+	void PutMarker(IncludeCacheRecordType aType, int aValue = 0) { WriteInt(aType); WriteInt(aValue); }
+	bool GetMarker(IncludeCacheRecordType aType, int *aValue = NULL);
+	bool PeekRecord(IncludeCacheRecordType aType);
+};
+#endif
+
 class Script
 {
 private:
@@ -3068,6 +3168,7 @@ private:
 public:	
 	Var **mVar, **mLazyVar; // Array of pointers-to-variable, allocated upon first use and later expanded as needed.
 	int mVarCount, mVarCountMax, mLazyVarCount; // Count of items in the above array as well as the maximum capacity.
+	VarHash mVarHash; // Hashed index of mVar+mLazyVar, used by FindVar().
 	WinGroup *mFirstGroup, *mLastGroup;  // The first and last variables in the linked list.
 	Line *mOpenBlock; // While loading the script, this is the beginning of a block which is currently open.
 	int mCurrentFuncOpenBlockCount; // While loading the script, this is how many blocks are currently open in the current function's body.
@@ -3077,6 +3178,7 @@ public:
 #define MAX_NESTED_CLASSES 5
 #define MAX_CLASS_NAME_LENGTH UCHAR_MAX
 	int mClassObjectCount;
+	int mClassDefinitionCount; // Unlike mClassObjectCount (the nesting depth), this only ever increases.
 	Object *mClassObject[MAX_NESTED_CLASSES]; // Class definition currently being parsed.
 	TCHAR mClassName[MAX_CLASS_NAME_LENGTH + 1]; // Only used during load-time.
 	Object *mUnresolvedClasses;
@@ -3100,6 +3202,7 @@ public:
 	NOTIFYICONDATA mNIC; // For ease of adding and deleting our tray icon.
 
 	size_t GetLine(LPTSTR aBuf, int aMaxCharsToRead, int aInContinuationSection, TextStream *ts);
+	size_t ReadScriptLine(LPTSTR aBuf, int aMaxCharsToRead, int aInContinuationSection, TextStream *ts);
 	ResultType IsDirective(LPTSTR aBuf);
 	ResultType ParseAndAddLine(LPTSTR aLineText, ActionTypeType aActionType = ACT_INVALID
 		, ActionTypeType aOldActionType = OLD_INVALID, LPTSTR aActionName = NULL
@@ -3153,6 +3256,14 @@ public:
 
 	ScriptTimer *mFirstTimer, *mLastTimer;  // The first and last script timers in the linked list.
 	UINT mTimerCount, mTimerEnabledCount;
+	// Enabled timers are also kept in a min-heap ordered by mTimeDue, so that finding the timers which
+	// are due doesn't require scanning all of them.  mTimerEnabledCount is the number of items in it.
+	ScriptTimer **mTimerHeap;
+	UINT mTimerHeapSize;
+	ScriptTimer **mTimerBucket; // Hash table of timers by mLabel, for UpdateOrCreateTimer() and DeleteTimer().
+	UINT mTimerBucketCount; // Always a power of 2 (or 0).
+	unsigned __int64 mTimerTickHigh;
+	DWORD mTimerTickLow;
 #ifndef MINIDLL
 	UserMenu *mFirstMenu, *mLastMenu;
 	UINT mMenuCount;
@@ -3174,6 +3285,7 @@ public:
 	bool mErrorStdOut; // true if load-time syntax errors should be sent to stdout vs. a MsgBox.
 #ifndef AUTOHOTKEYSC
 	TextStream *mIncludeLibraryFunctionsThenExit;
+	IncludeCache *mIncludeCache; // The include cache being recorded (/includecache mode) or replayed, only while loading.
 #endif
 	__int64 mLinesExecutedThisCycle; // Use 64-bit to match the type of g->LinesPerCycle
 	int mUninterruptedLineCountMax; // 32-bit for performance (since huge values seem unnecessary here).
@@ -3219,18 +3331,34 @@ public:
 	ResultType LoadIncludedFile(LPTSTR aFileSpec, bool aAllowDuplicateInclude, bool aIgnoreLoadFailure);
 	ResultType LoadIncludedFile(TextStream *fp);
 	ResultType OpenIncludedFile(TextStream &ts, LPTSTR aFileSpec, bool aAllowDuplicateInclude, bool aIgnoreLoadFailure, LPCTSTR aPathToShow = NULL);
+#ifndef AUTOHOTKEYSC
+	ResultType ReserveSourceFile();
+	ResultType OpenIncludedFileFromCache();
+#endif
 	LineNumberType CurrentLine();
 	LPTSTR CurrentFile();
 
 	ResultType UpdateOrCreateTimer(IObject *aLabel, LPTSTR aPeriod, LPTSTR aPriority, bool aEnable
 		, bool aUpdatePriorityOnly);
 	void DeleteTimer(IObject *aLabel);
+	void DestroyTimer(ScriptTimer *aTimer);
+	ScriptTimer *FindTimer(IObject *aLabel);
+	bool HashTimer(ScriptTimer *aTimer);
+	void UnhashTimer(ScriptTimer *aTimer);
+	bool ScheduleTimer(ScriptTimer *aTimer);
+	void UnscheduleTimer(ScriptTimer *aTimer);
+	void SiftTimer(int aIndex);
+	ScriptTimer *FindDueTimer(UINT aIndex, unsigned __int64 aNow, UINT aPass);
+	unsigned __int64 TimerTick();
 
 	ResultType DefineFunc(LPTSTR aBuf, Var *aFuncGlobalVar[]);
 #ifndef AUTOHOTKEYSC
 	void InitFuncLibraries(FuncLibrary aLibs[]);
 	void InitFuncLibrary(FuncLibrary &aLib, LPTSTR aPathBase, LPTSTR aPathSuffix);
 	Func *FindFuncInLibrary(LPTSTR aFuncName, size_t aFuncNameLength, bool &aErrorWasShown, bool &aFileWasFound, bool aIsAutoInclude);
+	Func *SearchFuncLibraries(LPTSTR aFuncName, size_t aFuncNameLength, bool &aErrorWasShown, bool &aFileWasFound, bool aIsAutoInclude);
+	Func *FindFuncInCache(LPTSTR aFuncName, size_t aFuncNameLength, bool &aErrorWasShown, bool &aFileWasFound, bool aIsAutoInclude);
+	Func *FindFuncInWinAPI(LPTSTR aFuncName, size_t aFuncNameLength, bool aIsAutoInclude);
 #endif
 	Func *FindFunc(LPCTSTR aFuncName, size_t aFuncNameLength = 0, int *apInsertPos = NULL);
 	Func *AddFunc(LPCTSTR aFuncName, size_t aFuncNameLength, bool aIsBuiltIn, int aInsertPos, Object *aClassObject = NULL);
@@ -3515,6 +3643,7 @@ BIF_DECL(BIF_InStr);
 BIF_DECL(BIF_StrSplit);
 BIF_DECL(BIF_StrReplace);
 BIF_DECL(BIF_RegEx);
+BIF_DECL(BIF_RegExCacheInfo);
 BIF_DECL(BIF_Ord);
 BIF_DECL(BIF_Chr);
 BIF_DECL(BIF_Format);
@@ -3657,5 +3786,7 @@ double ScriptGetJoyState(JoyControls aJoy, int aJoystickID, ExprTokenType &aToke
 LPTSTR GetExitReasonString(ExitReasons aExitReason);
 
 void free_compiled_regex();
+void init_regex_jit_stacks();
+void free_regex_jit_stacks();
 #endif
 
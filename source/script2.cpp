@@ -5810,8 +5810,15 @@ LRESULT CALLBACK MainWindowProc(HWND hWnd, UINT iMsg, WPARAM wParam, LPARAM lPar
 		callFuncDllVariant((FuncAndToken *) wParam);
 		return 0;
 	case AHK_EXECUTE_FUNCTION_DLL: 
-		callFuncDll((FuncAndToken *) wParam);
+		if (wParam)
+			callFuncDll((FuncAndToken *) wParam);
+		else // Sent by ahkPostFunction, which may have queued any number of calls.
+			callPostedFuncs();
 		return 0;
+#ifndef AUTOHOTKEYSC
+	case AHK_PROFILE:
+		return ExecuteProfileCommand((int)wParam, (LPTSTR)lParam);
+#endif
 #ifndef MINIDLL
 	case WM_MEASUREITEM: // L17: Measure menu icon. Not used on Windows Vista or later.
 		if (hWnd == g_hWnd && wParam == 0 && !g_os.IsWinVistaOrLater())
@@ -7842,78 +7849,176 @@ ResultType Line::SplitPath(LPTSTR aFileSpec)
 
 
 
-int SortWithOptions(const void *a1, const void *a2)
-// Decided to just have one sort function since there are so many permutations.  The performance
-// will be a little bit worse, but it seems simpler to implement and maintain.
-// This function's input parameters are pointers to the elements of the array.  Since those elements
-// are themselves pointers, the input parameters are therefore pointers to pointers (handles).
+struct sort_key_type
+{
+	LPTSTR item; // This must be the first member of the struct so that SortUDF() can treat each element as an LPTSTR*.
+	LPTSTR key;  // The part of item to compare: item itself, its column given by the P option, or its naked filename.
+	double num;  // The numeric value of key (N option) or a random number (Random option).
+};
+
+typedef int (* SortKeyCompareType)(const sort_key_type &, const sort_key_type &, UCHAR);
+
+struct sort_params_type
+{
+	SortKeyCompareType compare;
+	UCHAR case_sensitive;
+	bool reverse;
+};
+
+static int SortKeyString(const sort_key_type &aKey1, const sort_key_type &aKey2, UCHAR aCaseSensitive)
+{
+	// v1.0.43.03: Added support the new locale-insensitive mode.
+	return tcscmp2(aKey1.key, aKey2.key, aCaseSensitive);
+}
+
+static int SortKeyNumeric(const sort_key_type &aKey1, const sort_key_type &aKey2, UCHAR aCaseSensitive)
+// Non-numeric items were given a value of zero by PerformSort(), so they wind up in a sequential group.
+{
+	return aKey1.num < aKey2.num ? -1 : aKey1.num > aKey2.num;
+}
+
+static inline int SortKeyCompare(const sort_key_type &aKey1, const sort_key_type &aKey2, const sort_params_type &aParams)
+{
+	int result = aParams.compare(aKey1, aKey2, aParams.case_sensitive);
+	return aParams.reverse ? -result : result;
+}
+
+static void SortMergeRuns(const sort_key_type *aSrc, size_t aMid, size_t aCount, sort_key_type *aDest, const sort_params_type &aParams)
+// Merges the sorted runs aSrc[0..aMid) and aSrc[aMid..aCount) into aDest.  Ties are taken from the
+// left run, which is what keeps the overall sort stable.
+{
+	size_t left = 0, right = aMid, dest = 0;
+	while (left < aMid && right < aCount)
+		aDest[dest++] = SortKeyCompare(aSrc[right], aSrc[left], aParams) < 0 ? aSrc[right++] : aSrc[left++];
+	while (left < aMid)
+		aDest[dest++] = aSrc[left++];
+	while (right < aCount)
+		aDest[dest++] = aSrc[right++];
+}
+
+#define SORT_INSERTION_RUN 16
+
+static void SortKeys(sort_key_type *aKey, sort_key_type *aTemp, size_t aCount, const sort_params_type &aParams)
+// Stable bottom-up merge sort.  aTemp must have room for aCount elements.  The result is left in aKey.
 {
-	LPTSTR sort_item1 = *(LPTSTR *)a1;
-	LPTSTR sort_item2 = *(LPTSTR *)a2;
-	if (g_SortColumnOffset > 0)
+	size_t i, j, k, end, width;
+	// Insertion-sort short runs first since merging single elements is comparatively costly:
+	for (i = 0; i < aCount; i += SORT_INSERTION_RUN)
 	{
-		// Adjust each string (even for numerical sort) to be the right column position,
-		// or the position of its zero terminator if the column offset goes beyond its length:
-		size_t length = _tcslen(sort_item1);
-		sort_item1 += (size_t)g_SortColumnOffset > length ? length : g_SortColumnOffset;
-		length = _tcslen(sort_item2);
-		sort_item2 += (size_t)g_SortColumnOffset > length ? length : g_SortColumnOffset;
+		end = i + SORT_INSERTION_RUN < aCount ? i + SORT_INSERTION_RUN : aCount;
+		for (j = i + 1; j < end; ++j)
+		{
+			sort_key_type this_key = aKey[j];
+			for (k = j; k > i && SortKeyCompare(aKey[k - 1], this_key, aParams) > 0; --k)
+				aKey[k] = aKey[k - 1];
+			aKey[k] = this_key;
+		}
 	}
-	if (g_SortNumeric) // Takes precedence over g_SortCaseSensitive
+	// Merge the runs back and forth between aKey and aTemp until only one run remains:
+	sort_key_type *src = aKey, *dest = aTemp, *swap;
+	for (width = SORT_INSERTION_RUN; width < aCount; width *= 2)
 	{
-		// For now, assume both are numbers.  If one of them isn't, it will be sorted as a zero.
-		// Thus, all non-numeric items should wind up in a sequential, unsorted group.
-		// Resolve only once since parts of the ATOF() macro are inline:
-		double item1_minus_2 = ATOF(sort_item1) - ATOF(sort_item2);
-		if (!item1_minus_2) // Exactly equal.
-			return 0;
-		// Otherwise, it's either greater or less than zero:
-		int result = (item1_minus_2 > 0.0) ? 1 : -1;
-		return g_SortReverse ? -result : result;
+		for (i = 0; i < aCount; i += 2 * width)
+			SortMergeRuns(src + i, width < aCount - i ? width : aCount - i
+				, 2 * width < aCount - i ? 2 * width : aCount - i, dest + i, aParams);
+		swap = src, src = dest, dest = swap;
 	}
-	// Otherwise, it's a non-numeric sort.
-	// v1.0.43.03: Added support the new locale-insensitive mode.
-	int result = tcscmp2(sort_item1, sort_item2, g_SortCaseSensitive); // Resolve large macro only once for code size reduction.
-	return g_SortReverse ? -result : result;
+	if (src != aKey)
+		memcpy(aKey, src, aCount * sizeof(sort_key_type));
 }
 
+#define SORT_MAX_THREADS 8
+#define SORT_MIN_ITEMS_PER_THREAD 0x8000 // Below this, the cost of starting a thread outweighs the benefit.
 
+struct sort_job_type
+{
+	sort_key_type *key, *temp;
+	size_t mid, count; // mid is used only by SortMergeThread().
+	const sort_params_type *params;
+};
 
-int SortByNakedFilename(const void *a1, const void *a2)
-// See comments in prior function for details.
+static DWORD WINAPI SortKeysThread(LPVOID aJob)
 {
-	LPTSTR sort_item1 = *(LPTSTR *)a1;
-	LPTSTR sort_item2 = *(LPTSTR *)a2;
-	LPTSTR cp;
-	if (cp = _tcsrchr(sort_item1, '\\'))  // Assign
-		sort_item1 = cp + 1;
-	if (cp = _tcsrchr(sort_item2, '\\'))  // Assign
-		sort_item2 = cp + 1;
-	// v1.0.43.03: Added support the new locale-insensitive mode.
-	int result = tcscmp2(sort_item1, sort_item2, g_SortCaseSensitive); // Resolve large macro only once for code size reduction.
-	return g_SortReverse ? -result : result;
+	sort_job_type &job = *(sort_job_type *)aJob;
+	SortKeys(job.key, job.temp, job.count, *job.params);
+	return 0;
 }
 
+static DWORD WINAPI SortMergeThread(LPVOID aJob)
+{
+	sort_job_type &job = *(sort_job_type *)aJob;
+	SortMergeRuns(job.key, job.mid, job.count, job.temp, *job.params);
+	return 0;
+}
 
-
-struct sort_rand_type
+static void SortRunJobs(LPTHREAD_START_ROUTINE aProc, sort_job_type *aJob, int aJobCount)
+// Runs aJob[0] on the calling thread and the rest on worker threads.  A job whose thread can't be
+// created is simply run on the calling thread, so this can't fail.
 {
-	LPTSTR cp; // This must be the first member of the struct, otherwise the array trickery in PerformSort will fail.
-	union
+	HANDLE thread[SORT_MAX_THREADS];
+	int i, thread_count = 0;
+	for (i = 1; i < aJobCount; ++i)
+		if (thread[thread_count] = CreateThread(NULL, 0, aProc, aJob + i, 0, NULL)) // Assign.
+			++thread_count;
+		else
+			aProc(aJob + i);
+	aProc(aJob);
+	if (thread_count)
 	{
-		// This must be the same size in bytes as the above, which is why it's maintained as a union with
-		// a char* rather than a plain int.
-		LPTSTR unused;
-		int rand;
-	};
-};
+		WaitForMultipleObjects(thread_count, thread, TRUE, INFINITE);
+		for (i = 0; i < thread_count; ++i)
+			CloseHandle(thread[i]);
+	}
+}
 
-int SortRandom(const void *a1, const void *a2)
-// See comments in prior functions for details.
+static void SortKeysParallel(sort_key_type *aKey, sort_key_type *aTemp, size_t aCount, const sort_params_type &aParams)
+// Same as SortKeys(), but large lists are split into chunks which are sorted on separate threads and
+// then merged pairwise (also in parallel).  The comparison functions only read the precomputed keys and
+// aParams, and never call into script, so they are safe to run on any thread.
 {
-	return ((sort_rand_type *)a1)->rand - ((sort_rand_type *)a2)->rand;
+	SYSTEM_INFO sys_info;
+	GetSystemInfo(&sys_info);
+	int chunk_count = 1; // Must be a power of two for the merge stage below.
+	while (chunk_count < SORT_MAX_THREADS && chunk_count * 2 <= (int)sys_info.dwNumberOfProcessors
+		&& aCount / (chunk_count * 2) >= SORT_MIN_ITEMS_PER_THREAD)
+		chunk_count *= 2;
+	if (chunk_count == 1)
+	{
+		SortKeys(aKey, aTemp, aCount, aParams);
+		return;
+	}
+	size_t bound[SORT_MAX_THREADS + 1];
+	sort_job_type job[SORT_MAX_THREADS];
+	int i, step, job_count;
+	for (i = 0; i <= chunk_count; ++i)
+		bound[i] = (size_t)((unsigned __int64)aCount * i / chunk_count);
+	for (i = 0; i < chunk_count; ++i)
+	{
+		job[i].key = aKey + bound[i];
+		job[i].temp = aTemp + bound[i];
+		job[i].count = bound[i + 1] - bound[i];
+		job[i].params = &aParams;
+	}
+	SortRunJobs(SortKeysThread, job, chunk_count);
+	sort_key_type *src = aKey, *dest = aTemp, *swap;
+	for (step = 1; step < chunk_count; step *= 2)
+	{
+		for (job_count = 0, i = 0; i < chunk_count; i += 2 * step, ++job_count)
+		{
+			job[job_count].key = src + bound[i];
+			job[job_count].temp = dest + bound[i];
+			job[job_count].mid = bound[i + step] - bound[i];
+			job[job_count].count = bound[i + 2 * step] - bound[i];
+		}
+		SortRunJobs(SortMergeThread, job, job_count);
+		swap = src, src = dest, dest = swap;
+	}
+	if (src != aKey)
+		memcpy(aKey, src, aCount * sizeof(sort_key_type));
 }
 
+
+
 int SortUDF(const void *a1, const void *a2)
 // See comments in prior function for details.
 {
@@ -7994,10 +8099,9 @@ ResultType Line::PerformSort(LPTSTR aContents, LPTSTR aOptions)
 
 	// Resolve options.  First set defaults for options:
 	TCHAR delimiter = '\n';
-	g_SortCaseSensitive = SCS_INSENSITIVE;
-	g_SortNumeric = false;
-	g_SortReverse = false;
-	g_SortColumnOffset = 0;
+	UCHAR sort_case_sensitive = SCS_INSENSITIVE;
+	bool sort_numeric = false, sort_reverse = false;
+	int sort_column_offset = 0;
 	bool trailing_delimiter_indicates_trailing_blank_item = false, terminate_last_item_with_delimiter = false
 		, trailing_crlf_added_temporarily = false, sort_by_naked_filename = false, sort_random = false
 		, omit_dupes = false;
@@ -8011,10 +8115,10 @@ ResultType Line::PerformSort(LPTSTR aContents, LPTSTR aOptions)
 			if (ctoupper(cp[1]) == 'L') // v1.0.43.03: Locale-insensitive mode, which probably performs considerably worse.
 			{
 				++cp;
-				g_SortCaseSensitive = SCS_INSENSITIVE_LOCALE;
+				sort_case_sensitive = SCS_INSENSITIVE_LOCALE;
 			}
 			else
-				g_SortCaseSensitive = SCS_SENSITIVE;
+				sort_case_sensitive = SCS_SENSITIVE;
 			break;
 		case 'D':
 			if (!cp[1]) // Avoids out-of-bounds when the loop's own ++cp is done.
@@ -8046,15 +8150,15 @@ ResultType Line::PerformSort(LPTSTR aContents, LPTSTR aOptions)
 			cp = cp_end - 1; // In the next iteration (which also does a ++cp), resume looking for options after the function's name.
 			break;
 		case 'N':
-			g_SortNumeric = true;
+			sort_numeric = true;
 			break;
 		case 'P':
 			// Use atoi() vs. ATOI() to avoid interpreting something like 0x01C as hex
 			// when in fact the C was meant to be an option letter:
-			g_SortColumnOffset = _ttoi(cp + 1);
-			if (g_SortColumnOffset < 1)
-				g_SortColumnOffset = 1;
-			--g_SortColumnOffset;  // Convert to zero-based.
+			sort_column_offset = _ttoi(cp + 1);
+			if (sort_column_offset < 1)
+				sort_column_offset = 1;
+			--sort_column_offset;  // Convert to zero-based.
 			break;
 		case 'R':
 			if (!_tcsnicmp(cp, _T("Random"), 6))
@@ -8063,7 +8167,7 @@ ResultType Line::PerformSort(LPTSTR aContents, LPTSTR aOptions)
 				cp += 5; // Point it to the last char so that the loop's ++cp will point to the character after it.
 			}
 			else
-				g_SortReverse = true;
+				sort_reverse = true;
 			break;
 		case 'U':  // Unique.
 			omit_dupes = true;
@@ -8176,82 +8280,82 @@ ResultType Line::PerformSort(LPTSTR aContents, LPTSTR aOptions)
 		}
 	}
 
-	// Create the array of pointers that points into aContents to each delimited item.
-	// Use item_count + 1 to allow space for the last (blank) item in case
-	// trailing_delimiter_indicates_trailing_blank_item is false:
-	int unit_size = sort_random ? 2 : 1;
-	size_t item_size = unit_size * sizeof(LPTSTR);
-	LPTSTR *item = (LPTSTR *)malloc((item_count + 1) * item_size);
+	// Create the array of sort keys, one per delimited item.  Use item_count + 1 to allow space for the
+	// last (blank) item in case trailing_delimiter_indicates_trailing_blank_item is false.  The second half
+	// of the same allocation is the merge sort's scratch area (the UDF sort doesn't need it):
+	size_t key_alloc_count = g_SortFunc ? item_count + 1 : 2 * (item_count + 1);
+	sort_key_type *item = (sort_key_type *)malloc(key_alloc_count * sizeof(sort_key_type));
 	if (!item)
 	{
 		result_to_return = LineError(ERR_OUTOFMEM);  // Short msg. since so rare.
 		goto end;
 	}
 
-	// If sort_random is in effect, the above has created an array twice the normal size.
-	// This allows the random numbers to be interleaved inside the array as though it
-	// were an array consisting of sort_rand_type (which it actually is when viewed that way).
-	// Because of this, the array should be accessed through pointer addition rather than
-	// indexing via [].
-
 	// Scan aContents and do the following:
 	// 1) Replace each delimiter with a terminator so that the individual items can be seen
-	//    as real strings by the SortWithOptions() and when copying the sorted results back
-	//    into output_vav.  It is safe to change aContents in this way because
-	//    ArgMustBeDereferenced() has ensured that those contents are in the deref buffer.
-	// 2) Store a marker/pointer to each item (string) in aContents so that we know where
-	//    each item begins for sorting and recopying purposes.
-	LPTSTR *item_curr = item; // i.e. Don't use [] indexing for the reason in the paragraph previous to above.
-	for (item_count = 0, cp = *item_curr = aContents; *cp; ++cp)
+	//    as real strings by the sort and when copying the sorted results back into output_var.
+	//    It is safe to change aContents in this way because ArgMustBeDereferenced() has ensured
+	//    that those contents are in the deref buffer.
+	// 2) Store a pointer to each item (string) in aContents so that we know where each item
+	//    begins for sorting and recopying purposes.
+	sort_key_type *item_curr = item;
+	for (item_count = 0, cp = item_curr->item = aContents; *cp; ++cp)
 	{
 		if (*cp == delimiter)  // Each delimiter char becomes the terminator of the previous key phrase.
 		{
 			*cp = '\0';  // Terminate the item that appears before this delimiter.
 			++item_count;
-			if (sort_random)
-				*(item_curr + 1) = (LPTSTR)(size_t)genrand_int31(); // i.e. the randoms are in the odd fields, the pointers in the even.
-				// For the above:
-				// I don't know the exact reasons, but using genrand_int31() is much more random than
-				// using genrand_int32() in this case.  Perhaps it is some kind of statistical/cyclical
-				// anomaly in the random number generator.  Or perhaps it's something to do with integer
-				// underflow/overflow in SortRandom().  In any case, the problem can be proven via the
-				// following script, which shows a sharply non-random distribution when genrand_int32()
-				// is used:
-				//count = 0
-				//Loop 10000
-				//{
-				//	var = 1`n2`n3`n4`n5`n
-				//	Sort, Var, Random
-				//	StringLeft, Var1, Var, 1
-				//	if Var1 = 5  ; Change this value to 1 to see the opposite problem.
-				//		count += 1
-				//}
-				//Msgbox %count%
-				//
-				// I e-mailed the author about this sometime around/prior to 12/1/04 but never got a response.
-			item_curr += unit_size; // i.e. Don't use [] indexing for the reason described above.
-			*item_curr = cp + 1; // Make a pointer to the next item's place in aContents.
+			++item_curr;
+			item_curr->item = cp + 1; // Make a pointer to the next item's place in aContents.
 		}
 	}
 	// The above reset the count to 0 and recounted it.  So now re-add the last item to the count unless it was
 	// disqualified earlier. Verified correct:
 	if (!terminate_last_item_with_delimiter) // i.e. either trailing_delimiter_indicates_trailing_blank_item==true OR the final character isn't a delimiter. Either way the final item needs to be added.
-	{
 		++item_count;
-		if (sort_random) // Provide a random number for the last item.
-			*(item_curr + 1) = (LPTSTR)(size_t)genrand_int31(); // i.e. the randoms are in the odd fields, the pointers in the even.
-	}
-	else // Since the final item is not included in the count, point item_curr to the one before the last, for use below.
-		item_curr -= unit_size;
 
-	// Now aContents has been divided up based on delimiter.  Sort the array of pointers
-	// so that they indicate the correct ordering to copy aContents into output_var:
+	// Now aContents has been divided up based on delimiter.  Sort the array so that it indicates the
+	// correct ordering to copy aContents into output_var:
 	if (g_SortFunc) // Takes precedence other sorting methods.
-		qsort((void *)item, item_count, item_size, SortUDF);
-	else if (sort_random) // Takes precedence over all remaining options.
-		qsort((void *)item, item_count, item_size, SortRandom);
+		qsort((void *)item, item_count, sizeof(sort_key_type), SortUDF);
 	else
-		qsort((void *)item, item_count, item_size, sort_by_naked_filename ? SortByNakedFilename : SortWithOptions);
+	{
+		// Resolve each item's key only once rather than on every comparison, which is what made
+		// the numeric and column modes slow for large lists:
+		sort_params_type params;
+		params.case_sensitive = sort_case_sensitive;
+		params.reverse = sort_reverse && !sort_random;
+		params.compare = (sort_random || sort_numeric && !sort_by_naked_filename) ? SortKeyNumeric : SortKeyString;
+		size_t length;
+		for (item_curr = item; item_curr < item + item_count; ++item_curr)
+		{
+			cp = item_curr->item;
+			if (sort_column_offset > 0)
+			{
+				// Adjust the string (even for numerical sort) to be the right column position,
+				// or the position of its zero terminator if the column offset goes beyond its length:
+				length = _tcslen(cp);
+				cp += (size_t)sort_column_offset > length ? length : sort_column_offset;
+			}
+			item_curr->key = cp;
+			if (sort_random) // Takes precedence over all remaining options.
+				// I don't know the exact reasons, but using genrand_int31() is much more random than
+				// using genrand_int32() in this case.  Perhaps it is some kind of statistical/cyclical
+				// anomaly in the random number generator.
+				item_curr->num = genrand_int31();
+			else if (sort_numeric)
+				// For now, assume all items are numbers.  If one of them isn't, it will be sorted as a zero.
+				item_curr->num = ATOF(cp);
+			if (sort_by_naked_filename) // Takes precedence over the column offset for sorting purposes.
+			{
+				if (cp = _tcsrchr(item_curr->item, '\\'))  // Assign
+					item_curr->key = cp + 1;
+				else
+					item_curr->key = item_curr->item;
+			}
+		}
+		SortKeysParallel(item, item + item_count, item_count, params);
+	}
 
 	// Copy the sorted pointers back into output_var, which might not already be sized correctly
 	// if it's the clipboard or it was an environment variable when it came in as the input.
@@ -8267,24 +8371,24 @@ ResultType Line::PerformSort(LPTSTR aContents, LPTSTR aOptions)
 	DWORD omit_dupe_count = 0;
 	bool keep_this_item;
 	LPTSTR source, dest;
-	LPTSTR item_prev = NULL;
+	sort_key_type *item_prev = NULL;
 
 	// Copy the sorted result back into output_var.  Do all except the last item, since the last
 	// item gets special treatment depending on the options that were specified.  The call to
 	// output_var->Contents() below should never fail due to the above having prepped it:
-	item_curr = item; // i.e. Don't use [] indexing for the reason described higher above (same applies to item += unit_size below).
-	for (dest = output_var.Contents(), i = 0; i < item_count; ++i, item_curr += unit_size)
+	item_curr = item;
+	for (dest = output_var.Contents(), i = 0; i < item_count; ++i, ++item_curr)
 	{
 		keep_this_item = true;  // Set default.
 		if (omit_dupes && item_prev)
 		{
 			// Update to the comment below: Exact dupes will still be removed when sort_by_naked_filename
-			// or g_SortColumnOffset is in effect because duplicate lines would still be adjacent to
+			// or sort_column_offset is in effect because duplicate lines would still be adjacent to
 			// each other even in these modes.  There doesn't appear to be any exceptions, even if
 			// some items in the list are sorted as blanks due to being shorter than the specified 
-			// g_SortColumnOffset.
+			// sort_column_offset.
 			// As documented, special dupe-checking modes are not offered when sort_by_naked_filename
-			// is in effect, or g_SortColumnOffset is greater than 1.  That's because the need for such
+			// is in effect, or sort_column_offset is greater than 1.  That's because the need for such
 			// a thing seems too rare (and the result too strange) to justify the extra code size.
 			// However, adjacent dupes are still removed when any of the above modes are in effect,
 			// or when the "random" mode is in effect.  This might have some usefulness; for example,
@@ -8292,13 +8396,17 @@ ResultType Line::PerformSort(LPTSTR aContents, LPTSTR aOptions)
 			// the dupe-removal feature would remove duplicate songs if they happen to be sorted
 			// to lie adjacent to each other, which would be useful to prevent the same song from
 			// playing twice in a row.
-			if (g_SortNumeric && !g_SortColumnOffset)
-				// if g_SortColumnOffset is zero, fall back to the normal dupe checking in case its
+			if (sort_numeric && !sort_column_offset)
+				// if sort_column_offset is zero, fall back to the normal dupe checking in case its
 				// ever useful to anyone.  This is done because numbers in an offset column are not supported
 				// since the extra code size doensn't seem justified given the rarity of the need.
-				keep_this_item = (ATOF(*item_curr) != ATOF(item_prev)); // ATOF() ignores any trailing \r in CRLF mode, so no extra logic is needed for that.
+				// The value precomputed for the sort is reused unless the random mode overwrote it
+				// (or a UDF was used, in which case it was never computed):
+				keep_this_item = (g_SortFunc || sort_random)
+					? ATOF(item_curr->item) != ATOF(item_prev->item) // ATOF() ignores any trailing \r in CRLF mode, so no extra logic is needed for that.
+					: item_curr->num != item_prev->num;
 			else
-				keep_this_item = tcscmp2(*item_curr, item_prev, g_SortCaseSensitive); // v1.0.43.03: Added support for locale-insensitive mode.
+				keep_this_item = tcscmp2(item_curr->item, item_prev->item, sort_case_sensitive); // v1.0.43.03: Added support for locale-insensitive mode.
 				// Permutations of sorting case sensitive vs. eliminating duplicates based on case sensitivity:
 				// 1) Sort is not case sens, but dupes are: Won't work because sort didn't necessarily put
 				//    same-case dupes adjacent to each other.
@@ -8307,19 +8415,19 @@ ResultType Line::PerformSort(LPTSTR aContents, LPTSTR aOptions)
 				// 3) Both are case sensitive: seems okay
 				// 4) Both are not case sensitive: seems okay
 				//
-				// In light of the above, using the g_SortCaseSensitive flag to control the behavior of
+				// In light of the above, using the sort_case_sensitive flag to control the behavior of
 				// both sorting and dupe-removal seems best.
 		}
 		if (keep_this_item)
 		{
-			for (source = *item_curr; *source;)
+			for (source = item_curr->item; *source;)
 				*dest++ = *source++;
 			// If we're at the last item and the original list's last item had a terminating delimiter
 			// and the specified options said to treat it not as a delimiter but as a final char of sorts,
 			// include it after the item that is now last so that the overall layout is the same:
 			if (i < item_count_minus_1 || terminate_last_item_with_delimiter)
 				*dest++ = delimiter;  // Put each item's delimiter back in so that format is the same as the original.
-			item_prev = *item_curr; // Since the item just processed above isn't a dupe, save this item to compare against the next item.
+			item_prev = item_curr; // Since the item just processed above isn't a dupe, save this item to compare against the next item.
 		}
 		else // This item is a duplicate of the previous item.
 		{
@@ -9916,6 +10024,58 @@ bool Line::FileCreateDir(LPTSTR aDirSpec, LPTSTR aCanModifyDirSpec)
 
 
 
+#define FILEREAD_MAP_MIN_SIZE (1024 * 1024) // Smaller files are read normally since mapping has more overhead.
+
+static ResultType AssignFileText(Var &aOutputVar, LPBYTE &aBuf, DWORD aSize, UINT aCodepage, bool aBufIsOwned)
+// Converts the contents of a text file read by FileRead into aOutputVar, detecting UTF-8 and UTF-16LE BOMs.
+// If aBufIsOwned is true, aBuf is a malloc'd block with room for a terminator, and if it is handed
+// over to aOutputVar, aBuf is set to NULL.  Otherwise aBuf is neither written to nor freed.
+{
+	if (aSize >= 3 && aBuf[0] == 0xEF && aBuf[1] == 0xBB && aBuf[2] == 0xBF) // UTF-8 BOM
+		return aOutputVar.AssignStringFromUTF8((LPCSTR)aBuf + 3, aSize - 3);
+	bool has_bom;
+	if ( (has_bom = (aSize >= 2 && aBuf[0] == 0xFF && aBuf[1] == 0xFE)) // UTF-16LE BOM
+		|| aCodepage == CP_UTF16 ) // Covers FileEncoding UTF-16 and FileEncoding UTF-16-RAW.
+	{
+		LPCWSTR text_start = (LPCWSTR)aBuf;
+		if (has_bom) {
+			text_start ++; // Skip BOM.
+			aSize -= 2; // Exclude BOM from calculations below for consistency; include only the actual data.
+		}
+		return aOutputVar.AssignStringW(text_start, aSize / sizeof(wchar_t));
+	}
+#ifndef UNICODE
+	if (aCodepage == CP_ACP || aCodepage == GetACP())
+	{
+		if (!aBufIsOwned)
+			return aOutputVar.Assign((LPCSTR)aBuf, aSize);
+		// Avoid any unnecessary conversion or copying by using our malloc'd buffer directly.
+		// This should be worth doing since the string must otherwise be converted to UTF-16 and back.
+		aBuf[aSize] = 0; // Ensure text is terminated where indicated.
+		aOutputVar.AcceptNewMem((LPTSTR)aBuf, aSize);
+		aBuf = NULL; // AcceptNewMem took charge of it.
+		return OK;
+	}
+#endif
+	return aOutputVar.AssignStringFromCodePage((LPCSTR)aBuf, aSize, aCodepage);
+}
+
+static BOOL AssignMappedFileText(Var &aOutputVar, LPBYTE aView, DWORD aSize, UINT aCodepage)
+// Same as AssignFileText(), but for a view of a mapped file.  Unlike ReadFile(), a read error while
+// accessing a view is reported by raising an exception, which is handled here.
+{
+	__try
+	{
+		g->LastError = 0;
+		return AssignFileText(aOutputVar, aView, aSize, aCodepage, false) == OK;
+	}
+	__except(GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+	{
+		g->LastError = ERROR_READ_FAULT;
+		return FALSE;
+	}
+}
+
 ResultType Line::FileRead(LPTSTR aFilespec)
 // Returns OK or FAIL.  Will almost always return OK because if an error occurs,
 // the script's ErrorLevel variable will be set accordingly.  However, if some
@@ -10035,8 +10195,33 @@ ResultType Line::FileRead(LPTSTR aFilespec)
 		return SetErrorsOrThrow(false, 0); // Indicate success (a zero-length file results in empty output_var).
 	}
 
+	BOOL result;
+	DWORD bytes_actually_read;
 	LPBYTE output_buf;
-	bool output_buf_is_var = is_binary_clipboard && output_var.Type() != VAR_CLIPBOARD;
+	bool output_buf_is_var;
+	if (!is_binary_clipboard && bytes_to_read >= FILEREAD_MAP_MIN_SIZE)
+	{
+		// For large files, map a view of the file rather than reading it into a temporary buffer, so that
+		// the text is converted (or copied) directly from the file system cache into output_var.  This avoids
+		// allocating and filling a second buffer as large as the file.  If the file can't be mapped (e.g. it's
+		// a device, or there isn't enough contiguous address space), fall back to reading it normally.
+		HANDLE hmap = CreateFileMapping(hfile, NULL, PAGE_READONLY, 0, 0, NULL);
+		LPBYTE view = hmap ? (LPBYTE)MapViewOfFile(hmap, FILE_MAP_READ, 0, 0, (SIZE_T)bytes_to_read) : NULL;
+		if (view)
+		{
+			result = AssignMappedFileText(output_var, view, (DWORD)bytes_to_read, codepage);
+			UnmapViewOfFile(view);
+			CloseHandle(hmap);
+			CloseHandle(hfile);
+			if (!result)
+				output_var.Assign(); // In case a read error interrupted the conversion part-way.
+			goto text_assigned;
+		}
+		if (hmap)
+			CloseHandle(hmap);
+	}
+
+	output_buf_is_var = is_binary_clipboard && output_var.Type() != VAR_CLIPBOARD;
 	if (output_buf_is_var) 
 	{
 		// Set up the var, enlarging it if necessary.  If the output_var is of type VAR_CLIPBOARD,
@@ -10062,8 +10247,7 @@ ResultType Line::FileRead(LPTSTR aFilespec)
 		return FAIL;
 	}
 
-	DWORD bytes_actually_read;
-	BOOL result = ReadFile(hfile, output_buf, (DWORD)bytes_to_read, &bytes_actually_read, NULL);
+	result = ReadFile(hfile, output_buf, (DWORD)bytes_to_read, &bytes_actually_read, NULL);
 	g->LastError = GetLastError();
 	CloseHandle(hfile);
 
@@ -10076,42 +10260,11 @@ ResultType Line::FileRead(LPTSTR aFilespec)
 	{
 		if (!is_binary_clipboard) // text mode, do UTF-8 and UTF-16LE BOM checking
 		{
-			bool has_bom;
-			if (bytes_actually_read >= 3 && output_buf[0] == 0xEF && output_buf[1] == 0xBB && output_buf[2] == 0xBF) // UTF-8 BOM
-			{
-				if (!output_var.AssignStringFromUTF8((LPCSTR)output_buf + 3, bytes_actually_read - 3))
-					result = FALSE;
-			}
-			else if ( (has_bom = (bytes_actually_read >= 2 && output_buf[0] == 0xFF && output_buf[1] == 0xFE)) // UTF-16LE BOM
-					|| codepage == CP_UTF16 ) // Covers FileEncoding UTF-16 and FileEncoding UTF-16-RAW.
-			{
-				LPCWSTR text_start = (LPCWSTR)output_buf;
-				DWORD text_size = bytes_actually_read;
-				if (has_bom) {
-					text_start ++; // Skip BOM.
-					text_size -= 2; // Exclude BOM from calculations below for consistency; include only the actual data.
-				}
-				if (!output_var.AssignStringW(text_start, text_size / sizeof(wchar_t)))
-					result = FALSE;
-			}
-			else
-			{
-#ifndef UNICODE
-				if (codepage == CP_ACP || codepage == GetACP())
-				{
-					// Avoid any unnecessary conversion or copying by using our malloc'd buffer directly.
-					// This should be worth doing since the string must otherwise be converted to UTF-16 and back.
-					output_buf[bytes_actually_read] = 0; // Ensure text is terminated where indicated.
-					output_var.AcceptNewMem((LPTSTR)output_buf, bytes_actually_read);
-					output_buf = NULL; // AcceptNewMem took charge of it.
-				}
-				else
-#endif
-				if (!output_var.AssignStringFromCodePage((LPCSTR)output_buf, bytes_actually_read, codepage))
-					result = FALSE;
-			}
+			if (!AssignFileText(output_var, output_buf, bytes_actually_read, codepage, true))
+				result = FALSE;
 			if (output_buf) // i.e. it wasn't "claimed" above.
 				free(output_buf);
+text_assigned:
 			output_buf = (LPBYTE) output_var.Contents();
 			if (translate_crlf_to_lf)
 			{
@@ -13331,6 +13484,139 @@ bool IsDllArgTypeName(LPTSTR name)
 
 
 
+// Compiled signatures of DllCall: the attributes of the return type and each arg type, parsed once for a
+// given combination of type strings.  Only calls whose type parameters are all literal strings can use
+// them, since the text of a literal never changes.  The address of a function in one of the standard
+// modules is also kept, since those modules are never unloaded.
+struct DllSignature
+{
+	DYNAPARM return_attrib;
+	void *function; // NULL unless the signature is specific to a function in a standard module.
+#ifdef WIN32_PLATFORM
+	int dll_call_mode;
+#endif
+	int param_count; // Parameter count of DllCall, which tells whether the return type was specified.
+	int arg_count;
+	UINT hash;
+	DYNAPARM *arg; // Only the type attributes are used.
+	LPTSTR key; // The function name (or "") followed by each type string, each null-terminated.
+};
+static DllSignature **sDllSignature = NULL;
+static size_t sDllSignatureCount = 0, sDllSignatureCapacity = 0; // sDllSignatureCapacity is always a power of two (or zero).
+#define DLL_SIGNATURE_CACHE_LIMIT 4096
+
+
+
+static bool HashDllSignature(LPCTSTR aFuncName, ExprTokenType *aParam[], int aParamCount, UINT &aHash)
+// Returns false if any of the types isn't a literal string, in which case no signature can be used.
+// The return type (if any) and the arg types are always the odd-numbered parameters.
+{
+	UINT h = tcshash(aFuncName);
+	for (int i = 1; i < aParamCount; i += 2)
+	{
+		if (aParam[i]->symbol != SYM_STRING && aParam[i]->symbol != SYM_OPERAND)
+			return false;
+		h = (h ^ tcshash(aParam[i]->marker)) * 16777619U;
+	}
+	aHash = h ^ (UINT)aParamCount;
+	return true;
+}
+
+
+
+static DllSignature *FindDllSignature(UINT aHash, LPCTSTR aFuncName, ExprTokenType *aParam[], int aParamCount)
+// Caller has ensured HashDllSignature() returned true for these parameters.
+{
+	if (!sDllSignatureCount)
+		return NULL;
+	size_t mask = sDllSignatureCapacity - 1;
+	for (size_t i = aHash & mask; sDllSignature[i]; i = (i + 1) & mask)
+	{
+		DllSignature &sig = *sDllSignature[i];
+		if (sig.hash != aHash || sig.param_count != aParamCount || _tcscmp(sig.key, aFuncName))
+			continue;
+		LPCTSTR key = sig.key + _tcslen(sig.key) + 1;
+		int p;
+		for (p = 1; p < aParamCount && !_tcscmp(key, aParam[p]->marker); p += 2)
+			key += _tcslen(key) + 1;
+		if (p >= aParamCount) // All types matched.
+			return &sig;
+	}
+	return NULL;
+}
+
+
+
+static void AddDllSignature(DllSignature &aSig, UINT aHash, LPCTSTR aFuncName, ExprTokenType *aParam[], int aParamCount
+	, DYNAPARM *aArg, int aArgCount)
+// Caller has set the return type, calling convention and function of aSig, and has ensured that the
+// signature isn't already present.  If it can't be added, the types will simply be parsed each time.
+{
+	if (sDllSignatureCount >= DLL_SIGNATURE_CACHE_LIMIT)
+		return;
+	if ((sDllSignatureCount + 1) * 2 > sDllSignatureCapacity)
+	{	// Keep the table at most half full.
+		size_t new_capacity = sDllSignatureCapacity ? sDllSignatureCapacity * 2 : 64;
+		DllSignature **new_table = (DllSignature **)calloc(new_capacity, sizeof(DllSignature *));
+		if (!new_table)
+			return;
+		for (size_t i = 0; i < sDllSignatureCapacity; ++i)
+			if (sDllSignature[i])
+			{
+				size_t j;
+				for (j = sDllSignature[i]->hash & (new_capacity - 1); new_table[j]; j = (j + 1) & (new_capacity - 1));
+				new_table[j] = sDllSignature[i];
+			}
+		free(sDllSignature);
+		sDllSignature = new_table;
+		sDllSignatureCapacity = new_capacity;
+	}
+	size_t key_length = _tcslen(aFuncName) + 1;
+	int p;
+	for (p = 1; p < aParamCount; p += 2)
+		key_length += _tcslen(aParam[p]->marker) + 1;
+	// Allocate the signature, its arg types and its key as one block:
+	DllSignature *sig = (DllSignature *)malloc(sizeof(DllSignature) + aArgCount * sizeof(DYNAPARM) + key_length * sizeof(TCHAR));
+	if (!sig)
+		return;
+	*sig = aSig; // Struct copy.
+	sig->hash = aHash;
+	sig->param_count = aParamCount;
+	sig->arg_count = aArgCount;
+	sig->arg = (DYNAPARM *)(sig + 1);
+	sig->key = (LPTSTR)(sig->arg + aArgCount);
+	for (int i = 0; i < aArgCount; ++i)
+	{
+		sig->arg[i] = aArg[i]; // Struct copy.
+		sig->arg[i].value_int64 = 0; // The value was specific to this call.
+	}
+	LPTSTR key = sig->key;
+	_tcscpy(key, aFuncName);
+	for (p = 1; p < aParamCount; p += 2)
+	{
+		key += _tcslen(key) + 1;
+		_tcscpy(key, aParam[p]->marker);
+	}
+	size_t i, mask = sDllSignatureCapacity - 1;
+	for (i = aHash & mask; sDllSignature[i]; i = (i + 1) & mask);
+	sDllSignature[i] = sig;
+	++sDllSignatureCount;
+}
+
+
+
+void ClearDllSignatureCache()
+// Called when the script is destroyed.
+{
+	for (size_t i = 0; i < sDllSignatureCapacity; ++i)
+		free(sDllSignature[i]);
+	free(sDllSignature);
+	sDllSignature = NULL;
+	sDllSignatureCount = sDllSignatureCapacity = 0;
+}
+
+
+
 void *GetDllProcAddress(LPCTSTR aDllFileFunc, HMODULE *hmodule_to_free) // L31: Contains code extracted from BIF_DllCall for reuse in ExpressionToPostfix.
 {
 	int i;
@@ -13905,6 +14191,8 @@ ResultType STDMETHODCALLTYPE DynaToken::Invoke(
 				return FAIL;
 			}
 			// Otherwise, it's a supported type of string.
+			if (this_param.symbol == SYM_VAR && Var::sBorrow) // The function might write into the variable's memory, so give any borrower (e.g. Loop Parse) its own copy first.
+				this_param.var->ResolveAlias()->CopyBorrowed();
 			this_dyna_param.ptr = TokenToString(this_param); // SYM_VAR's Type() is always VAR_NORMAL (except lvalues in expressions).
 
 			// NOTES ABOUT THE ABOVE:
@@ -14299,6 +14587,8 @@ BIF_DECL(BIF_DllImport)
 				return;
 			}
 			// Otherwise, it's a supported type of string.
+			if (this_param.symbol == SYM_VAR && Var::sBorrow) // The function might write into the variable's memory, so give any borrower (e.g. Loop Parse) its own copy first.
+				this_param.var->ResolveAlias()->CopyBorrowed();
 			this_dyna_param.ptr = TokenToString(this_param); // SYM_VAR's Type() is always VAR_NORMAL (except lvalues in expressions).
 			// NOTES ABOUT THE ABOVE:
 			// UPDATE: The v1.0.44.14 item below doesn't work in release mode, only debug mode (turning off
@@ -14730,7 +15020,29 @@ BIF_DECL(BIF_DllCall)
 #ifdef WIN32_PLATFORM
 	int dll_call_mode = DC_CALL_STD; // Set default.  Can be overridden to DC_CALL_CDECL and flags can be OR'd into it.
 #endif
-	if (aParamCount % 2) // Odd number of parameters indicates the return type has been omitted, so assume BOOL/INT.
+
+	// If all types are literal strings, use the signature compiled by a previous call with the same types
+	// rather than parsing them again.  The signature is specific to the function only if it's in one of
+	// the standard modules (i.e. no DLL name was specified), since only then can its address be kept.
+	LPTSTR sig_func_name = (!function && (aParam[0]->symbol == SYM_STRING || aParam[0]->symbol == SYM_OPERAND)
+		&& !_tcschr(aParam[0]->marker, '\\')) ? aParam[0]->marker : _T("");
+	int sig_param_count = aParamCount; // Saved because aParamCount is adjusted below.
+	UINT sig_hash;
+	bool sig_allowed = HashDllSignature(sig_func_name, aParam, aParamCount, sig_hash);
+	DllSignature *sig = sig_allowed ? FindDllSignature(sig_hash, sig_func_name, aParam, aParamCount) : NULL;
+
+	if (sig)
+	{
+		return_attrib = sig->return_attrib;
+#ifdef WIN32_PLATFORM
+		dll_call_mode = sig->dll_call_mode;
+#endif
+		if (!(aParamCount % 2)) // The return type was specified.
+			--aParamCount;  // Remove the last parameter from further consideration.
+		if (!function)
+			function = sig->function; // NULL if the signature isn't specific to a function.
+	}
+	else if (aParamCount % 2) // Odd number of parameters indicates the return type has been omitted, so assume BOOL/INT.
 		return_attrib.type = DLL_ARG_INT;
 	else
 	{
@@ -14828,32 +15140,37 @@ has_valid_return_type:
 	// It has also verified that the dyna_param array is large enough to hold all of the args.
 	for (arg_count = 0, i = 1; i < aParamCount; ++arg_count, i += 2)  // Same loop as used later below, so maintain them together.
 	{
-		switch (aParam[i]->symbol)
-		{
-		case SYM_VAR: // SYM_VAR's Type() is always VAR_NORMAL (except lvalues in expressions).
-			arg_type_string[0] = aParam[i]->var->Contents(TRUE, TRUE);
-			arg_type_string[1] = aParam[i]->var->mName;
-			// v1.0.33.01: arg_type_string[1] improves convenience by falling back to the variable's name
-			// if the contents are not appropriate.  In other words, both Int and "Int" are treated the same.
-			// It's done this way to allow the variable named "Int" to actually contain some other legitimate
-			// type-name such as "Str" (in case anyone ever happens to do that).
-			break;
-		case SYM_STRING:
-		case SYM_OPERAND:
-			arg_type_string[0] = aParam[i]->marker;
-			arg_type_string[1] = NULL; // Added in 1.0.48.
-			break;
-		default:
-			arg_type_string[0] = _T(""); // It will be detected as invalid below.
-			arg_type_string[1] = NULL;
-			break;
-		}
-
 		ExprTokenType &this_param = *aParam[i + 1];         // Resolved for performance and convenience.
 		DYNAPARM &this_dyna_param = dyna_param[arg_count];  //
 
+		if (sig)
+			this_dyna_param = sig->arg[arg_count]; // Struct copy of the already-parsed type.
+		else
+		{
+			switch (aParam[i]->symbol)
+			{
+			case SYM_VAR: // SYM_VAR's Type() is always VAR_NORMAL (except lvalues in expressions).
+				arg_type_string[0] = aParam[i]->var->Contents(TRUE, TRUE);
+				arg_type_string[1] = aParam[i]->var->mName;
+				// v1.0.33.01: arg_type_string[1] improves convenience by falling back to the variable's name
+				// if the contents are not appropriate.  In other words, both Int and "Int" are treated the same.
+				// It's done this way to allow the variable named "Int" to actually contain some other legitimate
+				// type-name such as "Str" (in case anyone ever happens to do that).
+				break;
+			case SYM_STRING:
+			case SYM_OPERAND:
+				arg_type_string[0] = aParam[i]->marker;
+				arg_type_string[1] = NULL; // Added in 1.0.48.
+				break;
+			default:
+				arg_type_string[0] = _T(""); // It will be detected as invalid below.
+				arg_type_string[1] = NULL;
+				break;
+			}
+			ConvertDllArgType(arg_type_string, this_dyna_param);
+		}
+
 		// Store the each arg into a dyna_param struct, using its arg type to determine how.
-		ConvertDllArgType(arg_type_string, this_dyna_param);
 		switch (this_dyna_param.type)
 		{
 		case DLL_ARG_STR:
@@ -14870,6 +15187,8 @@ has_valid_return_type:
 				return;
 			}
 			// Otherwise, it's a supported type of string.
+			if (this_param.symbol == SYM_VAR && Var::sBorrow) // The function might write into the variable's memory, so give any borrower (e.g. Loop Parse) its own copy first.
+				this_param.var->ResolveAlias()->CopyBorrowed();
 			this_dyna_param.ptr = TokenToString(this_param); // SYM_VAR's Type() is always VAR_NORMAL (except lvalues in expressions).
 			// NOTES ABOUT THE ABOVE:
 			// UPDATE: The v1.0.44.14 item below doesn't work in release mode, only debug mode (turning off
@@ -14966,6 +15285,17 @@ has_valid_return_type:
 			goto end;
 	}
 
+	if (sig_allowed && !sig) // Compile a signature for subsequent calls with the same types.
+	{
+		DllSignature new_sig;
+		new_sig.return_attrib = return_attrib;
+#ifdef WIN32_PLATFORM
+		new_sig.dll_call_mode = dll_call_mode;
+#endif
+		new_sig.function = *sig_func_name ? function : NULL;
+		AddDllSignature(new_sig, sig_hash, sig_func_name, aParam, sig_param_count, dyna_param, arg_count);
+	}
+
 	////////////////////////
 	// Call the DLL function
 	////////////////////////
@@ -15218,12 +15548,27 @@ end:
 
 #endif
 
+static int CriticalObjectMode(ExprTokenType &aToken)
+// Returns the CRITICAL_MODE named by aToken, -1 if aToken is empty or numeric (i.e. a critical
+// section or query type rather than a mode name), or -2 if it is not a recognized name.
+{
+	TCHAR buf[MAX_NUMBER_SIZE];
+	LPTSTR name = TokenToString(aToken, buf);
+	if (!*name || IsPureNumeric(name, TRUE))
+		return -1;
+	if (!_tcsicmp(name, _T("RW")))
+		return CRITICAL_MODE_SHARED;
+	if (!_tcsicmp(name, _T("Snapshot")))
+		return CRITICAL_MODE_SNAPSHOT;
+	return -2;
+}
+
 BIF_DECL(BIF_CriticalObject)
 {
 	IObject *obj = NULL;
 	// If 2 parameters are given and second parameter is 1 or 2,
 	// means we want to get the reference to obj(1) or crisec(2)
-	if (aParamCount == 2 && TokenToInt64(*aParam[1]) < 3) 
+	if (aParamCount == 2 && CriticalObjectMode(*aParam[1]) == -1 && TokenToInt64(*aParam[1]) < 3) 
 	{
 		aResultToken.symbol = PURE_INTEGER;
 		CriticalObject *criticalobj;
@@ -15250,16 +15595,63 @@ BIF_DECL(BIF_CriticalObject)
 }
 
 
+static inline void CriticalObjectYield()
+// Waits briefly for another thread to finish with a CriticalObject.  Messages are processed while
+// waiting on the main thread to avoid deadlocking with a thread which is waiting for the main thread.
+{
+#ifdef _WIN64
+	DWORD aThreadID = __readgsdword(0x48); // Used to identify if code is called from different thread (AutoHotkey.dll)
+#else
+	DWORD aThreadID = __readfsdword(0x24);
+#endif
+	if (g_MainThreadID == aThreadID)
+		MsgSleep(-1);
+	else
+		Sleep(0);
+}
+
+static void CriticalObjectEnter(LPCRITICAL_SECTION aSection)
+{
+	while (!TryEnterCriticalSection(aSection))
+		CriticalObjectYield();
+}
+
+static Object *CriticalObjectCopy(Object *aObject)
+// Returns a new version of a snapshot-mode object, to be modified by a writer before it is published.
+{
+	Object *copy = aObject->Clone();
+	if (copy)
+		copy->SetBase(aObject->Base());
+	return copy;
+}
+
+
 CriticalObject *CriticalObject::Create(ExprTokenType *aParam[], int aParamCount)
 {
 	IObject *obj = NULL;
 	CriticalObject *criticalref = NULL;
-	if (aParamCount == 0) // No parameters given, create new object
+	int mode = aParamCount < 2 ? -1 : CriticalObjectMode(*aParam[1]);
+	if (mode == -2)
+	{
+		g_script.ScriptError(ERR_PARAM2_INVALID);
+		return NULL;
+	}
+	bool create_new = aParamCount == 0 || mode >= 0 && TokenIsEmptyString(*aParam[0]);
+	if (create_new) // No object given, create new object
 		obj = Object::Create(0,0);
 	else if (obj = TokenToObject(*aParam[0]))
 	{	
 		if (criticalref = dynamic_cast<CriticalObject *>(obj))
+		{
+			if (mode >= 0 && mode != criticalref->Mode()) // It can't be given a different mode since its lock is shared.
+			{
+				g_script.ScriptError(ERR_PARAM2_INVALID);
+				return NULL;
+			}
+			if (criticalref->mShare)
+				return criticalref->Share();
 			obj = (IObject *)criticalref->GetObj();
+		}
 		obj->AddRef();
 	} 
 	else if (obj = (IObject *)TokenToInt64(*aParam[0]))
@@ -15268,6 +15660,13 @@ CriticalObject *CriticalObject::Create(ExprTokenType *aParam[], int aParamCount)
 			obj = NULL;
 		else if (criticalref = dynamic_cast<CriticalObject *>(obj))
 		{
+			if (mode >= 0 && mode != criticalref->Mode())
+			{
+				g_script.ScriptError(ERR_PARAM2_INVALID);
+				return NULL;
+			}
+			if (criticalref->mShare)
+				return criticalref->Share();
 			obj = (IObject *)criticalref->GetObj();
 			obj->AddRef();
 		}
@@ -15276,16 +15675,59 @@ CriticalObject *CriticalObject::Create(ExprTokenType *aParam[], int aParamCount)
 	}
 	if (!obj)
 	{	
-		g_script.ScriptError(aParamCount == 0 ? ERR_OUTOFMEM : ERR_PARAM1_INVALID );
+		g_script.ScriptError(create_new ? ERR_OUTOFMEM : ERR_PARAM1_INVALID );
 		return NULL;
 	}
+	if (mode > CRITICAL_MODE_EXCLUSIVE && !criticalref)
+	{
+		Object *version = NULL;
+		if (mode == CRITICAL_MODE_SNAPSHOT)
+		{
+			// Take a private copy so that references to the original can't modify a published version.
+			Object *original = dynamic_cast<Object *>(obj);
+			if (!original)
+			{
+				obj->Release();
+				g_script.ScriptError(ERR_PARAM1_INVALID);
+				return NULL;
+			}
+			version = CriticalObjectCopy(original);
+			obj->Release();
+			if (!version)
+			{
+				g_script.ScriptError(ERR_OUTOFMEM);
+				return NULL;
+			}
+			version->PrepareForSharedReads();
+			obj = NULL;
+		}
+		CriticalShare *share = (CriticalShare *)GlobalAlloc(GMEM_ZEROINIT, sizeof(CriticalShare));
+		if (!share)
+		{
+			if (version)
+				version->Release();
+			if (obj)
+				obj->Release();
+			g_script.ScriptError(ERR_OUTOFMEM);
+			return NULL;
+		}
+		InitializeCriticalSection(&share->mSection);
+		share->mRefCount = 1;
+		share->mMode = mode;
+		share->mObject = version;
+		CriticalObject *criticalobj = new CriticalObject();
+		criticalobj->mShare = share;
+		criticalobj->lpCriticalSection = &share->mSection;
+		criticalobj->object = obj;
+		return criticalobj;
+	}
 	// create new critical object
 	CriticalObject *criticalobj = new CriticalObject();
 	criticalobj->object = obj;
 
 	if (criticalref)
 		criticalobj->lpCriticalSection = (LPCRITICAL_SECTION)criticalref->GetCriSec();
-	else if (aParamCount < 2)
+	else if (aParamCount < 2 || TokenIsEmptyString(*aParam[1]))
 	{	// no Critical Section reference was given, create one
 		criticalobj->lpCriticalSection = (LPCRITICAL_SECTION)GlobalAlloc(0, sizeof(CRITICAL_SECTION));
 		InitializeCriticalSection(criticalobj->lpCriticalSection);
@@ -15296,6 +15738,18 @@ CriticalObject *CriticalObject::Create(ExprTokenType *aParam[], int aParamCount)
 	return criticalobj;
 }
 
+CriticalObject *CriticalObject::Share()
+// Returns a new CriticalObject which shares this one's lock and mode.
+{
+	CriticalObject *criticalobj = new CriticalObject();
+	criticalobj->mShare = mShare;
+	criticalobj->lpCriticalSection = &mShare->mSection;
+	InterlockedIncrement(&mShare->mRefCount);
+	if (this->object) // Otherwise this is snapshot mode, where the current version is always retrieved from mShare.
+		(criticalobj->object = this->object)->AddRef();
+	return criticalobj;
+}
+
 //
 // CriticalObject::Delete - Called immediately before the object is deleted.
 //					Returns false if object should not be deleted yet.
@@ -15304,45 +15758,162 @@ CriticalObject *CriticalObject::Create(ExprTokenType *aParam[], int aParamCount)
 bool CriticalObject::Delete()
 {
 	// Avoid deadlocking the process so messages can still be processed
-
-#ifdef _WIN64
-	DWORD aThreadID = __readgsdword(0x48); // Used to identify if code is called from different thread (AutoHotkey.dll)
-#else
-	DWORD aThreadID = __readfsdword(0x24);
-#endif
-
-	// Check if we own the critical section and release it
-	while (!TryEnterCriticalSection(this->lpCriticalSection))
-		if (g_MainThreadID == aThreadID)
-			MsgSleep(-1);
-		else
-			Sleep(0); 
-	this->object->Release();
-	LeaveCriticalSection(this->lpCriticalSection);
+	if (!mShare)
+	{
+		// Check if we own the critical section and release it
+		CriticalObjectEnter(this->lpCriticalSection);
+		this->object->Release();
+		LeaveCriticalSection(this->lpCriticalSection);
+		return ObjectBase::Delete();
+	}
+	if (this->object)
+	{
+		EnterExclusive();
+		this->object->Release();
+		LeaveCriticalSection(&mShare->mSection);
+	}
+	if (!InterlockedDecrement(&mShare->mRefCount))
+	{
+		if (mShare->mObject)
+			mShare->mObject->Release();
+		DeleteCriticalSection(&mShare->mSection);
+		GlobalFree(mShare);
+	}
 	return ObjectBase::Delete();
 }
 
-ResultType STDMETHODCALLTYPE CriticalObject::Invoke(
-                                            ExprTokenType &aResultToken,
-                                            ExprTokenType &aThisToken,
-                                            int aFlags,
-                                            ExprTokenType *aParam[],
-                                            int aParamCount
-                                            )
- {
+//
+// Reader-writer and snapshot modes.
+//
+// In RW mode, readers pass through mSection only to register themselves in mReaders[0], so a writer
+// which holds mSection blocks new readers and then waits for existing ones to finish.
+//
+// In snapshot mode, readers take no lock at all.  A reader registers itself under the parity of the
+// current epoch and then invokes whichever version is current.  A writer (holding mSection, so writers
+// are serialized) modifies a copy, publishes it, advances the epoch and waits only for the readers
+// registered under the previous epoch before releasing the old version.
+//
+// Either way, a thread which is reading must not write to the same object (e.g. from a __Get
+// meta-function), since the writer would wait for the reader to finish.
+//
 
-#ifdef _WIN64
-	 DWORD aThreadID = __readgsdword(0x48); // Used to identify if code is called from different thread (AutoHotkey.dll)
-#else
-	 DWORD aThreadID = __readfsdword(0x24);
-#endif
+void CriticalObject::EnterShared(LONG &aSlot)
+{
+	if (mShare->mMode == CRITICAL_MODE_SNAPSHOT)
+	{
+		for (;;)
+		{
+			LONG epoch = mShare->mEpoch;
+			aSlot = epoch & 1;
+			InterlockedIncrement(&mShare->mReaders[aSlot]);
+			if (mShare->mEpoch == epoch)
+				return;
+			// A writer published a new version in the meantime and might not have seen this reader.
+			InterlockedDecrement(&mShare->mReaders[aSlot]);
+		}
+	}
+	CriticalObjectEnter(&mShare->mSection);
+	InterlockedIncrement(&mShare->mReaders[aSlot = 0]);
+	LeaveCriticalSection(&mShare->mSection);
+}
 
-	 // Avoid deadlocking the process so messages can still be processed
-	 while (!TryEnterCriticalSection(this->lpCriticalSection))
-		if (g_MainThreadID == aThreadID)
-			MsgSleep(-1);
-		else
-			Sleep(0); 
+void CriticalObject::EnterExclusive()
+{
+	CriticalObjectEnter(&mShare->mSection);
+	if (mShare->mMode == CRITICAL_MODE_SHARED)
+		while (mShare->mReaders[0])
+			CriticalObjectYield();
+}
+
+bool CriticalObject::IsReadOnlyInvoke(IObject *aObject, int aFlags, ExprTokenType *aParam[], int aParamCount)
+// Returns true for gets and for calls to those built-in methods of Object which don't modify it.
+// This relies on any meta-functions or overriding methods defined by the script doing likewise.
+{
+	if (IS_INVOKE_GET)
+		return true;
+	if (!IS_INVOKE_CALL || !aParamCount)
+		return false;
+	Object *obj = dynamic_cast<Object *>(aObject);
+	if (!obj)
+		return false;
+	TCHAR buf[MAX_NUMBER_SIZE];
+	switch (obj->GetBuiltinID(TokenToString(*aParam[0], buf)))
+	{
+	case FID_ObjHasKey:
+	case FID_ObjLength:
+	case FID_ObjCount:
+	case FID_ObjMaxIndex:
+	case FID_ObjMinIndex:
+	case FID_ObjGetCapacity:
+	case FID_ObjNewEnum: // The enumerator is wrapped below so that Next() is exclusive.
+		return true;
+	}
+	return false;
+}
+
+ResultType CriticalObject::InvokeSnapshotWrite(ExprTokenType &aResultToken, ExprTokenType &aThisToken, int aFlags, ExprTokenType *aParam[], int aParamCount)
+{
+	CriticalObjectEnter(&mShare->mSection);
+	ResultType r;
+	if (mShare->mPending)
+	{
+		// This thread is already writing (e.g. this was called by a meta-function), so apply
+		// the change to the same copy rather than publishing a copy which lacks it.
+		r = mShare->mPending->Invoke(aResultToken, aThisToken, aFlags, aParam, aParamCount);
+		LeaveCriticalSection(&mShare->mSection);
+		return r;
+	}
+	IObject *current = mShare->mObject;
+	Object *version = CriticalObjectCopy((Object *)current);
+	if (!version)
+	{
+		LeaveCriticalSection(&mShare->mSection);
+		return g_script.ScriptError(ERR_OUTOFMEM);
+	}
+	mShare->mPending = version;
+	r = version->Invoke(aResultToken, aThisToken, aFlags, aParam, aParamCount);
+	mShare->mPending = NULL;
+	version->PrepareForSharedReads();
+	// Publish the new version, then wait for any readers which might still be using the old one.
+	mShare->mObject = version;
+	LONG slot = (InterlockedIncrement(&mShare->mEpoch) - 1) & 1;
+	while (mShare->mReaders[slot])
+		CriticalObjectYield();
+	current->Release();
+	LeaveCriticalSection(&mShare->mSection);
+	return r;
+}
+
+ResultType STDMETHODCALLTYPE CriticalObject::Invoke(
+                                            ExprTokenType &aResultToken,
+                                            ExprTokenType &aThisToken,
+                                            int aFlags,
+                                            ExprTokenType *aParam[],
+                                            int aParamCount
+                                            )
+ {
+	 LONG slot = -1;
+	 if (!mShare)
+		 // Avoid deadlocking the process so messages can still be processed
+		 CriticalObjectEnter(this->lpCriticalSection);
+	 else if (mShare->mMode == CRITICAL_MODE_SNAPSHOT)
+	 {
+		 EnterShared(slot); // Keeps the version alive even if a writer replaces it.
+		 IObject *version = mShare->mObject;
+		 if (!IsReadOnlyInvoke(version, aFlags, aParam, aParamCount))
+		 {
+			 LeaveShared(slot);
+			 return InvokeSnapshotWrite(aResultToken, aThisToken, aFlags, aParam, aParamCount);
+		 }
+		 // Published versions are never modified, so enumerators need no lock.
+		 ResultType r = version->Invoke(aResultToken, aThisToken, aFlags, aParam, aParamCount);
+		 LeaveShared(slot);
+		 return r;
+	 }
+	 else if (IsReadOnlyInvoke(this->object, aFlags, aParam, aParamCount))
+		 EnterShared(slot);
+	 else
+		 EnterExclusive();
 	 // Invoke original object as if it was called
 	 ResultType r = this->object->Invoke(aResultToken,aThisToken,aFlags,aParam,aParamCount);
 	 if (aResultToken.symbol == SYM_OBJECT && dynamic_cast<EnumBase *>(aResultToken.object))
@@ -15351,9 +15922,14 @@ ResultType STDMETHODCALLTYPE CriticalObject::Invoke(
 		CriticalObject *new_object = new CriticalObject();
 		new_object->object = aResultToken.object;
 		new_object->lpCriticalSection = this->lpCriticalSection;
+		if (new_object->mShare = mShare)
+			InterlockedIncrement(&mShare->mRefCount);
 		aResultToken.object = new_object;
 	 }
-	 LeaveCriticalSection(this->lpCriticalSection);
+	 if (slot >= 0)
+		 LeaveShared(slot);
+	 else
+		 LeaveCriticalSection(this->lpCriticalSection);
 	 return r;
 }
 
@@ -15457,12 +16033,12 @@ BIF_DECL(BIF_InStr)
 	LPTSTR found_pos;
 	INT_PTR offset = 0; // Set default.
 	int occurrence_number = ParamIndexToOptionalInt(4, 1);
+	// The length of haystack is needed for offset validation, reverse search and by tmemsearch():
+	INT_PTR haystack_length = ParamIndexLength(0, haystack);
 
 	if (!ParamIndexIsOmitted(3)) // There is a starting position present.
 	{
 		offset = ParamIndexToIntPtr(3); // i.e. the fourth arg.
-		// For offset validation and reverse search we need to know the length of haystack:
-		INT_PTR haystack_length = ParamIndexLength(0, haystack);
 		if (offset <= 0) // Special mode to search from the right side.
 		{
 			haystack_length += offset; // i.e. reduce haystack_length by the absolute value of offset.
@@ -15478,10 +16054,11 @@ BIF_DECL(BIF_InStr)
 		}
 	}
 	// Since above didn't return:
-	size_t needle_length = (occurrence_number > 1) ? ParamIndexLength(1, needle) : 1; // Avoid unnecessary _tcslen() if occurrence_number == 1, which is the most common case.
+	size_t needle_length = ParamIndexLength(1, needle);
 	int i;
 	for (i = 1, found_pos = haystack + offset; ; ++i, found_pos += needle_length)
-		if (!(found_pos = tcsstr2(found_pos, needle, string_case_sense)) || i == occurrence_number)
+		if (!(found_pos = tmemsearch(found_pos, haystack_length - (found_pos - haystack), needle, needle_length, string_case_sense))
+			|| i == occurrence_number)
 			break;
 	aResultToken.value_int64 = found_pos ? (found_pos - haystack + 1) : 0;
 }
@@ -16124,11 +16701,13 @@ int RegExCallout(pcret_callout_block *cb)
 }
 
 // SET UP THE CACHE.
-// This is a very crude cache for linear search. Of course, hashing would be better in the sense that it
-// would allow the cache to get much larger while still being fast (I believe PHP caches up to 4096 items).
-// Binary search might not be such a good idea in this case due to the time required to find the right spot
-// to insert a new cache item (however, items aren't inserted often, so it might perform quite well until
-// the cache contained thousands of RegEx's, which is unlikely to ever happen in most scripts).
+// Compiled RegEx's are cached by their full NeedleRegEx string (options included), hashed and split into
+// PCRE_CACHE_SHARD_COUNT shards.  Each shard has its own critical section, which is held only for the hash
+// lookup and LRU bookkeeping -- never while compiling -- so the hook thread, timers and other threads of
+// the process only contend when they use patterns in the same shard at the same moment.  Entries are
+// reference counted: the cache holds one reference and each successful call to get_compiled_regex()
+// holds another until release_compiled_regex() is called.  This allows an entry to be evicted while it is
+// still executing (e.g. when a callout runs other RegEx's) without freeing it out from under its user.
 struct pcre_cache_entry
 {
 	// For simplicity (and thus performance), the entire RegEx pattern including its options is cached
@@ -16139,120 +16718,270 @@ struct pcre_cache_entry
 	// cache's benefit.  So for this reason, as well as rarity and code size issues, this policy seems best.
 	LPTSTR re_raw;      // The RegEx's literal string pattern such as "abc.*123".
 	pcret *re_compiled; // The RegEx in compiled form.
-	pcret_extra *extra; // NULL unless a study() was done (and NULL even then if study() didn't find anything).
+	pcret_extra *extra; // NULL unless a study() was done (and NULL even then if study() didn't find anything).  Shared between threads, so callers must not modify it.
 	// int pcre_options; // Not currently needed in the cache since options are implicitly inside re_compiled.
-	int options_length; // Lexikos: See aOptionsLength comment at beginning of this function.
+	int options_length; // Lexikos: See options_length comment at beginning of get_compiled_regex().
 	TCHAR output_mode;
+	UINT hash;          // tcshash(re_raw).  The low bits select the shard and the rest select the bucket.
+	LONG ref_count;     // One for the cache while the entry is linked into it, plus one per current user.
+	pcre_cache_entry *hash_next;           // Next entry in the same bucket.
+	pcre_cache_entry *lru_prev, *lru_next; // The most recently used entry is at the head of the list.
 };
 
-#define PCRE_CACHE_SIZE 100 // Going too high would be counterproductive due to the slowness of linear search (and also the memory utilization of so many compiled RegEx's).
-static pcre_cache_entry sCache[PCRE_CACHE_SIZE] = { { 0 } };
+struct pcre_cache_shard
+{
+	pcre_cache_entry **bucket; // NULL until the first entry is added.
+	int bucket_count;          // Always a power of two.
+	int count;
+	pcre_cache_entry *lru_head, *lru_tail;
+	UINT hits, misses, evictions; // Reported by RegExCacheInfo().
+};
+
+static pcre_cache_shard sCache[PCRE_CACHE_SHARD_COUNT] = { { 0 } };
+
+#define PCRE_CACHE_BUCKET(shard, hash) (shard).bucket[((hash) >> PCRE_CACHE_SHARD_BITS) & ((shard).bucket_count - 1)]
+
+static void pcre_cache_free_entry(pcre_cache_entry *aEntry)
+{
+	free(aEntry->re_raw);           // Free the uncompiled pattern.
+	pcret_free(aEntry->re_compiled); // Free the compiled pattern.
+	if (aEntry->extra)
+		pcret_free_study(aEntry->extra);
+	free(aEntry);
+}
+
+void release_compiled_regex(pcre_cache_entry *aEntry)
+// Releases a reference returned by get_compiled_regex().  The shard's lock isn't needed because the count
+// can only reach zero after the entry has been unlinked from the cache, at which point no other thread can
+// find it.
+{
+	if (!InterlockedDecrement(&aEntry->ref_count))
+		pcre_cache_free_entry(aEntry);
+}
+
+static pcre_cache_entry *pcre_cache_find(pcre_cache_shard &aShard, LPCTSTR aRegEx, UINT aHash)
+// Caller must own the shard's critical section.  If found, the entry is moved to the head of the LRU list.
+{
+	if (!aShard.bucket)
+		return NULL;
+	for (pcre_cache_entry *entry = PCRE_CACHE_BUCKET(aShard, aHash); entry; entry = entry->hash_next)
+	{
+		if (entry->hash != aHash || _tcscmp(aRegEx, entry->re_raw)) // Not a match (case sensitive).
+			continue;
+		if (entry != aShard.lru_head)
+		{
+			entry->lru_prev->lru_next = entry->lru_next;
+			if (entry->lru_next)
+				entry->lru_next->lru_prev = entry->lru_prev;
+			else
+				aShard.lru_tail = entry->lru_prev;
+			entry->lru_prev = NULL;
+			entry->lru_next = aShard.lru_head;
+			aShard.lru_head->lru_prev = entry;
+			aShard.lru_head = entry;
+		}
+		return entry;
+	}
+	return NULL;
+}
+
+static bool pcre_cache_insert(pcre_cache_shard &aShard, pcre_cache_entry *aEntry)
+// Caller must own the shard's critical section.  Returns false if there was insufficient memory to create
+// the shard's bucket array, in which case aEntry wasn't cached.
+{
+	if (aShard.count >= aShard.bucket_count) // Keep the chains short by having at least one bucket per entry.
+	{
+		int new_count = aShard.bucket_count ? aShard.bucket_count * 2 : 16;
+		pcre_cache_entry **new_bucket = (pcre_cache_entry **)calloc(new_count, sizeof(pcre_cache_entry *));
+		if (new_bucket)
+		{
+			free(aShard.bucket);
+			aShard.bucket = new_bucket;
+			aShard.bucket_count = new_count;
+			for (pcre_cache_entry *entry = aShard.lru_head; entry; entry = entry->lru_next)
+			{
+				pcre_cache_entry *&head = PCRE_CACHE_BUCKET(aShard, entry->hash);
+				entry->hash_next = head;
+				head = entry;
+			}
+		}
+		else if (!aShard.bucket)
+			return false;
+		//else continue on with longer chains.
+	}
+	pcre_cache_entry *&head = PCRE_CACHE_BUCKET(aShard, aEntry->hash);
+	aEntry->hash_next = head;
+	head = aEntry;
+	aEntry->lru_prev = NULL;
+	aEntry->lru_next = aShard.lru_head;
+	if (aShard.lru_head)
+		aShard.lru_head->lru_prev = aEntry;
+	else
+		aShard.lru_tail = aEntry;
+	aShard.lru_head = aEntry;
+	++aShard.count;
+	return true;
+}
+
+static pcre_cache_entry *pcre_cache_unlink_tail(pcre_cache_shard &aShard)
+// Caller must own the shard's critical section and ensure the shard isn't empty.  Removes the least recently
+// used entry and returns it; caller is responsible for releasing the cache's reference to it.
+{
+	pcre_cache_entry *entry = aShard.lru_tail;
+	if (aShard.lru_tail = entry->lru_prev)
+		aShard.lru_tail->lru_next = NULL;
+	else
+		aShard.lru_head = NULL;
+	pcre_cache_entry **link;
+	for (link = &PCRE_CACHE_BUCKET(aShard, entry->hash); *link != entry; link = &(*link)->hash_next);
+	*link = entry->hash_next;
+	--aShard.count;
+	return entry;
+}
+
+// JIT STACKS.
+// By default, JIT-compiled patterns use a 32 KB area of the machine stack, which is too small for patterns
+// that backtrack heavily.  Instead, each thread which executes JIT code gets its own growable stack, since a
+// JIT stack can't be used by two threads at once.  It is kept in a fiber-local storage slot rather than in
+// __declspec(thread) storage, which doesn't work when the DLL has been loaded from memory.  The system calls
+// FreeJitStack() for a thread's stack when that thread exits, so no thread can free a stack which another
+// thread might be using.  Fiber-local storage requires Vista or later, so on XP the machine stack is used.
+#define PCRE_JIT_STACK_START (32 * 1024)
+#define PCRE_JIT_STACK_MAX (1024 * 1024) // Only reserved; pages are committed as the stack grows.
+#define PCRE_JIT_STACK_NO_SLOT ((DWORD)0xFFFFFFFF) // FLS_OUT_OF_INDEXES.
+
+typedef DWORD (WINAPI *PFN_FlsAlloc)(void (WINAPI *)(void *));
+typedef BOOL (WINAPI *PFN_FlsFree)(DWORD);
+typedef void *(WINAPI *PFN_FlsGetValue)(DWORD);
+typedef BOOL (WINAPI *PFN_FlsSetValue)(DWORD, void *);
+static PFN_FlsFree _FlsFree;
+static PFN_FlsGetValue _FlsGetValue;
+static PFN_FlsSetValue _FlsSetValue;
+static DWORD sJitStackSlot = PCRE_JIT_STACK_NO_SLOT;
+
+static void WINAPI FreeJitStack(void *aStack)
+// Called by the system when a thread which has a JIT stack exits, and for every remaining stack by FlsFree().
+{
+	if (aStack)
+		pcret_jit_stack_free((pcret_jit_stack *)aStack);
+}
+
+void init_regex_jit_stacks()
+// Must be called once at startup, before any regex is executed.
+{
+	HMODULE kernel32 = GetModuleHandle(_T("kernel32"));
+	PFN_FlsAlloc _FlsAlloc = (PFN_FlsAlloc)GetProcAddress(kernel32, "FlsAlloc");
+	_FlsFree = (PFN_FlsFree)GetProcAddress(kernel32, "FlsFree");
+	_FlsGetValue = (PFN_FlsGetValue)GetProcAddress(kernel32, "FlsGetValue");
+	_FlsSetValue = (PFN_FlsSetValue)GetProcAddress(kernel32, "FlsSetValue");
+	if (_FlsAlloc && _FlsFree && _FlsGetValue && _FlsSetValue)
+		sJitStackSlot = _FlsAlloc(&FreeJitStack);
+}
+
+void free_regex_jit_stacks()
+// Called when the DLL is unloaded, so that the system doesn't call FreeJitStack() after the code is gone.
+{
+	if (sJitStackSlot != PCRE_JIT_STACK_NO_SLOT)
+	{
+		_FlsFree(sJitStackSlot);
+		sJitStackSlot = PCRE_JIT_STACK_NO_SLOT;
+	}
+}
+
+static pcret_jit_stack *RegExJitStack(void *)
+// Called by PCRE to get the JIT stack for the current thread.  Returning NULL causes the machine stack to be used.
+{
+	if (sJitStackSlot == PCRE_JIT_STACK_NO_SLOT)
+		return NULL;
+	pcret_jit_stack *stack = (pcret_jit_stack *)_FlsGetValue(sJitStackSlot);
+	if (!stack && (stack = pcret_jit_stack_alloc(PCRE_JIT_STACK_START, PCRE_JIT_STACK_MAX))
+		&& !_FlsSetValue(sJitStackSlot, stack))
+	{
+		pcret_jit_stack_free(stack);
+		return NULL;
+	}
+	return stack;
+}
+
+static int exec_compiled_regex(pcret *aRE, pcret_extra *aExtra, LPCTSTR aSubject, int aLength, int aStartOffset
+	, int aOptions, int *aOffset, int aOffsetCount)
+// Wrapper for pcret_exec() which falls back to the interpreter if JIT-compiled code runs out of stack,
+// which can only happen after the thread's JIT stack has grown to PCRE_JIT_STACK_MAX.
+{
+	int result = pcret_exec(aRE, aExtra, aSubject, aLength, aStartOffset, aOptions, aOffset, aOffsetCount);
+	if (result == PCRE_ERROR_JIT_STACKLIMIT && aExtra && (aExtra->flags & PCRE_EXTRA_EXECUTABLE_JIT))
+	{
+		pcret_extra extra = *aExtra; // Copy it because the original may be shared with other threads.
+		extra.flags &= ~PCRE_EXTRA_EXECUTABLE_JIT;
+		result = pcret_exec(aRE, &extra, aSubject, aLength, aStartOffset, aOptions, aOffset, aOffsetCount);
+	}
+	return result;
+}
 
 void free_compiled_regex()
 {
-	for (int i = 0; i < PCRE_CACHE_SIZE; i++)
+	// Free only this thread's JIT stack; other threads may still be executing patterns with theirs.
+	if (sJitStackSlot != PCRE_JIT_STACK_NO_SLOT)
+		if (pcret_jit_stack *stack = (pcret_jit_stack *)_FlsGetValue(sJitStackSlot))
+		{
+			_FlsSetValue(sJitStackSlot, NULL);
+			pcret_jit_stack_free(stack);
+		}
+	for (int i = 0; i < PCRE_CACHE_SHARD_COUNT; ++i)
 	{
-		pcre_cache_entry &this_entry = sCache[i]; // For performance and convenience.
-		if (this_entry.re_compiled) // An existing cache item is being overwritten, so free it's attributes.
+		pcre_cache_shard &shard = sCache[i]; // For performance and convenience.
+		EnterCriticalSection(&g_CriticalRegExCache[i]);
+		pcre_cache_entry *entry = shard.lru_head, *next;
+		free(shard.bucket);
+		ZeroMemory(&shard, sizeof(shard)); // This also resets the counters.
+		LeaveCriticalSection(&g_CriticalRegExCache[i]);
+		for ( ; entry; entry = next)
 		{
-			// Free the old cache entry's attributes
-			free(this_entry.re_raw);           // Free the uncompiled pattern.
-			pcret_free(this_entry.re_compiled); // Free the compiled pattern.
-			if (this_entry.extra)
-				pcret_free_study(this_entry.extra);
-			this_entry.re_compiled = NULL;
+			next = entry->lru_next;
+			release_compiled_regex(entry); // Release the cache's reference.  Any entry still in use is freed by its user.
 		}
 	}
 }
 
-pcret *get_compiled_regex(LPTSTR aRegEx, TCHAR &aOutputMode, pcret_extra *&aExtra
-	, int *aOptionsLength, ExprTokenType *aResultToken)
-// Returns the compiled RegEx, or NULL on failure.
+pcre_cache_entry *get_compiled_regex(LPTSTR aRegEx, ExprTokenType *aResultToken)
+// Returns the cache entry containing the compiled RegEx, or NULL on failure.
 // This function is called by things other than built-in functions so it should be kept general-purpose.
 // Upon failure, if aResultToken!=NULL:
 //   - ErrorLevel is set to a descriptive string other than "0".
 //   - *aResultToken is set up to contain an empty string.
-// Upon success, the following output parameters are set based on the options that were specified:
-//    aGetPositionsNotSubstrings
-//    aExtra
-//    (but it doesn't change ErrorLevel on success, not even if aResultToken!=NULL)
-// L14: aOptionsLength is used by callouts to adjust cb->pattern_position to be relative to beginning of actual user-specified NeedleRegEx instead of string seen by PCRE.
+// Upon success, the entry's output_mode, extra and options_length are set based on the options that were
+// specified (but it doesn't change ErrorLevel on success, not even if aResultToken!=NULL).  Caller must
+// pass the entry to release_compiled_regex() when it is done with it.
+// L14: options_length is used by callouts to adjust cb->pattern_position to be relative to beginning of actual user-specified NeedleRegEx instead of string seen by PCRE.
 {	
 	if (!pcret_callout)
 	{	// Ensure this is initialized, even for ::RegExMatch() (to allow (?C) in window title regexes).
 		pcret_callout = &RegExCallout;
 	}
 
-	// While reading from or writing to the cache, don't allow another thread entry.  This is because
-	// that thread (or this one) might write to the cache while the other one is reading/writing, which
-	// could cause loss of data integrity (the hook thread can enter here via #IfWin & SetTitleMatchMode RegEx).
-	// Together, Enter/LeaveCriticalSection reduce performance by only 1.4% in the tightest possible script
-	// loop that hits the first cache entry every time.  So that's the worst case except when there's an actual
-	// collision, in which case performance suffers more because internally, EnterCriticalSection() does a
-	// wait/semaphore operation, which is more costly.
-	// Finally, the code size of all critical-section features together is less than 512 bytes (uncompressed),
-	// so like performance, that's not a concern either.
-	EnterCriticalSection(&g_CriticalRegExCache); // Request ownership of the critical section. If another thread already owns it, this thread will block until the other thread finishes.
-
-	static int sLastInsert, sLastFound = -1; // -1 indicates "cache empty".
-	int insert_pos; // v1.0.45.03: This is used to avoid updating sLastInsert until an insert actually occurs (it might not occur if a compile error occurs in the regex, or something else stops it early).
+	UINT hash = tcshash(aRegEx);
+	int shard_index = hash & (PCRE_CACHE_SHARD_COUNT - 1);
+	pcre_cache_shard &shard = sCache[shard_index];
+	LPCRITICAL_SECTION lock = &g_CriticalRegExCache[shard_index];
+	pcre_cache_entry *entry;
 
 	// CHECK IF THIS REGEX IS ALREADY IN THE CACHE.
-	if (sLastFound == -1) // Cache is empty, so insert this RegEx at the first position.
-		insert_pos = 0;  // A section further below will change sLastFound to be 0.
-	else
+	// While reading from or writing to a shard, don't allow another thread entry.  This is because that
+	// thread (or this one) might write to the shard while the other one is reading/writing, which could
+	// cause loss of data integrity (the hook thread can enter here via #IfWin & SetTitleMatchMode RegEx).
+	EnterCriticalSection(lock);
+	if (entry = pcre_cache_find(shard, aRegEx, hash))
 	{
-		// Search the cache to see if it contains the caller-specified RegEx in compiled form.
-		// First check if the last-found item is a match, since often it will be (such as cases
-		// where a script-loop executes only one RegEx, and also for SetTitleMatchMode RegEx).
-		if (!_tcscmp(aRegEx, sCache[sLastFound].re_raw)) // Match found (case sensitive).
-			goto match_found; // And no need to update sLastFound because it's already set right.
-
-		// Since above didn't find a match, search outward in both directions from the last-found match.
-		// A bidirectional search is done because consecutively-called regex's tend to be adjacent to each other
-		// in the array, so performance is improved on average (since most of the time when repeating a previously
-		// executed regex, that regex will already be in the cache -- so optimizing the finding behavior is
-		// more important than optimizing the never-found-because-not-cached behavior).
-		bool go_right;
-		int i, item_to_check, left, right;
-		int last_populated_item = (sCache[PCRE_CACHE_SIZE-1].re_compiled) // When the array is full...
-			? PCRE_CACHE_SIZE - 1  // ...all items must be checked except the one already done earlier.
-			: sLastInsert;         // ...else only the items actually populated need to be checked.
-
-		for (go_right = true, left = sLastFound, right = sLastFound, i = 0
-			; i < last_populated_item  // This limits it to exactly the number of items remaining to be checked.
-			; ++i, go_right = !go_right)
-		{
-			if (go_right) // Proceed rightward in the array.
-			{
-				right = (right == last_populated_item) ? 0 : right + 1; // Increment or wrap around back to the left side.
-				item_to_check = right;
-			}
-			else // Proceed leftward.
-			{
-				left = (left == 0) ? last_populated_item : left - 1; // Decrement or wrap around back to the right side.
-				item_to_check = left;
-			}
-			if (!_tcscmp(aRegEx, sCache[item_to_check].re_raw)) // Match found (case sensitive).
-			{
-				sLastFound = item_to_check;
-				goto match_found;
-			}
-		}
-
-		// Since above didn't goto, no match was found nor is one possible.  So just indicate the insert position
-		// for where this RegEx will be put into the cache.
-		// The following formula is for both cache-full and cache-partially-full.  When the cache is full,
-		// it might not be the best possible formula; but it seems pretty good because it takes a round-robin
-		// approach to overwriting/discarding old cache entries.  A discarded entry might have just been
-		// used -- or even be sLastFound itself -- but on average, this approach seems pretty good because a
-		// script loop that uses 50 unique RegEx's will quickly stabilize in the cache so that all 50 of them
-		// stay compiled/cached until the loop ends.
-		insert_pos = (sLastInsert == PCRE_CACHE_SIZE-1) ? 0 : sLastInsert + 1; // Formula works for both full and partially-full array.
+		++shard.hits;
+		InterlockedIncrement(&entry->ref_count); // Interlocked because release_compiled_regex() doesn't lock.
+		LeaveCriticalSection(lock);
+		return entry;
 	}
-	// Since the above didn't goto:
-	// - This RegEx isn't yet in the cache.  So compile it and put it in the cache, then return it to caller.
-	// - Above is responsible for having set insert_pos to the cache position where the new RegEx will be stored.
+	++shard.misses;
+	LeaveCriticalSection(lock);
+
+	// Since the above didn't return, this RegEx isn't yet in the cache.  So compile it (without holding the
+	// lock) and put it in the cache, then return it to caller.
 
 	// The following macro is for maintainability, to enforce the definition of "default" in multiple places.
 	// PCRE_NEWLINE_CRLF is the default in AutoHotkey rather than PCRE_NEWLINE_LF because *multiline* haystacks
@@ -16271,14 +17000,16 @@ pcret *get_compiled_regex(LPTSTR aRegEx, TCHAR &aOutputMode, pcret_extra *&aExtr
 	#define SET_DEFAULT_PCRE_OPTIONS \
 	{\
 		pcre_options = PCRE_NEWLINE_CRLF | AHK_PCRE_CHARSET_OPTIONS;\
-		aOutputMode = '\0';\
-		do_study = false;\
+		output_mode = '\0';\
+		do_study = do_jit = g_RegExJIT;\
 	}
 	#define PCRE_NEWLINE_BITS (PCRE_NEWLINE_CRLF | PCRE_NEWLINE_ANY) // Covers all bits that are used for newline options.
 
 	// SET DEFAULT OPTIONS:
 	int pcre_options;
+	TCHAR output_mode;
 	long long do_study;
+	bool do_jit; // Since the cache is keyed by pattern, changing #RegExJIT doesn't affect patterns already cached.
 	SET_DEFAULT_PCRE_OPTIONS
 
 	// PARSE THE OPTIONS (if any).
@@ -16319,11 +17050,14 @@ pcret *get_compiled_regex(LPTSTR aRegEx, TCHAR &aOutputMode, pcret_extra *&aExtr
 		// Other options (uppercase so that lowercase can be reserved for future/PERL options):
 		case 'O':
 		case 'P':
-			aOutputMode = *pat;
+			output_mode = *pat;
 			break;
 		case 'S':
 			do_study = true;
 			break;
+		case 'T': // Translate to machine code (JIT), which requires studying.
+			do_study = do_jit = true;
+			break;
 
 		case ' ':  // Allow only spaces and tabs as fillers so that everything else is protected/reserved for
 		case '\t': // future use (such as future PERL options).
@@ -16361,6 +17095,7 @@ break_both:
 	TCHAR error_buf[ERRORLEVEL_SAVED_SIZE];
 	int error_code, error_offset;
 	pcret *re_compiled;
+	pcret_extra *extra;
 
 	// COMPILE THE REGEX.
 	if (   !(re_compiled = pcret_compile2(pat, pcre_options, &error_code, &error_msg, &error_offset, NULL))   )
@@ -16378,9 +17113,13 @@ break_both:
 
 	if (do_study)
 	{
-		// Enabling JIT compilation adds about 68 KB to the final executable size, which seems to outweigh
-		// the speed-up that a minority of scripts would get.  Pass the option anyway, in case it is enabled:
-		aExtra = pcret_study(re_compiled, PCRE_STUDY_JIT_COMPILE, &error_msg); // aExtra is an output parameter for caller.
+		// JIT compilation is done only on request (T option or #RegExJIT) since it takes considerably
+		// longer than compiling and is only worthwhile for patterns which are executed many times.
+		// If the pattern uses features the JIT compiler doesn't support, such as callouts or (*MARK),
+		// study() silently omits the JIT code and pcret_exec() uses the interpreter as usual.
+		extra = pcret_study(re_compiled, do_jit ? PCRE_STUDY_JIT_COMPILE : 0, &error_msg);
+		if (do_jit) // The following does nothing if there's no JIT code.
+			pcret_assign_jit_stack(extra, &RegExJitStack, NULL);
 		// Above returns NULL on failure or inability to find anything worthwhile in its study.  NULL is exactly
 		// the right value to pass to exec() to indicate "no study info".
 		// The following isn't done because:
@@ -16401,50 +17140,66 @@ break_both:
 		//}
 	}
 	else // No studying desired.
-		aExtra = NULL; // aExtra is an output parameter for caller.
+		extra = NULL;
 
 	// ADD THE NEWLY-COMPILED REGEX TO THE CACHE.
-	// An earlier stage has set insert_pos to be the desired insert-position in the cache.
-	pcre_cache_entry &this_entry = sCache[insert_pos]; // For performance and convenience.
-	if (this_entry.re_compiled) // An existing cache item is being overwritten, so free it's attributes.
-	{
-		// Free the old cache entry's attributes in preparation for overwriting them with the new one's.
-		free(this_entry.re_raw);           // Free the uncompiled pattern.
-		pcret_free(this_entry.re_compiled); // Free the compiled pattern.
-		if (this_entry.extra)
-			pcret_free_study(this_entry.extra);
-	}
-	//else the insert-position is an empty slot, which is usually the case because most scripts contain fewer than
-	// PCRE_CACHE_SIZE unique regex's.  Nothing extra needs to be done.
-	this_entry.re_raw = _tcsdup(aRegEx); // _strdup() is very tiny and basically just calls _tcslen+malloc+_tcscpy.
-	this_entry.re_compiled = re_compiled;
-	this_entry.extra = aExtra;
-	this_entry.output_mode = aOutputMode;
-	// "this_entry.pcre_options" doesn't exist because it isn't currently needed in the cache.  This is
+	if (   !(entry = (pcre_cache_entry *)malloc(sizeof(pcre_cache_entry)))
+		|| !(entry->re_raw = _tcsdup(aRegEx))   ) // _strdup() is very tiny and basically just calls _tcslen+malloc+_tcscpy.
+	{
+		free(entry);
+		pcret_free(re_compiled);
+		if (extra)
+			pcret_free_study(extra);
+		if (aResultToken)
+			g_script.SetErrorLevelOrThrowStr(ERR_OUTOFMEM, aResultToken->marker);
+		goto error;
+	}
+	entry->re_compiled = re_compiled;
+	entry->extra = extra;
+	entry->output_mode = output_mode;
+	// "entry->pcre_options" doesn't exist because it isn't currently needed in the cache.  This is
 	// because the RE's options are implicitly stored inside re_compiled.
 
-	// Lexikos: See aOptionsLength comment at beginning of this function.
-	this_entry.options_length = (int)(pat - aRegEx);
-
-	if (aOptionsLength) 
-		*aOptionsLength = this_entry.options_length;
-
-	sLastInsert = insert_pos; // v1.0.45.03: Must be done only *after* the insert succeeded because some things rely on sLastInsert being synonymous with the last populated item in the cache (when the cache isn't yet full).
-	sLastFound = sLastInsert; // Relied upon in the case where sLastFound==-1. But it also sets things up to start the search at this item next time, because it's a bit more likely to be found here such as tight loops containing only one RegEx.
-	// Remember that although sLastFound==sLastInsert in this case, it isn't always so -- namely when a previous
-	// call found an existing match in the cache without having to compile and insert the item.
-
-	LeaveCriticalSection(&g_CriticalRegExCache);
-	return re_compiled; // Indicate success.
-
-match_found: // RegEx was found in the cache at position sLastFound, so return the cached info back to the caller.
-	aOutputMode = sCache[sLastFound].output_mode;
-	aExtra = sCache[sLastFound].extra;
-	if (aOptionsLength) // Lexikos: See aOptionsLength comment at beginning of this function.
-		*aOptionsLength = sCache[sLastFound].options_length; 
+	// Lexikos: See options_length comment at beginning of this function.
+	entry->options_length = (int)(pat - aRegEx);
+	entry->hash = hash;
+	entry->ref_count = 2; // One for the cache and one for the caller.
 
-	LeaveCriticalSection(&g_CriticalRegExCache);
-	return sCache[sLastFound].re_compiled; // Indicate success.
+	pcre_cache_entry *existing, *evicted;
+	evicted = NULL;
+	EnterCriticalSection(lock);
+	if (existing = pcre_cache_find(shard, aRegEx, hash))
+	{
+		// Another thread compiled and cached the same RegEx while the lock wasn't held.  Use its entry
+		// so that each pattern is cached only once.
+		InterlockedIncrement(&existing->ref_count);
+		LeaveCriticalSection(lock);
+		pcre_cache_free_entry(entry);
+		return existing;
+	}
+	if (pcre_cache_insert(shard, entry))
+	{
+		// Evict the least recently used entries of this shard beyond its share of #RegExCacheSize.
+		// The new entry is at the head of the list, so it is never evicted here.
+		int shard_capacity = (g_RegExCacheSize + PCRE_CACHE_SHARD_COUNT - 1) >> PCRE_CACHE_SHARD_BITS;
+		while (shard.count > shard_capacity)
+		{
+			pcre_cache_entry *old_entry = pcre_cache_unlink_tail(shard);
+			old_entry->lru_next = evicted; // Collect them to be released below, outside the lock.
+			evicted = old_entry;
+			++shard.evictions;
+		}
+	}
+	else // Too little memory to cache it, but the caller can still use it.
+		entry->ref_count = 1;
+	LeaveCriticalSection(lock);
+	while (evicted)
+	{
+		existing = evicted->lru_next;
+		release_compiled_regex(evicted); // Any entry which is still in use is freed by its last user instead.
+		evicted = existing;
+	}
+	return entry; // Indicate success.
 
 error: // Since NULL is returned here, caller should ignore the contents of the output parameters.
 	if (aResultToken)
@@ -16452,22 +17207,50 @@ error: // Since NULL is returned here, caller should ignore the contents of the
 		aResultToken->symbol = SYM_STRING;
 		aResultToken->marker = _T("");
 	}
-
-	LeaveCriticalSection(&g_CriticalRegExCache);
 	return NULL; // Indicate failure.
 }
 
 
 
+BIF_DECL(BIF_RegExCacheInfo)
+// Returns an object containing the RegEx cache's statistics, which can be used to tune #RegExCacheSize.
+{
+	__int64 hits = 0, misses = 0, evictions = 0, count = 0;
+	for (int i = 0; i < PCRE_CACHE_SHARD_COUNT; ++i)
+	{
+		EnterCriticalSection(&g_CriticalRegExCache[i]);
+		hits += sCache[i].hits;
+		misses += sCache[i].misses;
+		evictions += sCache[i].evictions;
+		count += sCache[i].count;
+		LeaveCriticalSection(&g_CriticalRegExCache[i]);
+	}
+	Object *info = Object::Create();
+	if (   !info
+		|| !info->SetItem(_T("Hits"), hits)
+		|| !info->SetItem(_T("Misses"), misses)
+		|| !info->SetItem(_T("Evictions"), evictions)
+		|| !info->SetItem(_T("Count"), count)
+		|| !info->SetItem(_T("Capacity"), (__int64)g_RegExCacheSize)   )
+	{
+		if (info)
+			info->Release();
+		aResultToken.symbol = SYM_STRING;
+		aResultToken.marker = _T("");
+		return;
+	}
+	aResultToken.symbol = SYM_OBJECT;
+	aResultToken.object = info;
+}
+
+
+
 LPTSTR RegExMatch(LPTSTR aHaystack, LPTSTR aNeedleRegEx)
 // Returns NULL if no match.  Otherwise, returns the address where the pattern was found in aHaystack.
 {
-	TCHAR output_mode; // Currently ignored.
-	pcret_extra *extra;
-	pcret *re;
-
 	// Compile the regex or get it from cache.
-	if (   !(re = get_compiled_regex(aNeedleRegEx, output_mode, extra, NULL, NULL))   ) // Compiling problem.
+	pcre_cache_entry *entry;
+	if (   !(entry = get_compiled_regex(aNeedleRegEx, NULL))   ) // Compiling problem.
 		return NULL; // Our callers just want there to be "no match" in this case.
 
 	// Set up the offset array, which consists of int-pairs containing the start/end offset of each match.
@@ -16477,7 +17260,8 @@ LPTSTR RegExMatch(LPTSTR aHaystack, LPTSTR aNeedleRegEx)
 	int offset[RXM_INT_COUNT];
 
 	// Execute the regex.
-	int captured_pattern_count = pcret_exec(re, extra, aHaystack, (int)_tcslen(aHaystack), 0, 0, offset, RXM_INT_COUNT);
+	int captured_pattern_count = exec_compiled_regex(entry->re_compiled, entry->extra, aHaystack, (int)_tcslen(aHaystack), 0, 0, offset, RXM_INT_COUNT);
+	release_compiled_regex(entry);
 	if (captured_pattern_count < 0) // PCRE_ERROR_NOMATCH or some kind of error.
 		return NULL;
 
@@ -16487,6 +17271,130 @@ LPTSTR RegExMatch(LPTSTR aHaystack, LPTSTR aNeedleRegEx)
 
 
 
+struct RegExReplacePart
+// A section of RegExReplace()'s Replacement parameter: literal text, optionally followed by a backreference.
+// The Replacement is parsed into these once per call rather than once per match.
+{
+	LPCTSTR literal;
+	int literal_length;
+	int ref_num;        // The subpattern number (possibly invalid, such as ${-5}), or RXR_REF_NONE.
+	bool by_name;       // ref_num is unused because the subpattern is referred to by name.
+	TCHAR transform;    // 'U', 'L', 'T' or '\0' for none.
+	TCHAR name[33];     // In PCRE, "Names consist of up to 32 alphanumeric characters and underscores."
+	// The following are set for each match:
+	int match_start, match_length;
+};
+
+#define RXR_REF_NONE INT_MIN // Use INT_MIN to virtually guaranty that anything other than INT_MIN means that something like a backreference was found (even if it's invalid, such as ${-5}).
+
+static int ParseRegExReplacement(LPCTSTR aReplacement, RegExReplacePart *aPart)
+// Splits aReplacement into parts.  Caller must provide room for one part per '$' in aReplacement, plus one.
+// Returns the number of parts.
+{
+	// DOLLAR SIGN ($) is the only method supported because it simplifies the code, improves performance,
+	// and avoids the need to escape anything other than $ (which simplifies the syntax).
+	int part_count = 0, ref_num, extra_offset, substring_name_length;
+	LPCTSTR literal, src, dollar, closing_brace, substring_name_pos;
+	TCHAR char_after_dollar, transform;
+	for (literal = src = aReplacement; ; ++src)  // For each '$' (increment to skip over the symbol just found by the inner for()).
+	{
+		for (; *src && *src != '$'; ++src); // Find the next '$', if any.
+		if (!*src)  // Reached the end of the replacement text.
+			break;
+
+		// Otherwise, a '$' has been found.  Check if it's a backreference and handle it.
+		// But first process any special flags that are present.
+		dollar = src;
+		transform = '\0'; // Set default. Indicate "no transformation".
+		extra_offset = 0; // Set default. Indicate that there's no need to hop over an extra character.
+		if (char_after_dollar = src[1]) // This check avoids calling ctoupper on '\0', which directly or indirectly causes an assertion error in CRT.
+		{
+			switch(char_after_dollar = ctoupper(char_after_dollar))
+			{
+			case 'U':
+			case 'L':
+			case 'T':
+				transform = char_after_dollar;
+				extra_offset = 1;
+				char_after_dollar = src[2]; // Ignore the transform character for the purposes of backreference recognition further below.
+				break;
+			//else leave things at their defaults.
+			}
+		}
+		//else leave things at their defaults.
+
+		RegExReplacePart &part = aPart[part_count];
+		part.by_name = false;
+		ref_num = RXR_REF_NONE; // Set default to "no valid backreference".
+		switch (char_after_dollar)
+		{
+		case '{':  // Found a backreference: ${...
+			substring_name_pos = src + 2 + extra_offset;
+			if (closing_brace = _tcschr(substring_name_pos, '}'))
+			{
+				if (substring_name_length = (int)(closing_brace - substring_name_pos))
+				{
+					if (substring_name_length < _countof(part.name))
+					{
+						tcslcpy(part.name, substring_name_pos, substring_name_length + 1); // +1 to convert length to size, which truncates the new string at the desired position.
+						if (IsPureNumeric(part.name, true, false, true)) // Seems best to allow floating point such as 1.0 because it will then get truncated to an integer.  It seems to rare that anyone would want to use floats as names.
+							ref_num = _ttoi(part.name); // Uses _ttoi() vs. ATOI to avoid potential overlap with non-numeric names such as ${0x5}, which should probably be considered a name not a number?  In other words, seems best not to make some names that start with numbers "special" just because they happen to be hex numbers.
+						else // For simplicity, no checking is done to ensure it consists of the "32 alphanumeric characters and underscores".  Let pcret_get_first_set() figure that out for each match.
+						{
+							ref_num = 0; // Anything other than RXR_REF_NONE.
+							part.by_name = true;
+						}
+					}
+					//else it's too long, so it seems best (debatable) to treat it as a unmatched/unfound name, i.e. "".
+					src = closing_brace; // Set things up for the next iteration to resume at the char after "${..}"
+				}
+				//else it's ${}, so do nothing, which in effect will treat it all as literal text.
+			}
+			//else unclosed '{': for simplicity, do nothing, which in effect will treat it all as literal text.
+			break;
+
+		case '$':  // i.e. Two consecutive $ amounts to one literal $.
+			++src; // Skip over the first '$', and the loop's increment will skip over the second. "extra_offset" is ignored due to rarity and silliness.  Just transcribe things like $U$ as U$ to indicate the problem.
+			break; // This also sets up things properly to copy a single literal '$' into the result.
+
+		case '\0': // i.e. a single $ was found at the end of the string.
+			break; // Seems best to treat it as literal (strictly speaking the script should have escaped it).
+
+		default:
+			if (char_after_dollar >= '0' && char_after_dollar <= '9') // Treat it as a single-digit backreference. CONSEQUENTLY, $15 is really $1 followed by a literal '5'.
+			{
+				ref_num = char_after_dollar - '0'; // $0 is the whole pattern rather than a subpattern.
+				src += 1 + extra_offset; // Set things up for the next iteration to resume at the char after $d. Consequently, $19 is seen as $1 followed by a literal 9.
+			}
+			//else not a digit: do nothing, which treats a $x as literal text (seems ok since like $19, $name will never be supported due to ambiguity; only ${name}).
+		} // switch (char_after_dollar)
+
+		if (ref_num == RXR_REF_NONE) // Nothing that looks like backreference is present (or the very unlikely ${-2147483648}).
+		{
+			// The character at src is literal, and so is the text after it up to the next '$'.
+			if (src == dollar) // The '$' itself is literal, so it's simply part of the current literal text.
+				continue;
+			//else the text from the '$' up to src is omitted, so end the current part here.
+		}
+		part.literal = literal;
+		part.literal_length = (int)(dollar - literal);
+		part.ref_num = ref_num;
+		part.transform = transform;
+		++part_count;
+		// Resume the literal text at src if it's literal, otherwise at the char after the backreference.
+		literal = (ref_num == RXR_REF_NONE) ? src : src + 1;
+	}
+	RegExReplacePart &part = aPart[part_count++];
+	part.literal = literal;
+	part.literal_length = (int)(src - literal);
+	part.ref_num = RXR_REF_NONE;
+	part.by_name = false;
+	part.transform = '\0';
+	return part_count;
+}
+
+
+
 void RegExReplace(ExprTokenType &aResultToken, ExprTokenType *aParam[], int aParamCount
 	, pcret *aRE, pcret_extra *aExtra, LPTSTR aHaystack, int aHaystackLength
 	, int aStartingOffset, int aOffset[], int aNumberOfIntsInOffset)
@@ -16508,13 +17416,9 @@ void RegExReplace(ExprTokenType &aResultToken, ExprTokenType *aParam[], int aPar
 	LPTSTR replacement = ParamIndexToOptionalString(2, repl_buf);
 
 	// In PCRE, lengths and such are confined to ints, so there's little reason for using unsigned for anything.
-	int captured_pattern_count, empty_string_is_not_a_match, match_length, ref_num
-		, result_size, new_result_length, haystack_portion_length, second_iteration, substring_name_length
-		, extra_offset, pcre_options;
-	TCHAR *haystack_pos, *match_pos, *src, *src_orig, *closing_brace, *substring_name_pos;
-	TCHAR *dest, char_after_dollar
-		, substring_name[33] // In PCRE, "Names consist of up to 32 alphanumeric characters and underscores."
-		, transform;
+	int captured_pattern_count, empty_string_is_not_a_match, result_size, new_result_length
+		, haystack_portion_length, literal_length, part_count, i, pcre_options;
+	TCHAR *haystack_pos, *match_pos, *dest, *cp;
 
 	// Caller has provided mem_to_free (initially NULL) as a means of passing back memory we allocate here.
 	// So if we change "result" to be non-NULL, the caller will take over responsibility for freeing that memory.
@@ -16537,6 +17441,17 @@ void RegExReplace(ExprTokenType &aResultToken, ExprTokenType *aParam[], int aPar
 	// See if a replacement limit was specified.  If not, use the default (-1 means "replace all").
 	int limit = ParamIndexToOptionalInt(4, -1);
 
+	// Parse the replacement text once rather than for each match.  Since most replacements contain only a
+	// few backreferences, the parts usually fit in part_buf.
+	RegExReplacePart part_buf[8], *part = part_buf;
+	for (part_count = 1, cp = replacement; cp = _tcschr(cp, '$'); ++cp, ++part_count); // Count the maximum possible number of parts.
+	if (part_count > _countof(part_buf)
+		&& !(part = (RegExReplacePart *)malloc(part_count * sizeof(RegExReplacePart))))
+		goto out_of_mem;
+	part_count = ParseRegExReplacement(replacement, part);
+	for (literal_length = 0, i = 0; i < part_count; ++i)
+		literal_length += part[i].literal_length; // The total length of literal text in each replacement.
+
 	// aStartingOffset is altered further on in the loop; but for its initial value, the caller has ensured
 	// that it lies within aHaystackLength.  Also, if there are no replacements yet, haystack_pos ignores
 	// aStartingOffset because otherwise, when the first replacement occurs, any part of haystack that lies
@@ -16546,7 +17461,7 @@ void RegExReplace(ExprTokenType &aResultToken, ExprTokenType *aParam[], int aPar
 	{
 		// Execute the expression to find the next match.
 		captured_pattern_count = (limit == 0) ? PCRE_ERROR_NOMATCH // Only when limit is exactly 0 are we done replacing.  All negative values are "replace all".
-			: pcret_exec(aRE, aExtra, aHaystack, aHaystackLength, aStartingOffset
+			: exec_compiled_regex(aRE, aExtra, aHaystack, aHaystackLength, aStartingOffset
 				, empty_string_is_not_a_match, aOffset, aNumberOfIntsInOffset);
 
 		if (captured_pattern_count == PCRE_ERROR_NOMATCH)
@@ -16652,181 +17567,92 @@ void RegExReplace(ExprTokenType &aResultToken, ExprTokenType *aParam[], int aPar
 		int match_end_offset = aOffset[1];
 		haystack_portion_length = (int)(match_pos - haystack_pos); // The length of the haystack section between the end of the previous match and the start of the current one.
 
-		// Handle this replacement by making two passes through the replacement-text: The first calculates the size
-		// (which avoids having to constantly check for buffer overflow with potential realloc at multiple stages).
-		// The second iteration copies the replacement (along with any literal text in haystack before it) into the
-		// result buffer (which was expanded if necessary by the first iteration).
-		for (second_iteration = 0; second_iteration < 2; ++second_iteration) // second_iteration is used as a boolean for readability.
-		{
-			if (second_iteration)
+		// Calculate the length of this replacement, resolving each backreference to the section of haystack it
+		// refers to.  This avoids having to constantly check for buffer overflow while copying.
+		new_result_length = (int)result_length + haystack_portion_length + literal_length; // The part of haystack before the match is also copied over as literal text.
+		for (i = 0; i < part_count; ++i)
+		{
+			RegExReplacePart &this_part = part[i];
+			int ref_num = this_part.by_name ? pcret_get_first_set(aRE, this_part.name, aOffset) // Returns a negative on failure, which when stored in ref_num is relied upon as an indicator.
+				: this_part.ref_num;
+			// It seems to improve convenience and flexibility to transcribe a nonexistent backreference
+			// as a "" rather than literally (e.g. putting a ${1} literally into the new string).  Although
+			// putting it in literally has the advantage of helping debugging, it doesn't seem to outweigh
+			// the convenience of being able to specify nonexistent subpatterns. MORE IMPORANTLY a subpattern
+			// might not exist per se if it hasn't been matched, such as an "or" like (abc)|(xyz), at least
+			// when it's the last subpattern, in which case it should definitely be treated as "" and not
+			// copied over literally.  So that would have to be checked for if this is changed.
+			if (ref_num >= 0 && ref_num < captured_pattern_count) // Treat ref_num==0 as reference to the entire-pattern's match.
 			{
-				// Using the required length calculated by the first iteration, expand/realloc "result" if necessary.
-				if (new_result_length + 3 > result_size) // Must use +3 not +1 in case of empty_string_is_not_a_match (which needs room for up to two extra characters).
-				{
-					// The first expression passed to REGEX_REALLOC is the average length of each replacement so far.
-					// It's more typically more accurate to pass that than the following "length of current
-					// replacement":
-					//    new_result_length - haystack_portion_length - (aOffset[1] - aOffset[0])
-					// Above is the length difference between the current replacement text and what it's
-					// replacing (it's negative when replacement is smaller than what it replaces).
-					REGEX_REALLOC((int)PredictReplacementSize((new_result_length - match_end_offset) / replacement_count // See above.
-						, replacement_count, limit, aHaystackLength, new_result_length+2, match_end_offset)); // +2 in case of empty_string_is_not_a_match (which needs room for up to two extra characters).  The function will also do another +1 to convert length to size (for terminator).
-					// The above will return if an alloc error occurs.
-				}
-				//else result_size is not only large enough, but also non-zero.  Other sections rely on it always
-				// being non-zero when replacement_count>0.
-
-				// Before doing the actual replacement and its backreferences, copy over the part of haystack that
-				// appears before the match.
-				if (haystack_portion_length)
-				{
-					tmemcpy(result + result_length, haystack_pos, haystack_portion_length);
-					result_length += haystack_portion_length;
-				}
-				dest = result + result_length; // Init dest for use by the loops further below.
+				this_part.match_start = aOffset[ref_num*2];
+				this_part.match_length = aOffset[ref_num*2 + 1] - this_part.match_start;
+				new_result_length += this_part.match_length;
 			}
-			else // i.e. it's the first iteration, so begin calculating the size required.
-				new_result_length = (int)result_length + haystack_portion_length; // Init length to the part of haystack before the match (it must be copied over as literal text).
-
-			// DOLLAR SIGN ($) is the only method supported because it simplifies the code, improves performance,
-			// and avoids the need to escape anything other than $ (which simplifies the syntax).
-			for (src = replacement; ; ++src)  // For each '$' (increment to skip over the symbol just found by the inner for()).
+			else // Subpattern doesn't exist (or it's invalid such as ${-5}), or there's no backreference.
+				this_part.match_length = 0;
+			// Treating a nonexistent subpattern as blank is done because:
+			// 1) It's boosts script flexibility and convenience (at the cost of making it hard to detect
+			//    script bugs, which would be assisted by transcribing ${999} as literal text rather than "").
+			// 2) It simplifies the code.
+			// 3) A subpattern might not exist per se if it hasn't been matched, such as "(abc)|(xyz)"
+			//    (in which case only one of them is matched).  If such a thing occurs at the end
+			//    of the RegEx pattern, captured_pattern_count might not include it.  But it seems
+			//    pretty clear that it should be treated as "" rather than some kind of error condition.
+		}
+
+		// Using the required length calculated above, expand/realloc "result" if necessary.
+		if (new_result_length + 3 > result_size) // Must use +3 not +1 in case of empty_string_is_not_a_match (which needs room for up to two extra characters).
+		{
+			// The first expression passed to PredictReplacementSize is the average length of each replacement so far.
+			// It's more typically more accurate to pass that than the following "length of current
+			// replacement":
+			//    new_result_length - haystack_portion_length - (aOffset[1] - aOffset[0])
+			// Above is the length difference between the current replacement text and what it's
+			// replacing (it's negative when replacement is smaller than what it replaces).
+			size_t new_size = PredictReplacementSize((new_result_length - match_end_offset) / replacement_count // See above.
+				, replacement_count, limit, aHaystackLength, new_result_length+2, match_end_offset); // +2 in case of empty_string_is_not_a_match (which needs room for up to two extra characters).  The function will also do another +1 to convert length to size (for terminator).
+			// Grow by at least half, so that a series of slight underestimates (which are common when the
+			// replacements vary in length) can't cause a realloc and copy of the entire result for every match.
+			if (new_size < (size_t)result_size + result_size / 2 && result_size < INT_MAX / 3)
+				new_size = (size_t)result_size + result_size / 2;
+			REGEX_REALLOC((int)new_size); // This will end the loop if an alloc error occurs.
+		}
+		//else result_size is not only large enough, but also non-zero.  Other sections rely on it always
+		// being non-zero when replacement_count>0.
+
+		// Copy over the part of haystack that appears before the match, then the replacement text and its
+		// backreferences.
+		dest = result + result_length;
+		if (haystack_portion_length)
+		{
+			tmemcpy(dest, haystack_pos, haystack_portion_length);
+			dest += haystack_portion_length;
+		}
+		for (i = 0; i < part_count; ++i)
+		{
+			RegExReplacePart &this_part = part[i];
+			if (this_part.literal_length)
 			{
-				// Find the next '$', if any.
-				src_orig = src; // Init once for both loops below.
-				if (second_iteration) // Mode: copy src-to-dest.
-				{
-					while (*src && *src != '$') // While looking for the next '$', copy over everything up until the '$'.
-						*dest++ = *src++;
-					result_length += (int)(src - src_orig);
-				}
-				else // This is the first iteration (mode: size-calculation).
-				{
-					for (; *src && *src != '$'; ++src); // Find the next '$', if any.
-					new_result_length += (int)(src - src_orig); // '$' or '\0' was found: same expansion either way.
-				}
-				if (!*src)  // Reached the end of the replacement text.
-					break;  // Nothing left to do, so if this is the first major iteration, begin the second.
-
-				// Otherwise, a '$' has been found.  Check if it's a backreference and handle it.
-				// But first process any special flags that are present.
-				transform = '\0'; // Set default. Indicate "no transformation".
-				extra_offset = 0; // Set default. Indicate that there's no need to hop over an extra character.
-				if (char_after_dollar = src[1]) // This check avoids calling ctoupper on '\0', which directly or indirectly causes an assertion error in CRT.
-				{
-					switch(char_after_dollar = ctoupper(char_after_dollar))
-					{
-					case 'U':
-					case 'L':
-					case 'T':
-						transform = char_after_dollar;
-						extra_offset = 1;
-						char_after_dollar = src[2]; // Ignore the transform character for the purposes of backreference recognition further below.
-						break;
-					//else leave things at their defaults.
-					}
-				}
-				//else leave things at their defaults.
-
-				ref_num = INT_MIN; // Set default to "no valid backreference".  Use INT_MIN to virtually guaranty that anything other than INT_MIN means that something like a backreference was found (even if it's invalid, such as ${-5}).
-				switch (char_after_dollar)
-				{
-				case '{':  // Found a backreference: ${...
-					substring_name_pos = src + 2 + extra_offset;
-					if (closing_brace = _tcschr(substring_name_pos, '}'))
-					{
-						if (substring_name_length = (int)(closing_brace - substring_name_pos))
-						{
-							if (substring_name_length < _countof(substring_name))
-							{
-								tcslcpy(substring_name, substring_name_pos, substring_name_length + 1); // +1 to convert length to size, which truncates the new string at the desired position.
-								if (IsPureNumeric(substring_name, true, false, true)) // Seems best to allow floating point such as 1.0 because it will then get truncated to an integer.  It seems to rare that anyone would want to use floats as names.
-									ref_num = _ttoi(substring_name); // Uses _ttoi() vs. ATOI to avoid potential overlap with non-numeric names such as ${0x5}, which should probably be considered a name not a number?  In other words, seems best not to make some names that start with numbers "special" just because they happen to be hex numbers.
-								else // For simplicity, no checking is done to ensure it consists of the "32 alphanumeric characters and underscores".  Let pcre_get_stringnumber() figure that out for us.
-									ref_num = pcret_get_first_set(aRE, substring_name, aOffset); // Returns a negative on failure, which when stored in ref_num is relied upon as an indicator.
-							}
-							//else it's too long, so it seems best (debatable) to treat it as a unmatched/unfound name, i.e. "".
-							src = closing_brace; // Set things up for the next iteration to resume at the char after "${..}"
-						}
-						//else it's ${}, so do nothing, which in effect will treat it all as literal text.
-					}
-					//else unclosed '{': for simplicity, do nothing, which in effect will treat it all as literal text.
-					break;
-
-				case '$':  // i.e. Two consecutive $ amounts to one literal $.
-					++src; // Skip over the first '$', and the loop's increment will skip over the second. "extra_offset" is ignored due to rarity and silliness.  Just transcribe things like $U$ as U$ to indicate the problem.
-					break; // This also sets up things properly to copy a single literal '$' into the result.
-
-				case '\0': // i.e. a single $ was found at the end of the string.
-					break; // Seems best to treat it as literal (strictly speaking the script should have escaped it).
-
-				default:
-					if (char_after_dollar >= '0' && char_after_dollar <= '9') // Treat it as a single-digit backreference. CONSEQUENTLY, $15 is really $1 followed by a literal '5'.
-					{
-						ref_num = char_after_dollar - '0'; // $0 is the whole pattern rather than a subpattern.
-						src += 1 + extra_offset; // Set things up for the next iteration to resume at the char after $d. Consequently, $19 is seen as $1 followed by a literal 9.
-					}
-					//else not a digit: do nothing, which treats a $x as literal text (seems ok since like $19, $name will never be supported due to ambiguity; only ${name}).
-				} // switch (char_after_dollar)
-
-				if (ref_num == INT_MIN) // Nothing that looks like backreference is present (or the very unlikely ${-2147483648}).
+				tmemcpy(dest, this_part.literal, this_part.literal_length);
+				dest += this_part.literal_length;
+			}
+			if (this_part.match_length)
+			{
+				tmemcpy(dest, aHaystack + this_part.match_start, this_part.match_length);
+				if (this_part.transform)
 				{
-					if (second_iteration)
+					dest[this_part.match_length] = '\0'; // Terminate for use below (shouldn't cause overflow because REALLOC reserved space for terminator; nor should there be any need to undo the termination afterward).
+					switch(this_part.transform)
 					{
-						*dest++ = *src;  // src is incremented by the loop.  Copy only one character because the enclosing loop will take care of copying the rest.
-						++result_length; // Update the actual length.
+					case 'U': CharUpper(dest); break;
+					case 'L': CharLower(dest); break;
+					case 'T': StrToTitleCase(dest); break;
 					}
-					else
-						++new_result_length; // Update the calculated length.
-					// And now the enclosing loop will take care of the characters beyond src.
 				}
-				else // Something that looks like a backreference was found, even if it's invalid (e.g. ${-5}).
-				{
-					// It seems to improve convenience and flexibility to transcribe a nonexistent backreference
-					// as a "" rather than literally (e.g. putting a ${1} literally into the new string).  Although
-					// putting it in literally has the advantage of helping debugging, it doesn't seem to outweigh
-					// the convenience of being able to specify nonexistent subpatterns. MORE IMPORANTLY a subpattern
-					// might not exist per se if it hasn't been matched, such as an "or" like (abc)|(xyz), at least
-					// when it's the last subpattern, in which case it should definitely be treated as "" and not
-					// copied over literally.  So that would have to be checked for if this is changed.
-					if (ref_num >= 0 && ref_num < captured_pattern_count) // Treat ref_num==0 as reference to the entire-pattern's match.
-					{
-						int ref_num0 = aOffset[ref_num*2];
-						int ref_num1 = aOffset[ref_num*2 + 1];
-						match_length = ref_num1 - ref_num0;
-						if (match_length)
-						{
-							if (second_iteration)
-							{
-								tmemcpy(dest, aHaystack + ref_num0, match_length);
-								if (transform)
-								{
-									dest[match_length] = '\0'; // Terminate for use below (shouldn't cause overflow because REALLOC reserved space for terminator; nor should there be any need to undo the termination afterward).
-									switch(transform)
-									{
-									case 'U': CharUpper(dest); break;
-									case 'L': CharLower(dest); break;
-									case 'T': StrToTitleCase(dest); break;
-									}
-								}
-								dest += match_length;
-								result_length += match_length;
-							}
-							else // First iteration.
-								new_result_length += match_length;
-						}
-					}
-					//else subpattern doesn't exist (or it's invalid such as ${-5}, so treat it as blank because:
-					// 1) It's boosts script flexibility and convenience (at the cost of making it hard to detect
-					//    script bugs, which would be assisted by transcribing ${999} as literal text rather than "").
-					// 2) It simplifies the code.
-					// 3) A subpattern might not exist per se if it hasn't been matched, such as "(abc)|(xyz)"
-					//    (in which case only one of them is matched).  If such a thing occurs at the end
-					//    of the RegEx pattern, captured_pattern_count might not include it.  But it seems
-					//    pretty clear that it should be treated as "" rather than some kind of error condition.
-				}
-			} // for() (for each '$')
-		} // for() (a 2-iteration for-loop)
+				dest += this_part.match_length;
+			}
+		}
+		result_length = dest - result; // Remember that result_length is actually an output for our caller, so it must be kept accurate.
 
 		// If we're here, a match was found.
 		// Technique and comments from pcredemo.c:
@@ -16878,27 +17704,28 @@ out_of_mem:
 	}
 	// Now fall through to below so that count is set even for out-of-memory error.
 set_count_and_return:
+	if (part != part_buf)
+		free(part);
 	if (output_var_count)
 		output_var_count->Assign(replacement_count); // v1.0.47.05: Must be done last in case output_var_count shares the same memory with haystack, needle, or replacement.
 }
 
 
 
-BIF_DECL(BIF_RegEx)
-// This function is the initial entry point for both RegExMatch() and RegExReplace().
-// Caller has set aResultToken.symbol to a default of SYM_INTEGER.
+static void RegExExecute(ExprTokenType &aResultToken, ExprTokenType *aParam[], int aParamCount
+	, bool mode_is_replace, LPTSTR needle, pcre_cache_entry &aEntry)
+// Performs the remainder of BIF_RegEx after the regex has been compiled or found in the cache.
 {
-	bool mode_is_replace = ctoupper(aResultToken.marker[5]) == 'R'; // Union's marker initially contains the function name; e.g. RegEx[R]eplace.
-	LPTSTR needle = ParamIndexToString(1, aResultToken.buf); // Load-time validation has already ensured that at least two actual parameters are present.
-
-	TCHAR output_mode;
-	pcret_extra *extra;
-	pcret *re;
-	int options_length;
-
-	// COMPILE THE REGEX OR GET IT FROM CACHE.
-	if (   !(re = get_compiled_regex(needle, output_mode, extra, &options_length, &aResultToken))   ) // Compiling problem.
-		return; // It already set ErrorLevel and aResultToken for us. If caller provided an output var/array, it is not changed under these conditions because there's no way of knowing how many subpatterns are in the RegEx, and thus no way of knowing how far to init the array.
+	TCHAR output_mode = aEntry.output_mode;
+	pcret *re = aEntry.re_compiled;
+	int options_length = aEntry.options_length;
+	// The cached pcre_extra may be in use by other threads, so use a copy of it (if any) below.
+	pcret_extra extra_copy;
+	pcret_extra *extra = &extra_copy;
+	if (aEntry.extra) // S (study) option was specified.
+		extra_copy = *aEntry.extra;
+	else
+		extra_copy.flags = 0;
 
 	// Since compiling succeeded, get info about other parameters.
 	TCHAR haystack_buf[MAX_NUMBER_SIZE];
@@ -16942,15 +17769,7 @@ BIF_DECL(BIF_RegEx)
 	callout_data.options_length = options_length;
 	callout_data.pattern_count = pattern_count;
 	callout_data.output_mode = output_mode;
-	if (extra)
-	{	// S (study) option was specified, use existing pcre_extra struct.
-		extra->flags |= PCRE_EXTRA_CALLOUT_DATA | PCRE_EXTRA_MARK;	
-	}
-	else
-	{	// Allocate a pcre_extra struct to pass callout_data.
-		extra = (pcret_extra *)_alloca(sizeof(pcret_extra));
-		extra->flags = PCRE_EXTRA_CALLOUT_DATA | PCRE_EXTRA_MARK;
-	}
+	extra->flags |= PCRE_EXTRA_CALLOUT_DATA | PCRE_EXTRA_MARK;
 	// extra->callout_data is used to pass callout_data to PCRE.
 	extra->callout_data = &callout_data;
 	// callout_data.extra is used by RegExCallout, which only receives a pointer to callout_data.
@@ -16967,7 +17786,7 @@ BIF_DECL(BIF_RegEx)
 	// OTHERWISE, THIS IS RegExMatch() not RegExReplace().
 
 	// EXECUTE THE REGEX.
-	int captured_pattern_count = pcret_exec(re, extra, haystack, haystack_length
+	int captured_pattern_count = exec_compiled_regex(re, extra, haystack, haystack_length
 		, starting_offset, 0, offset, number_of_ints_in_offset);
 
 	int match_offset = 0; // Set default for no match/error cases below.
@@ -17041,6 +17860,26 @@ BIF_DECL(BIF_RegEx)
 
 
 
+BIF_DECL(BIF_RegEx)
+// This function is the initial entry point for both RegExMatch() and RegExReplace().
+// Caller has set aResultToken.symbol to a default of SYM_INTEGER.
+{
+	bool mode_is_replace = ctoupper(aResultToken.marker[5]) == 'R'; // Union's marker initially contains the function name; e.g. RegEx[R]eplace.
+	LPTSTR needle = ParamIndexToString(1, aResultToken.buf); // Load-time validation has already ensured that at least two actual parameters are present.
+
+	// COMPILE THE REGEX OR GET IT FROM CACHE.
+	pcre_cache_entry *entry;
+	if (   !(entry = get_compiled_regex(needle, &aResultToken))   ) // Compiling problem.
+		return; // It already set ErrorLevel and aResultToken for us. If caller provided an output var/array, it is not changed under these conditions because there's no way of knowing how many subpatterns are in the RegEx, and thus no way of knowing how far to init the array.
+
+	RegExExecute(aResultToken, aParam, aParamCount, mode_is_replace, needle, *entry);
+	// The entry must be kept until now because callouts refer to it and may run other RegEx's, which
+	// could evict it from the cache.
+	release_compiled_regex(entry);
+}
+
+
+
 BIF_DECL(BIF_Ord)
 {
 	// Result will always be an integer (this simplifies scripts that work with binary zeros since an
@@ -17359,6 +18198,8 @@ BIF_DECL(BIF_NumPut)
 	ExprTokenType &target_token = *aParam[1];
 	if (target_token.symbol == SYM_VAR) // SYM_VAR's Type() is always VAR_NORMAL (except lvalues in expressions).
 	{
+		if (Var::sBorrow) // Must be done before the variable's memory is written to below.
+			target_token.var->ResolveAlias()->CopyBorrowed();
 		target = (size_t)target_token.var->Contents(FALSE); // Pass FALSE for performance because contents is about to be overwritten, followed by a call to Close(). If something goes wrong and we return early, Contents() won't have been changed, so nothing about it needs updating.
 		right_side_bound = target + target_token.var->ByteCapacity(); // This is the first illegal address to the right of target.
 	}
@@ -17627,6 +18468,28 @@ BIF_DECL(BIF_StrGetPut)
 				CStringWCharFromChar wide_buf((LPCSTR)source_string, source_length, CP_ACP);				
 				source_string = wide_buf.GetString();
 				source_length = wide_buf.GetLength();
+#endif
+#ifdef UNICODE
+				int ascii_length = 0;
+				if (encoding == CP_UTF8 && length && (UINT)source_length <= (UINT)length)
+				{
+					// Since the target buffer is large enough for an all-ASCII string, copy the ASCII prefix
+					// directly, which is often the entire string.  Only the remainder (if any) is converted.
+					ascii_length = (int)CopyAsciiFromTChar((LPSTR)address, (LPCWSTR)source_string, source_length);
+					if (ascii_length == source_length)
+					{
+						char_count = source_length;
+						if ((UINT)char_count < (UINT)length)
+							((LPSTR)address)[char_count++] = '\0';
+						aResultToken.value_int64 = char_count;
+						return;
+					}
+					source_string = (LPCWSTR)source_string + ascii_length;
+					source_length -= ascii_length;
+					address = (LPSTR)address + ascii_length;
+					if (length > 0)
+						length -= ascii_length;
+				}
 #endif
 				// UTF-8 does not support this flag.  Although the check further below would probably
 				// compensate for this, UTF-8 is probably common enough to leave this exception here.
@@ -17669,6 +18532,9 @@ BIF_DECL(BIF_StrGetPut)
 				// else no space to null-terminate; or conversion failed.
 #ifndef UNICODE
 			}
+#else
+				if (char_count)
+					char_count += ascii_length;
 #endif
 		}
 		// Return the number of characters copied.
@@ -17681,11 +18547,26 @@ BIF_DECL(BIF_StrGetPut)
 			// Conversion is required.
 			int conv_length;
 #ifdef UNICODE
-			// Convert multi-byte encoded string to UTF-16.
-			conv_length = MultiByteToWideChar(encoding, 0, (LPCSTR)address, length, NULL, 0);
-			if (!TokenSetResult(aResultToken, NULL, conv_length)) // DO NOT SUBTRACT 1, conv_length might not include a null-terminator.
-				return; // Out of memory.
-			conv_length = MultiByteToWideChar(encoding, 0, (LPCSTR)address, length, aResultToken.marker, conv_length);
+			if (encoding == CP_UTF8)
+			{
+				// Since UTF-8 never requires more UTF-16 code units than bytes, the result can be converted
+				// in a single pass, with any ASCII prefix (often the entire string) copied directly.
+				int src_length = (length == -1) ? (int)strlen((LPCSTR)address) : length;
+				if (!TokenSetResult(aResultToken, NULL, src_length))
+					return; // Out of memory.
+				conv_length = (int)CopyAsciiToTChar(aResultToken.marker, (LPCSTR)address, src_length);
+				if (conv_length < src_length)
+					conv_length += MultiByteToWideChar(CP_UTF8, 0, (LPCSTR)address + conv_length, src_length - conv_length
+						, aResultToken.marker + conv_length, src_length - conv_length);
+			}
+			else
+			{
+				// Convert multi-byte encoded string to UTF-16.
+				conv_length = MultiByteToWideChar(encoding, 0, (LPCSTR)address, length, NULL, 0);
+				if (!TokenSetResult(aResultToken, NULL, conv_length)) // DO NOT SUBTRACT 1, conv_length might not include a null-terminator.
+					return; // Out of memory.
+				conv_length = MultiByteToWideChar(encoding, 0, (LPCSTR)address, length, aResultToken.marker, conv_length);
+			}
 #else
 			CStringW wide_buf;
 			// If the target string is not UTF-16, convert it to that first.
@@ -43,6 +43,89 @@ GNU General Public License for more details.
 #include "globaldata.h" // for a lot of things
 #include "qmath.h" // For ExpandExpression()
 
+
+// Sizes are rounded up to pointer alignment so that Owned nodes can be carved from the same blocks.
+#define EXPR_SCRATCH_ALIGN(size) (((size) + (sizeof(void *) - 1)) & ~(sizeof(void *) - 1))
+
+LPTSTR ExprScratch::Alloc(size_t aChars)
+{
+	size_t size = EXPR_SCRATCH_ALIGN(aChars * sizeof(TCHAR));
+	if (!mBlock || mBlock->mSize - mBlock->mUsed < size)
+	{
+		Block *block;
+		if (mSpare && size <= EXPR_SCRATCH_BLOCK_SIZE - sizeof(Block))
+		{
+			block = mSpare;
+			mSpare = NULL;
+		}
+		else
+		{
+			size_t block_size = size + sizeof(Block);
+			if (block_size < EXPR_SCRATCH_BLOCK_SIZE)
+				block_size = EXPR_SCRATCH_BLOCK_SIZE;
+			if (   !(block = (Block *)malloc(block_size))   )
+				return NULL;
+			block->mSize = block_size;
+		}
+		block->mUsed = sizeof(Block);
+		block->mPrev = mBlock;
+		mBlock = block;
+	}
+	mLast = (LPTSTR)((char *)mBlock + mBlock->mUsed);
+	mBlock->mUsed += size;
+	return mLast;
+}
+
+bool ExprScratch::Extend(LPTSTR aMem, size_t aNewChars)
+// Grows the most recent allocation in place, if there's room for it in the current block.
+{
+	if (aMem != mLast || !mLast)
+		return false;
+	size_t used = ((char *)aMem - (char *)mBlock) + EXPR_SCRATCH_ALIGN(aNewChars * sizeof(TCHAR));
+	if (used > mBlock->mSize)
+		return false;
+	if (used > mBlock->mUsed)
+		mBlock->mUsed = used;
+	return true;
+}
+
+bool ExprScratch::TakeOwnership(void *aMem)
+{
+	Owned *node = (Owned *)Alloc(sizeof(Owned) / sizeof(TCHAR)); // This also disqualifies the previous allocation from Extend(), as it must.
+	if (!node)
+		return false;
+	node->mMem = aMem;
+	node->mNext = mOwned;
+	mOwned = node;
+	return true;
+}
+
+void ExprScratch::Release(Mark &aMark)
+{
+	for (; mOwned != aMark.owned; mOwned = mOwned->mNext) // Must be done before the blocks below are released.
+		free(mOwned->mMem);
+	while (mBlock != aMark.block)
+	{
+		Block *prev = mBlock->mPrev;
+		if (!mSpare && mBlock->mSize == EXPR_SCRATCH_BLOCK_SIZE)
+			mSpare = mBlock;
+		else
+			free(mBlock); // Oversized blocks aren't kept, so that one huge expression doesn't tie up memory indefinitely.
+		mBlock = prev;
+	}
+	if (mBlock)
+		mBlock->mUsed = aMark.used;
+	mLast = NULL;
+}
+
+void ExprScratch::Free()
+{
+	Mark empty = {0};
+	Release(empty);
+	free(mSpare);
+	mSpare = NULL;
+}
+
 // __forceinline: Decided against it for this function because although it's only called by one caller,
 // testing shows that it wastes stack space (room for its automatic variables would be unconditionally 
 // reserved in the stack of its caller).  Also, the performance benefit of inlining this is too slight.
@@ -68,11 +151,11 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ExprTokenType
 {
 	LPTSTR target = aTarget; // "target" is used to track our usage (current position) within the aTarget buffer.
 
-	// The following must be defined early so that mem_count is initialized and the array is guaranteed to be
-	// "in scope" in case of early "goto" (goto substantially boosts performance and reduces code size here).
-	#define MAX_EXPR_MEM_ITEMS 256 // v1.0.47.01: Raised from 100 because a line consisting entirely of concat operators can exceed it.  However, there's probably not much point to going much above MAX_TOKENS/2 because then it would reach the MAX_TOKENS limit first.
-	LPTSTR mem[MAX_EXPR_MEM_ITEMS]; // No init necessary.  In most cases, it will never be used.
-	int mem_count = 0; // The actual number of items in use in the above array.
+	// The following must be defined early so that the mark is initialized and guaranteed to be "in scope"
+	// in case of early "goto" (goto substantially boosts performance and reduces code size here).
+	// Everything allocated from sExprScratch after this point is released when we return.
+	ExprScratch::Mark scratch_mark;
+	sExprScratch.GetMark(scratch_mark);
 	LPTSTR result_to_return = _T(""); // By contrast, NULL is used to tell the caller to abort the current thread.  That isn't done for normal syntax errors, just critical conditions such as out-of-memory.
 	Var *output_var = (mActionType == ACT_ASSIGNEXPR) ? OUTPUT_VAR : NULL; // Resolve early because it's similar in usage/scope to the above.  Plus MUST be resolved prior to calling any script-functions since they could change the values in sArgVar[].
 
@@ -96,22 +179,12 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ExprTokenType
 	TCHAR right_buf[MAX_NUMBER_SIZE]; // Only needed for holding numbers
 	LPTSTR result; // "result" is used for return values and also the final result.
 	VarSizeType result_length;
-	size_t result_size, alloca_usage = 0; // v1.0.45: Track amount of alloca mem to avoid stress on stack from extreme expressions (mostly theoretical).
+	size_t result_size;
 	BOOL done, done_and_have_an_output_var, make_result_persistent, left_branch_is_true
 		, left_was_negative, is_pre_op; // BOOL vs. bool benchmarks slightly faster, and is slightly smaller in code size (or maybe it's cp1's int vs. char that shrunk it).
 	ExprTokenType *circuit_token, *this_postfix, *p_postfix;
 	Var *sym_assign_var, *temp_var;
 
-	// v1.0.44.06: EXPR_SMALL_MEM_LIMIT is the means by which _alloca() is used to boost performance a
-	// little by avoiding the overhead of malloc+free for small strings.  The limit should be something
-	// small enough that the chance that even 10 of them would cause stack overflow is vanishingly small
-	// (the program is currently compiled to allow stack to expand anyway).  Even in a worst-case
-	// scenario where an expression is composed entirely of functions and they all need to use this
-	// limit of stack space, there's a practical limit on how many functions you can call in an
-	// expression due to MAX_TOKENS (probably around MAX_TOKENS / 3).
-	#define EXPR_SMALL_MEM_LIMIT 4097 // The maximum size allowed for an item to qualify for alloca.
-	#define EXPR_ALLOCA_LIMIT 40000  // The maximum amount of alloca memory for all items.  v1.0.45: An extra precaution against stack stress in extreme/theoretical cases.
-
 	// For each item in the postfix array: if it's an operand, push it onto stack; if it's an operator or
 	// function call, evaluate it and push its result onto the stack.  SYM_INVALID is the special symbol
 	// that marks the end of the postfix array.
@@ -325,22 +398,10 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ExprTokenType
 					result = target;
 					target += result_size; // Point it to the location where the next string would be written.
 				}
-				else if (result_size < EXPR_SMALL_MEM_LIMIT && alloca_usage < EXPR_ALLOCA_LIMIT) // See comments at EXPR_SMALL_MEM_LIMIT.
+				else if (   !(result = sExprScratch.Alloc(result_size))   ) // Need some new memory for our temporary use.
 				{
-					result = (LPTSTR)talloca(result_size);
-					alloca_usage += result_size; // This might put alloca_usage over the limit by as much as EXPR_SMALL_MEM_LIMIT, but that is fine because it's more of a guideline than a limit.
-				}
-				else // Need to create some new persistent memory for our temporary use.
-				{
-					if (mem_count == MAX_EXPR_MEM_ITEMS // No more slots left (should be nearly impossible).
-						|| !(mem[mem_count] = tmalloc(result_size)))
-					{
-						LineError(ERR_OUTOFMEM, FAIL, this_token.var->mName);
-						goto abort;
-					}
-					// Point result to its new, more persistent location:
-					result = mem[mem_count];
-					++mem_count; // Must be done last.
+					LineError(ERR_OUTOFMEM, FAIL, this_token.var->mName);
+					goto abort;
 				}
 				this_token.var->Get(result); // MUST USE "result" TO AVOID OVERWRITING MARKER/VAR UNION.
 				this_token.marker = result;  // Must be done after above because marker and var overlap in union.
@@ -481,7 +542,7 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ExprTokenType
 				if (mActionType == ACT_EXPRESSION) // Isolated expression: Outermost function call's result will be ignored, so no need to store it.
 				{
 					if (this_token.mem_to_free)
-						free(this_token.mem_to_free); // Don't bother putting it into mem[].
+						free(this_token.mem_to_free); // Don't bother putting it into sExprScratch.
 					goto normal_end_skip_output_var; // No output_var is possible for ACT_EXPRESSION.
 				}
 				internal_output_var = output_var; // NULL unless this is ACT_ASSIGNEXPR.
@@ -491,7 +552,7 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ExprTokenType
 			// But it seems best to optimize these cases so that commas aren't penalized.
 			else if (this_postfix[1].symbol == SYM_ASSIGN  // Next operation is ":=".
 					&& stack_count && stack[stack_count-1]->symbol == SYM_VAR // i.e. let the next iteration handle errors instead of doing it here.  Further below relies on this having been checked.
-					&& stack[stack_count-1]->var->Type() == VAR_NORMAL) // Don't do clipboard here because: 1) AcceptNewMem() doesn't support it; 2) Could probably use Assign() and then make its result be a newly added mem_count item, but the code complexity doesn't seem worth it given the rarity.
+					&& stack[stack_count-1]->var->Type() == VAR_NORMAL) // Don't do clipboard here because: 1) AcceptNewMem() doesn't support it; 2) Could probably use Assign() and then make its result be a newly added sExprScratch item, but the code complexity doesn't seem worth it given the rarity.
 				internal_output_var = stack[stack_count-1]->var;
 			else
 				internal_output_var = NULL;
@@ -560,8 +621,10 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ExprTokenType
 			// RESTORE THE CIRCUIT TOKEN (after handling what came back inside it):
 			if (this_token.mem_to_free) // The called function allocated some memory and turned it over to us.
 			{
-				if (mem_count == MAX_EXPR_MEM_ITEMS) // No more slots left (should be nearly impossible).
+				// Mark it to be freed at the time we return.
+				if (!sExprScratch.TakeOwnership(this_token.mem_to_free))
 				{
+					free(this_token.mem_to_free);
 					LineError(ERR_OUTOFMEM, FAIL, func->mName);
 					goto abort;
 				}
@@ -569,8 +632,6 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ExprTokenType
 				{
 					make_result_persistent = false; // Override the default set higher above.
 				}
-				// Mark it to be freed at the time we return.
-				mem[mem_count++] = this_token.mem_to_free;
 			}
 			//else this_token.mem_to_free==NULL, so the BIF just called didn't allocate memory to give to us.
 			this_token.circuit_token = circuit_token; // Restore it to its original value.
@@ -652,11 +713,6 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ExprTokenType
 					this_token.marker = (LPTSTR)tmemcpy(target, result, result_size); // Benches slightly faster than strcpy().
 					target += result_size; // Point it to the location where the next string would be written.
 				}
-				else if (result_size < EXPR_SMALL_MEM_LIMIT && alloca_usage < EXPR_ALLOCA_LIMIT) // See comments at EXPR_SMALL_MEM_LIMIT.
-				{
-					this_token.marker = (LPTSTR)tmemcpy((LPTSTR)talloca(result_size), result, result_size); // Benches slightly faster than strcpy().
-					alloca_usage += result_size; // This might put alloca_usage over the limit by as much as EXPR_SMALL_MEM_LIMIT, but that is fine because it's more of a guideline than a limit.
-				}
 				else // Need to create some new persistent memory for our temporary use.
 				{
 					// In real-world scripts the need for additional memory allocation should be quite
@@ -667,15 +723,13 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ExprTokenType
 					// - There's insufficient room at the end of the deref buf to store the return value
 					//   (unusual because the deref buf expands in block-increments, and also because
 					//   return values are usually small, such as numbers).
-					if (mem_count == MAX_EXPR_MEM_ITEMS // No more slots left (should be nearly impossible).
-						|| !(mem[mem_count] = tmalloc(result_size)))
+					if (   !(this_token.marker = sExprScratch.Alloc(result_size))   )
 					{
 						LineError(ERR_OUTOFMEM, FAIL, func->mName);
 						goto abort;
 					}
 					// Make the token's result the new, more persistent location:
-					this_token.marker = (LPTSTR)tmemcpy(mem[mem_count], result, result_size); // Benches slightly faster than strcpy().
-					++mem_count; // Must be done last.
+					tmemcpy(this_token.marker, result, result_size); // Benches slightly faster than strcpy().
 				}
 			}
 			else // make_result_persistent==false
@@ -888,6 +942,8 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ExprTokenType
 				}
 				else
 				{
+					if (Var::sBorrow) // The script could write to the variable through the address at any time, so stop sharing its memory now.
+						right.var->ResolveAlias()->CopyBorrowed();
 					right.var->DisableCache(); // Once the script take the address of a variable, there's no way to predict when it will make changes to the variable's contents.  So don't allow mContents to get out-of-sync with the variable's binary int/float.
 					this_token.symbol = SYM_INTEGER;
 					this_token.value_int64 = (__int64)right.var->Contents(); // Contents() vs. mContents to support VAR_CLIPBOARD, and in case mContents needs to be updated by Contents().
@@ -1090,9 +1146,9 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ExprTokenType
 					// simplify the code).
 					right_length = (right.symbol == SYM_VAR) ? right.var->LengthIgnoreBinaryClip() : _tcslen(right_string);
 					if (sym_assign_var // Since "right" is being appended onto a variable ("left"), an optimization is possible.
-						&& sym_assign_var->AppendIfRoom(right_string, (VarSizeType)right_length)) // But only if the target variable has enough remaining capacity.
+						&& sym_assign_var->Append(right_string, (VarSizeType)right_length)) // Writes directly into the variable, growing it geometrically if necessary.
 					{
-						// AppendIfRoom() always fails for VAR_CLIPBOARD, so below won't execute for it (which is
+						// Append() always fails for VAR_CLIPBOARD, so below won't execute for it (which is
 						// good because don't want clipboard to stay as SYM_VAR after the assignment. This is
 						// because it simplifies the code not to have to worry about VAR_CLIPBOARD in BIFs, etc.)
 						this_token.var = sym_assign_var; // Make the result a variable rather than a normal operand so that its
@@ -1112,7 +1168,7 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ExprTokenType
 					}
 					else if (this_postfix[1].symbol == SYM_ASSIGN // Next operation is ":=".
 						&& stack_count && stack[stack_count-1]->symbol == SYM_VAR // i.e. let the next iteration handle it instead of doing it here.  Further below relies on this having been checked.
-						&& stack[stack_count-1]->var->Type() == VAR_NORMAL) // Don't do clipboard here because: 1) AcceptNewMem() doesn't support it; 2) Could probably use Assign() and then make its result be a newly added mem_count item, but the code complexity doesn't seem worth it given the rarity.
+						&& stack[stack_count-1]->var->Type() == VAR_NORMAL) // Don't do clipboard here because: 1) AcceptNewMem() doesn't support it; 2) Could probably use Assign() and then make its result be a newly added sExprScratch item, but the code complexity doesn't seem worth it given the rarity.
 					{
 						temp_var = stack[stack_count-1]->var;
 						done_and_have_an_output_var = FALSE;
@@ -1128,8 +1184,8 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ExprTokenType
 							// One of the following is true:
 							//   1) temp_var has zero capacity and is empty.
 							//   2) temp_var has zero capacity and contains an unflushed binary number.
-							// In the first case, AppendIfRoom() will always fail, so we want to skip it and use
-							// the "no overlap" optimization below. In the second case, calling AppendIfRoom()
+							// In the first case, there's nothing to append to, so we want to skip Append() and use
+							// the "no overlap" optimization below. In the second case, calling Append()
 							// would produce the wrong result; e.g. (x := 0+1, x := y 0) would produce "10".
 							result = NULL;
 						}
@@ -1138,7 +1194,7 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ExprTokenType
 							// MUST DO THE ABOVE CHECK because the next section further below might free the
 							// destination memory before doing the operation. Thus, if the destination is the
 							// same as one of the sources, freeing it beforehand would obviously be a problem.
-							if (temp_var->AppendIfRoom(right_string, (VarSizeType)right_length))
+							if (temp_var->Append(right_string, (VarSizeType)right_length))
 							{
 								if (done_and_have_an_output_var) // Fix for v1.0.48: Checking "temp_var == output_var" would not be enough for cases like v := (v := v . "a") . "b"
 									goto normal_end_skip_output_var; // Nothing more to do because it has even taken care of output_var already.
@@ -1196,31 +1252,35 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ExprTokenType
 					//if (result_size == 1)
 					//	this_token.marker = "";
 					//else
-					// Must cast to int to avoid loss of negative values:
-					if (result_size <= (int)(aDerefBufSize - (target - aDerefBuf))) // There is room at the end of our deref buf, so use it.
+					// If the left operand is the most recent intermediate result (such as the previous link of
+					// a chain like a . b . c . d), append to it in place rather than copying all of it again.
+					// Nothing else can refer to that memory because each intermediate result belongs only to
+					// the token which produced it, and that token has just been popped.
+					if (left_length
+						&& (left_string + left_length + 1 == target && left_string >= aTarget
+							? right_length <= aDerefBufSize - (target - aDerefBuf) && (target += right_length, true)
+							: sExprScratch.Extend(left_string, result_size)))
 					{
-						this_token.marker = target;
-						target += result_size;  // Adjust target for potential future use by another concat or function call.
+						this_token.marker = left_string;
+						tmemcpy(left_string + left_length, right_string, right_length + 1); // +1 to include its zero terminator.
 					}
-					else if (result_size < EXPR_SMALL_MEM_LIMIT && alloca_usage < EXPR_ALLOCA_LIMIT) // See comments at EXPR_SMALL_MEM_LIMIT.
-					{
-						this_token.marker = (LPTSTR)talloca(result_size);
-						alloca_usage += result_size; // This might put alloca_usage over the limit by as much as EXPR_SMALL_MEM_LIMIT, but that is fine because it's more of a guideline than a limit.
-					}
-					else // Need to create some new persistent memory for our temporary use.
+					else
 					{
-						// See the nearly identical section higher above for comments:
-						if (mem_count == MAX_EXPR_MEM_ITEMS // No more slots left (should be nearly impossible).
-							|| !(this_token.marker = mem[mem_count] = tmalloc(result_size)))
+						// Must cast to int to avoid loss of negative values:
+						if (result_size <= (int)(aDerefBufSize - (target - aDerefBuf))) // There is room at the end of our deref buf, so use it.
+						{
+							this_token.marker = target;
+							target += result_size;  // Adjust target for potential future use by another concat or function call.
+						}
+						else if (   !(this_token.marker = sExprScratch.Alloc(result_size))   ) // Need some new memory for our temporary use.
 						{
 							LineError(ERR_OUTOFMEM);
 							goto abort;
 						}
-						++mem_count;
+						if (left_length)
+							tmemcpy(this_token.marker, left_string, left_length);  // Not +1 because don't need the zero terminator.
+						tmemcpy(this_token.marker + left_length, right_string, right_length + 1); // +1 to include its zero terminator.
 					}
-					if (left_length)
-						tmemcpy(this_token.marker, left_string, left_length);  // Not +1 because don't need the zero terminator.
-					tmemcpy(this_token.marker + left_length, right_string, right_length + 1); // +1 to include its zero terminator.
 
 					// For this new concat operator introduced in v1.0.31, it seems best to treat the
 					// result as a SYM_STRING if either operand is a SYM_STRING.  That way, when the
@@ -1545,6 +1605,7 @@ non_null_circuit_token:
 		{	// Return numeric or object result as-is.
 			aResultToken->symbol = result_token.symbol;
 			aResultToken->value_int64 = result_token.value_int64;
+			sExprScratch.Release(scratch_mark);
 			return _T(""); // Must not return NULL; any other value is OK (will be ignored).
 		}
 		if (result_token.symbol == SYM_VAR && result_token.var->HasObject())
@@ -1552,6 +1613,7 @@ non_null_circuit_token:
 			aResultToken->symbol = SYM_OBJECT;
 			aResultToken->object = result_token.var->Object();
 			aResultToken->object->AddRef();
+			sExprScratch.Release(scratch_mark);
 			return _T("");
 		}
 	}
@@ -1698,8 +1760,7 @@ abnormal_end: // Currently the same as normal_end; it's separate to improve read
 			aResult = FAIL;
 
 normal_end_skip_output_var:
-	for (i = mem_count; i--;) // Free any temporary memory blocks that were used.  Using reverse order might reduce memory fragmentation a little (depending on implementation of malloc).
-		free(mem[i]);
+	sExprScratch.Release(scratch_mark); // Free any temporary memory that was used.
 
 	// L31: Release any objects which have been previous pushed onto the stack and not yet released.
 	while (high_water_mark)
@@ -154,6 +154,8 @@ Object *Object::Clone(BOOL aExcludeIntegerKeys)
 {
 	IndexType aStartOffset = aExcludeIntegerKeys ? mKeyOffsetObject : 0;
 
+	SortStringKeys(); // The clone relies on binary search until it has enough keys to be indexed.
+
 	Object *objptr = new Object();
 	if (!objptr|| aStartOffset >= mFieldCount)
 		return objptr;
@@ -173,6 +175,7 @@ Object *Object::Clone(BOOL aExcludeIntegerKeys)
 	IndexType i;
 
 	obj.mFieldCount = field_count;
+	obj.mIsDenseArray = mIsDenseArray; // Keys are copied explicitly below, so this is merely a hint.
 	obj.mKeyOffsetObject = mKeyOffsetObject - aStartOffset;
 	obj.mKeyOffsetString = mKeyOffsetString - aStartOffset;
 	if (obj.mKeyOffsetObject < 0) // Currently might always evaluate to false.
@@ -204,7 +207,7 @@ Object *Object::Clone(BOOL aExcludeIntegerKeys)
 		else if (i >= obj.mKeyOffsetObject)
 			(dst.key.p = src.key.p)->AddRef();
 		else
-			dst.key.i = src.key.i;
+			dst.key.i = IntKey(aStartOffset + i);
 
 		// Copy value.
 		switch (dst.symbol = src.symbol)
@@ -261,7 +264,7 @@ void Object::ArrayToParams(ExprTokenType *token, ExprTokenType **param_list, int
 	// Find the first and last field to be used.
 	int start = (int)mKeyOffsetInt;
 	int end = (int)mKeyOffsetObject; // For readability.
-	while (start < end && mFields[start].key.i < 1)
+	while (start < end && IntKey(start) < 1)
 		++start; // Skip any keys <= 0 (consistent with UDF-calling behaviour).
 	
 	int param_index;
@@ -270,7 +273,7 @@ void Object::ArrayToParams(ExprTokenType *token, ExprTokenType **param_list, int
 	// For each extra param...
 	for (field_index = start, param_index = 0; field_index < end; ++field_index, ++param_index)
 	{
-		for ( ; param_index + 1 < (int)mFields[field_index].key.i; ++param_index)
+		for ( ; param_index + 1 < (int)IntKey(field_index); ++param_index)
 		{
 			token[param_index].symbol = SYM_MISSING;
 			token[param_index].marker = _T("");
@@ -391,6 +394,7 @@ Object::~Object()
 		// Free fields array.
 		free(mFields);
 	}
+	FreeStringIndex();
 }
 
 
@@ -978,6 +982,8 @@ void Object::EndClassDefinition()
 	// conflicting declarations.  Since these variables will be added at run-time to the derived objects,
 	// we don't want them in the class object.  So delete any key-value pairs with the special marker
 	// value (currently any integer, since static initializers haven't been evaluated yet).
+	DropStringIndex(); // Since keys will be moved below.
+	MakeSparse(); // Since integer keys might be removed below, such as for "0 := (expr)".
 	for (IndexType i = mFieldCount - 1; i >= 0; --i)
 		if (mFields[i].symbol == SYM_INTEGER)
 		{
@@ -1022,6 +1028,11 @@ bool Object::InsertAt(INT_PTR aOffset, INT_PTR aKey, ExprTokenType *aValue[], in
 	if (need_capacity > mFieldCountMax && !SetInternalCapacity(need_capacity))
 		// Fail.
 		return false;
+	// Inserting at key N+1 of a dense array of N items, or within it, keeps it dense
+	// unless some values are missing.  Otherwise, the keys must be stored first.
+	bool dense = mIsDenseArray && aKey == aOffset + 1 && actual_count == aValueCount;
+	if (!dense)
+		MakeSparse();
 	FieldType *field = mFields + aOffset;
 	if (aOffset < mFieldCount)
 		memmove(field + actual_count, field, (mFieldCount - aOffset) * sizeof(FieldType));
@@ -1041,6 +1052,8 @@ bool Object::InsertAt(INT_PTR aOffset, INT_PTR aKey, ExprTokenType *aValue[], in
 			field++;
 		}
 	}
+	if (dense) // Keys of the moved fields are implied by their new positions.
+		return true;
 	// Adjust keys of fields which have been moved.
 	for (field_end = mFields + mKeyOffsetObject; field < field_end; ++field)
 	{
@@ -1104,7 +1117,7 @@ ResultType Object::_Push(ExprTokenType &aResultToken, ExprTokenType *aParam[], i
 // Push(value1, ...)
 {
 	IndexType insert_pos = mKeyOffsetObject; // int keys end here.;
-	IntKeyType start_index = (insert_pos ? mFields[insert_pos - 1].key.i + 1 : 1);
+	IntKeyType start_index = (insert_pos ? IntKey(insert_pos - 1) + 1 : 1);
 	if (!InsertAt(insert_pos, start_index, aParam, aParamCount))
 		return g_script.ScriptError(ERR_OUTOFMEM);
 
@@ -1134,7 +1147,7 @@ ResultType Object::_Remove_impl(ExprTokenType &aResultToken, ExprTokenType *aPar
 		if (mKeyOffsetObject) // i.e. at least one int field; use _MaxIndex()
 		{
 			min_field = &mFields[min_pos = mKeyOffsetObject - 1];
-			min_key = min_field->key;
+			min_key.i = IntKey(min_pos);
 			min_key_type = SYM_INTEGER;
 		}
 		else // No appropriate field to remove, just return "".
@@ -1142,6 +1155,11 @@ ResultType Object::_Remove_impl(ExprTokenType &aResultToken, ExprTokenType *aPar
 	}
 	else
 	{
+		if (aParamCount > 1 && mStringIndex && TokenIsPureNumeric(*aParam[0]) != PURE_INTEGER)
+			// Removing a range of string keys relies on them being in order, and shifts the position of
+			// every key after the range, so revert to binary search.  The index is rebuilt if needed.
+			DropStringIndex();
+
 		if (min_field = FindField(*aParam[0], aResultToken.buf, min_key_type, min_key, min_pos))
 			min_pos = min_field - mFields; // else min_pos was already set by FindField.
 		
@@ -1155,6 +1173,12 @@ ResultType Object::_Remove_impl(ExprTokenType &aResultToken, ExprTokenType *aPar
 		aMode = RM_RemoveKey;
 		aParamCount = 1;
 	}
+
+	if (mIsDenseArray && min_key_type == SYM_INTEGER
+		&& (min_key.i < 1 // All remaining keys would be renumbered below 1, or a gap would be left at the front.
+			|| aMode == RM_RemoveKey && (aParamCount > 1 || min_key.i < mKeyOffsetObject))) // Would leave a gap, unless it's the last key.
+		MakeSparse(); // Keys must be stored before the fields are moved.
+	// Otherwise, the array is still dense after the removal, so the loops below which adjust keys are skipped.
 	
 	if (aParamCount > 1) // Removing a range of keys.
 	{
@@ -1193,8 +1217,9 @@ ResultType Object::_Remove_impl(ExprTokenType &aResultToken, ExprTokenType *aPar
 		if (!min_field) // Nothing to remove.
 		{
 			if (aMode == RM_RemoveAt || (aMode == RM_RemoveKeyOrIndex && min_key_type == SYM_INTEGER))
-				for (pos = min_pos; pos < mKeyOffsetObject; ++pos)
-					mFields[pos].key.i--;
+				if (!mIsDenseArray)
+					for (pos = min_pos; pos < mKeyOffsetObject; ++pos)
+						mFields[pos].key.i--;
 			// Our return value when only one key is given is supposed to be the value
 			// previously at this[key], which has just been removed.  Since this[key]
 			// would return "", it makes sense to return an empty string in this case.
@@ -1228,6 +1253,23 @@ ResultType Object::_Remove_impl(ExprTokenType &aResultToken, ExprTokenType *aPar
 		// Note that object keys can only be removed in the single-item mode.
 		if (min_key_type == SYM_OBJECT)
 			min_field->key.p->Release();
+		if (min_key_type == SYM_STRING && mStringIndex)
+		{
+			// Rather than shifting every subsequent field, fill the gap with the last string key.
+			// This leaves the keys out of order, but SortStringKeys() will be called if needed.
+			IndexType last_pos = mFieldCount - 1;
+			RemoveFromStringIndex(FindStringIndexSlot(min_pos - mKeyOffsetString));
+			min_field->Free();
+			free(min_field->key.s);
+			if (min_pos < last_pos)
+			{
+				FindStringIndexSlot(last_pos - mKeyOffsetString)->pos = min_pos - mKeyOffsetString + 1;
+				*min_field = mFields[last_pos];
+				mStringIndex->unsorted = true;
+			}
+			mFieldCount = last_pos;
+			return OK;
+		}
 		// Set these up as if caller did Remove(min_key, min_key):
 		max_pos = min_pos + 1;
 		max_key.i = min_key.i; // Union copy. Used only if min_key_type == SYM_INTEGER; has no effect in other cases.
@@ -1262,7 +1304,7 @@ ResultType Object::_Remove_impl(ExprTokenType &aResultToken, ExprTokenType *aPar
 					logical_count_removed = max_key.i - min_key.i + 1;
 				// Regardless of whether any fields were removed, min_pos contains the position of the field which
 				// immediately followed the specified range.  Decrement each numeric key from this position onward.
-				if (logical_count_removed > 0)
+				if (logical_count_removed > 0 && !mIsDenseArray)
 					for (pos = min_pos; pos < mKeyOffsetObject; ++pos)
 						mFields[pos].key.i -= logical_count_removed;
 			}
@@ -1309,7 +1351,7 @@ ResultType Object::_MinIndex(ExprTokenType &aResultToken, ExprTokenType *aParam[
 	if (mKeyOffsetObject) // i.e. there are fields with integer keys
 	{
 		aResultToken.symbol = SYM_INTEGER;
-		aResultToken.value_int64 = (__int64)mFields[0].key.i;
+		aResultToken.value_int64 = (__int64)IntKey(0);
 	}
 	// else no integer keys; leave aResultToken at default, empty string.
 	return OK;
@@ -1323,7 +1365,7 @@ ResultType Object::_Count(ExprTokenType &aResultToken, ExprTokenType *aParam[],
 
 ResultType Object::_Length(ExprTokenType &aResultToken, ExprTokenType *aParam[], int aParamCount)
 {
-	IntKeyType max_index = mKeyOffsetObject ? mFields[mKeyOffsetObject - 1].key.i : 0;
+	IntKeyType max_index = mKeyOffsetObject ? IntKey(mKeyOffsetObject - 1) : 0;
 	
 	aResultToken.symbol = SYM_INTEGER;
 	aResultToken.value_int64 = (__int64)(max_index > 0 ? max_index : 0);
@@ -1338,7 +1380,7 @@ ResultType Object::_MaxIndex(ExprTokenType &aResultToken, ExprTokenType *aParam[
 	if (mKeyOffsetObject) // i.e. there are fields with integer keys
 	{
 		aResultToken.symbol = SYM_INTEGER;
-		aResultToken.value_int64 = (__int64)mFields[mKeyOffsetObject - 1].key.i;
+		aResultToken.value_int64 = (__int64)IntKey(mKeyOffsetObject - 1);
 	}
 	// else no integer keys; leave aResultToken at default, empty string.
 	return OK;
@@ -1668,11 +1710,13 @@ int Object::Enumerator::Next(Var *aKey, Var *aVal)
 {
 	if (++mOffset < mObject->mFieldCount)
 	{
+		if (mOffset == mObject->mKeyOffsetString)
+			mObject->SortStringKeys(); // String keys are enumerated in alphabetical order.
 		FieldType &field = mObject->mFields[mOffset];
 		if (aKey)
 		{
 			if (mOffset < mObject->mKeyOffsetObject) // mKeyOffsetInt < mKeyOffsetObject
-				aKey->Assign(field.key.i);
+				aKey->Assign(mObject->IntKey(mOffset));
 			else if (mOffset < mObject->mKeyOffsetString) // mKeyOffsetObject < mKeyOffsetString
 				aKey->Assign(field.key.p);
 			else // mKeyOffsetString < mFieldCount
@@ -1733,6 +1777,22 @@ Object::FieldType *Object::FindField(SymbolType key_type, KeyType key, IndexType
 
 	if (key_type == SYM_STRING)
 	{
+		if (mStringIndex)
+		{
+			// New keys are appended while the index exists; see StringIndex for details.
+			insert_pos = mFieldCount;
+			StringIndex::Slot *slot = mStringIndex->slot;
+			IndexType mask = mStringIndex->capacity - 1;
+			UINT hash = tcsihash(key.s);
+			for (IndexType i = hash & mask; slot[i].pos; i = (i + 1) & mask)
+			{
+				FieldType &field = mFields[mKeyOffsetString + slot[i].pos - 1];
+				if (slot[i].hash == hash && !field.CompareKey(key.s))
+					return &field;
+			}
+			return NULL;
+		}
+
 		left = mKeyOffsetString;
 		right = mFieldCount - 1; // String keys are last in the mFields array.
 
@@ -1742,6 +1802,15 @@ Object::FieldType *Object::FindField(SymbolType key_type, KeyType key, IndexType
 	{
 		if (key_type == SYM_INTEGER)
 		{
+			if (!mIsDenseArray && mKeyOffsetObject && mFields[0].key.i == 1 && mFields[mKeyOffsetObject - 1].key.i == mKeyOffsetObject)
+				mIsDenseArray = true; // Keys are exactly 1..N, such as after filling in a gap.
+			if (mIsDenseArray)
+			{
+				if (key.i >= 1 && key.i <= mKeyOffsetObject)
+					return &mFields[key.i - 1];
+				insert_pos = key.i < 1 ? 0 : mKeyOffsetObject;
+				return NULL;
+			}
 			left = mKeyOffsetInt;
 			right = mKeyOffsetObject - 1; // Int keys end where Object keys begin.
 		}
@@ -1798,6 +1867,9 @@ Object::FieldType *Object::Insert(SymbolType key_type, KeyType key, IndexType at
 	}
 	// There is now definitely room in mFields for a new field.
 
+	if (key_type == SYM_INTEGER && mIsDenseArray && !(at == mKeyOffsetObject && key.i == at + 1))
+		MakeSparse(); // Not appending key N+1, so there will be a gap.
+
 	FieldType &field = mFields[at];
 	if (at < mFieldCount)
 		// Move existing fields to make room.
@@ -1822,10 +1894,137 @@ Object::FieldType *Object::Insert(SymbolType key_type, KeyType key, IndexType at
 	field.key = key; // Above has already copied string or called key.p->AddRef() as appropriate.
 	field.symbol = SYM_OPERAND;
 
+	if (key_type == SYM_STRING)
+	{
+		IndexType string_count = mFieldCount - mKeyOffsetString;
+		if (mStringIndex)
+		{
+			if (at + 1 < mFieldCount) // Caller didn't append the key as directed by FindField(), so other keys have moved.
+				mStringIndex->unsorted = true;
+			else if (at > mKeyOffsetString && _tcsicmp(key.s, mFields[at - 1].key.s) < 0)
+				mStringIndex->unsorted = true;
+			if (at + 1 == mFieldCount && string_count * 2 <= mStringIndex->capacity)
+			{
+				AddToStringIndex(at - mKeyOffsetString, tcsihash(key.s));
+				return &field;
+			}
+			// Otherwise, the index must be enlarged or rebuilt.
+		}
+		else if (string_count <= sStringIndexThreshold)
+			return &field;
+		if (!BuildStringIndex(string_count * 2))
+			DropStringIndex(); // Out of memory, so fall back to binary search (which is still valid).
+	}
+
 	return &field;
 }
 
 
+bool Object::BuildStringIndex(IndexType aMinCapacity)
+// Creates or rebuilds the string key index.  Returns false if out of memory, in which
+// case the old index (if any) is left unchanged but might no longer be valid.
+{
+	IndexType capacity = mStringIndex ? mStringIndex->capacity : 64;
+	while (capacity < aMinCapacity)
+		capacity *= 2;
+	if (!mStringIndex || capacity > mStringIndex->capacity)
+	{
+		StringIndex *new_index = (StringIndex *)realloc(mStringIndex, sizeof(StringIndex) + (capacity - 1) * sizeof(StringIndex::Slot));
+		if (!new_index)
+			return false;
+		if (!mStringIndex)
+			new_index->unsorted = false; // Keys were inserted in order by binary search up until now.
+		mStringIndex = new_index;
+		mStringIndex->capacity = capacity;
+	}
+	ZeroMemory(mStringIndex->slot, capacity * sizeof(StringIndex::Slot));
+	for (IndexType i = mKeyOffsetString; i < mFieldCount; ++i)
+		AddToStringIndex(i - mKeyOffsetString, tcsihash(mFields[i].key.s));
+	return true;
+}
+
+
+void Object::AddToStringIndex(IndexType aPos, UINT aHash)
+// Caller must ensure the index has room for one more key.
+{
+	StringIndex::Slot *slot = mStringIndex->slot;
+	IndexType mask = mStringIndex->capacity - 1, i;
+	for (i = aHash & mask; slot[i].pos; i = (i + 1) & mask);
+	slot[i].hash = aHash;
+	slot[i].pos = aPos + 1;
+}
+
+
+Object::StringIndex::Slot *Object::FindStringIndexSlot(IndexType aPos)
+// Returns the slot which refers to the string key at mKeyOffsetString + aPos.
+{
+	StringIndex::Slot *slot = mStringIndex->slot;
+	IndexType mask = mStringIndex->capacity - 1, i;
+	for (i = tcsihash(mFields[mKeyOffsetString + aPos].key.s) & mask; slot[i].pos != aPos + 1; i = (i + 1) & mask);
+	return slot + i;
+}
+
+
+void Object::RemoveFromStringIndex(StringIndex::Slot *aSlot)
+// Removes a slot from the index, moving any subsequent slots in the same probe sequence
+// back so that they can still be found (there are no "deleted" markers).
+{
+	StringIndex::Slot *slot = mStringIndex->slot;
+	IndexType mask = mStringIndex->capacity - 1;
+	IndexType i = aSlot - slot, j = i, k;
+	for (;;)
+	{
+		j = (j + 1) & mask;
+		if (!slot[j].pos)
+			break;
+		k = slot[j].hash & mask; // The slot this item would ideally occupy.
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue; // It can still be found from its ideal slot, so leave it.
+		slot[i] = slot[j];
+		i = j;
+	}
+	slot[i].pos = 0;
+}
+
+
+int __cdecl Object::CompareStringFields(const void *a, const void *b)
+{
+	return _tcsicmp(((FieldType *)a)->key.s, ((FieldType *)b)->key.s);
+}
+
+
+void Object::SortStringKeys()
+// Restores the alphabetical order of string keys if the index has allowed them to become unsorted.
+{
+	if (!mStringIndex || !mStringIndex->unsorted)
+		return;
+	qsort(mFields + mKeyOffsetString, mFieldCount - mKeyOffsetString, sizeof(FieldType), CompareStringFields);
+	mStringIndex->unsorted = false;
+	BuildStringIndex(0); // Every key may have moved.  This can't fail since the index is already large enough.
+}
+
+
+void Object::PrepareForSharedReads()
+// Settles the parts of the object's layout which are otherwise updated lazily by reads (the order
+// of string keys and dense-array mode), so that concurrent readers never modify the object.
+{
+	SortStringKeys();
+	if (!mIsDenseArray && mKeyOffsetObject && mFields[0].key.i == 1 && mFields[mKeyOffsetObject - 1].key.i == mKeyOffsetObject)
+		mIsDenseArray = true;
+}
+
+
+void Object::DropStringIndex()
+// Reverts to binary search of the string keys, sorting them first if necessary.
+{
+	if (!mStringIndex)
+		return;
+	if (mStringIndex->unsorted)
+		qsort(mFields + mKeyOffsetString, mFieldCount - mKeyOffsetString, sizeof(FieldType), CompareStringFields);
+	FreeStringIndex();
+}
+
+
 //
 // Property: Invoked when a derived object gets/sets the corresponding key.
 //
@@ -174,6 +174,43 @@ protected:
 	static const IndexType mKeyOffsetInt = 0;
 	IndexType mKeyOffsetObject, mKeyOffsetString;
 
+	// Index of string keys, created once the object has more than sStringIndexThreshold of them.
+	// While the index exists, string keys are found by hashing rather than by binary search, and new
+	// keys are appended to mFields rather than inserted in sorted order.  Since the documented order
+	// of enumeration is alphabetical, SortStringKeys() must be called before anything which depends
+	// on the order of the string keys.  Positions in the index are relative to mKeyOffsetString so
+	// that inserting or removing integer or object keys does not invalidate them.
+	struct StringIndex
+	{
+		struct Slot
+		{
+			UINT hash;
+			IndexType pos; // Position of the field relative to mKeyOffsetString, plus one.  Zero indicates an empty slot.
+		};
+		IndexType capacity; // Number of slots; always a power of two.
+		bool unsorted; // True if a key was appended or moved out of order.
+		Slot slot[1];
+	};
+	StringIndex *mStringIndex;
+	static const IndexType sStringIndexThreshold = 32;
+
+	// Dense array mode: while true, the integer keys are known to be exactly 1..mKeyOffsetObject, so the
+	// field for key i is simply mFields[i-1].  In this mode the key.i of integer-keyed fields is NOT kept
+	// up to date (so that InsertAt/RemoveAt don't have to renumber them), so IntKey() must be used to read
+	// an integer key.  MakeSparse() stores the keys and exits this mode, which is necessary before making
+	// any change which could leave a gap.  FindField() re-enters this mode when it detects keys 1..N.
+	bool mIsDenseArray;
+
+	IntKeyType IntKey(IndexType aPos) { return mIsDenseArray ? aPos + 1 : mFields[aPos].key.i; }
+	void MakeSparse()
+	{
+		if (!mIsDenseArray)
+			return;
+		for (IndexType i = 0; i < mKeyOffsetObject; ++i)
+			mFields[i].key.i = i + 1;
+		mIsDenseArray = false;
+	}
+
 #ifdef CONFIG_DEBUGGER
 	friend class Debugger;
 #endif
@@ -182,6 +219,8 @@ protected:
 		: mBase(NULL)
 		, mFields(NULL), mFieldCount(0), mFieldCountMax(0)
 		, mKeyOffsetObject(0), mKeyOffsetString(0)
+		, mStringIndex(NULL)
+		, mIsDenseArray(true) // No integer keys is the same as 1..0.
 	{}
 
 	bool Delete();
@@ -194,6 +233,15 @@ protected:
 	
 	FieldType *Insert(SymbolType key_type, KeyType key, IndexType at);
 
+	bool BuildStringIndex(IndexType aCapacity);
+	void AddToStringIndex(IndexType aPos, UINT aHash);
+	StringIndex::Slot *FindStringIndexSlot(IndexType aPos);
+	void RemoveFromStringIndex(StringIndex::Slot *aSlot);
+	void FreeStringIndex() { free(mStringIndex); mStringIndex = NULL; }
+	void DropStringIndex();
+	void SortStringKeys();
+	static int __cdecl CompareStringFields(const void *a, const void *b);
+
 	bool SetInternalCapacity(IndexType new_capacity);
 	bool Expand()
 	// Expands mFields by at least one field.
@@ -215,6 +263,8 @@ public:
 
 	// Used by Func::Call() for variadic functions/function-calls:
 	Object *Clone(BOOL aExcludeIntegerKeys = false);
+	// Used by CriticalObject before an object is shared by readers on multiple threads:
+	void PrepareForSharedReads();
 	void ArrayToParams(ExprTokenType *token, ExprTokenType **param_list, int extra_params, ExprTokenType **aParam, int aParamCount);
 	ResultType ArrayToStrings(LPTSTR *aStrings, int &aStringCount, int aStringsMax);
 	
@@ -223,7 +273,7 @@ public:
 		if (++aOffset >= mKeyOffsetObject) // i.e. no more integer-keyed items.
 			return false;
 		FieldType &field = mFields[aOffset];
-		aKey = field.key.i;
+		aKey = IntKey(aOffset);
 		field.ToToken(aToken);
 		return true;
 	}
@@ -302,12 +352,13 @@ public:
 	
 	void ReduceKeys(INT_PTR aAmount)
 	{
+		MakeSparse();
 		for (IndexType i = 0; i < mKeyOffsetObject; ++i)
 			mFields[i].key.i -= aAmount;
 	}
 
-	int MinIndex() { return (mKeyOffsetInt < mKeyOffsetObject) ? (int)mFields[0].key.i : 0; }
-	int MaxIndex() { return (mKeyOffsetInt < mKeyOffsetObject) ? (int)mFields[mKeyOffsetObject-1].key.i : 0; }
+	int MinIndex() { return (mKeyOffsetInt < mKeyOffsetObject) ? (int)IntKey(0) : 0; }
+	int MaxIndex() { return (mKeyOffsetInt < mKeyOffsetObject) ? (int)IntKey(mKeyOffsetObject-1) : 0; }
 	int Count() { return (int)mFieldCount; }
 	bool HasNonnumericKeys() { return mKeyOffsetObject < mFieldCount; }
 
@@ -400,6 +451,7 @@ public:
 			free(mFields);
 			mFields = NULL;
 			mFieldCountMax = 0;
+			FreeStringIndex();
 		}
 	}
 #endif
@@ -480,23 +532,52 @@ public:
 // CriticalObject - Multithread save object wrapper
 //
 
+#define CRITICAL_MODE_EXCLUSIVE	0 // Every call holds the critical section.
+#define CRITICAL_MODE_SHARED	1 // "RW": gets share the lock with each other; sets and calls are exclusive.
+#define CRITICAL_MODE_SNAPSHOT	2 // "Snapshot": reads take no lock; writers modify a copy and publish it.
+
+// State shared by all CriticalObjects which wrap the same object in one of the non-default modes.
+// In the default mode only the critical section is shared, and it is never freed.
+struct CriticalShare
+{
+	CRITICAL_SECTION mSection;		// Held by writers.  Must be first since GetCriSec() returns its address.
+	volatile LONG mRefCount;		// Number of CriticalObjects using this.
+	volatile LONG mReaders[2];		// Threads currently reading, by the parity of mEpoch when they started.
+	volatile LONG mEpoch;			// Snapshot mode: incremented each time mObject is replaced.
+	IObject *volatile mObject;		// Snapshot mode: the current version, which is never modified once published.
+	Object *mPending;				// Snapshot mode: the copy being modified by the thread which owns mSection.
+	int mMode;
+};
+
 class CriticalObject : public ObjectBase
 {
 protected:
-	IObject *object;
+	IObject *object; // NULL in snapshot mode, where mShare->mObject is used instead.
 	LPCRITICAL_SECTION lpCriticalSection;
+	CriticalShare *mShare; // NULL in the default mode.
 	CriticalObject()
 			: lpCriticalSection(0)
 			, object(0)
+			, mShare(0)
 	{}
 
 	bool Delete();
 	~CriticalObject(){}
 
+	CriticalObject *Share();
+	void EnterShared(LONG &aSlot);
+	void LeaveShared(LONG aSlot) { InterlockedDecrement(&mShare->mReaders[aSlot]); }
+	void EnterExclusive();
+	ResultType InvokeSnapshotWrite(ExprTokenType &aResultToken, ExprTokenType &aThisToken, int aFlags, ExprTokenType *aParam[], int aParamCount);
+	bool IsReadOnlyInvoke(IObject *aObject, int aFlags, ExprTokenType *aParam[], int aParamCount);
+	int Mode() { return mShare ? mShare->mMode : CRITICAL_MODE_EXCLUSIVE; }
+
 public:
 	__int64 GetObj()
+	// In snapshot mode this is the version current at the time of the call.  It must be treated as read-only,
+	// since other threads read it without a lock, and it is freed once a writer has replaced it.
 	{
-		return (__int64)&*this->object;
+		return (__int64)(mShare && mShare->mMode == CRITICAL_MODE_SNAPSHOT ? mShare->mObject : this->object);
 	}
 	__int64 GetCriSec()
 	{
@@ -535,6 +616,25 @@ protected:
 	FieldType *mFields;
 	IndexType mFieldCount, mFieldCountMax; // Current/max number of fields.
 
+	// Structs created from a string definition which doesn't refer to any variables share a cached
+	// layout (see Struct::Create), which owns the field names and the field index.  Each struct still
+	// has its own copy of mFields, since fields may have memory allocated for them.
+	Struct *mLayout; // The layout this struct was created from, or NULL if it owns its field names.
+
+	// Index of field names, created for cached layouts with more than sFieldIndexThreshold fields.
+	struct FieldIndex
+	{
+		struct Slot
+		{
+			UINT hash;
+			IndexType pos; // Position of the field in mFields, plus one.  Zero indicates an empty slot.
+		};
+		IndexType capacity; // Number of slots; always a power of two.
+		Slot slot[1];
+	};
+	FieldIndex *mFieldIndex;
+	static const IndexType sFieldIndexThreshold = 8;
+
 	// for loop enumerator
 	class Enumerator : public EnumBase
 	{
@@ -552,7 +652,7 @@ protected:
 #endif
 
 	Struct()
-		: mFields(NULL), mFieldCount(0), mFieldCountMax(0), mTypeOnly(false)
+		: mFields(NULL), mFieldCount(0), mFieldCountMax(0), mLayout(NULL), mFieldIndex(NULL), mTypeOnly(false)
 		, mStructMem(0), mSize(0), mIsPointer(0), mIsInteger(true), mIsUnsigned(true)
 		, mEncoding(-1), mArraySize(0), mMemAllocated(false), mVarRef(NULL)
 	{}
@@ -568,6 +668,10 @@ protected:
 	{
 		return SetInternalCapacity(mFieldCountMax ? mFieldCountMax * 2 : 4);
 	}
+	void BuildFieldIndex();
+	Struct *Instantiate();
+	static Struct *AddLayout(Struct *aLayout, LPTSTR aDefinition);
+	Struct *InitInstance(ExprTokenType *aParam[], int aParamCount);
 
 public:
 	UINT_PTR *mStructMem;		// Pointer to allocated memory
@@ -582,6 +686,8 @@ public:
 	Var *mVarRef;				// Reference to a variable containing the definition
 
 	static Struct *Create(ExprTokenType *aParam[] = NULL, int aParamCount = 0);
+	static Struct *FindLayout(LPTSTR aDefinition);
+	static void ClearLayoutCache();
 	
 	Struct *Clone(bool aIsDynamic = false);
 	Struct *CloneField(FieldType *field,bool aIsDynamic = false);
@@ -197,6 +197,15 @@ BIF_DECL(BIF_sizeof)
 	// Set buf to beginning of structure definition
 	buf = TokenToString(*aParam[0]);
 
+	// if Struct() already parsed this definition, use the size of its cached layout
+	if (aParamCount == 1)
+		if (Struct *layout = Struct::FindLayout(buf))
+		{
+			aResultToken.symbol = SYM_INTEGER;
+			aResultToken.value_int64 = layout->mSize;
+			return;
+		}
+
 	// continue as long as we did not reach end of string / structure definition
 	while (*buf)
 	{
@@ -453,179 +462,277 @@ BIF_DECL(BIF_sizeof)
 }
 
 //
-// ObjRawSize()
+// ObjDump()/ObjLoad() format
+//
+// An 8-byte header (OBJDUMP_SIGNATURE and OBJDUMP_VERSION) is followed by the root object.  Each object
+// is an __int64 byte count followed by its key-value pairs, and each key and value is a type followed by
+// its data.  The types of keys are the negative of the corresponding value types:
+//   1 char, 2 BYTE, 3 short, 4 USHORT, 5 int, 6 UINT, 7 negative __int64, 8 positive __int64, 9 double,
+//   10 string (__int64 size in bytes including the terminator, followed by the string),
+//   11 object (as above), 12 object already written (__int64 index in the order objects were written).
+// Dumps made before the header was added begin directly with the root object.  Their size was limited
+// to a DWORD, so their second DWORD is always zero, whereas the version in a header is not.
 //
 
-__int64 ObjRawSize(IObject *aObject, bool aCopyBuffer, IObject *aObjects)
-{
-	ExprTokenType Result, this_token, enum_token, aCall, aKey, aValue;
-	ExprTokenType *params[] = { &aCall, &aKey, &aValue };
-	TCHAR buf[MAX_PATH];
-	
-	// Set up enum_token the way Invoke expects:
-	enum_token.symbol = SYM_STRING;
-	enum_token.marker = _T("");
-	enum_token.mem_to_free = NULL;
-	enum_token.buf = buf;
+#define OBJDUMP_SIGNATURE 0x4F4B4841 // "AHKO"
+#define OBJDUMP_VERSION 1
+#define OBJDUMP_BUFFER_SIZE 65536
 
-	// Prepare to call object._NewEnum():
-	aCall.symbol = SYM_STRING;
-	aCall.marker = _T("_NewEnum");
+class ObjDumpWriter
+{
+	FILE *mFile; // NULL if writing to memory.
+	char *mBuffer; // The whole dump if writing to memory, otherwise the part not yet written to mFile.
+	size_t mLength, mCapacity;
+	__int64 mFlushed; // Bytes already written to mFile.
+	bool mCopyBuffer;
+	bool mFailed;
+
+	// Objects written so far, hashed by address so that an object which occurs again is written
+	// as a reference (which also prevents infinite recursion with circular references).
+	struct ObjectIndex
+	{
+		IObject *object; // NULL indicates an empty slot.
+		UINT index;
+	};
+	ObjectIndex *mObject;
+	UINT mObjectCount, mObjectCapacity; // mObjectCapacity is always a power of two (or zero).
+
+	static UINT HashObject(IObject *aObject) { return (UINT)((UINT_PTR)aObject >> 3) * 2654435761U; }
+	bool FindObject(IObject *aObject, UINT &aIndex);
+	bool AddObject(IObject *aObject);
+	bool Flush();
+	void Write(const void *aData, size_t aSize);
+	void WriteType(char aType, const void *aData, size_t aSize) { Write(&aType, 1); Write(aData, aSize); }
+	void WriteInteger(__int64 aValue, char aSign);
+	void WriteChild(IObject *aObject, char aSign);
+	void WriteObject(IObject *aObject);
+	void PatchSize(__int64 aPos, __int64 aSize);
+
+public:
+	ObjDumpWriter(FILE *aFile, bool aCopyBuffer) : mFile(aFile), mBuffer(NULL), mLength(0), mCapacity(0), mFlushed(0)
+		, mCopyBuffer(aCopyBuffer), mFailed(false), mObject(NULL), mObjectCount(0), mObjectCapacity(0)
+	{}
+	~ObjDumpWriter()
+	{
+		free(mBuffer);
+		free(mObject);
+	}
+	__int64 Tell() { return mFlushed + mLength; }
+	bool WriteDump(IObject *aObject);
+	char *DetachBuffer();
+};
 
-	aObject->Invoke(enum_token, Result, IT_CALL, params, 1);
+//
+// ObjDumpWriter::FindObject() - Find the index of an object which was already written.
+//
 
-	if (enum_token.mem_to_free)
-		// Invoke returned memory for us to free.
-		free(enum_token.mem_to_free);
+bool ObjDumpWriter::FindObject(IObject *aObject, UINT &aIndex)
+{
+	if (!mObjectCount)
+		return false;
+	UINT mask = mObjectCapacity - 1;
+	for (UINT i = HashObject(aObject) & mask; mObject[i].object; i = (i + 1) & mask)
+		if (mObject[i].object == aObject)
+		{
+			aIndex = mObject[i].index;
+			return true;
+		}
+	return false;
+}
 
-	// Check if object returned an enumerator, otherwise return
-	if (enum_token.symbol != SYM_OBJECT)
-		return 0;
+//
+// ObjDumpWriter::AddObject() - Give the next index to an object which is about to be written.
+//
 
-	// create variables to use in for loop / for enumeration
-	// these will be deleted afterwards
+bool ObjDumpWriter::AddObject(IObject *aObject)
+{
+	if ((mObjectCount + 1) * 2 > mObjectCapacity)
+	{	// keep the table at most half full
+		UINT new_capacity = mObjectCapacity ? mObjectCapacity * 2 : 64;
+		ObjectIndex *new_table = (ObjectIndex *)calloc(new_capacity, sizeof(ObjectIndex));
+		if (!new_table)
+			return false;
+		for (UINT i = 0; i < mObjectCapacity; ++i)
+			if (mObject[i].object)
+			{
+				UINT j;
+				for (j = HashObject(mObject[i].object) & (new_capacity - 1); new_table[j].object; j = (j + 1) & (new_capacity - 1));
+				new_table[j] = mObject[i];
+			}
+		free(mObject);
+		mObject = new_table;
+		mObjectCapacity = new_capacity;
+	}
+	UINT i, mask = mObjectCapacity - 1;
+	for (i = HashObject(aObject) & mask; mObject[i].object; i = (i + 1) & mask);
+	mObject[i].object = aObject;
+	mObject[i].index = mObjectCount++;
+	return true;
+}
 
-	Var *var1 = (Var*)alloca(sizeof(Var));
-	Var *var2 = (Var*)alloca(sizeof(Var));
-	var1->mType = var2->mType = VAR_NORMAL;
-	var1->mAttrib = var2->mAttrib = 0;
-	var1->mByteCapacity = var2->mByteCapacity = 0;
-	var1->mHowAllocated = var2->mHowAllocated = ALLOC_MALLOC;
+//
+// ObjDumpWriter::Flush() - Write the buffered part of the dump to the file.
+//
 
-	if (!aObjects)
-	{
-		aCall.symbol = SYM_OBJECT;
-		aCall.object = aObject;
-		aKey.symbol = SYM_STRING;
-		aKey.marker = _T("");
-		aKey.marker_length = 0;
-		aObjects = Object::Create(params, 2);
-	}
-	else
+bool ObjDumpWriter::Flush()
+{
+	if (mLength && fwrite(mBuffer, 1, mLength, mFile) != mLength)
 	{
-		aObjects->AddRef();
-		aCall.marker = _T("HasKey");
-		aKey.symbol = SYM_OBJECT;
-		aKey.object = aObject;
-		aObjects->Invoke(Result, this_token, IT_CALL, params, 2);
-		if (!Result.value_int64)
-		{
-			aCall.symbol = SYM_OBJECT;
-			aCall.object = aObject;
-			aKey.symbol = SYM_STRING;
-			aKey.marker = _T("");
-			aKey.marker_length = 0;
-			aObjects->Invoke(Result, this_token, IT_SET, params, 2);
-		}
+		mFailed = true;
+		return false;
 	}
-	// Prepare parameters for the loop below: enum.Next(var1 [, var2])
-	aCall.symbol = SYM_STRING;
-	aCall.marker = _T("Next");
-	aKey.symbol = SYM_VAR;
-	aKey.var = var1;
-	aKey.var->mCharContents = _T("");
-	aKey.mem_to_free = 0;
-	aValue.symbol = SYM_VAR;
-	aValue.var = var2;
-	aValue.var->mCharContents = _T("");
-	aValue.mem_to_free = 0;
+	mFlushed += mLength;
+	mLength = 0;
+	return true;
+}
 
-	ExprTokenType result_token;
-	IObject &enumerator = *enum_token.object; // Might perform better as a reference?
-	__int64 aSize = 0;
-	IObject *aIsObject;
-	__int64 aIsValue;
-	SymbolType aVarType;
+//
+// ObjDumpWriter::Write() - Append data to the dump.
+//
 
-	for (;;)
+void ObjDumpWriter::Write(const void *aData, size_t aSize)
+{
+	if (mFailed)
+		return;
+	if (aSize > mCapacity - mLength)
 	{
-		// Set up result_token the way Invoke expects; each Invoke() will change some or all of these:
-		result_token.symbol = SYM_STRING;
-		result_token.marker = _T("");
-		result_token.mem_to_free = NULL;
-		result_token.buf = buf;
-
-		// Call enumerator.Next(var1, var2)
-		enumerator.Invoke(result_token, enum_token, IT_CALL, params, 3);
-
-		bool next_returned_true = TokenToBOOL(result_token);
-		if (!next_returned_true)
-			break;
-
-		if (aIsObject = TokenToObject(aKey))
+		if (mFile)
 		{
-			aCall.marker = _T("HasKey");
-			aObjects->Invoke(Result, this_token, IT_CALL, params, 2);
-			if (Result.value_int64)
-				aSize += 9;
-			else
-				aSize += ObjRawSize(aIsObject, aCopyBuffer, aObjects) + 9;
-			aCall.marker = _T("Next");
+			if (!mBuffer)
+			{
+				if (!(mBuffer = (char *)malloc(OBJDUMP_BUFFER_SIZE)))
+				{
+					mFailed = true;
+					return;
+				}
+				mCapacity = OBJDUMP_BUFFER_SIZE;
+			}
+			if (!Flush())
+				return;
+			if (aSize > mCapacity)
+			{	// too large to be worth buffering
+				if (fwrite(aData, 1, aSize, mFile) != aSize)
+					mFailed = true;
+				mFlushed += aSize;
+				return;
+			}
 		}
-		else if ((aVarType = aKey.var->IsNonBlankIntegerOrFloat()) == SYM_STRING || RegExMatch(aKey.var->Contents(), _T("\\s")) || _tcscmp(ITOA64(ATOI64(aKey.var->Contents()), buf), aKey.var->Contents()))
-			aSize += (aKey.var->ByteLength() ? aKey.var->ByteLength() + sizeof(TCHAR) : 0) + 9;
 		else
-			aSize += (aVarType == SYM_FLOAT || (aIsValue = TokenToInt64(aKey)) > 4294967295) ? 9 : aIsValue > 65535 ? 5 : aIsValue > 255 ? 3 : aIsValue > -129 ? 2 : aIsValue > -32769 ? 3 : aIsValue >= INT_MIN ? 5 : 9;
-
-		if (aIsObject = TokenToObject(aValue))
-		{
-			aCall.marker = _T("HasKey");
-			aKey.symbol = SYM_OBJECT;
-			aKey.object = aIsObject;
-			aObjects->Invoke(Result, this_token, IT_CALL, params, 2);
-			if (Result.value_int64)
-				aSize += 9;
-			else
-				aSize += ObjRawSize(aIsObject, aCopyBuffer, aObjects) + 9;
-			aCall.marker = _T("Next");
-		}
-		else if ((aVarType = aValue.var->IsNonBlankIntegerOrFloat()) == SYM_STRING || RegExMatch(aValue.var->Contents(), _T("\\s")) || _tcscmp(ITOA64(ATOI64(aValue.var->Contents()), buf), aValue.var->Contents()))
-		{
-			if (aCopyBuffer)
+		{	// grow the buffer exponentially so that the dump is copied only a few times
+			size_t new_capacity = mCapacity ? mCapacity * 2 : OBJDUMP_BUFFER_SIZE;
+			if (new_capacity - mLength < aSize)
+				new_capacity = mLength + aSize;
+			char *new_buffer = (char *)realloc(mBuffer, new_capacity);
+			if (!new_buffer)
 			{
-				aCall.marker = _T("GetCapacity");
-				aObject->Invoke(Result, this_token, IT_CALL, params, 2);
-				aSize += Result.value_int64 + 9;
-				aCall.marker = _T("Next");
+				mFailed = true;
+				return;
 			}
-			else
-				aSize += (aValue.var->ByteLength() ? aValue.var->ByteLength() + sizeof(TCHAR) : 0) + 9;
+			mBuffer = new_buffer;
+			mCapacity = new_capacity;
 		}
-		else
-			aSize += aVarType == SYM_FLOAT || (aIsValue = TokenToInt64(aValue)) > 4294967295 ? 9 : aIsValue > 65535 ? 5 : aIsValue > 255 ? 3 : aIsValue > -129 ? 2 : aIsValue > -32769 ? 3 : aIsValue >= INT_MIN ? 5 : 9;
+	}
+	memcpy(mBuffer + mLength, aData, aSize);
+	mLength += aSize;
+}
 
-		// release object if it was assigned prevoiously when calling enum.Next
-		if (var1->IsObject())
-			var1->ReleaseObject();
-		if (var2->IsObject())
-			var2->ReleaseObject();
+//
+// ObjDumpWriter::WriteInteger() - Write an integer key (aSign = -1) or value (aSign = 1) using the smallest type which can hold it.
+//
 
-		// Free any memory or object which may have been returned by Invoke:
-		if (result_token.mem_to_free)
-			free(result_token.mem_to_free);
-		if (result_token.symbol == SYM_OBJECT)
-			result_token.object->Release();
+void ObjDumpWriter::WriteInteger(__int64 aValue, char aSign)
+{
+	if (aValue > 4294967295)
+		WriteType(8 * aSign, &aValue, sizeof(__int64));
+	else if (aValue > 65535)
+	{
+		UINT value = (UINT)aValue;
+		WriteType(6 * aSign, &value, sizeof(UINT));
+	}
+	else if (aValue > 255)
+	{
+		USHORT value = (USHORT)aValue;
+		WriteType(4 * aSign, &value, sizeof(USHORT));
+	}
+	else if (aValue > -1)
+	{
+		BYTE value = (BYTE)aValue;
+		WriteType(2 * aSign, &value, sizeof(BYTE));
+	}
+	else if (aValue > -129)
+	{
+		char value = (char)aValue;
+		WriteType(1 * aSign, &value, sizeof(char));
+	}
+	else if (aValue > -32769)
+	{
+		short value = (short)aValue;
+		WriteType(3 * aSign, &value, sizeof(short));
+	}
+	else if (aValue >= INT_MIN)
+	{
+		int value = (int)aValue;
+		WriteType(5 * aSign, &value, sizeof(int));
+	}
+	else
+		WriteType(7 * aSign, &aValue, sizeof(__int64));
+}
+
+//
+// ObjDumpWriter::WriteChild() - Write an object which is a key (aSign = -1) or value (aSign = 1) of another object.
+//
 
-		aKey.symbol = SYM_VAR;
-		aKey.var = var1;
-		aValue.symbol = SYM_VAR;
-		aValue.var = var2;
+void ObjDumpWriter::WriteChild(IObject *aObject, char aSign)
+{
+	UINT index;
+	if (FindObject(aObject, index))
+	{
+		__int64 value = index;
+		WriteType(12 * aSign, &value, sizeof(__int64));
+		return;
 	}
-	// release enumerator and free vars
-	enumerator.Release();
-	var1->Free();
-	var2->Free();
-	aObjects->Release();
-	return aSize;
+	// the size isn't known until the object has been written, so fill it in afterward
+	__int64 size = 0;
+	WriteType(11 * aSign, &size, sizeof(__int64));
+	__int64 start = Tell();
+	WriteObject(aObject);
+	PatchSize(start - sizeof(__int64), Tell() - start);
 }
 
 //
-// ObjRawDump()
+// ObjDumpWriter::PatchSize() - Fill in the size of an object which has been written.
 //
 
-__int64 ObjRawDump(IObject *aObject, char *aBuffer, bool aCopyBuffer, IObject *aObjects, UINT &aObjCount)
+void ObjDumpWriter::PatchSize(__int64 aPos, __int64 aSize)
 {
-	char *aThisBuffer = aBuffer;
+	if (mFailed)
+		return;
+	if (aPos >= mFlushed)
+	{
+		memcpy(mBuffer + (size_t)(aPos - mFlushed), &aSize, sizeof(__int64));
+		return;
+	}
+	// all or part of it has already been written to the file
+	if (aPos + (__int64)sizeof(__int64) > mFlushed && !Flush())
+		return;
+	if (_fseeki64(mFile, aPos, SEEK_SET)
+		|| fwrite(&aSize, sizeof(__int64), 1, mFile) != 1
+		|| _fseeki64(mFile, 0, SEEK_END))
+		mFailed = true;
+}
+
+//
+// ObjDumpWriter::WriteObject() - Write the key-value pairs of an object.
+//
+
+void ObjDumpWriter::WriteObject(IObject *aObject)
+{
+	// objects are numbered in the same order by ObjLoadReader, even if they can't be enumerated
+	if (!AddObject(aObject))
+	{
+		mFailed = true;
+		return;
+	}
 
 	ExprTokenType Result, this_token, enum_token, aCall, aKey, aValue;
 	ExprTokenType *params[] = { &aCall, &aKey, &aValue };
@@ -649,7 +756,7 @@ __int64 ObjRawDump(IObject *aObject, char *aBuffer, bool aCopyBuffer, IObject *a
 
 	// Check if object returned an enumerator, otherwise return
 	if (enum_token.symbol != SYM_OBJECT)
-		return NULL;
+		return;
 
 	// create variables to use in for loop / for enumeration
 	// these will be deleted afterwards
@@ -661,21 +768,7 @@ __int64 ObjRawDump(IObject *aObject, char *aBuffer, bool aCopyBuffer, IObject *a
 	var1->mByteCapacity = var2->mByteCapacity = 0;
 	var1->mHowAllocated = var2->mHowAllocated = ALLOC_MALLOC;
 
-	aCall.marker = _T("HasKey");
-	aKey.symbol = SYM_OBJECT;
-	aKey.object = aObject;
-	aObjects->Invoke(Result, this_token, IT_CALL, params, 2);
-	if (!Result.value_int64)
-	{
-		aCall.symbol = SYM_OBJECT;
-		aCall.object = aObject;
-		aKey.symbol = SYM_INTEGER;
-		aKey.value_int64 = aObjCount++;
-		aObjects->Invoke(Result, this_token, IT_SET, params, 2);
-	}
-
 	// Prepare parameters for the loop below: enum.Next(var1 [, var2])
-	aCall.symbol = SYM_STRING;
 	aCall.marker = _T("Next");
 	aKey.symbol = SYM_VAR;
 	aKey.var = var1;
@@ -689,11 +782,10 @@ __int64 ObjRawDump(IObject *aObject, char *aBuffer, bool aCopyBuffer, IObject *a
 	ExprTokenType result_token;
 	IObject &enumerator = *enum_token.object; // Might perform better as a reference?
 	IObject *aIsObject;
-	__int64 aIsValue;
 	__int64 aThisSize;
 	SymbolType aVarType;
 
-	for (;;)
+	while (!mFailed)
 	{
 		// Set up result_token the way Invoke expects; each Invoke() will change some or all of these:
 		result_token.symbol = SYM_STRING;
@@ -708,218 +800,58 @@ __int64 ObjRawDump(IObject *aObject, char *aBuffer, bool aCopyBuffer, IObject *a
 		if (!next_returned_true)
 			break;
 
-		// copy Key
+		// write Key
 		if (aIsObject = TokenToObject(aKey))
-		{
-			aCall.marker = _T("HasKey");
-			aObjects->Invoke(Result, this_token, IT_CALL, params, 2);
-			aCall.marker = _T("Next");
-			if (Result.value_int64)
-			{
-				aObjects->Invoke(Result, this_token, IT_GET, params + 1, 1);
-				*aThisBuffer = (char)-12;
-				aThisBuffer += 1;
-				*(__int64*)aThisBuffer = Result.value_int64;
-				aThisBuffer += sizeof(__int64);
-			}
-			else
-			{
-				*aThisBuffer = (char)-11;
-				aThisBuffer += 1;
-				*(__int64*)aThisBuffer = aThisSize = ObjRawDump(aIsObject, aThisBuffer + sizeof(__int64), aCopyBuffer, aObjects, aObjCount);
-				aThisBuffer += aThisSize + sizeof(__int64);
-			}
-		}
+			WriteChild(aIsObject, -1);
 		else if ((aVarType = aKey.var->IsNonBlankIntegerOrFloat()) == SYM_STRING || RegExMatch(aKey.var->Contents(), _T("\\s")) || _tcscmp(ITOA64(ATOI64(aKey.var->Contents()), buf), aKey.var->Contents()))
 		{
-			*aThisBuffer = (char)-10;
-			aThisBuffer += 1;
-			*(__int64*)aThisBuffer = aThisSize = (__int64)(aKey.var->ByteLength() ? aKey.var->ByteLength() + sizeof(TCHAR) : 0);
-			aThisBuffer += sizeof(__int64);
+			aThisSize = (__int64)(aKey.var->ByteLength() ? aKey.var->ByteLength() + sizeof(TCHAR) : 0);
+			WriteType(-10, &aThisSize, sizeof(__int64));
 			if (aThisSize)
-			{
-				memcpy(aThisBuffer, aKey.var->Contents(), (size_t)aThisSize);
-				aThisBuffer += aThisSize;
-			}
+				Write(aKey.var->Contents(), (size_t)aThisSize);
 		}
 		else if (aVarType == SYM_FLOAT)
 		{
-			*aThisBuffer = (char)-9;
-			aThisBuffer += 1;
-			*(double*)aThisBuffer = TokenToDouble(aKey);
-			aThisBuffer += sizeof(__int64);
-		}
-		else if ((aIsValue = TokenToInt64(aKey)) > 4294967295)
-		{
-			*aThisBuffer = (char)-8;
-			aThisBuffer += 1;
-			*(__int64*)aThisBuffer = aIsValue;
-			aThisBuffer += sizeof(__int64);
-		}
-		else if (aIsValue > 65535)
-		{
-			*aThisBuffer = (char)-6;
-			aThisBuffer += 1;
-			*(UINT*)aThisBuffer = (UINT)aIsValue;
-			aThisBuffer += sizeof(UINT);
-		}
-		else if (aIsValue > 255)
-		{
-			*aThisBuffer = (char)-4;
-			aThisBuffer += 1;
-			*(USHORT*)aThisBuffer = (USHORT)aIsValue;
-			aThisBuffer += sizeof(USHORT);
-		}
-		else if (aIsValue > -1)
-		{
-			*aThisBuffer = (char)-2;
-			aThisBuffer += 1;
-			*aThisBuffer = (BYTE)aIsValue;
-			aThisBuffer += sizeof(BYTE);
-		}
-		else if (aIsValue > -129)
-		{
-			*aThisBuffer = (char)-1;
-			aThisBuffer += 1;
-			*aThisBuffer = (char)aIsValue;
-			aThisBuffer += sizeof(char);
-		}
-		else if (aIsValue > -32769)
-		{
-			*aThisBuffer = (char)-3;
-			aThisBuffer += 1;
-			*(short*)aThisBuffer = (short)aIsValue;
-			aThisBuffer += sizeof(short);
-		}
-		else if (aIsValue >= INT_MIN)
-		{
-			*aThisBuffer = (char)-5;
-			aThisBuffer += 1;
-			*(int*)aThisBuffer = (int)aIsValue;
-			aThisBuffer += sizeof(int);
+			double value = TokenToDouble(aKey);
+			WriteType(-9, &value, sizeof(double));
 		}
 		else
-		{
-			*aThisBuffer = (char)-7;
-			aThisBuffer += 1;
-			*(__int64*)aThisBuffer = (__int64)aIsValue;
-			aThisBuffer += sizeof(__int64);
-		}
+			WriteInteger(TokenToInt64(aKey), -1);
 
-		// copy Value
+		// write Value
 		if (aIsObject = TokenToObject(aValue))
-		{
-			aCall.marker = _T("HasKey");
-			aKey.symbol = SYM_OBJECT;
-			aKey.object = aIsObject;
-			aObjects->Invoke(Result, this_token, IT_CALL, params, 2);
-			aCall.marker = _T("Next");
-			if (Result.value_int64)
-			{
-				aObjects->Invoke(Result, this_token, IT_GET, params + 2, 1);
-				*aThisBuffer = (char)12;
-				aThisBuffer += 1;
-				*(__int64*)aThisBuffer = Result.value_int64;
-				aThisBuffer += sizeof(__int64);
-			}
-			else
-			{
-				*aThisBuffer = (char)11;
-				aThisBuffer += 1;
-				*(__int64*)aThisBuffer = aThisSize = ObjRawDump(aIsObject, aThisBuffer + sizeof(__int64), aCopyBuffer, aObjects, aObjCount);
-				aThisBuffer += aThisSize + sizeof(__int64);
-			}
-		}
+			WriteChild(aIsObject, 1);
 		else if ((aVarType = aValue.var->IsNonBlankIntegerOrFloat()) == SYM_STRING || RegExMatch(aValue.var->Contents(), _T("\\s")) || _tcscmp(ITOA64(ATOI64(aValue.var->Contents()), buf), aValue.var->Contents()))
 		{
-			*aThisBuffer = (char)10;
-			aThisBuffer += 1;
-			if (aCopyBuffer)
+			if (mCopyBuffer)
 			{
 				aCall.marker = _T("GetCapacity");
 				aObject->Invoke(Result, this_token, IT_CALL, params, 2);
-				*(__int64*)aThisBuffer = aThisSize = Result.value_int64;
-				aThisBuffer += sizeof(__int64);
+				aThisSize = Result.value_int64;
+				WriteType(10, &aThisSize, sizeof(__int64));
 				if (aThisSize)
 				{
 					aCall.marker = _T("GetAddress");
 					aObject->Invoke(Result, this_token, IT_CALL, params, 2);
-					memcpy(aThisBuffer, (char*)Result.value_int64, (size_t)aThisSize);
+					Write((char*)Result.value_int64, (size_t)aThisSize);
 				}
 				aCall.marker = _T("Next");
 			}
 			else
 			{
-				*(__int64*)aThisBuffer = aThisSize = (__int64)(aValue.var->ByteLength() ? aValue.var->ByteLength() + sizeof(TCHAR) : 0);
-				aThisBuffer += sizeof(__int64);
+				aThisSize = (__int64)(aValue.var->ByteLength() ? aValue.var->ByteLength() + sizeof(TCHAR) : 0);
+				WriteType(10, &aThisSize, sizeof(__int64));
 				if (aThisSize)
-					memcpy(aThisBuffer, aValue.var->Contents(), (size_t)aThisSize);
+					Write(aValue.var->Contents(), (size_t)aThisSize);
 			}
-			aThisBuffer += aThisSize;
 		}
 		else if (aVarType == SYM_FLOAT)
 		{
-			*aThisBuffer = (char)9;
-			aThisBuffer += 1;
-			*(double*)aThisBuffer = TokenToDouble(aValue);
-			aThisBuffer += sizeof(double);
-		}
-		else if ((aIsValue = TokenToInt64(aValue)) > 4294967295)
-		{
-			*aThisBuffer = (char)8;
-			aThisBuffer += 1;
-			*(__int64*)aThisBuffer = aIsValue;
-			aThisBuffer += sizeof(__int64);
-		}
-		else if (aIsValue > 65535)
-		{
-			*aThisBuffer = (char)6;
-			aThisBuffer += 1;
-			*(UINT*)aThisBuffer = (UINT)aIsValue;
-			aThisBuffer += sizeof(UINT);
-		}
-		else if (aIsValue > 255)
-		{
-			*aThisBuffer = (char)4;
-			aThisBuffer += 1;
-			*(USHORT*)aThisBuffer = (USHORT)aIsValue;
-			aThisBuffer += sizeof(USHORT);
-		}
-		else if (aIsValue > -1)
-		{
-			*aThisBuffer = (char)2;
-			aThisBuffer += 1;
-			*aThisBuffer = (BYTE)aIsValue;
-			aThisBuffer += sizeof(BYTE);
-		}
-		else if (aIsValue > -129)
-		{
-			*aThisBuffer = (char)1;
-			aThisBuffer += 1;
-			*aThisBuffer = (char)aIsValue;
-			aThisBuffer += sizeof(char);
-		}
-		else if (aIsValue > -32769)
-		{
-			*aThisBuffer = (char)3;
-			aThisBuffer += 1;
-			*(short*)aThisBuffer = (short)aIsValue;
-			aThisBuffer += sizeof(short);
-		}
-		else if (aIsValue > INT_MIN)
-		{
-			*aThisBuffer = (char)5;
-			aThisBuffer += 1;
-			*aThisBuffer = (int)aIsValue;
-			aThisBuffer += sizeof(int);
+			double value = TokenToDouble(aValue);
+			WriteType(9, &value, sizeof(double));
 		}
 		else
-		{
-			*aThisBuffer = (char)7;
-			aThisBuffer += 1;
-			*(__int64*)aThisBuffer = (__int64)aIsValue;
-			aThisBuffer += sizeof(__int64);
-		}
+			WriteInteger(TokenToInt64(aValue), 1);
 
 		// release object if it was assigned prevoiously when calling enum.Next
 		if (var1->IsObject())
@@ -932,17 +864,80 @@ __int64 ObjRawDump(IObject *aObject, char *aBuffer, bool aCopyBuffer, IObject *a
 			free(result_token.mem_to_free);
 		if (result_token.symbol == SYM_OBJECT)
 			result_token.object->Release();
-
-		aKey.symbol = SYM_VAR;
-		aKey.var = var1;
-		aValue.symbol = SYM_VAR;
-		aValue.var = var2;
 	}
 	// release enumerator and free vars
 	enumerator.Release();
 	var1->Free();
 	var2->Free();
-	return aThisBuffer - aBuffer;
+}
+
+//
+// ObjDumpWriter::WriteDump() - Write the header and the root object.
+//
+
+bool ObjDumpWriter::WriteDump(IObject *aObject)
+{
+	UINT header[2] = { OBJDUMP_SIGNATURE, OBJDUMP_VERSION };
+	Write(header, sizeof(header));
+	__int64 size = 0;
+	Write(&size, sizeof(__int64));
+	__int64 start = Tell();
+	WriteObject(aObject);
+	PatchSize(start - sizeof(__int64), Tell() - start);
+	if (mFile && !mFailed)
+		Flush();
+	return !mFailed;
+}
+
+//
+// ObjDumpWriter::DetachBuffer() - Take ownership of a dump written to memory.
+//
+
+char *ObjDumpWriter::DetachBuffer()
+{
+	char *buffer = (char *)realloc(mBuffer, mLength); // Shrink it to fit.
+	if (!buffer)
+		buffer = mBuffer;
+	mBuffer = NULL;
+	mLength = mCapacity = 0;
+	return buffer;
+}
+
+//
+// OpenDumpTempFile() - Create a temporary file in the same directory as aPath.
+//
+
+static FILE *OpenDumpTempFile(LPCTSTR aPath, LPTSTR aTempPath)
+{
+	TCHAR dir[MAX_PATH];
+	tcslcpy(dir, aPath, _countof(dir));
+	LPTSTR name = _tcsrchr(dir, '\\');
+	if (LPTSTR slash = _tcsrchr(name ? name : dir, '/'))
+		name = slash;
+	if (name)
+		name[1] = '\0';
+	else
+		_tcscpy(dir, _T("."));
+	if (!GetTempFileName(dir, _T("ahk"), 0, aTempPath)) // Creates the file.
+		return NULL;
+	FILE *fp = _tfopen(aTempPath, _T("wb"));
+	if (!fp)
+		DeleteFile(aTempPath);
+	return fp;
+}
+
+//
+// CommitDumpTempFile() - Close the temporary file and replace aPath with it if aSuccess, otherwise delete it.
+//
+
+static bool CommitDumpTempFile(FILE *aFile, LPCTSTR aTempPath, LPCTSTR aPath, bool aSuccess)
+{
+	if (fclose(aFile))
+		aSuccess = false;
+	if (aSuccess && MoveFileEx(aTempPath, aPath, MOVEFILE_REPLACE_EXISTING | MOVEFILE_COPY_ALLOWED))
+		return true;
+	DeleteFile(aTempPath);
+	return false;
 }
 
 //
@@ -951,39 +946,41 @@ __int64 ObjRawDump(IObject *aObject, char *aBuffer, bool aCopyBuffer, IObject *a
 
 BIF_DECL(BIF_ObjDump)
 {
-	aResultToken.symbol = SYM_INTEGER;
+	aResultToken.symbol = SYM_STRING;
+	aResultToken.marker = _T("");
 	IObject *aObject;
 	if (!(aObject = TokenToObject(*aParam[0])) && !(aObject = TokenToObject(*aParam[1])))
-	{
-		aResultToken.symbol = SYM_STRING;
-		aResultToken.marker = _T("");
 		return;
-	}
 	INT aCopyBuffer = aParamCount > 2 ? (int)TokenToInt64(*aParam[2]) : 0;
-	DWORD aSize = (DWORD)ObjRawSize(aObject, (aCopyBuffer == 1 || aCopyBuffer == 3), NULL);
-	char *aBuffer = (char*)malloc(aSize + sizeof(__int64));
-	if (!aBuffer)
+	bool aFileMode = !TokenToObject(*aParam[0]); // i.e. the object is in aParam[1]
+	bool aCompress = aCopyBuffer > 1;
+
+	// Unless it will be compressed, a dump to file is written as it is produced, without holding it in memory.
+	// Either way it is written to a temporary file which replaces the target only once it is complete.
+	LPTSTR aPath = aFileMode ? TokenToString(*aParam[0]) : NULL;
+	TCHAR aTempPath[MAX_PATH];
+	FILE *hFile = NULL;
+	if (aFileMode && !aCompress && !(hFile = OpenDumpTempFile(aPath, aTempPath)))
+		return;
+	ObjDumpWriter writer(hFile, aCopyBuffer == 1 || aCopyBuffer == 3);
+	bool aSuccess = writer.WriteDump(aObject);
+	if (hFile)
+		aSuccess = CommitDumpTempFile(hFile, aTempPath, aPath, aSuccess);
+	if (!aSuccess)
 	{
-		g_script.ScriptError(ERR_OUTOFMEM);
-		aResultToken.symbol = SYM_STRING;
-		aResultToken.marker = _T("");
+		g_script.ScriptError(_T("Error dumping Object."));
 		return;
 	}
-	*(__int64*)aBuffer = aSize;
-	IObject *aObjects = Object::Create();
-	UINT aObjCount = 0;
-	if (aSize != ObjRawDump(aObject, aBuffer + sizeof(__int64), (aCopyBuffer == 1 || aCopyBuffer == 3), aObjects, aObjCount))
+	__int64 aSize = writer.Tell();
+	if (hFile)
 	{
-		aObjects->Release();
-		free(aBuffer);
-		g_script.ScriptError(_T("Error dumping Object."));
-		aResultToken.symbol = SYM_STRING;
-		aResultToken.marker = _T("");
+		aResultToken.symbol = SYM_INTEGER;
+		aResultToken.value_int64 = aSize;
 		return;
 	}
-	aSize += sizeof(__int64);
-	aObjects->Release();
-	if (aParamCount > 2 && TokenToInt64(*aParam[2]) > 1)
+
+	char *aBuffer = writer.DetachBuffer();
+	if (aCompress)
 	{
 		LPVOID aDataBuf;
 		TCHAR *pw[1024] = {};
@@ -994,34 +991,35 @@ BIF_DECL(BIF_ObjDump)
 			for (size_t i = 0; i <= pwlen; i++)
 				pw[i] = &pwd[i];
 		}
-		DWORD aCompressedSize = CompressBuffer((BYTE*)aBuffer, aDataBuf, aSize, pw);
-		if (aCompressedSize)
+		if (aSize > MAXDWORD) // CompressBuffer() can't handle it.
 		{
 			free(aBuffer);
-			aBuffer = (char*)malloc(aCompressedSize);
-			if (!aBuffer)
-			{
-				g_script.ScriptError(ERR_OUTOFMEM);
-				aResultToken.symbol = SYM_STRING;
-				aResultToken.marker = _T("");
-				return;
-			}
-			memcpy(aBuffer, aDataBuf, aSize = aCompressedSize);
-			VirtualFree(aDataBuf, 0, MEM_RELEASE);
+			g_script.ScriptError(_T("Object is too large to compress."));
+			return;
+		}
+		DWORD aCompressedSize = CompressBuffer((BYTE*)aBuffer, aDataBuf, (DWORD)aSize, pw);
+		if (aCompressedSize)
+		{	// aDataBuf was allocated with malloc, so it can be used in place of aBuffer
+			free(aBuffer);
+			aBuffer = (char*)aDataBuf;
+			aSize = aCompressedSize;
 		}
 	}
-	aResultToken.value_int64 = aSize;
-	if (!TokenToObject(*aParam[0]) && TokenToObject(*aParam[1]))
+	if (aFileMode)
 	{ // FileWrite mode
-		FILE *hFile = _tfopen(TokenToString(*aParam[0]), _T("wb"));
+		hFile = OpenDumpTempFile(aPath, aTempPath);
 		if (!hFile)
 		{
-			aResultToken.symbol = SYM_STRING;
-			aResultToken.marker = _T("");
+			free(aBuffer);
+			return;
+		}
+		aSuccess = fwrite(aBuffer, (size_t)aSize, 1, hFile) == 1;
+		if (!CommitDumpTempFile(hFile, aTempPath, aPath, aSuccess))
+		{
+			free(aBuffer);
+			g_script.ScriptError(_T("Error dumping Object."));
 			return;
 		}
-		fwrite(aBuffer, aSize, 1, hFile);
-		fclose(hFile);
 		free(aBuffer);
 	}
 	else if (aParam[1]->symbol == SYM_VAR)
@@ -1029,267 +1027,329 @@ BIF_DECL(BIF_ObjDump)
 		Var &var = *(aParam[1]->var->mType == VAR_ALIAS ? aParam[1]->var->mAliasFor : aParam[1]->var);
 		if (var.mType != VAR_NORMAL) // i.e. VAR_CLIPBOARD or VAR_VIRTUAL.
 		{
+			free(aBuffer);
 			g_script.ScriptError(ERR_VAR_IS_READONLY, var.mName);
-			aResultToken.symbol = SYM_STRING;
-			aResultToken.marker = _T("");
 			return;
 		}
 		var.Free(VAR_ALWAYS_FREE); // Release the variable's old memory. This also removes flags VAR_ATTRIB_OFTEN_REMOVED.
 		var.mHowAllocated = ALLOC_MALLOC; // Must always be this type to avoid complications and possible memory leaks.
 		var.mByteContents = aBuffer;
-		var.mByteCapacity = var.mByteLength = (VarSizeType)aResultToken.value_int64;
+		var.mByteCapacity = var.mByteLength = (VarSizeType)aSize;
+	}
+	else
+		free(aBuffer);
+	aResultToken.symbol = SYM_INTEGER;
+	aResultToken.value_int64 = aSize;
+}
+
+class ObjLoadReader
+{
+	FILE *mFile; // NULL if reading from memory.
+	char *mBuffer; // The whole dump if reading from memory, otherwise the part most recently read from mFile.
+	size_t mLength, mPos;
+	__int64 mOffset; // Position of mBuffer within the dump.
+	IObject **mObject; // Objects read so far, by index.
+	UINT mObjectCount, mObjectCapacity;
+	char *mValueString; // Holds a string value read from a file.  Keys are held by ReadObject() since the value might be an object.
+	size_t mValueStringCapacity;
+
+	bool Read(void *aData, size_t aSize);
+	bool ReadString(__int64 aSize, LPTSTR &aString, char *&aBuf, size_t &aBufCapacity);
+	bool ReadField(ExprTokenType &aToken, char aType, char *&aBuf, size_t &aBufCapacity, __int64 &aStringSize, bool &aIsNewObject);
+	IObject *ReadObject();
+
+public:
+	// aLength may be zero if the size of the buffer isn't known.
+	ObjLoadReader(FILE *aFile, char *aBuffer, size_t aLength) : mFile(aFile), mBuffer(aBuffer), mLength(aLength), mPos(0), mOffset(0)
+		, mObject(NULL), mObjectCount(0), mObjectCapacity(0)
+	{
+		if (mFile)
+		{
+			mBuffer = (char *)malloc(OBJDUMP_BUFFER_SIZE);
+			mLength = 0;
+		}
+		else if (!mLength)
+			mLength = ~(size_t)0;
+		mValueString = NULL;
+		mValueStringCapacity = 0;
+	}
+	~ObjLoadReader()
+	{
+		if (mFile)
+			free(mBuffer);
+		free(mObject);
+		free(mValueString);
+	}
+	__int64 Tell() { return mOffset + mPos; }
+	IObject *ReadDump();
+};
+
+//
+// ObjLoadReader::Read() - Read data from the dump.  Returns false if the end of the dump was reached.
+//
+
+bool ObjLoadReader::Read(void *aData, size_t aSize)
+{
+	while (aSize > mLength - mPos)
+	{
+		if (!mFile)
+			return false;
+		size_t available = mLength - mPos;
+		memcpy(aData, mBuffer + mPos, available);
+		aData = (char *)aData + available;
+		aSize -= available;
+		mOffset += mLength;
+		mPos = 0;
+		if (!(mLength = fread(mBuffer, 1, OBJDUMP_BUFFER_SIZE, mFile)))
+			return false;
+	}
+	memcpy(aData, mBuffer + mPos, aSize);
+	mPos += aSize;
+	return true;
+}
+
+//
+// ObjLoadReader::ReadString() - Read a string of aSize bytes.  When reading from a file, aBuf is used to hold it.
+//
+
+bool ObjLoadReader::ReadString(__int64 aSize, LPTSTR &aString, char *&aBuf, size_t &aBufCapacity)
+{
+	if (!mFile)
+	{	// point directly into the buffer
+		if (aSize < 0 || (unsigned __int64)aSize > mLength - mPos)
+			return false;
+		aString = (LPTSTR)(mBuffer + mPos);
+		mPos += (size_t)aSize;
+		return true;
 	}
+	if (aSize < 0 || (unsigned __int64)aSize > (size_t)-1 - sizeof(TCHAR))
+		return false;
+	size_t size = (size_t)aSize;
+	if (size + sizeof(TCHAR) > aBufCapacity)
+	{
+		char *new_buf = (char *)realloc(aBuf, size + sizeof(TCHAR));
+		if (!new_buf)
+			return false;
+		aBuf = new_buf;
+		aBufCapacity = size + sizeof(TCHAR);
+	}
+	if (!Read(aBuf, size))
+		return false;
+	*(TCHAR *)(aBuf + size) = '\0'; // In case the dump is corrupt.
+	aString = (LPTSTR)aBuf;
+	return true;
 }
 
 //
-// ObjRawLoad()
+// ObjLoadReader::ReadField() - Read the data of a key or value of the given (positive) type into aToken.
 //
 
-IObject* ObjRawLoad(char *aBuffer, IObject **&aObjects, UINT &aObjCount, UINT &aObjSize)
+bool ObjLoadReader::ReadField(ExprTokenType &aToken, char aType, char *&aBuf, size_t &aBufCapacity, __int64 &aStringSize, bool &aIsNewObject)
 {
+	union
+	{
+		char c;
+		BYTE b;
+		short s;
+		USHORT us;
+		int i;
+		UINT ui;
+		__int64 i64;
+		double d;
+	} data;
+	aIsNewObject = false;
+	aToken.symbol = SYM_INTEGER;
+	switch (aType)
+	{
+	case 1: if (!Read(&data.c, sizeof(char))) return false; aToken.value_int64 = data.c; return true;
+	case 2: if (!Read(&data.b, sizeof(BYTE))) return false; aToken.value_int64 = data.b; return true;
+	case 3: if (!Read(&data.s, sizeof(short))) return false; aToken.value_int64 = data.s; return true;
+	case 4: if (!Read(&data.us, sizeof(USHORT))) return false; aToken.value_int64 = data.us; return true;
+	case 5: if (!Read(&data.i, sizeof(int))) return false; aToken.value_int64 = data.i; return true;
+	case 6: if (!Read(&data.ui, sizeof(UINT))) return false; aToken.value_int64 = data.ui; return true;
+	case 7:
+	case 8: if (!Read(&data.i64, sizeof(__int64))) return false; aToken.value_int64 = data.i64; return true;
+	case 9:
+		if (!Read(&data.d, sizeof(double)))
+			return false;
+		aToken.symbol = SYM_FLOAT;
+		aToken.value_double = data.d;
+		return true;
+	case 10:
+		if (!Read(&aStringSize, sizeof(__int64)))
+			return false;
+		aToken.symbol = SYM_STRING;
+		if (!aStringSize)
+		{
+			aToken.marker = _T("");
+			aToken.marker_length = 0;
+			return true;
+		}
+		if (!ReadString(aStringSize, aToken.marker, aBuf, aBufCapacity))
+			return false;
+		aToken.marker_length = (size_t)(aStringSize - sizeof(TCHAR)) / sizeof(TCHAR);
+		return true;
+	case 11:
+		aToken.symbol = SYM_OBJECT;
+		if (!(aToken.object = ReadObject()))
+			return false;
+		aIsNewObject = true;
+		return true;
+	case 12:
+		if (!Read(&data.i64, sizeof(__int64)) || data.i64 < 0 || data.i64 >= mObjectCount)
+			return false;
+		aToken.symbol = SYM_OBJECT;
+		aToken.object = mObject[data.i64];
+		return true;
+	}
+	return false;
+}
+
+//
+// ObjLoadReader::ReadObject() - Read an object and its key-value pairs.
+//
+
+IObject *ObjLoadReader::ReadObject()
+{
+	__int64 aSize;
+	if (!Read(&aSize, sizeof(__int64)) || aSize < 0)
+		return NULL;
 	IObject *aObject = Object::Create();
-	if (aObjCount == aObjSize)
+	if (!aObject)
+		return NULL;
+	if (mObjectCount == mObjectCapacity)
 	{
-		IObject **newObjects = (IObject**)malloc(aObjSize * 2 * sizeof(IObject**));
-		if (!newObjects)
-			return 0;
-		memcpy(newObjects, aObjects, aObjSize);
-		free(aObjects);
-		aObjects = newObjects;
-		aObjSize *= 2;
+		UINT new_capacity = mObjectCapacity ? mObjectCapacity * 2 : 16;
+		IObject **new_objects = (IObject **)realloc(mObject, new_capacity * sizeof(IObject *));
+		if (!new_objects)
+		{
+			aObject->Release();
+			return NULL;
+		}
+		mObject = new_objects;
+		mObjectCapacity = new_capacity;
 	}
-	aObjects[aObjCount++] = aObject;
-	char *aThisBuffer = aBuffer + sizeof(__int64);
+	mObject[mObjectCount++] = aObject;
 
-	ExprTokenType Result, this_token, enum_token, aCall, aKey, aValue;
+	ExprTokenType Result, this_token, aCall, aKey, aValue;
 	ExprTokenType *params[] = { &aCall, &aKey, &aValue };
 	aCall.symbol = SYM_STRING;
-	size_t aSize = (size_t)*(__int64*)aBuffer;
 	TCHAR buf[MAX_INTEGER_LENGTH];
-
-	for (char *end = aThisBuffer + aSize; aThisBuffer < end;)
+	char type;
+	__int64 aStringSize;
+	bool aKeyIsNew, aValueIsNew;
+	char *key_buf = NULL; // Holds a string key read from a file, while the value is read.
+	size_t key_buf_capacity = 0;
+	bool aFailed = false;
+
+	__int64 end = Tell() + aSize;
+	while (Tell() < end)
 	{
-		char type = *(char*)aThisBuffer;
-		aThisBuffer += 1;
-		if (type == -12)
-		{
-			aKey.symbol = SYM_OBJECT;
-			aKey.object = aObjects[*(__int64*)aThisBuffer];
-			aThisBuffer += sizeof(__int64);
-		}
-		else if (type == -11)
-		{
-			aKey.symbol = SYM_OBJECT;
-			aKey.object = ObjRawLoad(aThisBuffer, aObjects, aObjCount, aObjSize);
-			aThisBuffer += sizeof(__int64) + *(__int64*)aThisBuffer;
-		}
-		else if (type == -10)
-		{
-			aKey.symbol = SYM_STRING;
-			__int64 aMarkerSize = *(__int64*)aThisBuffer;
-			aThisBuffer += sizeof(__int64);
-			if (aMarkerSize)
-			{
-				aKey.marker_length = (size_t)(aMarkerSize - sizeof(TCHAR)) / sizeof(TCHAR);
-				aKey.marker = (LPTSTR)aThisBuffer;
-				aThisBuffer += aMarkerSize;
-			}
-			else
-			{
-				aKey.marker = _T("");
-				aKey.marker_length = 0;
-			}
-		}
-		else if (type == -9)
+		if (aFailed = !Read(&type, 1) || type >= 0 || !ReadField(aKey, -type, key_buf, key_buf_capacity, aStringSize, aKeyIsNew))
+			break;
+		if (aKey.symbol == SYM_FLOAT)
 		{
 			aKey.symbol = SYM_STRING;
-			aKey.marker_length = FTOA(*(double*)aThisBuffer, buf, MAX_INTEGER_LENGTH);
+			aKey.marker_length = FTOA(aKey.value_double, buf, MAX_INTEGER_LENGTH);
 			aKey.marker = buf;
-			aThisBuffer += sizeof(__int64);
 		}
-		else
+		if (aFailed = !Read(&type, 1) || type <= 0 || !ReadField(aValue, type, mValueString, mValueStringCapacity, aStringSize, aValueIsNew))
 		{
-			aKey.symbol = SYM_INTEGER;
-			if (type == -8)
-			{
-				aKey.value_int64 = *(__int64*)aThisBuffer;
-				aThisBuffer += sizeof(__int64);
-			}
-			else if (type == -6)
-			{
-				aKey.value_int64 = *(UINT*)aThisBuffer;
-				aThisBuffer += sizeof(UINT);
-			}
-			else if (type == -4)
-			{
-				aKey.value_int64 = *(USHORT*)aThisBuffer;
-				aThisBuffer += sizeof(USHORT);
-			}
-			else if (type == -2)
-			{
-				aKey.value_int64 = *(BYTE*)aThisBuffer;
-				aThisBuffer += sizeof(BYTE);
-			}
-			else if (type == -1)
-			{
-				aKey.value_int64 = *(char*)aThisBuffer;
-				aThisBuffer += sizeof(char);
-			}
-			else if (type == -3)
-			{
-				aKey.value_int64 = *(short*)aThisBuffer;
-				aThisBuffer += sizeof(short);
-			}
-			else if (type == -5)
-			{
-				aKey.value_int64 = *(int*)aThisBuffer;
-				aThisBuffer += sizeof(int);
-			}
-			else if (type == -7)
-			{
-				aKey.value_int64 = *(__int64*)aThisBuffer;
-				aThisBuffer += sizeof(__int64);
-			}
-			else
-				return NULL;
-		}
-
-		type = *(char*)aThisBuffer;
-		aThisBuffer += 1;
-		if (type == 12)
-		{
-			aValue.symbol = SYM_OBJECT;
-			aValue.object = aObjects[*(__int64*)aThisBuffer];
-			aThisBuffer += sizeof(__int64);
-		}
-		else if (type == 11)
-		{
-			aValue.symbol = SYM_OBJECT;
-			aValue.object = ObjRawLoad(aThisBuffer, aObjects, aObjCount, aObjSize);
-			aThisBuffer += sizeof(__int64) + *(__int64*)aThisBuffer;
-		}
-		else if (type == 9)
-		{
-			aValue.symbol = SYM_FLOAT;
-			aValue.value_double = *(double*)aThisBuffer;
-			aThisBuffer += sizeof(__int64);
+			if (aKeyIsNew)
+				aKey.object->Release();
+			break;
 		}
-		else if (type != 10)
-		{
+		if (aValue.symbol == SYM_STRING && aStringSize)
+		{	// the string may be a binary buffer, so set its capacity and copy all of it
+			LPTSTR aString = aValue.marker;
+			aValue.marker_length = -1;
+			aObject->Invoke(Result, this_token, IT_SET, params + 1, 2);
+			aCall.marker = _T("SetCapacity");
 			aValue.symbol = SYM_INTEGER;
-			if (type == 8)
-			{
-				aValue.value_int64 = *(__int64*)aThisBuffer;
-				aThisBuffer += sizeof(__int64);
-			}
-			else if (type == 6)
-			{
-				aValue.value_int64 = *(UINT*)aThisBuffer;
-				aThisBuffer += sizeof(UINT);
-			}
-			else if (type == 4)
-			{
-				aValue.value_int64 = *(USHORT*)aThisBuffer;
-				aThisBuffer += sizeof(USHORT);
-			}
-			else if (type == 2)
-			{
-				aValue.value_int64 = *(BYTE*)aThisBuffer;
-				aThisBuffer += sizeof(BYTE);
-			}
-			else if (type == 1)
-			{
-				aValue.value_int64 = *(char*)aThisBuffer;
-				aThisBuffer += sizeof(char);
-			}
-			else if (type == 3)
-			{
-				aValue.value_int64 = *(short*)aThisBuffer;
-				aThisBuffer += sizeof(short);
-			}
-			else if (type == 5)
-			{
-				aValue.value_int64 = *(int*)aThisBuffer;
-				aThisBuffer += sizeof(int);
-			}
-			else if (type == 7)
-			{
-				aValue.value_int64 = *(__int64*)aThisBuffer;
-				aThisBuffer += sizeof(__int64);
-			}
-			else
-				return NULL;
-		}
-		if (type == 10)
-		{
-			aValue.symbol = SYM_STRING;
-			__int64 aMarkerSize = *(__int64*)aThisBuffer;
-			aThisBuffer += sizeof(__int64);
-			if (aMarkerSize)
-			{
-				aValue.marker_length = -1;
-				aValue.marker = (LPTSTR)aThisBuffer;
-				aObject->Invoke(Result, this_token, IT_SET, params + 1, 2);
-				aCall.marker = _T("SetCapacity");
-				aValue.symbol = SYM_INTEGER;
-				aValue.value_int64 = aMarkerSize;
-				aObject->Invoke(Result, this_token, IT_CALL, params, 3);
-				aCall.marker = _T("GetAddress");
-				aObject->Invoke(Result, this_token, IT_CALL, params, 2);
-				memcpy((char*)Result.value_int64, aThisBuffer, (size_t)aMarkerSize);
-				aThisBuffer += aMarkerSize;
-			}
-			else
-			{
-				aValue.marker = _T("");
-				aValue.marker_length = 0;
-				aObject->Invoke(Result, this_token, IT_SET, params + 1, 2);
-			}
+			aValue.value_int64 = aStringSize;
+			aObject->Invoke(Result, this_token, IT_CALL, params, 3);
+			aCall.marker = _T("GetAddress");
+			aObject->Invoke(Result, this_token, IT_CALL, params, 2);
+			memcpy((char*)Result.value_int64, aString, (size_t)aStringSize);
 		}
 		else
 			aObject->Invoke(Result, this_token, IT_SET, params + 1, 2);
+		// the new objects are now referenced by aObject
+		if (aKeyIsNew)
+			aKey.object->Release();
+		if (aValueIsNew)
+			aValue.object->Release();
+	}
+	free(key_buf);
+	if (aFailed || Tell() != end) // Read failed or the data is corrupt.
+	{
+		aObject->Release();
+		return NULL;
 	}
 	return aObject;
 }
 
+//
+// ObjLoadReader::ReadDump() - Read the header (if present) and the root object.
+//
+
+IObject *ObjLoadReader::ReadDump()
+{
+	UINT header[2];
+	if (!mBuffer || !Read(header, sizeof(header)))
+		return NULL;
+	if (header[0] != OBJDUMP_SIGNATURE || !header[1])
+		mPos -= sizeof(header); // No header, so this is the size of the root object.
+	else if (header[1] > OBJDUMP_VERSION)
+		return NULL; // Written by a newer version.
+	return ReadObject();
+}
+
 //
 // ObjLoad()
 //
 
 BIF_DECL(BIF_ObjLoad)
 {
-	aResultToken.symbol = SYM_OBJECT;
-	bool aFreeBuffer = false;
-	DWORD aSize = aParamCount > 1 ? (DWORD)TokenToInt64(*aParam[1]) : 0;
-	LPTSTR aPath = TokenToString(*aParam[0]);
+	aResultToken.symbol = SYM_STRING;
+	aResultToken.marker = _T("");
+	bool aFreeBuffer = false, aDecompressed = false;
+	DWORD aSize = 0;
 	char *aBuffer = (char *)TokenToInt64(*aParam[0]);
+	FILE *fp = NULL;
 	if (!aBuffer)
 	{ // FileRead Mode
+		LPTSTR aPath = TokenToString(*aParam[0]);
 		if (GetFileAttributes(aPath) == 0xFFFFFFFF)
-		{
-			aResultToken.symbol = SYM_STRING;
-			aResultToken.marker = _T("");
 			return;
-		}
-		FILE *fp;
-
 		fp = _tfopen(aPath, _T("rb"));
 		if (fp == NULL)
-		{
-			aResultToken.symbol = SYM_STRING;
-			aResultToken.marker = _T("");
 			return;
-		}
 
-		fseek(fp, 0, SEEK_END);
-		aSize = ftell(fp);
-		aBuffer = (char *)malloc(aSize);
-		aFreeBuffer = true;
-		fseek(fp, 0, SEEK_SET);
-		fread(aBuffer, 1, aSize, fp);
-		fclose(fp);
+		// A compressed dump has to be read into memory, but otherwise the file is read while loading.
+		unsigned int aSignature = 0;
+		fread(&aSignature, 1, sizeof(aSignature), fp);
+		if (aSignature == 0x04034b50)
+		{
+			fseek(fp, 0, SEEK_END);
+			aSize = ftell(fp);
+			aBuffer = (char *)malloc(aSize);
+			if (!aBuffer)
+			{
+				fclose(fp);
+				g_script.ScriptError(ERR_OUTOFMEM);
+				return;
+			}
+			aFreeBuffer = true;
+			fseek(fp, 0, SEEK_SET);
+			fread(aBuffer, 1, aSize, fp);
+			fclose(fp);
+			fp = NULL;
+		}
+		else
+			fseek(fp, 0, SEEK_SET);
 	}
-	if (*(unsigned int*)aBuffer == 0x04034b50)
+	if (aBuffer && *(unsigned int*)aBuffer == 0x04034b50)
 	{
 		LPVOID aDataBuf;
 		TCHAR *pw[1024] = {};
@@ -1304,39 +1364,33 @@ BIF_DECL(BIF_ObjLoad)
 		if (*(ULONG*)((UINT_PTR)aBuffer + 16) > aSize)
 			aSize = *(ULONG*)((UINT_PTR)aBuffer + 16);
 		DWORD aSizeDeCompressed = DecompressBuffer(aBuffer, aDataBuf, aSize, pw);
-		if (aSizeDeCompressed)
-		{
-			LPVOID buff = malloc(aSizeDeCompressed);
-			aFreeBuffer = true;
-			memcpy(buff, aDataBuf, aSizeDeCompressed);
-			g_memset(aDataBuf, 0, aSizeDeCompressed);
-			free(aDataBuf);
-			aBuffer = (char*)buff;
-		}
-		else
+		if (aFreeBuffer)
+			free(aBuffer);
+		if (!aSizeDeCompressed)
 		{
-			aResultToken.symbol = SYM_STRING;
-			aResultToken.marker = _T("");
 			g_script.ScriptError(_T("ObjLoad: Password mismatch."));
 			return;
 		}
+		// aDataBuf was allocated with malloc, so it can be used directly
+		aBuffer = (char*)aDataBuf;
+		aFreeBuffer = aDecompressed = true;
+		aSize = aSizeDeCompressed;
 	}
-	UINT aObjCount = 0;
-	UINT aObjSize = 16;
-	IObject **aObjects = (IObject**)malloc(aObjSize * sizeof(IObject**));
-	if (!aObjects || !(aResultToken.object = ObjRawLoad(aBuffer, aObjects, aObjCount, aObjSize)))
+	ObjLoadReader reader(fp, aBuffer, aSize);
+	IObject *aObject = reader.ReadDump();
+	if (fp)
+		fclose(fp);
+	if (aDecompressed) // Don't leave the decrypted data in freed memory.
+		g_memset(aBuffer, 0, aSize);
+	if (aFreeBuffer)
+		free(aBuffer);
+	if (!aObject)
 	{
-		if (!TokenToInt64(*aParam[0]))
-			free(aBuffer);
-		free(aObjects);
-		aResultToken.symbol = SYM_STRING;
-		aResultToken.marker = _T("");
-		g_script.ScriptError(ERR_OUTOFMEM);
+		g_script.ScriptError(_T("Error loading Object."));
 		return;
 	}
-	free(aObjects);
-	if (aFreeBuffer)
-		free(aBuffer);
+	aResultToken.symbol = SYM_OBJECT;
+	aResultToken.object = aObject;
 }
 
 //
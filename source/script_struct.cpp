@@ -7,6 +7,19 @@
 
 #include "script_object.h"
 
+// Cache of struct layouts by definition text; see Struct::mLayout.  A layout depends only on the text of
+// its definition, so entries never need to be invalidated, but their number is limited in case a script
+// generates definitions dynamically.
+struct StructLayoutEntry
+{
+	LPTSTR definition;
+	UINT hash;
+	Struct *layout; // NULL indicates an empty slot.
+};
+static StructLayoutEntry *sLayoutCache = NULL;
+static size_t sLayoutCacheCount = 0, sLayoutCacheCapacity = 0; // sLayoutCacheCapacity is always a power of two (or zero).
+#define STRUCT_LAYOUT_CACHE_LIMIT 4096
+
 //
 // Struct::Create - Called by BIF_ObjCreate to create a new object, optionally passing key/value pairs to set.
 //
@@ -28,6 +41,7 @@ Struct *Struct::Create(ExprTokenType *aParam[], int aParamCount)
 	int aligntotal = 0;				// pointer alignment for total structure
 	int thissize;					// used to check if type was found in above array.
 	int maxsize = 0;				// max size of union or struct
+	bool cacheable = true;			// false if the layout depends on a variable, so can't be cached
 
 	// following are used to find variable and also get size of a structure defined in variable
 	// this will hold the variable reference and offset that is given to size() to align if necessary in 64-bit
@@ -103,6 +117,19 @@ Struct *Struct::Create(ExprTokenType *aParam[], int aParamCount)
 	
 	// Set buf to beginning of structure definition
 	buf = TokenToString(*aParam[0]);
+
+	// Use the cached layout if this definition was already parsed
+	if (Struct *layout = FindLayout(buf))
+	{
+		obj->Release();
+		if (!(obj = layout->Instantiate()))
+		{
+			g_script.ScriptError(ERR_OUTOFMEM);
+			return NULL;
+		}
+		return obj->InitInstance(aParam, aParamCount);
+	}
+	LPTSTR definition = buf;
 	
 	// continue as long as we did not reach end of string / structure definition
 	while (*buf)
@@ -319,6 +346,7 @@ Struct *Struct::Create(ExprTokenType *aParam[], int aParamCount)
 		}
 		else // type was not found, check for user defined type in variables
 		{
+			cacheable = false;			// the variable's contents might change
 			Var1.var = NULL;			// init to not found
 			Func *bkpfunc = NULL;
 			// check if we have a local/static declaration and resolve to function
@@ -499,25 +527,159 @@ Struct *Struct::Create(ExprTokenType *aParam[], int aParamCount)
 	}
 	
 	obj->mSize = offset;
+	// keep the parsed object as the layout for this definition and return a new instance of it
+	if (cacheable)
+		obj = AddLayout(obj, definition);
+	return obj->InitInstance(aParam, aParamCount);
+}
+
+//
+// Struct::InitInstance - Assign memory to a newly created structure and initialize its fields.
+//
+
+Struct *Struct::InitInstance(ExprTokenType *aParam[], int aParamCount)
+{
 	if (aParamCount > 1 && TokenIsPureNumeric(*aParam[1]))
 	{	// second parameter exist and it is digit assumme this is new pointer for our structure
-		obj->mStructMem = (UINT_PTR *)TokenToInt64(*aParam[1]);
-		obj->mMemAllocated = 0;
+		mStructMem = (UINT_PTR *)TokenToInt64(*aParam[1]);
+		mMemAllocated = 0;
 	}
 	else // no pointer given so allocate memory and fill memory with 0
 	{	// setting the memory after parsing definition saves a call to BIF_sizeof
-		obj->mStructMem = (UINT_PTR *)malloc(offset);
-		obj->mMemAllocated = offset;
-		g_memset(obj->mStructMem, NULL, offset);
+		if (!(mStructMem = (UINT_PTR *)malloc(mSize)))
+		{
+			Release();
+			g_script.ScriptError(ERR_OUTOFMEM);
+			return NULL;
+		}
+		mMemAllocated = mSize;
+		g_memset(mStructMem, NULL, mSize);
 	}
 
 	// an object was passed to initialize fields
 	// enumerate trough object and assign values
 	if ((aParamCount > 1 && !TokenIsPureNumeric(*aParam[1])) || aParamCount > 2 )
-		obj->ObjectToStruct(TokenToObject(*aParam[aParamCount - 1]));
+		ObjectToStruct(TokenToObject(*aParam[aParamCount - 1]));
+	return this;
+}
+
+//
+// Struct::FindLayout - Find the cached layout of a definition, or NULL if it wasn't cached.
+//
+
+Struct *Struct::FindLayout(LPTSTR aDefinition)
+{
+	if (!sLayoutCacheCount)
+		return NULL;
+	UINT hash = tcshash(aDefinition);
+	size_t mask = sLayoutCacheCapacity - 1;
+	for (size_t i = hash & mask; sLayoutCache[i].layout; i = (i + 1) & mask)
+		if (sLayoutCache[i].hash == hash && !_tcscmp(sLayoutCache[i].definition, aDefinition))
+			return sLayoutCache[i].layout;
+	return NULL;
+}
+
+//
+// Struct::AddLayout - Cache a newly parsed structure which has no memory assigned yet.
+//					   Returns a new instance of it, or aLayout itself if it could not be cached.
+//
+
+Struct *Struct::AddLayout(Struct *aLayout, LPTSTR aDefinition)
+{
+	if (sLayoutCacheCount >= STRUCT_LAYOUT_CACHE_LIMIT)
+		return aLayout;
+	if ((sLayoutCacheCount + 1) * 2 > sLayoutCacheCapacity)
+	{	// keep the table at most half full
+		size_t new_capacity = sLayoutCacheCapacity ? sLayoutCacheCapacity * 2 : 64;
+		StructLayoutEntry *new_cache = (StructLayoutEntry *)calloc(new_capacity, sizeof(StructLayoutEntry));
+		if (!new_cache)
+			return aLayout;
+		for (size_t i = 0; i < sLayoutCacheCapacity; ++i)
+			if (sLayoutCache[i].layout)
+			{
+				size_t j;
+				for (j = sLayoutCache[i].hash & (new_capacity - 1); new_cache[j].layout; j = (j + 1) & (new_capacity - 1));
+				new_cache[j] = sLayoutCache[i];
+			}
+		free(sLayoutCache);
+		sLayoutCache = new_cache;
+		sLayoutCacheCapacity = new_capacity;
+	}
+	LPTSTR definition = _tcsdup(aDefinition);
+	if (!definition)
+		return aLayout;
+	aLayout->BuildFieldIndex(); // before Instantiate() so that the index is shared
+	Struct *obj = aLayout->Instantiate();
+	if (!obj)
+	{
+		free(definition);
+		return aLayout;
+	}
+	// the cache takes over the reference which was returned to us
+	UINT hash = tcshash(definition);
+	size_t i, mask = sLayoutCacheCapacity - 1;
+	for (i = hash & mask; sLayoutCache[i].layout; i = (i + 1) & mask);
+	sLayoutCache[i].definition = definition;
+	sLayoutCache[i].hash = hash;
+	sLayoutCache[i].layout = aLayout;
+	++sLayoutCacheCount;
 	return obj;
 }
 
+//
+// Struct::ClearLayoutCache - Called when the script is destroyed.
+//							  Structures created from a cached layout keep it alive until they are deleted.
+//
+
+void Struct::ClearLayoutCache()
+{
+	for (size_t i = 0; i < sLayoutCacheCapacity; ++i)
+		if (sLayoutCache[i].layout)
+		{
+			free(sLayoutCache[i].definition);
+			sLayoutCache[i].layout->Release();
+		}
+	free(sLayoutCache);
+	sLayoutCache = NULL;
+	sLayoutCacheCount = sLayoutCacheCapacity = 0;
+}
+
+//
+// Struct::Instantiate - Create a structure with the fields of a cached layout, sharing its field names.
+//
+
+Struct *Struct::Instantiate()
+{
+	Struct *objptr = new Struct();
+	if (!objptr)
+		return objptr;
+
+	Struct &obj = *objptr;
+	if (mFieldCount)
+	{
+		if (!obj.SetInternalCapacity(mFieldCount))
+		{
+			obj.Release();
+			return NULL;
+		}
+		// fields of a layout never have memory allocated, so they can simply be copied
+		memcpy(obj.mFields, mFields, mFieldCount * sizeof(FieldType));
+		obj.mFieldCount = mFieldCount;
+	}
+	obj.mArraySize = mArraySize;
+	obj.mIsInteger = mIsInteger;
+	obj.mIsPointer = mIsPointer;
+	obj.mEncoding = mEncoding;
+	obj.mIsUnsigned = mIsUnsigned;
+	obj.mSize = mSize;
+	obj.mVarRef = mVarRef;
+	obj.mTypeOnly = mTypeOnly;
+	obj.mFieldIndex = mFieldIndex;
+	obj.mLayout = this;
+	AddRef();
+	return &obj;
+}
+
 //
 // Struct::ObjectToStruct - Initialize structure from array, object or structure.
 //
@@ -634,12 +796,17 @@ Struct::~Struct()
 			{
 				if (mFields[i].mMemAllocated > 0)
 					free(mFields[i].mStructMem);
-				free(mFields[i].key);
+				if (!mLayout) // otherwise the layout owns the keys
+					free(mFields[i].key);
 			}
 		}
 		// Free fields array.
 		free(mFields);
 	}
+	if (mLayout)
+		mLayout->Release();
+	else
+		free(mFieldIndex);
 }
 
 
@@ -1929,6 +2096,16 @@ ResultType STDMETHODCALLTYPE Struct::Invoke(
 
 Struct::FieldType *Struct::FindField(LPTSTR val)
 {
+	if (mFieldIndex)
+	{
+		FieldIndex::Slot *slot = mFieldIndex->slot;
+		IndexType mask = mFieldIndex->capacity - 1;
+		UINT hash = tcsihash(val);
+		for (IndexType i = hash & mask; slot[i].pos; i = (i + 1) & mask)
+			if (slot[i].hash == hash && !_tcsicmp(mFields[slot[i].pos - 1].key, val))
+				return &mFields[slot[i].pos - 1];
+		return NULL;
+	}
 	for (int i = 0;i < mFieldCount;i++)
 	{
 		FieldType &field = mFields[i];
@@ -1938,6 +2115,28 @@ Struct::FieldType *Struct::FindField(LPTSTR val)
 	return NULL;
 }
 
+void Struct::BuildFieldIndex()
+// Creates the field index of a cached layout.  If out of memory, fields are found by comparing each name.
+{
+	if (mFieldIndex || mFieldCount <= sFieldIndexThreshold)
+		return;
+	IndexType capacity = 16;
+	while (capacity < mFieldCount * 2)
+		capacity *= 2;
+	if (!(mFieldIndex = (FieldIndex *)calloc(1, sizeof(FieldIndex) + (capacity - 1) * sizeof(FieldIndex::Slot))))
+		return;
+	mFieldIndex->capacity = capacity;
+	FieldIndex::Slot *slot = mFieldIndex->slot;
+	for (IndexType pos = 0; pos < mFieldCount; ++pos)
+	{
+		UINT hash = tcsihash(mFields[pos].key);
+		IndexType i;
+		for (i = hash & (capacity - 1); slot[i].pos; i = (i + 1) & (capacity - 1));
+		slot[i].hash = hash;
+		slot[i].pos = pos + 1;
+	}
+}
+
 bool Struct::SetInternalCapacity(IndexType new_capacity)
 // Expands mFields to the specified number if fields.
 // Caller *must* ensure new_capacity >= 1 && new_capacity >= mFieldCount.
@@ -22,6 +22,10 @@ GNU General Public License for more details.
 #include "script.h"
 #include "globaldata.h"
 #include "LiteZip.h"
+#if defined(_M_IX86) || defined(_M_X64)
+#include <intrin.h> // For _BitScanForward/Reverse().
+#include <emmintrin.h> // For SSE2 intrinsics used by tmemsearch().
+#endif
 
 int GetYDay(int aMon, int aDay, bool aIsLeapYear)
 // Returns a number between 1 and 366.
@@ -548,95 +552,450 @@ int tcslicmp(LPTSTR aBuf1, LPTSTR aBuf2, size_t aLength1, size_t aLength2)
 
 
 
-LPTSTR tcsrstr(LPTSTR aStr, size_t aStr_length, LPCTSTR aPattern, StringCaseSenseType aStringCaseSense, int aOccurrence)
-// Returns NULL if not found, otherwise the address of the found string.
-// This could probably use a faster algorithm someday.  For now it seems adequate because
-// scripts rarely use it and when they do, it's usually on short haystack strings (such as
-// to find the last period in a filename).
+// SUBSTRING SEARCH ENGINE.
+// tmemsearch() and tmemrsearch() search a haystack of known length, so unlike _tcsstr() and tcscasestr()
+// they don't need to check each character for the terminator.  Candidates are found by comparing the
+// needle's first and last characters against a whole block of positions at once using SSE2, then verified
+// with a full comparison.  Where SSE2 isn't available and for SCS_INSENSITIVE_LOCALE (whose case mapping
+// can't be vectorized), a Boyer-Moore-Horspool skip table is used for needles long enough to benefit.
+// Case folding is consistent with the other search functions: SCS_INSENSITIVE folds only ASCII letters
+// (ctolower) and SCS_INSENSITIVE_LOCALE folds via CharLower (ltolower).
+
+#define TMEMSEARCH_BMH_MIN_NEEDLE 4     // Shorter needles don't skip far enough to pay for building the table.
+#define TMEMSEARCH_BMH_MIN_HAYSTACK 256 // Nor do short haystacks.
+
+struct FoldNone
 {
-	if (aOccurrence < 1)
+	inline TBYTE operator()(TBYTE c) const { return c; }
+};
+
+struct FoldAscii
+{
+	inline TBYTE operator()(TBYTE c) const { return (c >= 'A' && c <= 'Z') ? (c | 0x20) : c; }
+};
+
+struct FoldLocaleTable
+{
+	const TBYTE *table;
+	inline TBYTE operator()(TBYTE c) const { return table[c]; }
+};
+
+struct FoldLocale
+{
+	inline TBYTE operator()(TBYTE c) const { return ltolower(c); }
+};
+
+static TBYTE *volatile sLocaleLowerTable = NULL;
+
+static const TBYTE *GetLocaleLowerTable()
+// Returns a table mapping each character to ltolower() of it, or NULL if there's insufficient memory.
+// It's built upon first use since it's relatively large in Unicode builds (128 KB) and most scripts never
+// need it.  ltolower() is called for each character (rather than CharLowerBuff on the whole range) to
+// ensure the table is exactly consistent with it.
+{
+	if (!sLocaleLowerTable)
+	{
+		const UINT char_count = (UINT)(TBYTE)-1 + 1;
+		TBYTE *table = (TBYTE *)malloc(char_count * sizeof(TBYTE));
+		if (!table)
+			return NULL;
+		for (UINT c = 0; c < char_count; ++c)
+			table[c] = ltolower(c);
+		if (InterlockedCompareExchangePointer((PVOID volatile *)&sLocaleLowerTable, table, NULL))
+			free(table); // Another thread built it at the same time.
+	}
+	return sLocaleLowerTable;
+}
+
+template<class Fold>
+static inline bool tmemequal(const TBYTE *aStr1, const TBYTE *aStr2, size_t aLength, Fold aFold)
+{
+	for (size_t i = 0; i < aLength; ++i)
+		if (aFold(aStr1[i]) != aFold(aStr2[i]))
+			return false;
+	return true;
+}
+
+static inline bool tmemequal(const TBYTE *aStr1, const TBYTE *aStr2, size_t aLength, FoldNone)
+{
+	return !tmemcmp((LPCTSTR)aStr1, (LPCTSTR)aStr2, aLength);
+}
+
+template<class Fold>
+static LPTSTR tmemsearch_scalar(const TBYTE *aHaystack, size_t aHaystackLength, const TBYTE *aNeedle, size_t aNeedleLength
+	, size_t aStartPos, Fold aFold)
+// Searches for aNeedle starting at aStartPos.  Caller has ensured aNeedleLength is non-zero and no
+// greater than aHaystackLength.
+{
+	size_t last_pos = aHaystackLength - aNeedleLength, n1 = aNeedleLength - 1, pos;
+	TBYTE first = aFold(aNeedle[0]), last = aFold(aNeedle[n1]);
+	if (aNeedleLength < TMEMSEARCH_BMH_MIN_NEEDLE || aHaystackLength - aStartPos < TMEMSEARCH_BMH_MIN_HAYSTACK)
+	{
+		for (pos = aStartPos; pos <= last_pos; ++pos)
+			if (aFold(aHaystack[pos]) == first && aFold(aHaystack[pos + n1]) == last
+				&& tmemequal(aHaystack + pos + 1, aNeedle + 1, n1, aFold))
+				return (LPTSTR)aHaystack + pos;
 		return NULL;
-	if (!*aPattern)
-		// The empty string is found in every string, and since we're searching from the right, return
-		// the position of the zero terminator to indicate the situation:
-		return aStr + aStr_length;
+	}
+	// Horspool: Each position's shift is determined by the character aligned with the end of the needle.
+	// The table is indexed by the low byte of each character; collisions only reduce the shift.
+	size_t shift[256], i;
+	for (i = 0; i < 256; ++i)
+		shift[i] = aNeedleLength;
+	for (i = 0; i < n1; ++i)
+		shift[(UCHAR)aFold(aNeedle[i])] = n1 - i;
+	for (pos = aStartPos; pos <= last_pos; )
+	{
+		TBYTE c = aFold(aHaystack[pos + n1]);
+		if (c == last && tmemequal(aHaystack + pos, aNeedle, n1, aFold))
+			return (LPTSTR)aHaystack + pos;
+		pos += shift[(UCHAR)c];
+	}
+	return NULL;
+}
 
-	size_t aPattern_length = _tcslen(aPattern);
-	TCHAR aPattern_last_char = aPattern[aPattern_length - 1];
-	TCHAR aPattern_last_char_lower = (aStringCaseSense == SCS_INSENSITIVE_LOCALE)
-		? (TCHAR)ltolower(aPattern_last_char)
-		: ctolower(aPattern_last_char);
+template<class Fold>
+static LPTSTR tmemrsearch_scalar(const TBYTE *aHaystack, size_t aEndPos, const TBYTE *aNeedle, size_t aNeedleLength, Fold aFold)
+// Searches for the last occurrence of aNeedle which starts before aEndPos.  Caller has ensured aNeedleLength
+// is non-zero and that aEndPos + aNeedleLength - 1 is within the haystack.
+{
+	size_t n1 = aNeedleLength - 1, pos;
+	TBYTE first = aFold(aNeedle[0]), last = aFold(aNeedle[n1]);
+	if (aNeedleLength < TMEMSEARCH_BMH_MIN_NEEDLE || aEndPos < TMEMSEARCH_BMH_MIN_HAYSTACK)
+	{
+		for (pos = aEndPos; pos-- > 0; )
+			if (aFold(aHaystack[pos]) == first && aFold(aHaystack[pos + n1]) == last
+				&& tmemequal(aHaystack + pos + 1, aNeedle + 1, n1, aFold))
+				return (LPTSTR)aHaystack + pos;
+		return NULL;
+	}
+	// Horspool in reverse: the shift is determined by the character aligned with the start of the needle.
+	size_t shift[256], i;
+	for (i = 0; i < 256; ++i)
+		shift[i] = aNeedleLength;
+	for (i = aNeedleLength; --i > 0; )
+		shift[(UCHAR)aFold(aNeedle[i])] = i;
+	for (pos = aEndPos - 1; ; )
+	{
+		TBYTE c = aFold(aHaystack[pos]);
+		if (c == first && tmemequal(aHaystack + pos + 1, aNeedle + 1, n1, aFold))
+			return (LPTSTR)aHaystack + pos;
+		if (pos < shift[(UCHAR)c])
+			return NULL;
+		pos -= shift[(UCHAR)c];
+	}
+}
 
-	int occurrence = 0;
-	LPCTSTR match_starting_pos = aStr + aStr_length - 1;
+#if defined(_M_IX86) || defined(_M_X64)
 
-	// Keep finding matches from the right until the Nth occurrence (specified by the caller) is found.
-	for (;;)
+static bool HaveSSE2()
+{
+#ifdef _M_X64
+	return true; // All x64 processors support SSE2.
+#else
+	static int sHaveSSE2 = -1; // Unknown.  Races are harmless since each thread would get the same answer.
+	if (sHaveSSE2 == -1)
+		sHaveSSE2 = IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE) ? 1 : 0;
+	return sHaveSSE2 == 1;
+#endif
+}
+
+#ifdef UNICODE
+#define SSE_CHARS 8 // Characters per 128-bit block.
+#define sse_set1(c) _mm_set1_epi16((short)(c))
+#define sse_cmpeq _mm_cmpeq_epi16
+#define sse_cmpgt _mm_cmpgt_epi16
+#define sse_add _mm_add_epi16
+#define SSE_MASK_BITS 0x5555 // _mm_movemask_epi8 yields two bits per character; use only one.
+#define SSE_MASK_SHIFT 1
+#else
+#define SSE_CHARS 16
+#define sse_set1(c) _mm_set1_epi8((char)(c))
+#define sse_cmpeq _mm_cmpeq_epi8
+#define sse_cmpgt _mm_cmpgt_epi8
+#define sse_add _mm_add_epi8
+#define SSE_MASK_BITS 0xFFFF
+#define SSE_MASK_SHIFT 0
+#endif
+
+struct SSEFoldNone
+{
+	inline __m128i operator()(__m128i v) const { return v; }
+};
+
+struct SSEFoldAscii
+{
+	__m128i before_a, after_z, diff;
+	SSEFoldAscii() : before_a(sse_set1('A' - 1)), after_z(sse_set1('Z' + 1)), diff(sse_set1(0x20)) {}
+	// Characters above the signed range (e.g. 0x80-0xFF in ANSI builds) compare as negative, so are never
+	// folded, which is consistent with ctolower().
+	inline __m128i operator()(__m128i v) const
 	{
-		if (match_starting_pos < aStr)
-			return NULL;  // No further matches are possible.
-		// Find (from the right) the first occurrence of aPattern's last char:
-		LPCTSTR last_char_match;
-		for (last_char_match = match_starting_pos; last_char_match >= aStr; --last_char_match)
+		__m128i is_upper = _mm_and_si128(sse_cmpgt(v, before_a), sse_cmpgt(after_z, v));
+		return sse_add(v, _mm_and_si128(is_upper, diff));
+	}
+};
+
+template<class SSEFold, class Fold>
+static LPTSTR tmemsearch_sse2(const TBYTE *aHaystack, size_t aHaystackLength, const TBYTE *aNeedle, size_t aNeedleLength
+	, SSEFold aSSEFold, Fold aFold)
+{
+	size_t n1 = aNeedleLength - 1, pos;
+	__m128i first = sse_set1(aFold(aNeedle[0])), last = sse_set1(aFold(aNeedle[n1]));
+	unsigned long bit;
+	// Each iteration checks the SSE_CHARS positions starting at pos, which requires that the block
+	// starting at pos + n1 lies within the haystack:
+	for (pos = 0; pos + n1 + SSE_CHARS <= aHaystackLength; pos += SSE_CHARS)
+	{
+		__m128i block_first = aSSEFold(_mm_loadu_si128((const __m128i *)(aHaystack + pos)));
+		__m128i block_last = aSSEFold(_mm_loadu_si128((const __m128i *)(aHaystack + pos + n1)));
+		UINT mask = _mm_movemask_epi8(_mm_and_si128(sse_cmpeq(block_first, first), sse_cmpeq(block_last, last))) & SSE_MASK_BITS;
+		for (; mask; mask &= mask - 1) // For each candidate, lowest position first.
 		{
-			if (aStringCaseSense == SCS_INSENSITIVE) // The most common mode is listed first for performance.
-			{
-				if (ctolower(*last_char_match) == aPattern_last_char_lower)
-					break;
-			}
-			else if (aStringCaseSense == SCS_INSENSITIVE_LOCALE)
-			{
-				if (ltolower(*last_char_match) == aPattern_last_char_lower)
-					break;
-			}
-			else // Case sensitive.
+			_BitScanForward(&bit, mask);
+			size_t candidate = pos + (bit >> SSE_MASK_SHIFT);
+			if (tmemequal(aHaystack + candidate + 1, aNeedle + 1, n1, aFold))
+				return (LPTSTR)aHaystack + candidate;
+		}
+	}
+	// Check the remaining positions, of which there are fewer than SSE_CHARS.
+	return pos + n1 < aHaystackLength ? tmemsearch_scalar(aHaystack, aHaystackLength, aNeedle, aNeedleLength, pos, aFold) : NULL;
+}
+
+template<class SSEFold, class Fold>
+static LPTSTR tmemrsearch_sse2(const TBYTE *aHaystack, size_t aEndPos, const TBYTE *aNeedle, size_t aNeedleLength
+	, SSEFold aSSEFold, Fold aFold)
+{
+	size_t n1 = aNeedleLength - 1, pos;
+	__m128i first = sse_set1(aFold(aNeedle[0])), last = sse_set1(aFold(aNeedle[n1]));
+	unsigned long bit;
+	// Each iteration checks the SSE_CHARS positions ending before aEndPos, which is then reduced.
+	for (; aEndPos >= SSE_CHARS; aEndPos -= SSE_CHARS)
+	{
+		pos = aEndPos - SSE_CHARS;
+		__m128i block_first = aSSEFold(_mm_loadu_si128((const __m128i *)(aHaystack + pos)));
+		__m128i block_last = aSSEFold(_mm_loadu_si128((const __m128i *)(aHaystack + pos + n1)));
+		UINT mask = _mm_movemask_epi8(_mm_and_si128(sse_cmpeq(block_first, first), sse_cmpeq(block_last, last))) & SSE_MASK_BITS;
+		while (mask) // For each candidate, highest position first.
+		{
+			_BitScanReverse(&bit, mask);
+			size_t candidate = pos + (bit >> SSE_MASK_SHIFT);
+			if (tmemequal(aHaystack + candidate + 1, aNeedle + 1, n1, aFold))
+				return (LPTSTR)aHaystack + candidate;
+			mask &= ~(1U << bit);
+		}
+	}
+	return aEndPos ? tmemrsearch_scalar(aHaystack, aEndPos, aNeedle, aNeedleLength, aFold) : NULL;
+}
+
+#endif // _M_IX86 || _M_X64
+
+
+
+LPTSTR tmemsearch(LPCTSTR aHaystack, size_t aHaystackLength, LPCTSTR aNeedle, size_t aNeedleLength
+	, StringCaseSenseType aStringCaseSense)
+// Returns the address of the first occurrence of aNeedle in aHaystack, or NULL if there isn't one.
+// Neither string needs to be terminated, and any binary zero they contain is treated as an ordinary character.
+{
+	if (!aNeedleLength)
+		return (LPTSTR)aHaystack; // The empty string is found at the start of every string.
+	if (aNeedleLength > aHaystackLength)
+		return NULL;
+	const TBYTE *haystack = (const TBYTE *)aHaystack, *needle = (const TBYTE *)aNeedle;
+	if (aStringCaseSense == SCS_INSENSITIVE_LOCALE)
+	{
+		FoldLocaleTable fold_table;
+		if (fold_table.table = GetLocaleLowerTable())
+			return tmemsearch_scalar(haystack, aHaystackLength, needle, aNeedleLength, 0, fold_table);
+		return tmemsearch_scalar(haystack, aHaystackLength, needle, aNeedleLength, 0, FoldLocale());
+	}
+#if defined(_M_IX86) || defined(_M_X64)
+	if (HaveSSE2())
+	{
+		if (aStringCaseSense == SCS_INSENSITIVE)
+			return tmemsearch_sse2(haystack, aHaystackLength, needle, aNeedleLength, SSEFoldAscii(), FoldAscii());
+		return tmemsearch_sse2(haystack, aHaystackLength, needle, aNeedleLength, SSEFoldNone(), FoldNone());
+	}
+#endif
+	if (aStringCaseSense == SCS_INSENSITIVE)
+		return tmemsearch_scalar(haystack, aHaystackLength, needle, aNeedleLength, 0, FoldAscii());
+	return tmemsearch_scalar(haystack, aHaystackLength, needle, aNeedleLength, 0, FoldNone());
+}
+
+
+
+LPTSTR tmemrsearch(LPCTSTR aHaystack, size_t aHaystackLength, LPCTSTR aNeedle, size_t aNeedleLength
+	, StringCaseSenseType aStringCaseSense)
+// Returns the address of the last occurrence of aNeedle in aHaystack, or NULL if there isn't one.
+// If aNeedle is empty, the address of the end of aHaystack is returned.
+{
+	if (!aNeedleLength)
+		return (LPTSTR)aHaystack + aHaystackLength;
+	if (aNeedleLength > aHaystackLength)
+		return NULL;
+	const TBYTE *haystack = (const TBYTE *)aHaystack, *needle = (const TBYTE *)aNeedle;
+	size_t end_pos = aHaystackLength - aNeedleLength + 1; // The number of positions at which it could start.
+	if (aStringCaseSense == SCS_INSENSITIVE_LOCALE)
+	{
+		FoldLocaleTable fold_table;
+		if (fold_table.table = GetLocaleLowerTable())
+			return tmemrsearch_scalar(haystack, end_pos, needle, aNeedleLength, fold_table);
+		return tmemrsearch_scalar(haystack, end_pos, needle, aNeedleLength, FoldLocale());
+	}
+#if defined(_M_IX86) || defined(_M_X64)
+	if (HaveSSE2())
+	{
+		if (aStringCaseSense == SCS_INSENSITIVE)
+			return tmemrsearch_sse2(haystack, end_pos, needle, aNeedleLength, SSEFoldAscii(), FoldAscii());
+		return tmemrsearch_sse2(haystack, end_pos, needle, aNeedleLength, SSEFoldNone(), FoldNone());
+	}
+#endif
+	if (aStringCaseSense == SCS_INSENSITIVE)
+		return tmemrsearch_scalar(haystack, end_pos, needle, aNeedleLength, FoldAscii());
+	return tmemrsearch_scalar(haystack, end_pos, needle, aNeedleLength, FoldNone());
+}
+
+
+
+#define TMEMCHRANY_MAX_SSE_CHARS 8 // Longer lists are rare, and each char costs another compare per block.
+
+LPTSTR tmemchrany(LPCTSTR aBuf, size_t aLength, LPCTSTR aCharList, size_t aCharCount)
+// Returns the address of the first char in aBuf that is any one of the aCharCount chars in aCharList,
+// or NULL if there isn't one.  This is the length-aware counterpart of StrChrAny(); neither string needs
+// to be terminated.
+{
+	const TBYTE *buf = (const TBYTE *)aBuf;
+	size_t pos = 0, i;
+#if defined(_M_IX86) || defined(_M_X64)
+	if (aCharCount && aCharCount <= TMEMCHRANY_MAX_SSE_CHARS && HaveSSE2())
+	{
+		__m128i target[TMEMCHRANY_MAX_SSE_CHARS];
+		for (i = 0; i < aCharCount; ++i)
+			target[i] = sse_set1(aCharList[i]);
+		unsigned long bit;
+		for (; pos + SSE_CHARS <= aLength; pos += SSE_CHARS)
+		{
+			__m128i block = _mm_loadu_si128((const __m128i *)(buf + pos));
+			__m128i match = sse_cmpeq(block, target[0]);
+			for (i = 1; i < aCharCount; ++i)
+				match = _mm_or_si128(match, sse_cmpeq(block, target[i]));
+			if (UINT mask = _mm_movemask_epi8(match) & SSE_MASK_BITS)
 			{
-				if (*last_char_match == aPattern_last_char)
-					break;
+				_BitScanForward(&bit, mask);
+				return (LPTSTR)buf + pos + (bit >> SSE_MASK_SHIFT);
 			}
 		}
+	}
+#endif
+	// Check the remaining chars (or all of them if SSE2 wasn't used).
+	for (; pos < aLength; ++pos)
+		for (i = 0; i < aCharCount; ++i)
+			if (buf[pos] == (TBYTE)aCharList[i])
+				return (LPTSTR)buf + pos;
+	return NULL;
+}
+
 
-		if (last_char_match < aStr) // No further matches are possible.
-			return NULL;
 
-		// Now that aPattern's last character has been found in aStr, ensure the rest of aPattern
-		// exists in aStr to the left of last_char_match:
-		LPCTSTR full_match, cp;
-		bool found;
-		for (found = false, cp = aPattern + aPattern_length - 2, full_match = last_char_match - 1;; --cp, --full_match)
+size_t CopyAsciiToTChar(LPTSTR aDst, LPCSTR aSrc, size_t aLength, int aStop1, int aStop2)
+// Copies chars from aSrc into aDst, widening them in Unicode builds, until a non-ASCII char, aStop1 or
+// aStop2 is reached, or until aLength chars have been copied.  Returns the number of chars copied.
+// Pass -1 for any stop char which isn't needed.  Neither string is terminated.
+{
+	size_t pos = 0;
+#if defined(_M_IX86) || defined(_M_X64)
+	if (HaveSSE2())
+	{
+		__m128i stop1 = _mm_set1_epi8((char)aStop1), stop2 = _mm_set1_epi8((char)aStop2);
+		unsigned long bit;
+		for (; pos + 16 <= aLength; pos += 16)
 		{
-			if (cp < aPattern) // The complete pattern has been found at the position in full_match + 1.
+			__m128i block = _mm_loadu_si128((const __m128i *)(aSrc + pos));
+			// The high bit of each non-ASCII byte is already set, so it is picked up by the movemask directly.
+			if (UINT mask = _mm_movemask_epi8(_mm_or_si128(block, _mm_or_si128(_mm_cmpeq_epi8(block, stop1), _mm_cmpeq_epi8(block, stop2)))))
 			{
-				++full_match; // Adjust for the prior iteration's decrement.
-				if (++occurrence == aOccurrence)
-					return (LPTSTR) full_match;
-				found = true;
+				_BitScanForward(&bit, mask);
+				aLength = pos + bit; // Let the loop below copy the chars which precede it.
 				break;
 			}
-			if (full_match < aStr) // Only after checking the above is this checked.
-				break;
+#ifdef UNICODE
+			__m128i zero = _mm_setzero_si128();
+			_mm_storeu_si128((__m128i *)(aDst + pos), _mm_unpacklo_epi8(block, zero));
+			_mm_storeu_si128((__m128i *)(aDst + pos + 8), _mm_unpackhi_epi8(block, zero));
+#else
+			_mm_storeu_si128((__m128i *)(aDst + pos), block);
+#endif
+		}
+	}
+#endif
+	for (; pos < aLength; ++pos)
+	{
+		UCHAR c = (UCHAR)aSrc[pos];
+		if (c > 0x7F || c == aStop1 || c == aStop2)
+			break;
+		aDst[pos] = c;
+	}
+	return pos;
+}
 
-			if (aStringCaseSense == SCS_INSENSITIVE) // The most common mode is listed first for performance.
-			{
-				if (ctolower(*full_match) != ctolower(*cp))
-					break;
-			}
-			else if (aStringCaseSense == SCS_INSENSITIVE_LOCALE)
-			{
-				if (ltolower(*full_match) != ltolower(*cp))
-					break;
-			}
-			else // Case sensitive.
+
+
+size_t CopyAsciiFromTChar(LPSTR aDst, LPCTSTR aSrc, size_t aLength, int aStop)
+// Counterpart of CopyAsciiToTChar(): copies chars from aSrc into aDst, narrowing them in Unicode builds,
+// until a non-ASCII char or aStop is reached, or until aLength chars have been copied.
+{
+#ifdef UNICODE
+	size_t pos = 0;
+#if defined(_M_IX86) || defined(_M_X64)
+	if (HaveSSE2())
+	{
+		__m128i stop = _mm_set1_epi16((short)aStop), non_ascii = _mm_set1_epi16((short)0xFF80), zero = _mm_setzero_si128();
+		unsigned long bit;
+		for (; pos + 8 <= aLength; pos += 8)
+		{
+			__m128i block = _mm_loadu_si128((const __m128i *)(aSrc + pos));
+			// Since the comparison instructions are signed, test the bits directly rather than comparing to 0x7F.
+			__m128i ok = _mm_andnot_si128(_mm_cmpeq_epi16(block, stop), _mm_cmpeq_epi16(_mm_and_si128(block, non_ascii), zero));
+			if (UINT mask = ~_mm_movemask_epi8(ok) & 0xFFFF)
 			{
-				if (*full_match != *cp)
-					break;
+				_BitScanForward(&bit, mask);
+				aLength = pos + (bit >> 1); // Let the loop below copy the chars which precede it.
+				break;
 			}
-		} // for() innermost
-		if (found) // Although the above found a match, it wasn't the right one, so resume searching.
-			match_starting_pos = full_match - 1;
-		else // the pattern broke down, so resume searching at THIS position.
-			match_starting_pos = last_char_match - 1;  // Don't go back by more than 1.
-	} // while() find next match
+			_mm_storel_epi64((__m128i *)(aDst + pos), _mm_packus_epi16(block, block));
+		}
+	}
+#endif
+	for (; pos < aLength; ++pos)
+	{
+		WCHAR c = aSrc[pos];
+		if (c > 0x7F || c == aStop)
+			break;
+		aDst[pos] = (CHAR)c;
+	}
+	return pos;
+#else
+	return CopyAsciiToTChar(aDst, aSrc, aLength, aStop);
+#endif
+}
+
+
+
+LPTSTR tcsrstr(LPTSTR aStr, size_t aStr_length, LPCTSTR aPattern, StringCaseSenseType aStringCaseSense, int aOccurrence)
+// Returns NULL if not found, otherwise the address of the found string.
+// Searches backward from aStr + aStr_length.  Each subsequent occurrence must end before the start of the
+// previous one, so searching for the 2nd occurrence of FF in FFFF finds the first two F's.
+{
+	if (aOccurrence < 1)
+		return NULL;
+	if (!*aPattern)
+		// The empty string is found in every string, and since we're searching from the right, return
+		// the position of the zero terminator to indicate the situation:
+		return aStr + aStr_length;
+	size_t pattern_length = _tcslen(aPattern);
+	for (LPTSTR found;; aStr_length = found - aStr)
+		if (!(found = tmemrsearch(aStr, aStr_length, aPattern, pattern_length, aStringCaseSense)) || !--aOccurrence)
+			return found;
 }
 
 
@@ -1000,7 +1359,7 @@ UINT StrReplace(LPTSTR aHaystack, LPTSTR aOld, LPTSTR aNew, StringCaseSenseType
 
 	// Perform the replacement:
 	for (replacement_count = 0, src = aHaystack
-		; aLimit && (match_pos = tcsstr2(src, aOld, aStringCaseSense));) // Relies on short-circuit boolean order.
+		; aLimit && (match_pos = tmemsearch(src, haystack_length - (src - aHaystack), aOld, aOld_length, aStringCaseSense));) // Relies on short-circuit boolean order.
 	{
 		++replacement_count;
 		--aLimit;
@@ -1088,7 +1447,7 @@ in_place_method:
 	//for ( ; ptr = StrReplace(aHaystack, aOld, aNew, aStringCaseSense); ); // Note that this very different from the below.
 
 	for (replacement_count = 0, src = aHaystack
-		; aLimit && (match_pos = tcsstr2(src, aOld, aStringCaseSense)) // Relies on short-circuit boolean order.
+		; aLimit && (match_pos = tmemsearch(src, haystack_length - (src - aHaystack), aOld, aOld_length, aStringCaseSense)) // Relies on short-circuit boolean order.  haystack_length is kept up-to-date below.
 		; --aLimit, ++replacement_count)
 	{
 		src = match_pos + aNew_length;  // The next search should start at this position when all is adjusted below.
@@ -98,6 +98,25 @@ inline TCHAR ctolower(TBYTE c)
 	return cisupper(c) ? (c | 0x20) : c;
 }
 
+// Returns a hash of aStr which is consistent with _tcsicmp() in the "C" locale; i.e. strings which differ
+// only in the case of ASCII letters produce the same hash.  Used by VarHash and Object's string key index.
+inline UINT tcsihash(LPCTSTR aStr)
+{
+	UINT h = 2166136261U; // FNV-1a.
+	for (; *aStr; ++aStr)
+		h = (h ^ (UINT)ctolower(*aStr)) * 16777619U;
+	return h;
+}
+
+inline UINT tcshash(LPCTSTR aStr)
+// Case-sensitive counterpart of tcsihash(), for use with _tcscmp.
+{
+	UINT h = 2166136261U; // FNV-1a.
+	for (; *aStr; ++aStr)
+		h = (h ^ (UINT)(TBYTE)*aStr) * 16777619U;
+	return h;
+}
+
 // Runtime setting dependent. "a" prefix stand for AutoHotkey.
 #define aisalpha(c)	((int)((::g->StringCaseSense == SCS_INSENSITIVE_LOCALE) ? IsCharAlpha(c) : cisalpha(c)))
 #define aisalnum(c)	((int)((::g->StringCaseSense == SCS_INSENSITIVE_LOCALE) ? IsCharAlphaNumeric(c) : cisalnum(c)))
@@ -739,6 +758,11 @@ int sntprintfcat(LPTSTR aBuf, int aBufSize, LPCTSTR aFormat, ...);
 //int tcslcmp (LPTSTR aBuf1, LPTSTR aBuf2, UINT aLength1 = UINT_MAX, UINT aLength2 = UINT_MAX);
 int tcslicmp(LPTSTR aBuf1, LPTSTR aBuf2, size_t aLength1 = -1, size_t aLength2 = -1);
 LPTSTR tcsrstr(LPTSTR aStr, size_t aStr_length, LPCTSTR aPattern, StringCaseSenseType aStringCaseSense, int aOccurrence = 1);
+LPTSTR tmemsearch(LPCTSTR aHaystack, size_t aHaystackLength, LPCTSTR aNeedle, size_t aNeedleLength, StringCaseSenseType aStringCaseSense);
+LPTSTR tmemrsearch(LPCTSTR aHaystack, size_t aHaystackLength, LPCTSTR aNeedle, size_t aNeedleLength, StringCaseSenseType aStringCaseSense);
+LPTSTR tmemchrany(LPCTSTR aBuf, size_t aLength, LPCTSTR aCharList, size_t aCharCount);
+size_t CopyAsciiToTChar(LPTSTR aDst, LPCSTR aSrc, size_t aLength, int aStop1 = -1, int aStop2 = -1);
+size_t CopyAsciiFromTChar(LPSTR aDst, LPCTSTR aSrc, size_t aLength, int aStop = -1);
 LPTSTR ltcschr(LPCTSTR haystack, TCHAR ch);
 LPTSTR lstrcasestr(LPCTSTR phaystack, LPCTSTR pneedle);
 LPTSTR tcscasestr (LPCTSTR phaystack, LPCTSTR pneedle);
@@ -21,6 +21,7 @@ GNU General Public License for more details.
 
 // Init static vars:
 TCHAR Var::sEmptyString[] = _T(""); // For explanation, see its declaration in .h file.
+VarBorrow *Var::sBorrow = NULL;
 
 
 ResultType Var::AssignHWND(HWND aWnd)
@@ -527,6 +528,9 @@ ResultType Var::AssignString(LPCTSTR aBuf, VarSizeType aLength, bool aExactSize,
 		// if your forget at use the implicit "this" by accident.  So instead, just call self.
 		return mAliasFor->AssignString(aBuf, aLength, aExactSize, aObeyMaxMem);
 
+	if (sBorrow) // Must be done before anything below changes or frees mContents.
+		CopyBorrowed();
+
 	bool do_assign = true;        // Set defaults.
 	bool free_it_if_large = true; //
 	if (!aBuf)
@@ -588,11 +592,19 @@ ResultType Var::AssignString(LPCTSTR aBuf, VarSizeType aLength, bool aExactSize,
 	// the way it is now (rather than forcing it to be blank) since the script thread that caused the error
 	// will be ended.
 
+	char *abandoned_mem = NULL; // SimpleHeap memory this var outgrows, to be recycled once it has no further use.
+	VarSizeType abandoned_capacity;
 	if (space_needed_in_bytes > mByteCapacity)
 	{
 		size_t new_size; // Use a new name, rather than overloading space_needed, for maintainability.
 		char *new_mem;
 
+		if (mHowAllocated == ALLOC_SIMPLE && mByteCapacity)
+		{
+			abandoned_mem = mByteContents;
+			abandoned_capacity = mByteCapacity;
+		}
+
 		switch (mHowAllocated)
 		{
 		case ALLOC_NONE:
@@ -729,6 +741,9 @@ ResultType Var::AssignString(LPCTSTR aBuf, VarSizeType aLength, bool aExactSize,
 		// Below: Already verified that the length value will fit into VarSizeType.
 	}
 
+	if (abandoned_mem) // Done last in case aBuf overlapped it (though that shouldn't be possible when expanding).
+		SimpleHeap::Free(abandoned_mem, abandoned_capacity);
+
 	// Writing to union is safe because above already ensured that "this" isn't an alias.
 	mByteLength = aLength * sizeof(TCHAR); // aLength was verified accurate higher above.
 	return OK;
@@ -949,6 +964,9 @@ void Var::Free(int aWhenToFree, bool aExcludeAliasesAndRequireInit)
 		return;
 	}
 
+	if (sBorrow)
+		CopyBorrowed();
+
 	// Must check this one first because caller relies not only on var not being freed in this case,
 	// but also on its contents not being set to an empty string:
 	
@@ -1040,6 +1058,8 @@ void Var::Free(int aWhenToFree, bool aExcludeAliasesAndRequireInit)
 		// a variable (since variables are never truly destroyed, just their contents freed).
 		// The odds against all of these worst-case factors occurring simultaneously in anything other
 		// than a theoretical test script seem nearly astronomical.
+		// UPDATE: AssignString() now hands the ALLOC_SIMPLE memory it abandons to SimpleHeap::Free(),
+		// which lets other small allocations reuse it.
 		break;
 	} // switch()
 }
@@ -1062,6 +1082,8 @@ ResultType Var::AppendIfRoom(LPTSTR aStr, VarSizeType aLength)
 	VarSizeType new_length = var_length + aLength;
 	if (new_length >= var._CharCapacity()) // Not enough room.
 		return FAIL;
+	if (sBorrow)
+		var.CopyBorrowed();
 	tmemmove(var.mCharContents + var_length, aStr, aLength);  // mContents was updated via LengthIgnoreBinaryClip() above. Use memmove() vs. memcpy() in case there's any overlap between source and dest.
 	var.mCharContents[new_length] = '\0'; // Terminate it as a separate step in case caller passed a length shorter than the apparent length of aStr.
 	var.mByteLength = new_length * sizeof(TCHAR);
@@ -1077,6 +1099,53 @@ ResultType Var::AppendIfRoom(LPTSTR aStr, VarSizeType aLength)
 
 
 
+ResultType Var::Append(LPTSTR aStr, VarSizeType aLength)
+// Same as AppendIfRoom() except that when there isn't enough room, the capacity is grown geometrically
+// rather than by the small margin AssignString() allows.  This makes repeated appending (e.g. x .= y in
+// a loop) take amortized linear time instead of copying the entire string every time the margin runs out.
+// Returns FAIL without reporting any error for cases it doesn't handle (including out-of-memory), so that
+// the caller can fall back to the general method, which reports the error if there really is one.
+{
+	if (AppendIfRoom(aStr, aLength))
+		return OK;
+	Var &var = *(mType == VAR_ALIAS ? mAliasFor : this);
+	if (var.mType != VAR_NORMAL || var.IsObject())
+		return FAIL;
+	VarSizeType var_length = var.LengthIgnoreBinaryClip(); // Same as in AppendIfRoom().
+	VarSizeType new_length = var_length + aLength;
+	size_t new_size = (new_length + 1) * sizeof(TCHAR);
+	if (new_size <= _TSIZE(MAX_ALLOC_SIMPLE) // Let AssignString() handle small strings, since it knows how to use SimpleHeap.
+		|| new_size > g_MaxVarCapacity) // Let the caller report the error.
+		return FAIL;
+	size_t grown_size = var.mByteCapacity + var.mByteCapacity / 2;
+	if (grown_size > g_MaxVarCapacity)
+		grown_size = g_MaxVarCapacity; // Which has already been verified to be enough.
+	if (new_size < grown_size)
+		new_size = grown_size;
+	LPTSTR new_mem;
+	if (   (ptrdiff_t)new_size < 0 || !(new_mem = (LPTSTR)malloc(new_size))   )
+		return FAIL;
+	// Copy both parts before freeing the old memory, since aStr might overlap it (e.g. x .= x):
+	tmemcpy(new_mem, var.mCharContents, var_length);
+	tmemcpy(new_mem + var_length, aStr, aLength);
+	new_mem[new_length] = '\0';
+	if (sBorrow)
+		var.CopyBorrowed();
+	if (var.mHowAllocated == ALLOC_MALLOC && var.mByteCapacity)
+		free(var.mByteContents);
+	else if (var.mByteCapacity) // It points to memory on SimpleHeap, which can only be recycled.
+		SimpleHeap::Free(var.mByteContents, var.mByteCapacity);
+	//else mContents contains a "", so don't attempt to free it.
+	var.mHowAllocated = ALLOC_MALLOC;
+	var.mCharContents = new_mem;
+	var.mByteCapacity = (VarSizeType)new_size;
+	var.mByteLength = new_length * sizeof(TCHAR);
+	var.mAttrib &= ~(VAR_ATTRIB_OFTEN_REMOVED | VAR_ATTRIB_UNINITIALIZED | VAR_ATTRIB_CACHE_DISABLED); // See AppendIfRoom() and AssignString().
+	return OK;
+}
+
+
+
 void Var::AcceptNewMem(LPTSTR aNewMem, VarSizeType aLength)
 // Caller provides a new malloc'd memory block (currently must be non-NULL).  That block and its
 // contents are directly hung onto this variable in place of its old block, which is freed (except
@@ -1094,6 +1163,8 @@ void Var::AcceptNewMem(LPTSTR aNewMem, VarSizeType aLength)
 	else // VAR_NORMAL
 	{
 		var.Free(VAR_ALWAYS_FREE); // Release the variable's old memory. This also removes flags VAR_ATTRIB_OFTEN_REMOVED.
+		if (var.mHowAllocated == ALLOC_SIMPLE && var.mByteCapacity) // Free() doesn't release SimpleHeap memory, but it can be recycled now that this var is leaving it.
+			SimpleHeap::Free(var.mByteContents, var.mByteCapacity);
 		var.mHowAllocated = ALLOC_MALLOC; // Must always be this type to avoid complications and possible memory leaks.
 		var.mByteContents = (char *) aNewMem;
 		var.mByteLength = aLength * sizeof(TCHAR);
@@ -1128,6 +1199,56 @@ void Var::AcceptNewMem(LPTSTR aNewMem, VarSizeType aLength)
 
 
 
+bool Var::Borrow(VarBorrow &aBorrow, LPCTSTR aContents)
+// Begins reading this variable's contents in place, given the caller's pointer to them (which might actually
+// be a copy, such as in the deref buffer).  Returns false if aContents isn't this variable's memory or that
+// memory can't be borrowed safely, in which case the caller should make its own copy.  Otherwise, the caller must call EndBorrow() before returning, and must
+// re-read aBorrow.mContents after running any script, since it might have been replaced with a copy.
+{
+	// Relies on the fact that aliases can't point to other aliases (enforced by UpdateAlias()).
+	Var &var = *(mType == VAR_ALIAS ? mAliasFor : this);
+	if (var.mType != VAR_NORMAL || var.mCharContents != aContents || var.IsObject() || !var.mByteCapacity
+		|| (var.mAttrib & (VAR_ATTRIB_CONTENTS_OUT_OF_DATE | VAR_ATTRIB_BINARY_CLIP
+			| VAR_ATTRIB_CACHE_DISABLED))) // The script has its address, so it might be changed directly (e.g. via NumPut).
+		return false;
+	aBorrow.mContents = var.mCharContents;
+	aBorrow.mLength = var._CharLength();
+	aBorrow.mIsCopy = false;
+	aBorrow.mPrev = sBorrow;
+	sBorrow = &aBorrow;
+	return true;
+}
+
+
+
+void Var::EndBorrow(VarBorrow &aBorrow)
+{
+	sBorrow = aBorrow.mPrev;
+	if (aBorrow.mIsCopy)
+		free(aBorrow.mContents);
+}
+
+
+
+void Var::CopyBorrowed()
+// Called only when sBorrow is non-NULL, just before this (non-alias) variable's memory is modified or freed.
+{
+	for (VarBorrow *borrow = sBorrow; borrow; borrow = borrow->mPrev)
+	{
+		if (borrow->mIsCopy || borrow->mContents != mCharContents)
+			continue;
+		LPTSTR copy = tmalloc(borrow->mLength + 1);
+		if (copy)
+		{
+			tmemcpy(copy, borrow->mContents, borrow->mLength + 1);
+			borrow->mIsCopy = true;
+		}
+		borrow->mContents = copy; // The borrower reports the error if it's NULL.
+	}
+}
+
+
+
 void Var::SetLengthFromContents()
 // Function added in v1.0.43.06.  It updates the mLength member to reflect the actual current length of mContents.
 // Caller must ensure that Type() is VAR_NORMAL.
@@ -1408,3 +1529,53 @@ __forceinline void Var::MaybeWarnUninitialized()
 			g_script.WarnUninitializedVar(this);
 	}
 }
+
+
+
+bool VarHash::Expand()
+{
+	int new_capacity = mCapacity ? mCapacity * 2 : 64;
+	Entry *new_slot = (Entry *)calloc(new_capacity, sizeof(Entry));
+	if (!new_slot)
+		return false;
+	int mask = new_capacity - 1;
+	for (int i = 0; i < mCapacity; ++i)
+	{
+		if (!mSlot[i].var)
+			continue;
+		int j;
+		for (j = mSlot[i].hash & mask; new_slot[j].var; j = (j + 1) & mask);
+		new_slot[j] = mSlot[i];
+	}
+	free(mSlot);
+	mSlot = new_slot;
+	mCapacity = new_capacity;
+	return true;
+}
+
+
+
+bool VarHash::Insert(Var *aVar)
+// Returns false if out of memory.
+{
+	// Keep the load factor at or below 3/4 so that probe sequences stay short:
+	if ((mCount + 1) * 4 > mCapacity * 3 && !Expand())
+		return false;
+	UINT hash = Hash(aVar->mName);
+	int mask = mCapacity - 1, i;
+	for (i = hash & mask; mSlot[i].var; i = (i + 1) & mask);
+	mSlot[i].hash = hash;
+	mSlot[i].var = aVar;
+	++mCount;
+	return true;
+}
+
+
+
+void VarHash::Clear()
+{
+	free(mSlot);
+	mSlot = NULL;
+	mCount = 0;
+	mCapacity = 0;
+}
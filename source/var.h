@@ -89,6 +89,18 @@ struct VarBkp // This should be kept in sync with any changes to the Var class.
 	void ToToken(ExprTokenType &aValue);
 };
 
+struct VarBorrow
+// Lets a caller such as Loop Parse read a variable's contents in place while running script that might
+// change that variable.  Before any Var method modifies or frees the borrowed memory, it gives each borrow
+// of that memory a private copy (see Var::CopyBorrowed()).  Borrows are strictly nested since each lives
+// on the stack of the function that made it.
+{
+	LPTSTR mContents;    // The borrowed memory, its private copy, or NULL if the copy couldn't be allocated.
+	VarSizeType mLength; // In characters, not including the terminator.
+	bool mIsCopy;        // Whether mContents is a private copy, to be freed by Var::EndBorrow().
+	VarBorrow *mPrev;
+};
+
 #pragma warning(push)
 #pragma warning(disable: 4995 4996)
 
@@ -277,6 +289,11 @@ public:
 	// when a script forgets to call VarSetCapacity before passing a buffer to some function that writes a
 	// string to it.  There is now some code there that tries to detect when that happens.
 	static TCHAR sEmptyString[1]; // See above.
+	static VarBorrow *sBorrow; // The innermost active borrow, if any.
+
+	bool Borrow(VarBorrow &aBorrow, LPCTSTR aContents);
+	static void EndBorrow(VarBorrow &aBorrow);
+	void CopyBorrowed();
 
 	VarSizeType Get(LPTSTR aBuf = NULL);
 	ResultType AssignHWND(HWND aWnd);
@@ -537,6 +554,7 @@ public:
 	#define VAR_FREE_IF_LARGE                  3
 	void Free(int aWhenToFree = VAR_ALWAYS_FREE, bool aExcludeAliasesAndRequireInit = false);
 	ResultType AppendIfRoom(LPTSTR aStr, VarSizeType aLength);
+	ResultType Append(LPTSTR aStr, VarSizeType aLength);
 	void AcceptNewMem(LPTSTR aNewMem, VarSizeType aLength);
 	void SetLengthFromContents();
 
@@ -887,6 +905,47 @@ struct VarEntry
 	BuiltInVarType type; // Function pointer or VarTypes constant.
 };
 
+
+// VarHash: An open-addressing (linear probing) index of variables keyed by case-folded name.
+// It is maintained alongside each sorted var list (and its lazy list) so that FindVar() can
+// locate a variable without binary searching; the sorted arrays are still kept because ListVars,
+// the debugger and the lazy-list merge in AddVar() rely on their alphabetical order.
+// Only ASCII letters are folded by the hash (see tcsihash), which is consistent with _tcsicmp().
+class VarHash
+{
+	struct Entry
+	{
+		UINT hash;
+		Var *var; // NULL indicates an empty slot.  Items are never removed individually.
+	};
+	Entry *mSlot;
+	int mCount, mCapacity; // mCapacity is always zero or a power of two.
+
+	bool Expand();
+
+public:
+	static UINT Hash(LPCTSTR aName) { return tcsihash(aName); }
+
+	Var *Find(LPCTSTR aName, UINT aHash)
+	{
+		if (!mCount)
+			return NULL;
+		int mask = mCapacity - 1;
+		for (int i = aHash & mask; mSlot[i].var; i = (i + 1) & mask)
+			if (mSlot[i].hash == aHash && !_tcsicmp(aName, mSlot[i].var->mName)) // lstrcmpi() is not used, for consistency with FindVar().
+				return mSlot[i].var;
+		return NULL;
+	}
+	Var *Find(LPCTSTR aName) { return Find(aName, Hash(aName)); }
+
+	bool Insert(Var *aVar); // Caller must ensure aVar isn't already present.
+	void Clear();
+	int Count() { return mCount; }
+
+	VarHash() : mSlot(NULL), mCount(0), mCapacity(0) {}
+	~VarHash() { free(mSlot); }
+};
+
 #pragma warning(pop)
 
 #endif